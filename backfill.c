@@ -0,0 +1,599 @@
+/***********************************************************************/ /**
+ * @file backfill.c
+ *
+ * Parallel backfill: a time range is split into slices, each slice is
+ * collected from the server on its own connection and thread, and the
+ * packets are merged into a single callback and/or capture file.
+ *
+ * Slices are bounded by packet ID: each connection is positioned with
+ * dl_position_after() to the start time of its slice and collects
+ * until it reaches the packet ID where the next slice was positioned,
+ * so every packet in the server is collected by exactly one slice.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+/* Interval to check for termination while waiting for packets (microseconds) */
+#define BACKFILL_WAIT 500000
+
+typedef struct Backfill_s Backfill;
+
+/* Slice parameters */
+typedef struct BackfillSlice_s
+{
+  Backfill *backfill;
+  int index;
+  DLCP *dlconn;
+  int64_t startid;              /* First packet ID of slice */
+  int64_t endid;                /* First packet ID of next slice, 0 for none */
+  char *data;
+  size_t maxdatasize;
+  DLCapture *spool;             /* Spool of packets for ordered delivery */
+  char spoolpath[600];
+  DLPThread thread;
+  int8_t running;
+  int8_t done;                  /* Set when the end of the slice is reached */
+  int rv;
+} BackfillSlice;
+
+struct Backfill_s
+{
+  DLCP *dlconn;
+  dltime_t starttime;
+  dltime_t endtime;
+  DLCollectCallback callback;
+  void *cbdata;
+  DLCapture *capture;
+  DLPMutex lock;                /* Serializes delivery of packets */
+  int64_t idletime;             /* Time without packets ending a slice (microseconds) */
+  int64_t delivered;
+  uint64_t stop;                /* Set to end all slices */
+  int error;
+  BackfillSlice *slices;
+  int slicecount;
+  char spooldir[600];           /* Private directory for spool files, empty for none */
+};
+
+static int backfill_openslice (Backfill *backfill, BackfillSlice *slice,
+                               dltime_t slicestart, dltime_t nextstart,
+                               const char *match, const char *reject);
+static void backfill_stop (Backfill *backfill);
+static int backfill_deliver (Backfill *backfill, DLPacket *packet, void *packetdata);
+static int backfill_packet (DLPacket *packet, void *packetdata, void *cbdata);
+static void backfill_slice (void *arg);
+static int backfill_replay (BackfillSlice *slice);
+
+/***********************************************************************/ /**
+ * @brief Collect a time range of packets over parallel connections
+ *
+ * Split the data time range from @a starttime to @a endtime into @a
+ * slices equal slices and collect each slice on a separate connection
+ * in a separate thread.  The connections are created with the address,
+ * client ID, timeouts and logging parameters of @a dlconn, which is
+ * not connected or used for collection.  Each connection applies the
+ * @a match and @a reject stream ID expressions if they are not NULL.
+ *
+ * Each slice connection is positioned to the start time of its slice
+ * with dl_position_after() and collects packets in streaming mode
+ * until it reaches the packet ID where the following slice starts.
+ * The last slice ends at the packet positioned to for @a endtime.  A
+ * slice also ends when no packets are received for @a idletime
+ * seconds, e.g. when the newest packet in the server has been
+ * collected.  Only packets with data overlapping the time range are
+ * delivered.
+ *
+ * Each packet is passed to @a callback, if not NULL, and written to
+ * @a capture, if not NULL.  Packets are delivered one at a time, never
+ * concurrently, but from different threads.  A non-zero return from
+ * @a callback ends the backfill, as does dl_terminate() on @a dlconn.
+ *
+ * When @a ordered is false packets are delivered as they are
+ * received by each slice.  When @a ordered is true packets are
+ * delivered in packet ID order, i.e. the order the server received
+ * them: packets of the first slice are delivered as received while
+ * the following slices are spooled to temporary capture files, in a
+ * new private directory created in @a spooldir, or the current
+ * directory if NULL, and delivered in turn when the preceding slices
+ * are complete.
+ *
+ * @param dlconn DataLink Connection Parameters used as a template
+ * @param match Stream ID match expression, NULL for none
+ * @param reject Stream ID reject expression, NULL for none
+ * @param starttime Start of data time range
+ * @param endtime End of data time range
+ * @param slices Number of slices and connections
+ * @param idletime Seconds without packets ending a slice
+ * @param ordered Flag to deliver packets in packet ID order
+ * @param spooldir Directory for temporary spool files when ordered
+ * @param callback Function called for each packet, NULL for none
+ * @param cbdata Pointer passed to @a callback
+ * @param capture Capture to write packets to, NULL for none
+ *
+ * @return number of packets delivered on success and -1 on error.
+ ***************************************************************************/
+int64_t
+dl_backfill (DLCP *dlconn, const char *match, const char *reject,
+             dltime_t starttime, dltime_t endtime, int slices, int idletime,
+             int8_t ordered, const char *spooldir,
+             DLCollectCallback callback, void *cbdata, DLCapture *capture)
+{
+  Backfill backfill;
+  BackfillSlice *slice;
+  dltime_t slicestart;
+  dltime_t nextstart;
+  int idx;
+
+  if (!dlconn || (!callback && !capture))
+    return -1;
+
+  if (slices <= 0 || endtime <= starttime)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_backfill(): invalid time range or slice count\n",
+              dlconn->addr);
+    return -1;
+  }
+
+  memset (&backfill, 0, sizeof (backfill));
+  backfill.dlconn     = dlconn;
+  backfill.starttime  = starttime;
+  backfill.endtime    = endtime;
+  backfill.callback   = callback;
+  backfill.cbdata     = cbdata;
+  backfill.capture    = capture;
+  backfill.idletime   = (int64_t)idletime * 1000000;
+  backfill.slicecount = slices;
+
+  if (!(backfill.slices = (BackfillSlice *)calloc (slices, sizeof (BackfillSlice))))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_backfill(): error allocating memory\n", dlconn->addr);
+    return -1;
+  }
+
+  if (dlp_mutex_init (&backfill.lock))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_backfill(): cannot initialize mutex\n", dlconn->addr);
+    free (backfill.slices);
+    return -1;
+  }
+
+  /* Connect and position all slices before starting any */
+  for (idx = 0; idx < slices; idx++)
+  {
+    slice           = &backfill.slices[idx];
+    slice->backfill = &backfill;
+    slice->index    = idx;
+
+    slicestart = starttime + (endtime - starttime) * idx / slices;
+    nextstart  = starttime + (endtime - starttime) * (idx + 1) / slices;
+
+    if (backfill_openslice (&backfill, slice, slicestart, nextstart, match, reject))
+    {
+      backfill.error = 1;
+      break;
+    }
+
+    /* Spool all but the first slice for ordered delivery */
+    if (ordered && idx > 0 && slice->dlconn)
+    {
+      /* Spool files are created in a new directory only the user can access */
+      if (!backfill.spooldir[0])
+      {
+        snprintf (backfill.spooldir, sizeof (backfill.spooldir), "%s/dlbackfill-XXXXXX",
+                  (spooldir) ? spooldir : ".");
+
+        if (dlp_mkdtemp (backfill.spooldir))
+        {
+          dl_log_r (dlconn, 2, 0, "[%s] dl_backfill(): cannot create spool directory %s: %s\n",
+                    dlconn->addr, backfill.spooldir, strerror (errno));
+          backfill.spooldir[0] = '\0';
+          backfill.error       = 1;
+          break;
+        }
+      }
+
+      snprintf (slice->spoolpath, sizeof (slice->spoolpath), "%s/slice-%d",
+                backfill.spooldir, idx);
+
+      if (!(slice->spool = dl_capture_open (slice->spoolpath, 'w')))
+      {
+        backfill.error = 1;
+        break;
+      }
+    }
+  }
+
+  /* Start slice threads */
+  for (idx = 0; idx < slices && !backfill.error; idx++)
+  {
+    slice = &backfill.slices[idx];
+
+    if (!slice->dlconn)
+      continue;
+
+    if (dlp_thread_create (&slice->thread, backfill_slice, slice))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_backfill(): cannot create slice thread\n", dlconn->addr);
+      backfill.error = 1;
+      break;
+    }
+
+    slice->running = 1;
+  }
+
+  if (backfill.error)
+    backfill_stop (&backfill);
+
+  /* Wait for slices in order, delivering spooled packets in turn */
+  for (idx = 0; idx < slices; idx++)
+  {
+    slice = &backfill.slices[idx];
+
+    if (slice->running)
+    {
+      dlp_thread_join (slice->thread);
+      slice->running = 0;
+
+      if (slice->rv < 0)
+      {
+        backfill.error = 1;
+        backfill_stop (&backfill);
+      }
+    }
+
+    if (slice->spool)
+    {
+      if (!backfill.error && !DLP_LOAD_ACQUIRE (&backfill.stop))
+      {
+        if (backfill_replay (slice) < 0)
+        {
+          backfill.error = 1;
+          backfill_stop (&backfill);
+        }
+      }
+
+      if (slice->spool)
+        dl_capture_close (slice->spool);
+    }
+  }
+
+  /* Release slices after all threads have finished */
+  for (idx = 0; idx < slices; idx++)
+  {
+    slice = &backfill.slices[idx];
+
+    /* Remove spool and its index */
+    if (slice->spoolpath[0])
+    {
+      remove (slice->spoolpath);
+      strcat (slice->spoolpath, ".idx");
+      remove (slice->spoolpath);
+    }
+
+    if (slice->dlconn)
+    {
+      dl_disconnect (slice->dlconn);
+
+      /* Logging parameters are shared with the template connection */
+      slice->dlconn->log = NULL;
+      dl_freedlcp (slice->dlconn);
+    }
+
+    if (slice->data)
+      free (slice->data);
+  }
+
+  if (backfill.spooldir[0])
+    dlp_rmdir (backfill.spooldir);
+
+  dlp_mutex_destroy (&backfill.lock);
+  free (backfill.slices);
+
+  return (backfill.error) ? -1 : backfill.delivered;
+} /* End of dl_backfill() */
+
+/***************************************************************************
+ * backfill_openslice:
+ *
+ * Create, connect and position the connection for a slice.  The
+ * connection is left NULL when the slice contains no packets.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+backfill_openslice (Backfill *backfill, BackfillSlice *slice,
+                    dltime_t slicestart, dltime_t nextstart,
+                    const char *match, const char *reject)
+{
+  DLCP *template = backfill->dlconn;
+  DLCP *dlconn;
+  char pattern[512];
+
+  if (!(dlconn = dl_newdlcp (template->addr, NULL)))
+    return -1;
+
+  strcpy (dlconn->clientid, template->clientid);
+  dlconn->keepalive   = template->keepalive;
+  dlconn->iotimeout   = template->iotimeout;
+  dlconn->sockprofile = template->sockprofile;
+  dlconn->log         = template->log;
+
+  slice->dlconn = dlconn;
+
+  if (dl_connect (dlconn) < 0)
+  {
+    dl_log_r (template, 2, 0, "[%s] dl_backfill(): cannot connect slice %d\n",
+              template->addr, slice->index);
+    return -1;
+  }
+
+  if (match)
+  {
+    strncpy (pattern, match, sizeof (pattern) - 1);
+    pattern[sizeof (pattern) - 1] = '\0';
+
+    if (dl_match (dlconn, pattern) < 0)
+      return -1;
+  }
+
+  if (reject)
+  {
+    strncpy (pattern, reject, sizeof (pattern) - 1);
+    pattern[sizeof (pattern) - 1] = '\0';
+
+    if (dl_reject (dlconn, pattern) < 0)
+      return -1;
+  }
+
+  /* The end of this slice is the start of the next, found first as the
+   * connection is left positioned to the start of this slice */
+  if ((slice->endid = dl_position_after (dlconn, nextstart)) < 0)
+    return -1;
+
+  if ((slice->startid = dl_position_after (dlconn, slicestart)) < 0)
+    return -1;
+
+  /* No packets after the slice start or before the slice end */
+  if (slice->startid == 0 || (slice->endid > 0 && slice->endid <= slice->startid))
+  {
+    dl_log_r (template, 1, 2, "[%s] Backfill slice %d contains no packets\n",
+              template->addr, slice->index);
+
+    dl_disconnect (dlconn);
+    dlconn->log = NULL;
+    dl_freedlcp (dlconn);
+    slice->dlconn = NULL;
+    return 0;
+  }
+
+  slice->maxdatasize = (dlconn->maxpktsize > 0) ? (size_t)dlconn->maxpktsize : MAXPACKETSIZE;
+
+  if (!(slice->data = (char *)malloc (slice->maxdatasize)))
+  {
+    dl_log_r (template, 2, 0, "[%s] dl_backfill(): error allocating memory\n", template->addr);
+    return -1;
+  }
+
+  dl_log_r (template, 1, 2, "[%s] Backfill slice %d from packet %" PRId64 " to %" PRId64 "\n",
+            template->addr, slice->index, slice->startid, slice->endid);
+
+  return 0;
+} /* End of backfill_openslice() */
+
+/***************************************************************************
+ * backfill_stop:
+ *
+ * Signal all slices to end collection.
+ ***************************************************************************/
+static void
+backfill_stop (Backfill *backfill)
+{
+  int idx;
+
+  DLP_STORE_RELEASE (&backfill->stop, 1);
+
+  for (idx = 0; idx < backfill->slicecount; idx++)
+  {
+    if (backfill->slices[idx].dlconn)
+      dl_terminate (backfill->slices[idx].dlconn);
+  }
+} /* End of backfill_stop() */
+
+/***************************************************************************
+ * backfill_deliver:
+ *
+ * Pass a packet to the callback and/or capture, serialized with the
+ * other slices.
+ *
+ * Returns 0 to continue, 1 when the backfill is ending and -1 on error.
+ ***************************************************************************/
+static int
+backfill_deliver (Backfill *backfill, DLPacket *packet, void *packetdata)
+{
+  int rv = 0;
+
+  dlp_mutex_lock (&backfill->lock);
+
+  if (DLP_LOAD_ACQUIRE (&backfill->stop))
+  {
+    rv = 1;
+  }
+  else if (backfill->capture && dl_capture_write (backfill->capture, packet, packetdata))
+  {
+    rv = -1;
+  }
+  else
+  {
+    backfill->delivered++;
+
+    if (backfill->callback && backfill->callback (packet, packetdata, backfill->cbdata))
+      rv = 1;
+  }
+
+  dlp_mutex_unlock (&backfill->lock);
+
+  if (rv)
+    backfill_stop (backfill);
+
+  return rv;
+} /* End of backfill_deliver() */
+
+/***************************************************************************
+ * backfill_packet:
+ *
+ * Handle a packet collected by a slice, a DLCollectCallback.
+ *
+ * Returns 0 to continue collecting and 1 when the slice is done.
+ ***************************************************************************/
+static int
+backfill_packet (DLPacket *packet, void *packetdata, void *cbdata)
+{
+  BackfillSlice *slice = (BackfillSlice *)cbdata;
+  Backfill *backfill   = slice->backfill;
+  int rv;
+
+  /* End of slice when reaching the start of the next */
+  if (slice->endid > 0 && packet->pktid >= slice->endid)
+  {
+    slice->done = 1;
+    return 1;
+  }
+
+  /* Skip packets with data outside of the time range */
+  if (packet->dataend < backfill->starttime || packet->datastart >= backfill->endtime)
+    return 0;
+
+  if (slice->spool)
+  {
+    if (dl_capture_write (slice->spool, packet, packetdata))
+    {
+      slice->rv   = -1;
+      slice->done = 1;
+      return 1;
+    }
+
+    return 0;
+  }
+
+  if ((rv = backfill_deliver (backfill, packet, packetdata)))
+  {
+    if (rv < 0)
+      slice->rv = -1;
+
+    slice->done = 1;
+    return 1;
+  }
+
+  return 0;
+} /* End of backfill_packet() */
+
+/***************************************************************************
+ * backfill_slice:
+ *
+ * Slice thread, collect packets until the end of the slice, the idle
+ * time has passed without packets or the backfill is ending.
+ ***************************************************************************/
+static void
+backfill_slice (void *arg)
+{
+  BackfillSlice *slice = (BackfillSlice *)arg;
+  Backfill *backfill   = slice->backfill;
+  DLCP *dlconn         = slice->dlconn;
+  int64_t idlestart    = dlp_monotime ();
+  int count;
+  int rv;
+
+  while (!slice->done)
+  {
+    if (DLP_LOAD_ACQUIRE (&backfill->stop))
+      break;
+
+    /* Template connection terminated, e.g. from a signal handler */
+    if (backfill->dlconn->terminate)
+    {
+      backfill_stop (backfill);
+      break;
+    }
+
+    rv = dl_collect_batch (dlconn, NULL, 0, slice->data, slice->maxdatasize,
+                           backfill_packet, slice, BACKFILL_WAIT, &count);
+
+    if (rv == DLPACKET)
+    {
+      idlestart = dlp_monotime ();
+    }
+    else if (rv == DLNOPACKET)
+    {
+      if (dlp_monotime () - idlestart >= backfill->idletime)
+      {
+        dl_log_r (dlconn, 1, 2, "[%s] Backfill slice %d idle, ending\n",
+                  dlconn->addr, slice->index);
+        break;
+      }
+    }
+    else
+    {
+      if (rv == DLERROR && !DLP_LOAD_ACQUIRE (&backfill->stop))
+        slice->rv = -1;
+      break;
+    }
+  }
+} /* End of backfill_slice() */
+
+/***************************************************************************
+ * backfill_replay:
+ *
+ * Deliver the packets spooled by a slice.
+ *
+ * Returns the number of packets delivered on success and -1 on error.
+ ***************************************************************************/
+static int
+backfill_replay (BackfillSlice *slice)
+{
+  Backfill *backfill = slice->backfill;
+  DLCapture *spool;
+  DLPacket packet;
+  int64_t count = 0;
+  int rv;
+
+  /* Reopen spool for reading */
+  rv           = dl_capture_close (slice->spool);
+  slice->spool = NULL;
+
+  if (rv)
+    return -1;
+
+  if (!(slice->spool = spool = dl_capture_open (slice->spoolpath, 'r')))
+    return -1;
+
+  while ((rv = dl_capture_read (spool, &packet, slice->data, slice->maxdatasize)) == DLPACKET)
+  {
+    if ((rv = backfill_deliver (backfill, &packet, slice->data)))
+      return (rv < 0) ? -1 : count;
+
+    count++;
+  }
+
+  return (rv == DLENDED) ? count : -1;
+} /* End of backfill_replay() */
@@ -0,0 +1,796 @@
+/***********************************************************************/ /**
+ * @file capture.c
+ *
+ * Routines for recording and reading packet capture files.
+ *
+ * A capture file contains packets in the same form they are streamed
+ * by a DataLink server.  A sparse index, stored in a companion file,
+ * allows positioning to a packet ID or data time with a binary search
+ * followed by a short sequential scan.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+static int capture_readrecord (DLCapture *capture, DLPacket *packet, void *packetdata,
+                               size_t maxdatasize, int64_t *offset);
+static int capture_track (DLCapture *capture, DLPacket *packet, int64_t offset);
+static int capture_scan (DLCapture *capture, int64_t offset);
+static int capture_loadindex (DLCapture *capture);
+static int capture_saveindex (DLCapture *capture);
+
+/***********************************************************************/ /**
+ * @brief Open a packet capture file
+ *
+ * Open a capture file for reading or writing.  The @a perm character
+ * is interpreted the following way:
+ *
+ * @a perm:
+ *  'r', open an existing capture for reading and positioning
+ *  'w', create a new capture for writing, truncating any existing file
+ *  'a', open a capture for writing, appending to any existing packets
+ *
+ * When opening an existing capture the sparse index is loaded from
+ * the companion index file, if it exists and is consistent with the
+ * capture, and any packets beyond the last index entry are scanned
+ * and indexed.  If the index file cannot be used the entire capture
+ * is scanned to rebuild the index.
+ *
+ * @param path Path to capture file
+ * @param perm Permission flag
+ *
+ * @return allocated DLCapture struct on success, NULL on error.
+ ***************************************************************************/
+DLCapture *
+dl_capture_open (const char *path, char perm)
+{
+  DLCapture *capture;
+  const char *mode;
+
+  if (!path)
+    return NULL;
+
+  if (perm == 'r')
+    mode = "rb";
+  else if (perm == 'w')
+    mode = "wb";
+  else if (perm == 'a')
+    mode = "ab+";
+  else
+  {
+    dl_log (2, 0, "dl_capture_open(): unrecognized permission flag: '%c'\n", perm);
+    return NULL;
+  }
+
+  if (strlen (path) >= sizeof (capture->path) - 4)
+  {
+    dl_log (2, 0, "dl_capture_open(): capture file path is too long: %s\n", path);
+    return NULL;
+  }
+
+  if (!(capture = (DLCapture *)calloc (1, sizeof (DLCapture))))
+  {
+    dl_log (2, 0, "dl_capture_open(): error allocating memory\n");
+    return NULL;
+  }
+
+  strcpy (capture->path, path);
+  capture->writable     = (perm != 'r');
+  capture->maxpktid     = -1;
+  capture->maxdatastart = DLTERROR;
+
+  if (!(capture->fp = fopen (path, mode)))
+  {
+    dl_log (2, 0, "dl_capture_open(): cannot open %s: %s\n", path, strerror (errno));
+    free (capture);
+    return NULL;
+  }
+
+  /* Load index for existing captures, rebuilding it if necessary */
+  if (perm != 'w')
+  {
+    if (capture_loadindex (capture))
+    {
+      dl_capture_close (capture);
+      return NULL;
+    }
+
+    /* Appended packets are written at the end of the capture */
+    if (perm == 'a')
+    {
+      if (fseek (capture->fp, 0, SEEK_END) || (capture->offset = dlp_ftell (capture->fp)) < 0)
+      {
+        dl_log (2, 0, "dl_capture_open(): cannot seek to end of %s\n", path);
+        dl_capture_close (capture);
+        return NULL;
+      }
+    }
+    else if (dlp_fseek (capture->fp, 0))
+    {
+      dl_log (2, 0, "dl_capture_open(): cannot seek to start of %s\n", path);
+      dl_capture_close (capture);
+      return NULL;
+    }
+    else
+    {
+      capture->offset = 0;
+    }
+  }
+  else
+  {
+    capture->indexdirty = 1;
+  }
+
+  return capture;
+} /* End of dl_capture_open() */
+
+/***********************************************************************/ /**
+ * @brief Close a packet capture file
+ *
+ * Close a capture file, saving the sparse index if it has changed,
+ * and free all memory associated with the DLCapture struct.
+ *
+ * @param capture Capture to close
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_capture_close (DLCapture *capture)
+{
+  int rv = 0;
+
+  if (!capture)
+    return -1;
+
+  if (capture->fp)
+  {
+    if (capture->writable && fflush (capture->fp))
+    {
+      dl_log (2, 0, "dl_capture_close(): cannot flush %s: %s\n",
+              capture->path, strerror (errno));
+      rv = -1;
+    }
+
+    /* An index that cannot be saved will be rebuilt the next time */
+    if (capture->indexdirty && capture_saveindex (capture))
+      rv = (capture->writable) ? -1 : rv;
+
+    if (fclose (capture->fp))
+    {
+      dl_log (2, 0, "dl_capture_close(): cannot close %s: %s\n",
+              capture->path, strerror (errno));
+      rv = -1;
+    }
+  }
+
+  if (capture->index)
+    free (capture->index);
+
+  free (capture);
+
+  return rv;
+} /* End of dl_capture_close() */
+
+/***********************************************************************/ /**
+ * @brief Write a packet to a capture file
+ *
+ * Append a packet, as received with dl_collect() or dl_read(), to a
+ * capture file opened for writing.
+ *
+ * Packets should be written in order of increasing packet ID and, if
+ * positioning by time is needed, roughly increasing data start time;
+ * positioning always finds the first qualifying packet but relies on
+ * ordered packets to skip over large portions of the capture.
+ *
+ * @param capture Capture to write to
+ * @param packet Packet header information
+ * @param packetdata Packet data, @a packet->datasize bytes
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_capture_write (DLCapture *capture, DLPacket *packet, void *packetdata)
+{
+  char header[258];
+  int headerlen;
+
+  if (!capture || !packet || (!packetdata && packet->datasize > 0))
+    return -1;
+
+  if (!capture->writable)
+  {
+    dl_log (2, 0, "dl_capture_write(): %s is not open for writing\n", capture->path);
+    return -1;
+  }
+
+  if (packet->datasize < 0)
+  {
+    dl_log (2, 0, "dl_capture_write(): invalid packet data size: %d\n", packet->datasize);
+    return -1;
+  }
+
+  /* Create packet header: "PACKET streamid pktid hppackettime hpdatastart hpdataend size" */
+  headerlen = snprintf (header + 3, sizeof (header) - 3, "PACKET %s %lld %lld %lld %lld %d",
+                        packet->streamid, (long long int)packet->pktid,
+                        (long long int)packet->pkttime, (long long int)packet->datastart,
+                        (long long int)packet->dataend, packet->datasize);
+
+  if (headerlen <= 0 || headerlen > 254)
+  {
+    dl_log (2, 0, "dl_capture_write(): packet header too large for %s\n", packet->streamid);
+    return -1;
+  }
+
+  /* Set the synchronization and header size bytes */
+  header[0] = 'D';
+  header[1] = 'L';
+  header[2] = (uint8_t)headerlen;
+
+  if (fwrite (header, 1, 3 + headerlen, capture->fp) != (size_t) (3 + headerlen) ||
+      (packet->datasize > 0 &&
+       fwrite (packetdata, 1, packet->datasize, capture->fp) != (size_t)packet->datasize))
+  {
+    dl_log (2, 0, "dl_capture_write(): cannot write to %s: %s\n",
+            capture->path, strerror (errno));
+    return -1;
+  }
+
+  if (capture_track (capture, packet, capture->offset))
+    return -1;
+
+  capture->offset += 3 + headerlen + packet->datasize;
+
+  return 0;
+} /* End of dl_capture_write() */
+
+/***********************************************************************/ /**
+ * @brief Read the next packet from a capture file
+ *
+ * Read the packet at the current position of a capture file opened
+ * for reading.  On successfully reading a packet @a packet will be
+ * populated and the packet data will be copied into @a packetdata.
+ *
+ * @param capture Capture to read from
+ * @param packet Pointer to a DLPacket struct for the packet header information
+ * @param packetdata Pointer to a buffer for packet data
+ * @param maxdatasize Maximum data size to write to @a packetdata
+ *
+ * @retval DLPACKET when a packet is read.
+ * @retval DLENDED when the end of the capture is reached.
+ * @retval DLERROR when an error occurred.
+ ***************************************************************************/
+int
+dl_capture_read (DLCapture *capture, DLPacket *packet, void *packetdata,
+                 size_t maxdatasize)
+{
+  int64_t offset;
+  int rv;
+
+  if (!capture || !packet || !packetdata)
+    return DLERROR;
+
+  if (capture->writable)
+  {
+    dl_log (2, 0, "dl_capture_read(): %s is not open for reading\n", capture->path);
+    return DLERROR;
+  }
+
+  rv = capture_readrecord (capture, packet, packetdata, maxdatasize, &offset);
+
+  if (rv < 0)
+    return DLERROR;
+
+  return (rv == 0) ? DLENDED : DLPACKET;
+} /* End of dl_capture_read() */
+
+/***********************************************************************/ /**
+ * @brief Position a capture file to a packet ID
+ *
+ * Set the read position of a capture to the first packet with a
+ * packet ID greater than or equal to @a pktid, the local equivalent
+ * of dl_position().  The sparse index is binary searched and at most
+ * @a DLCAPTURE_INDEXSTRIDE packet headers are read to find the packet.
+ *
+ * @param capture Capture to position
+ * @param pktid Packet ID to set position to
+ *
+ * @return The packet ID of the packet at the new position on success,
+ * 0 when no such packet is in the capture and -1 on error.
+ ***************************************************************************/
+int64_t
+dl_capture_seek_pktid (DLCapture *capture, int64_t pktid)
+{
+  DLPacket packet;
+  int64_t low;
+  int64_t high;
+  int64_t mid;
+  int64_t offset;
+  int rv;
+
+  if (!capture || capture->writable)
+    return -1;
+
+  if (capture->indexcount == 0 || capture->maxpktid < pktid)
+    return 0;
+
+  /* Find last index entry with a maximum packet ID less than pktid */
+  low  = 0;
+  high = capture->indexcount;
+  while (low < high)
+  {
+    mid = low + (high - low) / 2;
+
+    if (capture->index[mid].maxpktid < pktid)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  offset = capture->index[(low > 0) ? low - 1 : 0].offset;
+
+  if (dlp_fseek (capture->fp, offset))
+  {
+    dl_log (2, 0, "dl_capture_seek_pktid(): cannot seek in %s\n", capture->path);
+    return -1;
+  }
+  capture->offset = offset;
+
+  /* Scan forward to the first qualifying packet */
+  while ((rv = capture_readrecord (capture, &packet, NULL, 0, &offset)) > 0)
+  {
+    if (packet.pktid >= pktid)
+    {
+      if (dlp_fseek (capture->fp, offset))
+        return -1;
+
+      capture->offset = offset;
+      return packet.pktid;
+    }
+  }
+
+  return (rv < 0) ? -1 : 0;
+} /* End of dl_capture_seek_pktid() */
+
+/***********************************************************************/ /**
+ * @brief Position a capture file to a data time
+ *
+ * Set the read position of a capture to the first packet with a data
+ * start time greater than or equal to @a datatime.  The sparse index
+ * is binary searched and at most @a DLCAPTURE_INDEXSTRIDE packet
+ * headers are read to find the packet.
+ *
+ * @param capture Capture to position
+ * @param datatime Reference data time as a dltime_t value
+ *
+ * @return The packet ID of the packet at the new position on success,
+ * 0 when no such packet is in the capture and -1 on error.
+ ***************************************************************************/
+int64_t
+dl_capture_seek_time (DLCapture *capture, dltime_t datatime)
+{
+  DLPacket packet;
+  int64_t low;
+  int64_t high;
+  int64_t mid;
+  int64_t offset;
+  int rv;
+
+  if (!capture || capture->writable)
+    return -1;
+
+  if (capture->indexcount == 0 || capture->maxdatastart < datatime)
+    return 0;
+
+  /* Find last index entry with a maximum data start less than datatime */
+  low  = 0;
+  high = capture->indexcount;
+  while (low < high)
+  {
+    mid = low + (high - low) / 2;
+
+    if (capture->index[mid].maxdatastart < datatime)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  offset = capture->index[(low > 0) ? low - 1 : 0].offset;
+
+  if (dlp_fseek (capture->fp, offset))
+  {
+    dl_log (2, 0, "dl_capture_seek_time(): cannot seek in %s\n", capture->path);
+    return -1;
+  }
+  capture->offset = offset;
+
+  /* Scan forward to the first qualifying packet */
+  while ((rv = capture_readrecord (capture, &packet, NULL, 0, &offset)) > 0)
+  {
+    if (packet.datastart >= datatime)
+    {
+      if (dlp_fseek (capture->fp, offset))
+        return -1;
+
+      capture->offset = offset;
+      return packet.pktid;
+    }
+  }
+
+  return (rv < 0) ? -1 : 0;
+} /* End of dl_capture_seek_time() */
+
+/***************************************************************************
+ * capture_readrecord:
+ *
+ * Read the next PACKET record from the current capture position,
+ * skipping any other DataLink frames (e.g. keepalives in a raw
+ * recording of a stream).  If packetdata is NULL the packet data is
+ * skipped over.  The offset of the returned record is set in offset.
+ *
+ * A truncated record at the end of the file, e.g. from an interrupted
+ * writer, is treated as the end of the capture.
+ *
+ * Returns 1 when a packet was read, 0 at the end of the capture and
+ * -1 on error.
+ ***************************************************************************/
+static int
+capture_readrecord (DLCapture *capture, DLPacket *packet, void *packetdata,
+                    size_t maxdatasize, int64_t *offset)
+{
+  char header[256];
+  int headerlen;
+  int rv;
+
+  long long int spktid;
+  long long int spkttime;
+  long long int sdatastart;
+  long long int sdataend;
+  long int sdatasize;
+
+  for (;;)
+  {
+    *offset = capture->offset;
+
+    /* Read synchronization bytes and header length */
+    if (fread (header, 1, 3, capture->fp) != 3)
+      break;
+
+    if (header[0] != 'D' || header[1] != 'L')
+    {
+      dl_log (2, 0, "capture_readrecord(): no DataLink packet detected at offset %lld in %s\n",
+              (long long int)*offset, capture->path);
+      return -1;
+    }
+
+    headerlen = (uint8_t)header[2];
+
+    if (fread (header, 1, headerlen, capture->fp) != (size_t)headerlen)
+      break;
+
+    header[headerlen] = '\0';
+
+    /* Skip non-PACKET frames, they are not expected to contain data */
+    if (strncmp (header, "PACKET", 6))
+    {
+      capture->offset += 3 + headerlen;
+      continue;
+    }
+
+    rv = sscanf (header, "PACKET %59s %lld %lld %lld %lld %ld",
+                 packet->streamid, &spktid, &spkttime,
+                 &sdatastart, &sdataend, &sdatasize);
+
+    if (rv != 6 || sdatasize < 0)
+    {
+      dl_log (2, 0, "capture_readrecord(): cannot parse PACKET header at offset %lld in %s\n",
+              (long long int)*offset, capture->path);
+      return -1;
+    }
+
+    packet->pktid     = spktid;
+    packet->pkttime   = spkttime;
+    packet->datastart = sdatastart;
+    packet->dataend   = sdataend;
+    packet->datasize  = sdatasize;
+
+    packet->recvtime    = 0;
+    packet->readtime    = 0;
+    packet->handofftime = 0;
+
+    if (packetdata)
+    {
+      if (packet->datasize > (int64_t)maxdatasize)
+      {
+        dl_log (2, 0, "capture_readrecord(): packet data larger (%d) than receiving buffer (%" PRIsize_t ")\n",
+                packet->datasize, maxdatasize);
+        dlp_fseek (capture->fp, *offset);
+        return -1;
+      }
+
+      if (fread (packetdata, 1, packet->datasize, capture->fp) != (size_t)packet->datasize)
+        break;
+    }
+    else if (dlp_fseek (capture->fp, *offset + 3 + headerlen + packet->datasize))
+    {
+      return -1;
+    }
+
+    capture->offset = *offset + 3 + headerlen + packet->datasize;
+
+    return 1;
+  }
+
+  if (ferror (capture->fp))
+  {
+    dl_log (2, 0, "capture_readrecord(): error reading %s: %s\n",
+            capture->path, strerror (errno));
+    return -1;
+  }
+
+  /* Leave the position at the start of any truncated record */
+  clearerr (capture->fp);
+  dlp_fseek (capture->fp, *offset);
+  capture->offset = *offset;
+
+  return 0;
+} /* End of capture_readrecord() */
+
+/***************************************************************************
+ * capture_track:
+ *
+ * Track a packet at the specified offset as the next packet of the
+ * capture, updating the running maximums and adding an index entry
+ * every DLCAPTURE_INDEXSTRIDE packets.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+capture_track (DLCapture *capture, DLPacket *packet, int64_t offset)
+{
+  DLCaptureIndex *newindex;
+  DLCaptureIndex *entry;
+
+  if (packet->pktid > capture->maxpktid)
+    capture->maxpktid = packet->pktid;
+  if (packet->datastart > capture->maxdatastart)
+    capture->maxdatastart = packet->datastart;
+
+  if ((capture->packetcount % DLCAPTURE_INDEXSTRIDE) == 0)
+  {
+    if (capture->indexcount >= capture->indexalloc)
+    {
+      capture->indexalloc = (capture->indexalloc) ? capture->indexalloc * 2 : 64;
+
+      newindex = (DLCaptureIndex *)realloc (capture->index,
+                                            capture->indexalloc * sizeof (DLCaptureIndex));
+      if (!newindex)
+      {
+        dl_log (2, 0, "capture_track(): error allocating memory for index\n");
+        return -1;
+      }
+
+      capture->index = newindex;
+    }
+
+    entry               = &capture->index[capture->indexcount++];
+    entry->offset       = offset;
+    entry->maxpktid     = capture->maxpktid;
+    entry->maxdatastart = capture->maxdatastart;
+
+    capture->indexdirty = 1;
+  }
+
+  capture->packetcount++;
+
+  return 0;
+} /* End of capture_track() */
+
+/***************************************************************************
+ * capture_scan:
+ *
+ * Scan and track all packets from the specified offset to the end of
+ * the capture.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+capture_scan (DLCapture *capture, int64_t offset)
+{
+  DLPacket packet;
+  int rv;
+
+  if (dlp_fseek (capture->fp, offset))
+  {
+    dl_log (2, 0, "capture_scan(): cannot seek in %s\n", capture->path);
+    return -1;
+  }
+  capture->offset = offset;
+
+  while ((rv = capture_readrecord (capture, &packet, NULL, 0, &offset)) > 0)
+  {
+    if (capture_track (capture, &packet, offset))
+      return -1;
+  }
+
+  return rv;
+} /* End of capture_scan() */
+
+/***************************************************************************
+ * capture_loadindex:
+ *
+ * Load the sparse index from the companion index file and scan any
+ * packets beyond the last index entry.  If the index file does not
+ * exist or is inconsistent with the capture the entire capture is
+ * scanned.
+ *
+ * The index file is a text file with a "DLCAPTURE-INDEX <stride>"
+ * line followed by lines of "<offset> <maxpktid> <maxdatastart>".
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+capture_loadindex (DLCapture *capture)
+{
+  DLCaptureIndex entry;
+  DLCaptureIndex *last;
+  DLPacket packet;
+  FILE *ifp;
+  char indexpath[sizeof (capture->path) + 4];
+  char line[200];
+  long long int soffset;
+  long long int smaxpktid;
+  long long int smaxdatastart;
+  int64_t offset;
+  int stride = 0;
+
+  snprintf (indexpath, sizeof (indexpath), "%s.idx", capture->path);
+
+  if ((ifp = fopen (indexpath, "rb")))
+  {
+    if (fgets (line, sizeof (line), ifp) &&
+        sscanf (line, "DLCAPTURE-INDEX %d", &stride) == 1 &&
+        stride == DLCAPTURE_INDEXSTRIDE)
+    {
+      while (fgets (line, sizeof (line), ifp))
+      {
+        if (sscanf (line, "%lld %lld %lld", &soffset, &smaxpktid, &smaxdatastart) != 3)
+          break;
+
+        entry.offset       = soffset;
+        entry.maxpktid     = smaxpktid;
+        entry.maxdatastart = smaxdatastart;
+
+        /* Add entry through the tracking logic to keep counts consistent */
+        capture->maxpktid     = entry.maxpktid;
+        capture->maxdatastart = entry.maxdatastart;
+        capture->packetcount  = capture->indexcount * DLCAPTURE_INDEXSTRIDE;
+        packet.pktid          = entry.maxpktid;
+        packet.datastart      = entry.maxdatastart;
+
+        if (capture_track (capture, &packet, entry.offset))
+        {
+          fclose (ifp);
+          return -1;
+        }
+      }
+    }
+
+    fclose (ifp);
+  }
+
+  /* Verify the last index entry against the capture, it will be re-tracked by the scan */
+  if (capture->indexcount > 0)
+  {
+    int64_t loaded = capture->indexcount;
+
+    last = &capture->index[loaded - 1];
+
+    if (dlp_fseek (capture->fp, last->offset) == 0)
+    {
+      capture->offset = last->offset;
+
+      if (capture_readrecord (capture, &packet, NULL, 0, &offset) > 0 &&
+          packet.pktid <= last->maxpktid && packet.datastart <= last->maxdatastart)
+      {
+        offset = last->offset;
+
+        /* Running maxima through the last entry include all packets before it */
+        capture->maxpktid     = last->maxpktid;
+        capture->maxdatastart = last->maxdatastart;
+
+        capture->indexcount  = loaded - 1;
+        capture->packetcount = capture->indexcount * DLCAPTURE_INDEXSTRIDE;
+
+        if (capture_scan (capture, offset))
+          return -1;
+
+        /* Only entries for packets beyond the loaded index need saving */
+        capture->indexdirty = (capture->indexcount != loaded);
+
+        return 0;
+      }
+    }
+
+    dl_log (1, 1, "Index for %s is not consistent with capture, rebuilding\n", capture->path);
+  }
+
+  /* Rebuild index from the complete capture */
+  capture->indexcount   = 0;
+  capture->packetcount  = 0;
+  capture->maxpktid     = -1;
+  capture->maxdatastart = DLTERROR;
+
+  if (capture_scan (capture, 0))
+    return -1;
+
+  capture->indexdirty = 1;
+
+  return 0;
+} /* End of capture_loadindex() */
+
+/***************************************************************************
+ * capture_saveindex:
+ *
+ * Save the sparse index to the companion index file.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+capture_saveindex (DLCapture *capture)
+{
+  FILE *ifp;
+  char indexpath[sizeof (capture->path) + 4];
+  int64_t idx;
+  int rv = 0;
+
+  snprintf (indexpath, sizeof (indexpath), "%s.idx", capture->path);
+
+  if (!(ifp = fopen (indexpath, "wb")))
+  {
+    dl_log (1, 1, "cannot open capture index %s: %s\n", indexpath, strerror (errno));
+    return -1;
+  }
+
+  if (fprintf (ifp, "DLCAPTURE-INDEX %d\n", DLCAPTURE_INDEXSTRIDE) < 0)
+    rv = -1;
+
+  for (idx = 0; idx < capture->indexcount && rv == 0; idx++)
+  {
+    if (fprintf (ifp, "%lld %lld %lld\n",
+                 (long long int)capture->index[idx].offset,
+                 (long long int)capture->index[idx].maxpktid,
+                 (long long int)capture->index[idx].maxdatastart) < 0)
+      rv = -1;
+  }
+
+  if (fclose (ifp))
+    rv = -1;
+
+  if (rv)
+    dl_log (2, 0, "cannot write capture index %s: %s\n", indexpath, strerror (errno));
+  else
+    capture->indexdirty = 0;
+
+  return rv;
+} /* End of capture_saveindex() */
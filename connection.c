@@ -28,6 +28,16 @@
 #include "libdali.h"
 #include "portable.h"
 
+static int process_io (DLCP *dlconn, DLPacket *packet, void *packetdata,
+                       size_t maxdatasize, int8_t *toolarge);
+static int collect_stream (DLCP *dlconn, DLPacket *packet, void *packetdata,
+                           size_t maxdatasize, int8_t endflag, int8_t *toolarge);
+static int collect_stream_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
+                              size_t maxdatasize, int8_t endflag, int8_t *toolarge);
+static int reconnect_needed (DLCP *dlconn, int rv, int8_t toolarge, int8_t endflag);
+static void update_keepalive (DLCP *dlconn);
+static int collect_wait (DLCP *dlconn, int64_t deadline);
+
 /***********************************************************************/ /**
  * @brief Create a new DataLink Connection Parameter (DLCP) structure
  *
@@ -57,6 +67,9 @@ dl_newdlcp (char *address, char *progname)
     dlconn->clientid[0] = '\0';
   dlconn->keepalive      = 600;
   dlconn->iotimeout      = 60;
+  dlconn->reconnect      = 0;
+  dlconn->standby        = 0;
+  memset (&dlconn->sockprofile, 0, sizeof (DLSocketProfile));
   dlconn->link           = -1;
   dlconn->serverproto    = 0.0;
   dlconn->maxpktsize     = 0;
@@ -67,6 +80,36 @@ dl_newdlcp (char *address, char *progname)
   dlconn->keepalive_time = 0;
   dlconn->terminate      = 0;
   dlconn->streaming      = 0;
+  dlconn->looptime       = 0;
+  dlconn->recvbuf        = NULL;
+  dlconn->recvhead       = 0;
+  dlconn->recvtail       = 0;
+  dlconn->matchpattern   = NULL;
+  dlconn->rejectpattern  = NULL;
+  dlconn->addrinfo       = NULL;
+  dlconn->connecting     = NULL;
+  dlconn->standbyconn    = NULL;
+  dlconn->reconnect_time = 0;
+  dlconn->reconnect_backoff = 0;
+  dlconn->reconnects     = 0;
+  dlconn->recvbufsize    = 0;
+  dlconn->sendq          = NULL;
+  dlconn->sendqsize      = 0;
+  dlconn->sendqhead      = 0;
+  dlconn->sendqtail      = 0;
+  dlconn->iotime         = 0;
+  dlconn->wakeup_rfd     = -1;
+  dlconn->wakeup_wfd     = -1;
+  dlconn->rxbytes        = 0;
+  dlconn->socktune       = NULL;
+  dlconn->busypoll       = 0;
+  dlconn->busypoll_cpu   = -1;
+  dlconn->busypoll_pinned = 0;
+  dlconn->latency        = 0;
+  dlconn->latencystats   = NULL;
+  dlconn->recvstamp      = 0;
+  dlconn->readstamp      = 0;
+  dlconn->ioring         = NULL;
 
   dlconn->log = NULL;
 
@@ -83,9 +126,42 @@ dl_newdlcp (char *address, char *progname)
 void
 dl_freedlcp (DLCP *dlconn)
 {
+  dlp_ioring_release (dlconn);
+
   if (dlconn->log)
     free (dlconn->log);
 
+  if (dlconn->recvbuf)
+    free (dlconn->recvbuf);
+
+  if (dlconn->sendq)
+    free (dlconn->sendq);
+
+  dlp_sockopt_free (dlconn);
+  dlp_latency_free (dlconn);
+
+  if (dlconn->matchpattern)
+    free (dlconn->matchpattern);
+
+  if (dlconn->rejectpattern)
+    free (dlconn->rejectpattern);
+
+  if (dlconn->connecting)
+    dl_disconnect (dlconn);
+
+  if (dlconn->addrinfo)
+    dlp_resolve_release (dlconn->addrinfo);
+
+  if (dlconn->wakeup_wfd >= 0)
+    dlp_wakeup_close ((SOCKET)dlconn->wakeup_rfd, (SOCKET)dlconn->wakeup_wfd);
+
+  if (dlconn->standbyconn)
+  {
+    dlconn->standbyconn->log = NULL;
+    dl_disconnect (dlconn->standbyconn);
+    dl_freedlcp (dlconn->standbyconn);
+  }
+
   free (dlconn);
 } /* End of dl_freedlcp() */
 
@@ -107,9 +183,7 @@ dl_exchangeIDs (DLCP *dlconn, int parseresp)
 {
   char sendstr[255]; /* Buffer for command strings */
   char respstr[255]; /* Buffer for server response */
-  char *capptr;      /* Pointer to capabilities flags */
   int respsize;
-  int ret = 0;
 
   if (!dlconn)
     return -1;
@@ -135,6 +209,28 @@ dl_exchangeIDs (DLCP *dlconn, int parseresp)
     return -1;
   }
 
+  /* Make sure the response string is terminated */
+  respstr[respsize] = '\0';
+
+  return dlp_serverid (dlconn, respstr, respsize, parseresp);
+} /* End of dl_exchangeIDs() */
+
+/***************************************************************************
+ * dlp_serverid:
+ *
+ * Verify the server ID response to the ID command and optionally
+ * parse the capability flags, setting the server protocol version,
+ * maximum packet size and write permission of the connection.  The
+ * response must be NULL terminated.
+ *
+ * Returns -1 on errors, 0 on success.
+ ***************************************************************************/
+int
+dlp_serverid (DLCP *dlconn, char *respstr, int respsize, int parseresp)
+{
+  char *capptr = NULL; /* Pointer to capabilities flags */
+  int ret      = 0;
+
   /* Check minimum server ID response size */
   if (respsize < 11)
   {
@@ -143,9 +239,6 @@ dl_exchangeIDs (DLCP *dlconn, int parseresp)
     return -1;
   }
 
-  /* Make sure the response string is terminated */
-  respstr[respsize] = '\0';
-
   /* Verify DataLink signature in server response */
   if (strncasecmp (respstr, "ID DATALINK", 11))
   {
@@ -219,7 +312,7 @@ dl_exchangeIDs (DLCP *dlconn, int parseresp)
   }
 
   return 0;
-} /* End of dl_exchangeIDs() */
+} /* End of dlp_serverid() */
 
 /***********************************************************************/ /**
  * @brief Position the client read position
@@ -437,6 +530,15 @@ dl_match (DLCP *dlconn, char *matchpattern)
   if (rv >= 0)
     dl_log_r (dlconn, 1, 1, "[%s] %s\n", dlconn->addr, reply);
 
+  /* Remember accepted expression for reconnection */
+  if (rv == 0 && matchpattern != dlconn->matchpattern)
+  {
+    if (dlconn->matchpattern)
+      free (dlconn->matchpattern);
+
+    dlconn->matchpattern = (matchpattern && *matchpattern) ? strdup (matchpattern) : NULL;
+  }
+
   return (rv < 0) ? -1 : replyvalue;
 } /* End of dl_match() */
 
@@ -507,6 +609,15 @@ dl_reject (DLCP *dlconn, char *rejectpattern)
   if (rv >= 0)
     dl_log_r (dlconn, 1, 1, "[%s] %s\n", dlconn->addr, reply);
 
+  /* Remember accepted expression for reconnection */
+  if (rv == 0 && rejectpattern != dlconn->rejectpattern)
+  {
+    if (dlconn->rejectpattern)
+      free (dlconn->rejectpattern);
+
+    dlconn->rejectpattern = (rejectpattern && *rejectpattern) ? strdup (rejectpattern) : NULL;
+  }
+
   return (rv < 0) ? -1 : replyvalue;
 } /* End of dl_reject() */
 
@@ -756,6 +867,10 @@ dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet, void *packetdata,
     /* Update most recently received packet ID and time */
     dlconn->pktid   = packet->pktid;
     dlconn->pkttime = packet->pkttime;
+
+    packet->recvtime    = dlconn->recvstamp;
+    packet->readtime    = dlconn->readstamp;
+    packet->handofftime = (dlconn->latency || dlconn->sockprofile.timestamps) ? dlp_time () : 0;
   }
   else if (!strncmp (header, "ERROR", 5))
   {
@@ -778,6 +893,241 @@ dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet, void *packetdata,
   return packet->datasize;
 } /* End of dl_read() */
 
+/***********************************************************************/ /**
+ * @brief Read a range of packets with multiple requests in flight
+ *
+ * Read packets by ID from @a startid to @a endid, keeping up to @a
+ * depth READ commands in flight so that reading a range is not limited
+ * to one packet per network round trip.  Replies are received in the
+ * order requested and passed to @a callback with the requested packet
+ * ID.
+ *
+ * For a packet, @a callback is called with the packet description and
+ * data and a NULL error.  For an ERROR reply from the server, or a
+ * packet with more than @a maxdatasize bytes of data, @a callback is
+ * called with NULL packet and data and the error message.  A non-zero
+ * return from @a callback ends the range.
+ *
+ * If @a endtime is not 0 the range ends before the first packet with
+ * a packet time at or after @a endtime.  If @a endid is 0 the range is
+ * open ended and also ends at the first ERROR reply, e.g. after the
+ * newest packet in the server.
+ *
+ * When the range ends early the replies to requests already in flight
+ * are received and discarded, leaving the connection usable.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param startid First packet ID to read
+ * @param endid Last packet ID to read, 0 for open ended
+ * @param endtime Packet time ending the range, 0 for none
+ * @param depth Number of READ commands in flight, 0 for ::DLREAD_DEPTH
+ * @param packetdata Buffer for received packet data
+ * @param maxdatasize Size of @a packetdata
+ * @param callback Function called for each requested packet ID
+ * @param cbdata Pointer passed to @a callback
+ *
+ * @return number of packets passed to @a callback on success and -1
+ * on error, in which case the connection should be shut down.
+ ***************************************************************************/
+int64_t
+dl_read_range (DLCP *dlconn, int64_t startid, int64_t endid,
+               dltime_t endtime, int depth,
+               void *packetdata, size_t maxdatasize,
+               DLReadCallback callback, void *cbdata)
+{
+  DLPacket packet;
+  char *discard;
+  char header[255];
+  int headerlen;
+  int64_t nextid;
+  int64_t replyid;
+  int64_t inflight = 0;
+  int64_t count    = 0;
+  int stop         = 0;
+  int rv;
+
+  long long int spktid;
+  long long int spkttime;
+  long long int sdatastart;
+  long long int sdataend;
+  long int sdatasize;
+
+  if (!dlconn || !packetdata || !callback)
+    return -1;
+
+  if (dlconn->link < 0)
+    return -1;
+
+  if (startid <= 0 || (endid > 0 && endid < startid))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_read_range(): invalid range, start %" PRId64 ", end %" PRId64 "\n",
+              dlconn->addr, startid, endid);
+    return -1;
+  }
+
+  /* Sanity check that connection is not in streaming mode */
+  if (dlconn->streaming)
+  {
+    dl_log_r (dlconn, 1, 1, "[%s] dl_read_range(): Connection in streaming mode, cannot continue\n",
+              dlconn->addr);
+    return -1;
+  }
+
+  if (depth <= 0)
+    depth = DLREAD_DEPTH;
+
+  nextid  = startid;
+  replyid = startid;
+
+  for (;;)
+  {
+    /* Keep requests in flight up to the depth */
+    while (!stop && inflight < depth && (endid <= 0 || nextid <= endid))
+    {
+      /* Create packet header with command: "READ pktid" */
+      headerlen = snprintf (header, sizeof (header), "READ %lld", (long long int)nextid);
+
+      if (dl_sendpacket (dlconn, header, headerlen, NULL, 0, NULL, 0) < 0)
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] dl_read_range(): problem sending READ command\n",
+                  dlconn->addr);
+        return -1;
+      }
+
+      nextid++;
+      inflight++;
+    }
+
+    if (inflight == 0)
+      break;
+
+    /* Receive reply header, blocking until received */
+    if ((rv = dl_recvheader (dlconn, header, sizeof (header), 1)) < 0)
+    {
+      /* Only log an error if the connection was not shut down */
+      if (rv < -1)
+        dl_log_r (dlconn, 2, 0, "[%s] dl_read_range(): problem receving packet header\n",
+                  dlconn->addr);
+      return -1;
+    }
+
+    inflight--;
+
+    if (!strncmp (header, "PACKET", 6))
+    {
+      /* Parse PACKET header */
+      rv = sscanf (header, "PACKET %s %lld %lld %lld %lld %ld",
+                   packet.streamid, &spktid, &spkttime,
+                   &sdatastart, &sdataend, &sdatasize);
+
+      if (rv != 6)
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] dl_read_range(): cannot parse PACKET header\n",
+                  dlconn->addr);
+        return -1;
+      }
+
+      packet.pktid     = spktid;
+      packet.pkttime   = spkttime;
+      packet.datastart = sdatastart;
+      packet.dataend   = sdataend;
+      packet.datasize  = sdatasize;
+
+      if (packet.pktid != replyid)
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] dl_read_range(): received packet %" PRId64 ", expected %" PRId64 "\n",
+                  dlconn->addr, packet.pktid, replyid);
+        return -1;
+      }
+
+      /* Consume packet data larger than the buffer and report it */
+      if (packet.datasize > (int64_t)maxdatasize)
+      {
+        if (!(discard = (char *)malloc (packet.datasize)))
+        {
+          dl_log_r (dlconn, 2, 0,
+                    "[%s] dl_read_range(): cannot allocate %d bytes for temporary buffer\n",
+                    dlconn->addr, packet.datasize);
+          return -1;
+        }
+
+        rv = dl_recvdata (dlconn, discard, packet.datasize, 1);
+        free (discard);
+
+        if (rv != packet.datasize)
+        {
+          if (rv < -1)
+            dl_log_r (dlconn, 2, 0, "[%s] dl_read_range(): problem receiving packet data\n",
+                      dlconn->addr);
+          return -1;
+        }
+
+        snprintf (header, sizeof (header), "packet data larger (%d) than receiving buffer (%" PRIsize_t ")",
+                  packet.datasize, maxdatasize);
+
+        if (!stop && callback (replyid, NULL, NULL, header, cbdata))
+          stop = 1;
+      }
+      else
+      {
+        /* Receive packet data, blocking until complete */
+        if ((rv = dl_recvdata (dlconn, packetdata, packet.datasize, 1)) != packet.datasize)
+        {
+          if (rv < -1)
+            dl_log_r (dlconn, 2, 0, "[%s] dl_read_range(): problem receiving packet data\n",
+                      dlconn->addr);
+          return -1;
+        }
+
+        /* Update most recently received packet ID and time */
+        dlconn->pktid   = packet.pktid;
+        dlconn->pkttime = packet.pkttime;
+
+        packet.recvtime    = dlconn->recvstamp;
+        packet.readtime    = dlconn->readstamp;
+        packet.handofftime = (dlconn->latency || dlconn->sockprofile.timestamps) ? dlp_time () : 0;
+
+        if (!stop)
+        {
+          if (endtime != 0 && packet.pkttime >= endtime)
+          {
+            stop = 1;
+          }
+          else
+          {
+            count++;
+
+            if (callback (replyid, &packet, packetdata, NULL, cbdata))
+              stop = 1;
+          }
+        }
+      }
+    }
+    else if (!strncmp (header, "ERROR", 5))
+    {
+      /* Reply message, if sent, will be placed into the header buffer */
+      if (dl_handlereply (dlconn, header, sizeof (header) - 1, NULL) < 0)
+        return -1;
+
+      if (!stop)
+      {
+        if (callback (replyid, NULL, NULL, header, cbdata) || endid <= 0)
+          stop = 1;
+      }
+    }
+    else
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_read_range(): Unrecognized reply string %.6s\n",
+                dlconn->addr, header);
+      return -1;
+    }
+
+    replyid++;
+  }
+
+  return count;
+} /* End of dl_read_range() */
+
 /***********************************************************************/ /**
  * @brief Request information from the DataLink server
  *
@@ -804,11 +1154,8 @@ int
 dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
             char **infodata, size_t maxinfosize)
 {
-  char header[255];
-  char type[255];
-  int headerlen;
-  int infosize = 0;
-  int rv       = 0;
+  int infosize;
+  int rv;
 
   if (!dlconn || !infotype || !infodata)
     return -1;
@@ -816,14 +1163,68 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
   if (maxinfosize && !*infodata)
     return -1;
 
+  if ((infosize = dlp_info_request (dlconn, infotype, infomatch, "dl_getinfo")) < 0)
+    return -1;
+
+  /* If a maximum buffer size was specified check that it's large enough */
+  if (maxinfosize && infosize > (int64_t)maxinfosize)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): INFO data larger (%d) than the maximum size (%" PRIsize_t ")\n",
+              dlconn->addr, infosize, maxinfosize);
+    return -1;
+  }
+
+  /* Allocate the infobuffer if needed */
+  if (maxinfosize == 0)
+  {
+    if (!(*infodata = malloc (infosize)))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): error allocating receving buffer of %d bytes\n",
+                dlconn->addr, infosize);
+      return -1;
+    }
+  }
+
+  /* Receive INFO data, blocking until complete */
+  if ((rv = dl_recvdata (dlconn, *infodata, infosize, 1)) != infosize)
+  {
+    /* Only log an error if the connection was not shut down */
+    if (rv < -1)
+      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): problem receiving INFO data\n",
+                dlconn->addr);
+    return -1;
+  }
+
+  return infosize;
+} /* End of dl_getinfo() */
+
+/***************************************************************************
+ * dlp_info_request:
+ *
+ * Send an INFO request and receive the response header, leaving the
+ * INFO data to be received by the caller.  Errors are logged as from
+ * the function named @a caller.
+ *
+ * Returns the size of the INFO data in bytes on success and -1 on error.
+ ***************************************************************************/
+int
+dlp_info_request (DLCP *dlconn, const char *infotype, char *infomatch,
+                  const char *caller)
+{
+  char header[255];
+  char type[255];
+  int headerlen;
+  int infosize = 0;
+  int rv       = 0;
+
   if (dlconn->link < 0)
     return -1;
 
   /* Sanity check that connection is not in streaming mode */
   if (dlconn->streaming)
   {
-    dl_log_r (dlconn, 1, 1, "[%s] dl_getinfo(): Connection in streaming mode, cannot continue\n",
-              dlconn->addr);
+    dl_log_r (dlconn, 1, 1, "[%s] %s(): Connection in streaming mode, cannot continue\n",
+              dlconn->addr, caller);
     return -1;
   }
 
@@ -835,8 +1236,8 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
   /* Send command and packet to server */
   if (dl_sendpacket (dlconn, header, headerlen, NULL, 0, NULL, 0) < 0)
   {
-    dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): problem sending INFO command\n",
-              dlconn->addr);
+    dl_log_r (dlconn, 2, 0, "[%s] %s(): problem sending INFO command\n",
+              dlconn->addr, caller);
     return -1;
   }
 
@@ -845,8 +1246,8 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
   {
     /* Only log an error if the connection was not shut down */
     if (rv < -1)
-      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): problem receving packet header\n",
-                dlconn->addr);
+      dl_log_r (dlconn, 2, 0, "[%s] %s(): problem receving packet header\n",
+                dlconn->addr, caller);
     return -1;
   }
 
@@ -855,46 +1256,17 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
     /* Parse INFO header */
     rv = sscanf (header, "INFO %s %d", type, &infosize);
 
-    if (rv != 2)
+    if (rv != 2 || infosize < 0)
     {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): cannot parse INFO header\n",
-                dlconn->addr);
+      dl_log_r (dlconn, 2, 0, "[%s] %s(): cannot parse INFO header\n",
+                dlconn->addr, caller);
       return -1;
     }
 
     if (strncasecmp (infotype, type, strlen (infotype)))
     {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): requested type %s but received type %s\n",
-                dlconn->addr, infotype, type);
-      return -1;
-    }
-
-    /* If a maximum buffer size was specified check that it's large enough */
-    if (maxinfosize && infosize > (int64_t)maxinfosize)
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): INFO data larger (%d) than the maximum size (%" PRIsize_t ")\n",
-                dlconn->addr, infosize, maxinfosize);
-      return -1;
-    }
-
-    /* Allocate the infobuffer if needed */
-    if (maxinfosize == 0)
-    {
-      if (!(*infodata = malloc (infosize)))
-      {
-        dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): error allocating receving buffer of %d bytes\n",
-                  dlconn->addr, infosize);
-        return -1;
-      }
-    }
-
-    /* Receive INFO data, blocking until complete */
-    if ((rv = dl_recvdata (dlconn, *infodata, infosize, 1)) != infosize)
-    {
-      /* Only log an error if the connection was not shut down */
-      if (rv < -1)
-        dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): problem receiving INFO data\n",
-                  dlconn->addr);
+      dl_log_r (dlconn, 2, 0, "[%s] %s(): requested type %s but received type %s\n",
+                dlconn->addr, caller, infotype, type);
       return -1;
     }
   }
@@ -911,13 +1283,13 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
   }
   else
   {
-    dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo(): Unrecognized reply string %.6s\n",
-              dlconn->addr, header);
+    dl_log_r (dlconn, 2, 0, "[%s] %s(): Unrecognized reply string %.6s\n",
+              dlconn->addr, caller, header);
     return -1;
   }
 
   return infosize;
-} /* End of dl_getinfo() */
+} /* End of dlp_info_request() */
 
 /***********************************************************************/ /**
  * @brief Collect packets streaming from the DataLink server
@@ -928,6 +1300,10 @@ dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
  * sending keepalive packets to the server based on the DLCP.keepalive
  * parameter.
  *
+ * While waiting the socket and the wakeup descriptor of the
+ * connection, see dl_wakeup_fd(), are waited on, so dl_terminate()
+ * from another thread or a signal handler ends the wait immediately.
+ *
  * Designed to run in a tight loop at the heart of a client program,
  * this function will return every time a packet is received.  On
  * successfully receiving a packet @a dlpack will be populated and the
@@ -948,247 +1324,646 @@ int
 dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
             size_t maxdatasize, int8_t endflag)
 {
-  dltime_t now;
-  char header[255];
-  int headerlen;
+  int8_t toolarge;
   int rv;
 
-  long long int spktid;
-  long long int spkttime;
-  long long int sdatastart;
-  long long int sdataend;
-  long int sdatasize;
-
-  /* For select()ing during the read loop */
-  struct timeval select_tv;
-  fd_set select_fd;
-  int select_ret;
-
-  if (!dlconn || !packet || !packetdata)
-    return DLERROR;
-
-  if (dlconn->link == -1)
-    return DLERROR;
-
-  /* If not streaming send the STREAM command */
-  if (!dlconn->streaming && !endflag)
+  for (;;)
   {
-    /* Create packet header with command: "STREAM" */
-    headerlen = snprintf (header, sizeof (header), "STREAM");
+    rv = collect_stream (dlconn, packet, packetdata, maxdatasize, endflag, &toolarge);
 
-    /* Send command to server */
-    if (dl_sendpacket (dlconn, header, headerlen, NULL, 0, NULL, 0) < 0)
+    if (!reconnect_needed (dlconn, rv, toolarge, endflag))
+      return rv;
+
+    /* Reconnect, waiting for the backoff between attempts */
+    while (dl_reconnect (dlconn) < 0)
     {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): problem sending STREAM command\n",
-                dlconn->addr);
-      return DLERROR;
-    }
+      while (!dlconn->terminate && dlp_monotime () < dlconn->reconnect_time)
+      {
+        if (collect_wait (dlconn, dlconn->reconnect_time) < 0)
+          dlp_usleep (100000);
+      }
 
-    dlconn->streaming      = 1;
-    dlconn->keepalive_trig = -1;
-    dl_log_r (dlconn, 1, 2, "[%s] STREAM command sent to server\n", dlconn->addr);
+      if (dlconn->terminate)
+        return DLENDED;
+    }
   }
+} /* End of dl_collect() */
 
-  /* If streaming and end is requested send the ENDSTREAM command */
-  if (dlconn->streaming == 1 && endflag)
-  {
-    /* Create packet header with command: "ENDSTREAM" */
-    headerlen = snprintf (header, sizeof (header), "ENDSTREAM");
-
-    /* Send command to server */
-    if (dl_sendpacket (dlconn, header, headerlen, NULL, 0, NULL, 0) < 0)
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): problem sending ENDSTREAM command\n",
-                dlconn->addr);
-      return DLERROR;
-    }
+/***********************************************************************/ /**
+ * @brief Collect packets streaming from the DataLink server without blocking
+ *
+ * Collect packets streaming from the DataLink server.  If the
+ * connection is not already in streaming mode the STREAM command will
+ * first be sent.  This routine is a non-blocking version of
+ * dl_collect() and will return quickly whether data is received or
+ * not.  Keep alive packets are sent to the server based on the
+ * DLCP.keepalive parameter.
+ *
+ * This routine never blocks: commands are sent as the socket allows
+ * and a partially received packet is kept in the receive buffer and
+ * completed on later calls, see dl_process().  An I/O timeout,
+ * DLCP.iotimeout, while a packet is incomplete is an error.
+ *
+ * Designed to run in a tight loop at the heart of a client program,
+ * this function will return every time a packet is received.  On
+ * successfully receiving a packet @a dlpack will be populated and the
+ * packet data will be copied into @a packetdata.
+ *
+ * If the @a endflag is true the ENDSTREAM command is sent which
+ * instructs the server to stop streaming packets; a client must
+ * continue collecting packets until DLENDED is returned in order to
+ * get any packets that were in-the-air when ENDSTREAM was requested.
+ * The stream ending sequence must be completed if the connection is
+ * to be used after streaming mode.
+ *
+ * @retval DLPACKET A packet is received.
+ * @retval DLNOPACKET No packet is received.
+ * @retval DLENDED when the stream ending sequence was completed or the connection was shut down.
+ * @retval DLERROR when an error occurred.
+ ***************************************************************************/
+int
+dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
+               size_t maxdatasize, int8_t endflag)
+{
+  int8_t toolarge;
+  int rv;
 
-    dlconn->streaming      = -1;
-    dlconn->keepalive_trig = -1;
-    dl_log_r (dlconn, 1, 2, "[%s] ENDSTREAM command sent to server\n", dlconn->addr);
+  /* Reconnection pending, attempt when the backoff has passed */
+  if (dlconn && dlconn->link < 0 && dlconn->reconnect_time > 0)
+  {
+    if (dlconn->terminate)
+      return DLENDED;
+
+    if (dlp_monotime () < dlconn->reconnect_time || dl_reconnect (dlconn) < 0)
+      return DLNOPACKET;
   }
 
-  /* Start the primary loop */
-  while (!dlconn->terminate)
+  rv = collect_stream_nb (dlconn, packet, packetdata, maxdatasize, endflag, &toolarge);
+
+  if (reconnect_needed (dlconn, rv, toolarge, endflag))
   {
-    /* Check if a keepalive packet needs to be sent */
-    if (dlconn->keepalive && dlconn->keepalive_trig > 0)
-    {
-      dl_log_r (dlconn, 1, 2, "[%s] Sending keepalive packet\n", dlconn->addr);
+    /* Attempt immediately, otherwise retry on later calls */
+    dlconn->reconnect_time = dlp_monotime ();
 
-      /* Send ID as a keepalive packet exchange */
-      headerlen = snprintf (header, sizeof (header), "ID %s", dlconn->clientid);
+    if (dl_reconnect (dlconn) < 0)
+      return DLNOPACKET;
 
-      if (dl_sendpacket (dlconn, header, headerlen, NULL, 0, NULL, 0) < 0)
-      {
-        dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): problem sending keepalive packet\n",
-                  dlconn->addr);
-        return DLERROR;
-      }
+    rv = DLNOPACKET;
+  }
+
+  return rv;
+} /* End of dl_collect_nb() */
+
+/***********************************************************************/ /**
+ * @brief Collect a batch of packets streaming from the DataLink server
+ *
+ * Collect all packets that are already available, up to @a
+ * maxpackets, with one call.  If the connection is not already in
+ * streaming mode the STREAM command will first be sent.  Keepalive
+ * packets are sent as by dl_collect_nb().
+ *
+ * Without a @a callback, packet descriptions are placed in the @a
+ * packets array and packet data is laid out contiguously in @a arena:
+ * the data of each packet follows the data of the previous packet, so
+ * the data of packet N starts at the sum of the data sizes of packets
+ * 0 to N-1.  The batch ends when the arena has less room than the
+ * maximum packet size of the server (or ::MAXPACKETSIZE if unknown).
+ *
+ * With a @a callback, @a packets may be NULL and each packet is
+ * received at the start of @a arena and passed to @a callback with
+ * @a cbdata.  A non-zero return from the callback ends the batch.  If
+ * @a maxpackets is 0 the number of packets is not limited.
+ *
+ * If no packet is available the call waits up to @a timeout
+ * microseconds for data; the batch ends when no more packets are
+ * immediately available or when the timeout has passed.  A @a timeout
+ * of 0 does not wait.  The wait also ends when dl_wakeup() is called
+ * for the connection, e.g. by another thread with work for the
+ * collecting thread.
+ *
+ * The number of packets collected is placed in @a count, these are
+ * valid whatever the return value.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param packets Array of at least @a maxpackets packet descriptions
+ * @param maxpackets Maximum number of packets to collect
+ * @param arena Buffer for packet data
+ * @param arenasize Size of @a arena in bytes
+ * @param callback Function called for each packet, or NULL
+ * @param cbdata Pointer passed to @a callback
+ * @param timeout Maximum time to wait for packets in microseconds
+ * @param count Number of packets collected
+ *
+ * @retval DLPACKET One or more packets were collected.
+ * @retval DLNOPACKET No packets were available within the timeout.
+ * @retval DLENDED when the stream ending sequence was completed or the connection was shut down.
+ * @retval DLERROR when an error occurred.
+ ***************************************************************************/
+int
+dl_collect_batch (DLCP *dlconn, DLPacket *packets, int maxpackets,
+                  void *arena, size_t arenasize,
+                  DLCollectCallback callback, void *cbdata,
+                  int64_t timeout, int *count)
+{
+  DLPacket cbpacket;
+  DLPacket *packet;
+  char *packetdata;
+  size_t maxdatasize;
+  size_t used = 0;
+  int64_t deadline = 0;
+  int collected = 0;
+  int rv;
+
+  if (count)
+    *count = 0;
+
+  if (!dlconn || !arena || !count || (!callback && (!packets || maxpackets <= 0)))
+    return DLERROR;
+
+  maxdatasize = (dlconn->maxpktsize > 0) ? (size_t)dlconn->maxpktsize : MAXPACKETSIZE;
+
+  if (!callback && arenasize < maxdatasize)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_collect_batch(): arena (%" PRIsize_t ") smaller than maximum packet size (%" PRIsize_t ")\n",
+              dlconn->addr, arenasize, maxdatasize);
+    return DLERROR;
+  }
+
+  if (timeout > 0)
+  {
+    deadline = dlp_monotime () + timeout;
+
+    /* Create the wakeup descriptor, without it the terminate flag is polled */
+    dl_wakeup_fd (dlconn);
+  }
+
+  for (;;)
+  {
+    if (maxpackets > 0 && collected >= maxpackets)
+      break;
 
-      dlconn->keepalive_trig = -1;
+    if (callback)
+    {
+      packet     = (packets) ? &packets[0] : &cbpacket;
+      packetdata = (char *)arena;
     }
+    else
+    {
+      /* End batch when the arena cannot hold another packet */
+      if (arenasize - used < maxdatasize)
+        break;
 
-    /* Poll the socket for available data */
-    FD_ZERO (&select_fd);
-    FD_SET ((unsigned int)dlconn->link, &select_fd);
-    select_tv.tv_sec  = 0;
-    select_tv.tv_usec = 500000; /* Block up to 0.5 seconds */
+      packet     = &packets[collected];
+      packetdata = (char *)arena + used;
+    }
 
-    select_ret = select ((dlconn->link + 1), &select_fd, NULL, NULL, &select_tv);
+    rv = dl_collect_nb (dlconn, packet, packetdata,
+                        (callback) ? arenasize : arenasize - used, 0);
 
-    /* Check the return from select(), an interrupted system call error
-	 will be reported if a signal handler was used.  If the terminate
-	 flag is set this is not an error. */
-    if (select_ret > 0)
+    if (rv == DLPACKET)
     {
-      if (!FD_ISSET (dlconn->link, &select_fd))
+      collected++;
+      *count = collected;
+
+      if (callback)
       {
-        dl_log_r (dlconn, 2, 0, "[%s] select() reported data but socket not in set!\n",
-                  dlconn->addr);
+        if (callback (packet, packetdata, cbdata))
+          break;
       }
       else
       {
-        /* Receive packet header, blocking until complete */
-        if ((rv = dl_recvheader (dlconn, header, sizeof (header), 1)) < 0)
-        {
-          if (rv == -1)
-            return DLENDED;
+        used += packet->datasize;
+      }
 
-          dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): problem receving packet header\n",
-                    dlconn->addr);
-          return DLERROR;
-        }
+      continue;
+    }
 
-        /* Reset keepalive trigger */
-        dlconn->keepalive_trig = -1;
+    if (rv != DLNOPACKET)
+      return rv;
 
-        if (!strncmp (header, "PACKET", 6))
-        {
-          /* Parse PACKET header */
-          rv = sscanf (header, "PACKET %s %lld %lld %lld %lld %ld",
-                       packet->streamid, &spktid, &spkttime,
-                       &sdatastart, &sdataend, &sdatasize);
+    /* End batch when drained or no time remains */
+    if (collected > 0 || timeout <= 0)
+      break;
 
-          if (rv != 6)
-          {
-            dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): cannot parse PACKET header\n",
-                      dlconn->addr);
-            return DLERROR;
-          }
+    if (deadline - dlp_monotime () <= 0)
+      break;
 
-          packet->pktid     = spktid;
-          packet->pkttime   = spkttime;
-          packet->datastart = sdatastart;
-          packet->dataend   = sdataend;
-          packet->datasize  = sdatasize;
+    /* Wait for data, a wakeup ends the batch unless terminating */
+    if ((rv = collect_wait (dlconn, deadline)) < 0)
+      return DLERROR;
 
-          if (packet->datasize > (int64_t)maxdatasize)
-          {
-            dl_log_r (dlconn, 2, 0,
-                      "[%s] dl_collect(): packet data larger (%d) than receiving buffer (%" PRIsize_t ")\n",
-                      dlconn->addr, packet->datasize, maxdatasize);
-            return DLERROR;
-          }
+    if (rv > 0 && !dlconn->terminate)
+      break;
+  }
 
-          /* Receive packet data, blocking until complete */
-          if ((rv = dl_recvdata (dlconn, packetdata, packet->datasize, 1)) != packet->datasize)
-          {
-            if (rv == -1)
-              return DLENDED;
+  return (collected > 0) ? DLPACKET : DLNOPACKET;
+} /* End of dl_collect_batch() */
 
-            dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): problem receiving packet data\n",
-                      dlconn->addr);
-            return DLERROR;
-          }
+/***********************************************************************/ /**
+ * @brief Queue the STREAM or ENDSTREAM command without blocking
+ *
+ * Queue the STREAM command, or the ENDSTREAM command if @a endflag is
+ * true, to be sent by dl_process(), setting the streaming mode of the
+ * connection as dl_collect_nb() does.  Nothing is queued if the
+ * connection is already in the requested mode.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param endflag Flag to request the end of streaming
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_stream_nb (DLCP *dlconn, int8_t endflag)
+{
+  char header[255];
+  int headerlen;
 
-          /* Update most recently received packet ID and time */
-          dlconn->pktid   = packet->pktid;
-          dlconn->pkttime = packet->pkttime;
+  if (!dlconn || dlconn->link < 0)
+    return -1;
 
-          return DLPACKET;
-        }
-        else if (!strncmp (header, "ID", 2))
-        {
-          dl_log_r (dlconn, 1, 2, "[%s] Received keepalive from server\n",
-                    dlconn->addr);
-        }
-        else if (!strncmp (header, "ENDSTREAM", 9))
-        {
-          dl_log_r (dlconn, 1, 2, "[%s] Received end-of-stream from server\n",
-                    dlconn->addr);
-          dlconn->streaming = 0;
-          return DLENDED;
-        }
-        else
-        {
-          dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): Unrecognized packet header %.6s\n",
-                    dlconn->addr, header);
-          return DLERROR;
-        }
-      }
+  if (!dlconn->streaming && !endflag)
+  {
+    /* Create packet header with command: "STREAM" */
+    headerlen = snprintf (header, sizeof (header), "STREAM");
+
+    if (dlp_sendqueue (dlconn, header, headerlen, NULL, 0) < 0)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_stream_nb(): problem queuing STREAM command\n",
+                dlconn->addr);
+      return -1;
     }
-    else if (select_ret < 0 && !dlconn->terminate)
+
+    dlconn->streaming      = 1;
+    dlconn->keepalive_trig = -1;
+    dl_log_r (dlconn, 1, 2, "[%s] STREAM command queued\n", dlconn->addr);
+  }
+  else if (dlconn->streaming == 1 && endflag)
+  {
+    /* Create packet header with command: "ENDSTREAM" */
+    headerlen = snprintf (header, sizeof (header), "ENDSTREAM");
+
+    if (dlp_sendqueue (dlconn, header, headerlen, NULL, 0) < 0)
     {
-      dl_log_r (dlconn, 2, 0, "[%s] select() error: %s\n", dlconn->addr, dlp_strerror ());
-      return DLERROR;
+      dl_log_r (dlconn, 2, 0, "[%s] dl_stream_nb(): problem queuing ENDSTREAM command\n",
+                dlconn->addr);
+      return -1;
     }
 
-    /* Update timing variables */
-    now = dlp_time ();
+    dlconn->streaming      = -1;
+    dlconn->keepalive_trig = -1;
+    dl_log_r (dlconn, 1, 2, "[%s] ENDSTREAM command queued\n", dlconn->addr);
+  }
+
+  return 0;
+} /* End of dl_stream_nb() */
+
+/***********************************************************************/ /**
+ * @brief Queue a packet to be written to the DataLink server
+ *
+ * Queue a WRITE command with the supplied packet to be sent by
+ * dl_process().  The packet data is copied, the buffer may be reused
+ * on return.  If an acknowledgement is requested the server reply is
+ * returned by dl_process() as ::DLREPLY, replies are returned in the
+ * order the packets were queued.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param packet Packet data buffer to send
+ * @param packetlen Length of data in bytes to send from @a packet
+ * @param streamid Stream ID of packet
+ * @param datastart Data start time for packet
+ * @param dataend Data end time for packet
+ * @param ack Acknowledgement flag, if true request acknowledgement
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_write_nb (DLCP *dlconn, void *packet, int packetlen, char *streamid,
+             dltime_t datastart, dltime_t dataend, int ack)
+{
+  char header[255];
+  int headerlen;
+
+  if (!dlconn || !packet || !streamid || packetlen < 0)
+    return -1;
+
+  if (dlconn->link < 0)
+    return -1;
+
+  /* Sanity check that packet data is not larger than max packet size if known */
+  if (dlconn->maxpktsize > 0 && packetlen > dlconn->maxpktsize)
+  {
+    dl_log_r (dlconn, 1, 1, "[%s] dl_write_nb(): Packet length (%d) greater than max packet size (%d)\n",
+              dlconn->addr, packetlen, dlconn->maxpktsize);
+    return -1;
+  }
+
+  /* Create packet header with command: "WRITE streamid hpdatastart hpdataend flags size" */
+  headerlen = snprintf (header, sizeof (header),
+                        "WRITE %s %lld %lld %s %d",
+                        streamid, (long long int)datastart, (long long int)dataend,
+                        (ack) ? "A" : "N", packetlen);
+
+  if (headerlen < 0 || headerlen >= (int)sizeof (header))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_write_nb(): stream ID too long\n", dlconn->addr);
+    return -1;
+  }
 
-    /* Keepalive/heartbeat interval timing logic */
-    if (dlconn->keepalive)
+  if (dlp_sendqueue (dlconn, header, headerlen, packet, packetlen) < 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_write_nb(): problem queuing WRITE command\n",
+              dlconn->addr);
+    return -1;
+  }
+
+  return 0;
+} /* End of dl_write_nb() */
+
+/***********************************************************************/ /**
+ * @brief Perform available network I/O for a connection without blocking
+ *
+ * Designed to be called from an application's event loop when the
+ * socket of a connection, 'dlconn->link', is ready for the events
+ * reported by dl_interest() or when the time reported by
+ * dl_deadline() has passed.  Commands queued with dl_stream_nb() and
+ * dl_write_nb() are sent, keepalives are sent at the DLCP.keepalive
+ * interval while streaming, and received data is consumed until a
+ * complete packet or command reply is available or no more data can
+ * be read without blocking.  Partially received packets are kept and
+ * completed on later calls.
+ *
+ * A connection driven by this function should not be used with the
+ * blocking routines, e.g. dl_collect() or dl_write(), as queued
+ * commands and partially received packets would be mixed with theirs.
+ *
+ * When ::DLPACKET is returned @a packet is populated and the packet
+ * data is copied into @a packetdata.  When ::DLREPLY is returned, in
+ * reply to a command such as a WRITE with acknowledgement, the
+ * 'streamid' of @a packet is set to "OK" or "ERROR", the 'pktid' to
+ * the reply value and the server message, if any, is copied into @a
+ * packetdata as a NULL terminated string of 'datasize' bytes,
+ * truncated if needed.
+ *
+ * Call this function repeatedly until ::DLNOPACKET is returned, more
+ * packets may already be received.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param packet Pointer to a DLPacket struct for a received packet or reply
+ * @param packetdata Pointer to a buffer for received packet data
+ * @param maxdatasize Maximum data size to write to @a packetdata
+ *
+ * @retval DLPACKET A packet is received.
+ * @retval DLREPLY A command reply is received.
+ * @retval DLNOPACKET No packet or reply is available.
+ * @retval DLENDED when the stream ending sequence was completed or the connection was shut down.
+ * @retval DLERROR when an error occurred, including the I/O timeout.
+ ***************************************************************************/
+int
+dl_process (DLCP *dlconn, DLPacket *packet, void *packetdata, size_t maxdatasize)
+{
+  return process_io (dlconn, packet, packetdata, maxdatasize, NULL);
+} /* End of dl_process() */
+
+/***********************************************************************/ /**
+ * @brief Handle the server reply to a command
+ *
+ * Handle the server reply to a command.  This routine is used by
+ * other library routines to process replies from the server.
+ *
+ * Server replies are of the form:
+ *
+ * "OK|ERROR value size"
+ *
+ * followed by an optional server message of size bytes.  If size is
+ * greater than zero it will be read from the connection and placed
+ * into @a buffer.  The server message, if included, will always be a
+ * NULL-terminated string.
+ *
+ * @retval -1 Error
+ * @retval 0 "OK" received
+ * @retval 1 "ERROR" received
+ ***************************************************************************/
+int
+dl_handlereply (DLCP *dlconn, void *buffer, int buflen, int64_t *value)
+{
+  char status[11];
+  char *cbuffer = buffer;
+  int64_t pvalue;
+  int64_t size = 0;
+  int rv       = 0;
+
+  if (!dlconn || !buffer)
+    return -1;
+
+  /* Make sure buffer if terminated */
+  cbuffer[buflen] = '\0';
+
+  /* Parse reply header */
+  if (sscanf (buffer, "%10s %" SCNd64 " %" SCNd64, status, &pvalue, &size) != 3)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_handlereply(): Unable to parse reply header: '%s'\n",
+              dlconn->addr, (char *)buffer);
+    return -1;
+  }
+
+  /* Store reply value if requested */
+  if (value)
+    *value = pvalue;
+
+  /* Check that reply message will fit into buffer */
+  if (size > buflen)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_handlereply(): Reply message too large (%" PRId64 ") for buffer (%d)\n",
+              dlconn->addr, size, buflen);
+    return -1;
+  }
+
+  /* Receive reply message if included */
+  if (size > 0)
+  {
+    /* Receive reply message, blocking until complete */
+    if ((rv = dl_recvdata (dlconn, buffer, (size_t)size, 1)) != size)
     {
-      if (dlconn->keepalive_trig == -1) /* reset timer */
-      {
-        dlconn->keepalive_time = now;
-        dlconn->keepalive_trig = 0;
-      }
-      else if (dlconn->keepalive_trig == 0 &&
-               (now - dlconn->keepalive_time) > (dlconn->keepalive * DLTMODULUS))
-      {
-        dlconn->keepalive_trig = 1;
-      }
+      /* Only log an error if the connection was not shut down */
+      if (rv < -1)
+        dl_log_r (dlconn, 2, 0, "[%s] dl_handlereply(): Problem receiving reply message\n",
+                  dlconn->addr);
+      return -1;
     }
-  } /* End of primary loop */
 
-  return DLENDED;
-} /* End of dl_collect() */
+    if (size < buflen)
+      cbuffer[size] = '\0';
+    else
+      cbuffer[buflen - 1] = '\0';
+  }
+  /* Make sure buffer is terminated */
+  else
+  {
+    cbuffer[0] = '\0';
+  }
+
+  /* Check for "OK" status in reply header */
+  if (!strncmp (status, "OK", 2))
+  {
+    rv = 0;
+  }
+  else if (!strncmp (status, "ERROR", 5))
+  {
+    rv = 1;
+  }
+  else
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_handlereply(): Unrecognized reply string %.5s\n",
+              dlconn->addr, (char *)buffer);
+    rv = -1;
+  }
+
+  return rv;
+} /* End of dl_handlereply() */
+
+/***********************************************************************/ /**
+ * @brief Set the terminate parameter of a DataLink connection
+ *
+ * Set the terminate parameter/flag in the @a DLCP and log a
+ * diagnostic message indicating that the connection is terminating.
+ * Some of the library routines watch the terminate parameter as an
+ * indication that the client program is requesting a shut down.  This
+ * routine is typically used in a signal handler.
+ *
+ * A thread waiting in dl_collect() or dl_collect_batch() for the
+ * connection is woken immediately, see dl_wakeup().
+ ***************************************************************************/
+void
+dl_terminate (DLCP *dlconn)
+{
+  dl_log_r (dlconn, 1, 1, "[%s] Terminating connection\n", dlconn->addr);
+
+  dlconn->terminate = 1;
+
+  dl_wakeup (dlconn);
+} /* End of dl_terminate() */
+
+/***********************************************************************/ /**
+ * @brief Get the wakeup descriptor of a DataLink connection
+ *
+ * Get a descriptor that becomes readable when dl_wakeup() or
+ * dl_terminate() is called for the connection, creating it on first
+ * use.  The descriptor can be added to an application's event loop
+ * (e.g. select(), poll() or epoll) next to 'dlconn->link' so other
+ * threads can wake the loop, e.g. to handle work they have queued.
+ * Pending wakeups are cleared when the library waits on the
+ * descriptor, an application waiting on it itself should clear them
+ * by reading from it until no data remains.
+ *
+ * The descriptor is created by the thread using the connection, in
+ * dl_collect() and dl_collect_batch() or by calling this function
+ * before other threads may call dl_wakeup().  It is closed by
+ * dl_freedlcp().
+ *
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return The descriptor to wait on, or -1 on error.
+ ***************************************************************************/
+int64_t
+dl_wakeup_fd (DLCP *dlconn)
+{
+  SOCKET rfd;
+  SOCKET wfd;
+
+  if (!dlconn)
+    return -1;
+
+  if (dlconn->wakeup_wfd >= 0)
+    return dlconn->wakeup_rfd;
+
+  if (dlp_wakeup_open (&rfd, &wfd))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] cannot create wakeup descriptor: %s\n",
+              dlconn->addr, dlp_strerror ());
+    return -1;
+  }
+
+  /* Publish the signaling side last for dl_wakeup() in other threads */
+  dlconn->wakeup_rfd = (int64_t)rfd;
+  DLP_STORE_RELEASE (&dlconn->wakeup_wfd, (int64_t)wfd);
+
+  return dlconn->wakeup_rfd;
+} /* End of dl_wakeup_fd() */
+
+/***********************************************************************/ /**
+ * @brief Wake a thread waiting for a DataLink connection
+ *
+ * Signal the wakeup descriptor of a connection, see dl_wakeup_fd().
+ * A thread waiting in dl_collect_batch() returns with the packets
+ * collected so far, dl_collect() continues waiting unless the
+ * connection is terminated.  This routine may be called from any
+ * thread and from a signal handler.
+ *
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return 0 on success, including when no wakeup descriptor has been
+ * created as nothing is waiting on it, and -1 on error.
+ ***************************************************************************/
+int
+dl_wakeup (DLCP *dlconn)
+{
+  int64_t wfd;
+
+  if (!dlconn)
+    return -1;
+
+  if ((wfd = (int64_t)DLP_LOAD_ACQUIRE (&dlconn->wakeup_wfd)) < 0)
+    return 0;
+
+  return dlp_wakeup_signal ((SOCKET)wfd);
+} /* End of dl_wakeup() */
+
+/***************************************************************************
+ * update_keepalive:
+ *
+ * Update the loop time of a connection from the monotonic clock and
+ * run the keepalive/heartbeat interval timing logic.  The loop time
+ * is read once per collection loop iteration and is unaffected by
+ * changes to the system clock.
+ ***************************************************************************/
+static void
+update_keepalive (DLCP *dlconn)
+{
+  dlconn->looptime = dlp_monotime ();
+
+  /* Keepalive/heartbeat interval timing logic */
+  if (dlconn->keepalive)
+  {
+    if (dlconn->keepalive_trig == -1) /* reset timer */
+    {
+      dlconn->keepalive_time = dlconn->looptime;
+      dlconn->keepalive_trig = 0;
+    }
+    else if (dlconn->keepalive_trig == 0 &&
+             (dlconn->looptime - dlconn->keepalive_time) > ((int64_t)dlconn->keepalive * 1000000))
+    {
+      dlconn->keepalive_trig = 1;
+    }
+  }
+} /* End of update_keepalive() */
 
-/***********************************************************************/ /**
- * @brief Collect packets streaming from the DataLink server without blocking
- *
- * Collect packets streaming from the DataLink server.  If the
- * connection is not already in streaming mode the STREAM command will
- * first be sent.  This routine is a non-blocking version of
- * dl_collect() and will return quickly whether data is received or
- * not.  Keep alive packets are sent to the server based on the
- * DLCP.keepalive parameter.
- *
- * Designed to run in a tight loop at the heart of a client program,
- * this function will return every time a packet is received.  On
- * successfully receiving a packet @a dlpack will be populated and the
- * packet data will be copied into @a packetdata.
- *
- * If the @a endflag is true the ENDSTREAM command is sent which
- * instructs the server to stop streaming packets; a client must
- * continue collecting packets until DLENDED is returned in order to
- * get any packets that were in-the-air when ENDSTREAM was requested.
- * The stream ending sequence must be completed if the connection is
- * to be used after streaming mode.
+/***************************************************************************
+ * process_io:
  *
- * @retval DLPACKET A packet is received.
- * @retval DLNOPACKET No packet is received.
- * @retval DLENDED when the stream ending sequence was completed or the connection was shut down.
- * @retval DLERROR when an error occurred.
+ * Perform available network I/O for a connection without blocking,
+ * see dl_process().  If @a toolarge is not NULL it is set when
+ * DLERROR is returned for a packet larger than @a maxdatasize, which
+ * does not indicate a connection failure.
  ***************************************************************************/
-int
-dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
-               size_t maxdatasize, int8_t endflag)
+static int
+process_io (DLCP *dlconn, DLPacket *packet, void *packetdata, size_t maxdatasize,
+            int8_t *toolarge)
 {
-  dltime_t now;
-  char header[255];
+  char header[256];
+  char status[11];
+  char *data;
+  size_t datasize;
+  size_t msgsize;
   int headerlen;
   int rv;
 
@@ -1197,86 +1972,51 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
   long long int sdatastart;
   long long int sdataend;
   long int sdatasize;
+  long long int svalue;
+
+  if (toolarge)
+    *toolarge = 0;
 
   if (!dlconn || !packet || !packetdata)
     return DLERROR;
 
-  if (dlconn->link == -1)
+  if (dlconn->link < 0 || dlconn->connecting)
     return DLERROR;
 
-  /* If not streaming send the STREAM command */
-  if (!dlconn->streaming && !endflag)
-  {
-    /* Create packet header with command: "STREAM" */
-    headerlen = snprintf (header, sizeof (header), "STREAM");
-
-    /* Send command to server */
-    if (dl_sendpacket (dlconn, header, headerlen, NULL, 0, NULL, 0) < 0)
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): problem sending STREAM command\n",
-                dlconn->addr);
-      return DLERROR;
-    }
-
-    dlconn->streaming      = 1;
-    dlconn->keepalive_trig = -1;
-    dl_log_r (dlconn, 1, 2, "[%s] STREAM command sent to server", dlconn->addr);
-  }
+  if (dlconn->terminate)
+    return DLENDED;
 
-  /* If streaming and end is requested send the ENDSTREAM command */
-  if (dlconn->streaming == 1 && endflag)
+  /* Queue a keepalive packet if needed */
+  if (dlconn->streaming && dlconn->keepalive && dlconn->keepalive_trig > 0)
   {
-    /* Create packet header with command: "ENDSTREAM" */
-    headerlen = snprintf (header, sizeof (header), "ENDSTREAM");
+    dl_log_r (dlconn, 1, 2, "[%s] Sending keepalive packet\n", dlconn->addr);
 
-    /* Send command to server */
-    if (dl_sendpacket (dlconn, header, headerlen, NULL, 0, NULL, 0) < 0)
+    /* Send ID as a keepalive packet exchange */
+    headerlen = snprintf (header, sizeof (header), "ID %s", dlconn->clientid);
+
+    if (dlp_sendqueue (dlconn, header, headerlen, NULL, 0) < 0)
     {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): problem sending ENDSTREAM command\n",
+      dl_log_r (dlconn, 2, 0, "[%s] dl_process(): problem queuing keepalive packet\n",
                 dlconn->addr);
       return DLERROR;
     }
 
-    dlconn->streaming      = -1;
     dlconn->keepalive_trig = -1;
-    dl_log_r (dlconn, 1, 2, "[%s] ENDSTREAM command sent to server", dlconn->addr);
   }
 
-  if (!dlconn->terminate)
-  {
-    /* Check if a keepalive packet needs to be sent */
-    if (dlconn->keepalive && dlconn->keepalive_trig > 0)
-    {
-      dl_log_r (dlconn, 1, 2, "[%s] Sending keepalive packet\n", dlconn->addr);
-
-      /* Send ID as a keepalive packet exchange */
-      headerlen = snprintf (header, sizeof (header), "ID %s", dlconn->clientid);
-
-      if (dl_sendpacket (dlconn, header, headerlen,
-                         NULL, 0, NULL, 0) < 0)
-      {
-        dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): problem sending keepalive packet\n",
-                  dlconn->addr);
-        return DLERROR;
-      }
-
-      dlconn->keepalive_trig = -1;
-    }
-  }
+  /* Adaptive receive buffer sizing */
+  dlp_sockopt_adapt (dlconn);
 
-  /* Receive packet header if it's available */
-  if ((rv = dl_recvheader (dlconn, header, sizeof (header), 0)) < 0)
+  /* Send queued commands */
+  if (dlp_sendflush (dlconn) < 0)
   {
-    if (rv == -1)
-      return DLENDED;
-
-    dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): problem receving packet header\n",
+    dl_log_r (dlconn, 2, 0, "[%s] dl_process(): problem sending queued commands\n",
               dlconn->addr);
     return DLERROR;
   }
 
-  /* Process data if header received */
-  if (rv > 0)
+  /* Process complete frames */
+  while ((headerlen = dlp_recvframe (dlconn, header, &data, &datasize)) > 0)
   {
     /* Reset keepalive trigger */
     dlconn->keepalive_trig = -1;
@@ -1290,7 +2030,7 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
 
       if (rv != 6)
       {
-        dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): cannot parse PACKET header\n",
+        dl_log_r (dlconn, 2, 0, "[%s] dl_process(): cannot parse PACKET header\n",
                   dlconn->addr);
         return DLERROR;
       }
@@ -1304,28 +2044,69 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
       if (packet->datasize > (int64_t)maxdatasize)
       {
         dl_log_r (dlconn, 2, 0,
-                  "[%s] dl_collect_nb(): packet data larger (%d) than receiving buffer (%" PRIsize_t ")\n",
+                  "[%s] dl_process(): packet data larger (%d) than receiving buffer (%" PRIsize_t ")\n",
                   dlconn->addr, packet->datasize, maxdatasize);
-        return DLERROR;
-      }
 
-      /* Receive packet data, blocking until complete */
-      if ((rv = dl_recvdata (dlconn, packetdata, packet->datasize, 1)) != packet->datasize)
-      {
-        if (rv == -1)
-          return DLENDED;
+        if (toolarge)
+          *toolarge = 1;
 
-        dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): problem receiving packet data\n",
-                  dlconn->addr);
         return DLERROR;
       }
 
+      memcpy (packetdata, data, datasize);
+
       /* Update most recently received packet ID and time */
       dlconn->pktid   = packet->pktid;
       dlconn->pkttime = packet->pkttime;
 
+      /* Receive times, from the last receive completing the packet */
+      packet->recvtime    = dlconn->recvstamp;
+      packet->readtime    = dlconn->readstamp;
+      packet->handofftime = (dlconn->latency || dlconn->sockprofile.timestamps) ? dlp_time () : 0;
+
+      if (dlconn->latency)
+      {
+        dlp_latency_record (dlconn, DLLATENCY_DELIVERY, packet->handofftime - packet->pkttime);
+        dlp_latency_record (dlconn, DLLATENCY_LIBRARY, packet->handofftime - packet->readtime);
+
+        if (packet->recvtime)
+        {
+          dlp_latency_record (dlconn, DLLATENCY_NETWORK, packet->recvtime - packet->pkttime);
+          dlp_latency_record (dlconn, DLLATENCY_KERNEL, packet->readtime - packet->recvtime);
+        }
+      }
+
       return DLPACKET;
     }
+    else if (!strncmp (header, "OK", 2) || !strncmp (header, "ERROR", 5))
+    {
+      /* Parse reply header: "OK|ERROR value size" */
+      if (sscanf (header, "%10s %lld", status, &svalue) != 2)
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] dl_process(): cannot parse reply header\n",
+                  dlconn->addr);
+        return DLERROR;
+      }
+
+      memset (packet, 0, sizeof (DLPacket));
+      strcpy (packet->streamid, status);
+      packet->pktid = svalue;
+
+      /* Copy server message, truncated to fit with a terminator */
+      msgsize = 0;
+      if (maxdatasize > 0)
+      {
+        msgsize = (datasize < maxdatasize) ? datasize : maxdatasize - 1;
+        memcpy (packetdata, data, msgsize);
+        ((char *)packetdata)[msgsize] = '\0';
+      }
+      packet->datasize = (int32_t)msgsize;
+
+      dl_log_r (dlconn, 1, (status[0] == 'O') ? 3 : 0, "[%s] %s %lld: %.*s\n",
+                dlconn->addr, status, svalue, (int)msgsize, (char *)packetdata);
+
+      return DLREPLY;
+    }
     else if (!strncmp (header, "ID", 2))
     {
       dl_log_r (dlconn, 1, 2, "[%s] Received keepalive (ID) from server\n", dlconn->addr);
@@ -1338,143 +2119,273 @@ dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
     }
     else
     {
-      dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): Unrecognized packet header %.6s\n",
+      dl_log_r (dlconn, 2, 0, "[%s] dl_process(): Unrecognized packet header %.6s\n",
                 dlconn->addr, header);
       return DLERROR;
     }
   }
 
+  if (headerlen < 0)
+  {
+    if (headerlen == -1)
+      return DLENDED;
+
+    dl_log_r (dlconn, 2, 0, "[%s] dl_process(): problem receiving packet\n",
+              dlconn->addr);
+    return DLERROR;
+  }
+
   /* Update timing variables */
-  now = dlp_time ();
+  update_keepalive (dlconn);
 
-  /* Keepalive/heartbeat interval timing logic */
-  if (dlconn->keepalive)
+  /* Check for I/O timeout while a send or a packet is incomplete */
+  if (dlconn->iotimeout &&
+      (dlconn->sendqtail > dlconn->sendqhead || dlconn->recvtail > dlconn->recvhead) &&
+      (dlconn->looptime - dlconn->iotime) > (int64_t)abs (dlconn->iotimeout) * 1000000)
   {
-    if (dlconn->keepalive_trig == -1) /* reset timer */
-    {
-      dlconn->keepalive_time = now;
-      dlconn->keepalive_trig = 0;
-    }
-    else if (dlconn->keepalive_trig == 0 &&
-             (now - dlconn->keepalive_time) > (dlconn->keepalive * DLTMODULUS))
-    {
-      dlconn->keepalive_trig = 1;
-    }
+    dl_log_r (dlconn, 2, 0, "[%s] dl_process(): network I/O timeout\n", dlconn->addr);
+    return DLERROR;
   }
 
   return (dlconn->terminate) ? DLENDED : DLNOPACKET;
-} /* End of dl_collect_nb() */
+} /* End of process_io() */
 
-/***********************************************************************/ /**
- * @brief Handle the server reply to a command
- *
- * Handle the server reply to a command.  This routine is used by
- * other library routines to process replies from the server.
+/***************************************************************************
+ * collect_stream:
  *
- * Server replies are of the form:
- *
- * "OK|ERROR value size"
+ * Collect the next packet in streaming mode, blocking, for dl_collect().
+ * Packets are received with process_io(), waiting with collect_wait()
+ * between calls, so the wait ends as soon as the connection is
+ * terminated and is otherwise only interrupted for keepalives and
+ * timeouts.
  *
- * followed by an optional server message of size bytes.  If size is
- * greater than zero it will be read from the connection and placed
- * into @a buffer.  The server message, if included, will always be a
- * NULL-terminated string.
+ * With DLCP.busypoll set, process_io() is called repeatedly for up to
+ * that many microseconds without a packet before waiting, avoiding
+ * the wakeup delay of the wait at the cost of a busy processor.  The
+ * thread is pinned to DLCP.busypoll_cpu, if set, on first use.
  *
- * @retval -1 Error
- * @retval 0 "OK" received
- * @retval 1 "ERROR" received
+ * @a toolarge is set when DLERROR is returned for a packet larger
+ * than @a maxdatasize.
  ***************************************************************************/
-int
-dl_handlereply (DLCP *dlconn, void *buffer, int buflen, int64_t *value)
+static int
+collect_stream (DLCP *dlconn, DLPacket *packet, void *packetdata,
+                size_t maxdatasize, int8_t endflag, int8_t *toolarge)
 {
-  char status[11];
-  char *cbuffer = buffer;
-  int64_t pvalue;
-  int64_t size = 0;
-  int rv       = 0;
+  int64_t spinstart = 0;
+  int64_t now;
+  int rv;
 
-  if (!dlconn || !buffer)
-    return -1;
+  *toolarge = 0;
 
-  /* Make sure buffer if terminated */
-  cbuffer[buflen] = '\0';
+  if (!dlconn || !packet || !packetdata)
+    return DLERROR;
 
-  /* Parse reply header */
-  if (sscanf (buffer, "%10s %" SCNd64 " %" SCNd64, status, &pvalue, &size) != 3)
+  if (dlconn->link == -1)
+    return DLERROR;
+
+  /* Create the wakeup descriptor, without it the terminate flag is polled */
+  dl_wakeup_fd (dlconn);
+
+  if (dl_stream_nb (dlconn, endflag) < 0)
+    return DLERROR;
+
+  /* Start the primary loop */
+  while (!dlconn->terminate)
   {
-    dl_log_r (dlconn, 2, 0, "[%s] dl_handlereply(): Unable to parse reply header: '%s'\n",
-              dlconn->addr, (char *)buffer);
-    return -1;
-  }
+    if ((rv = process_io (dlconn, packet, packetdata, maxdatasize, toolarge)) == DLREPLY)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_collect(): Unexpected reply from server: %s %lld\n",
+                dlconn->addr, packet->streamid, (long long int)packet->pktid);
+      return DLERROR;
+    }
 
-  /* Store reply value if requested */
-  if (value)
-    *value = pvalue;
+    if (rv != DLNOPACKET)
+      return rv;
 
-  /* Check that reply message will fit into buffer */
-  if (size > buflen)
+    /* Spin for the busy poll time before waiting */
+    if (dlconn->busypoll > 0)
+    {
+      if (!dlconn->busypoll_pinned && dlconn->busypoll_cpu >= 0)
+      {
+        if (dlp_thread_pin (dlconn->busypoll_cpu))
+          dl_log_r (dlconn, 1, 0, "[%s] Cannot pin busy poll thread to CPU %d\n",
+                    dlconn->addr, dlconn->busypoll_cpu);
+        else
+          dl_log_r (dlconn, 1, 1, "[%s] Pinned busy poll thread to CPU %d\n",
+                    dlconn->addr, dlconn->busypoll_cpu);
+
+        dlconn->busypoll_pinned = 1;
+      }
+
+      now = dlp_monotime ();
+
+      if (!spinstart)
+        spinstart = now;
+
+      if ((now - spinstart) < dlconn->busypoll)
+        continue;
+    }
+
+    if (collect_wait (dlconn, 0) < 0)
+      return DLERROR;
+
+    spinstart = 0;
+  } /* End of primary loop */
+
+  return DLENDED;
+} /* End of collect_stream() */
+
+/***************************************************************************
+ * collect_stream_nb:
+ *
+ * Collect the next packet in streaming mode without blocking, for
+ * dl_collect_nb().  The STREAM and ENDSTREAM commands are queued with
+ * dl_stream_nb() and packets are received with process_io(), so a
+ * partially received packet is kept and completed on later calls.
+ * Command replies are not expected in streaming mode.  @a toolarge is
+ * set as for collect_stream().
+ ***************************************************************************/
+static int
+collect_stream_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
+                   size_t maxdatasize, int8_t endflag, int8_t *toolarge)
+{
+  int rv;
+
+  *toolarge = 0;
+
+  if (!dlconn || !packet || !packetdata)
+    return DLERROR;
+
+  if (dlconn->link == -1)
+    return DLERROR;
+
+  if (dl_stream_nb (dlconn, endflag) < 0)
+    return DLERROR;
+
+  if ((rv = process_io (dlconn, packet, packetdata, maxdatasize, toolarge)) == DLREPLY)
   {
-    dl_log_r (dlconn, 2, 0, "[%s] dl_handlereply(): Reply message too large (%" PRId64 ") for buffer (%d)\n",
-              dlconn->addr, size, buflen);
-    return -1;
+    dl_log_r (dlconn, 2, 0, "[%s] dl_collect_nb(): Unexpected reply from server: %s %lld\n",
+              dlconn->addr, packet->streamid, (long long int)packet->pktid);
+    return DLERROR;
   }
 
-  /* Receive reply message if included */
-  if (size > 0)
+  return rv;
+} /* End of collect_stream_nb() */
+
+/***************************************************************************
+ * collect_wait:
+ *
+ * Wait until the connection socket is ready for the events reported by
+ * dl_interest(), the wakeup descriptor is signaled, the time reported
+ * by dl_deadline() or @a deadline, if not 0, whichever is first.  The
+ * socket is not waited on when disconnected.  Without a wakeup
+ * descriptor the wait is limited to 0.5 seconds so that the terminate
+ * flag is checked regularly.
+ *
+ * Returns 1 when woken by the wakeup descriptor, 0 otherwise and -1 on
+ * error.
+ ***************************************************************************/
+static int
+collect_wait (DLCP *dlconn, int64_t deadline)
+{
+  DLPPollFD pollfds[2];
+  int64_t conndeadline;
+  int64_t now;
+  int64_t wait = -1;
+  int interest;
+  int npoll = 0;
+  int wakeidx = -1;
+  int rv;
+
+  now = dlp_monotime ();
+
+  if (dlconn->link >= 0)
   {
-    /* Receive reply message, blocking until complete */
-    if ((rv = dl_recvdata (dlconn, buffer, (size_t)size, 1)) != size)
+    interest = dl_interest (dlconn);
+
+    if (interest)
     {
-      /* Only log an error if the connection was not shut down */
-      if (rv < -1)
-        dl_log_r (dlconn, 2, 0, "[%s] dl_handlereply(): Problem receiving reply message\n",
-                  dlconn->addr);
-      return -1;
+      pollfds[npoll].fd      = dlconn->link;
+      pollfds[npoll].events  = ((interest & DLWANT_READ) ? POLLIN : 0) |
+                               ((interest & DLWANT_WRITE) ? POLLOUT : 0);
+      pollfds[npoll].revents = 0;
+      npoll++;
     }
 
-    if (size < buflen)
-      cbuffer[size] = '\0';
-    else
-      cbuffer[buflen - 1] = '\0';
+    conndeadline = dl_deadline (dlconn);
+
+    if (conndeadline && (!deadline || conndeadline < deadline))
+      deadline = conndeadline;
   }
-  /* Make sure buffer is terminated */
-  else
+
+  if (dlconn->wakeup_rfd >= 0)
   {
-    cbuffer[0] = '\0';
+    wakeidx                = npoll;
+    pollfds[npoll].fd      = (SOCKET)dlconn->wakeup_rfd;
+    pollfds[npoll].events  = POLLIN;
+    pollfds[npoll].revents = 0;
+    npoll++;
+  }
+  else if (!deadline || deadline > now + 500000)
+  {
+    deadline = now + 500000;
   }
 
-  /* Check for "OK" status in reply header */
-  if (!strncmp (status, "OK", 2))
+  if (deadline)
+    wait = (deadline > now) ? deadline - now : 0;
+
+  /* Nothing to wait on, sleep until the deadline */
+  if (npoll == 0)
   {
-    rv = 0;
+    if (wait > 0)
+      dlp_usleep ((unsigned long int)wait);
+    return 0;
   }
-  else if (!strncmp (status, "ERROR", 5))
+
+  /* An interrupted system call error will be reported if a signal
+     handler was used.  If the terminate flag is set this is not an error. */
+  if ((rv = dlp_poll (pollfds, npoll, wait)) < 0)
   {
-    rv = 1;
+    if (dlconn->terminate)
+      return 0;
+
+    dl_log_r (dlconn, 2, 0, "[%s] poll() error: %s\n", dlconn->addr, dlp_strerror ());
+    return -1;
   }
-  else
+
+  if (rv > 0 && wakeidx >= 0 && (pollfds[wakeidx].revents & POLLIN))
   {
-    dl_log_r (dlconn, 2, 0, "[%s] dl_handlereply(): Unrecognized reply string %.5s\n",
-              dlconn->addr, (char *)buffer);
-    rv = -1;
+    dlp_wakeup_drain ((SOCKET)dlconn->wakeup_rfd);
+    return 1;
   }
 
-  return rv;
-} /* End of dl_handlereply() */
+  return 0;
+} /* End of collect_wait() */
 
-/***********************************************************************/ /**
- * @brief Set the terminate parameter of a DataLink connection
+/***************************************************************************
+ * reconnect_needed:
  *
- * Set the terminate parameter/flag in the @a DLCP and log a
- * diagnostic message indicating that the connection is terminating.
- * Some of the library routines watch the terminate parameter as an
- * indication that the client program is requesting a shut down.  This
- * routine is typically used in a signal handler.
+ * Determine if a collection result indicates a lost connection that
+ * should be automatically reconnected: automatic reconnection is
+ * enabled, the connection is not terminated or ending streaming and
+ * the connection was shut down or failed.  A packet too large for the
+ * caller's buffer, reported by collect_stream() and collect_stream_nb()
+ * with @a toolarge, is not a connection failure, reconnecting would
+ * only receive it again.
+ *
+ * Returns 1 if a reconnection is needed, otherwise 0.
  ***************************************************************************/
-void
-dl_terminate (DLCP *dlconn)
+static int
+reconnect_needed (DLCP *dlconn, int rv, int8_t toolarge, int8_t endflag)
 {
-  dl_log_r (dlconn, 1, 1, "[%s] Terminating connection\n", dlconn->addr);
+  if (!dlconn || dlconn->reconnect <= 0 || dlconn->terminate || endflag)
+    return 0;
 
-  dlconn->terminate = 1;
-} /* End of dl_terminate() */
+  if (rv == DLENDED && dlconn->streaming == 1)
+    return 1;
+
+  if (rv == DLERROR && dlconn->streaming == 1 && !toolarge)
+    return 1;
+
+  return 0;
+} /* End of reconnect_needed() */
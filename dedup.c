@@ -0,0 +1,360 @@
+/***********************************************************************/ /**
+ * @file dedup.c
+ *
+ * Duplicate packet suppression over a bounded time window.
+ *
+ * Each packet is reduced to a 64-bit fingerprint of its stream ID,
+ * data start and end times and data.  Fingerprints are kept in an
+ * open addressing hash table for lookup and in a ring, in the order
+ * they were added, for expiry.  Fingerprints are expired when the
+ * newest data start time is more than the window beyond theirs, and
+ * the oldest is evicted when the ring is full, so memory is fixed by
+ * the capacity regardless of how long the filter runs.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+
+/* Fingerprint ring entry */
+typedef struct DedupEntry_s
+{
+  uint64_t fingerprint;
+  dltime_t datastart;
+} DedupEntry;
+
+struct DLDedup_s
+{
+  dltime_t window;
+  uint64_t *table;              /* Fingerprints, 0 for an empty bucket */
+  uint64_t mask;
+  DedupEntry *ring;             /* Fingerprints in the order added */
+  uint64_t capacity;
+  uint64_t head;                /* Oldest entry */
+  uint64_t count;
+  dltime_t newest;              /* Latest data start time added */
+  int8_t havenewest;
+
+  DLDedupStats stats;
+};
+
+static uint64_t dedup_fingerprint (DLPacket *packet, void *packetdata);
+static uint64_t dedup_find (DLDedup *dedup, uint64_t fingerprint);
+static void dedup_remove (DLDedup *dedup, uint64_t bucket);
+static void dedup_expire (DLDedup *dedup);
+
+/***********************************************************************/ /**
+ * @brief Create a duplicate packet filter
+ *
+ * Allocate and initialize a filter recognizing packets with the same
+ * stream ID, data start time, data end time and data as a packet
+ * already seen, e.g. the same packet received from redundant servers.
+ *
+ * Packets are remembered until a packet with a data start time more
+ * than @a window later is seen, and at most @a capacity packets are
+ * remembered, the oldest are forgotten when full.  The memory used is
+ * fixed by @a capacity, about 40 bytes per packet.
+ *
+ * Packets are compared by a 64-bit hash, the chance of a distinct
+ * packet being reported as a duplicate is negligible but not zero.
+ *
+ * @param window Time window to remember packets (dltime_t ticks)
+ * @param capacity Maximum number of packets remembered, 0 for ::DLDEDUP_CAPACITY
+ *
+ * @return allocated DLDedup on success, NULL on error.
+ ***************************************************************************/
+DLDedup *
+dl_dedup_new (dltime_t window, int capacity)
+{
+  DLDedup *dedup;
+  uint64_t tablesize = 16;
+
+  if (window <= 0)
+  {
+    dl_log (2, 0, "dl_dedup_new(): window must be greater than 0\n");
+    return NULL;
+  }
+
+  if (capacity <= 0)
+    capacity = DLDEDUP_CAPACITY;
+
+  /* Hash table at most half full */
+  while (tablesize < (uint64_t)capacity * 2)
+    tablesize <<= 1;
+
+  if (!(dedup = (DLDedup *)calloc (1, sizeof (DLDedup))))
+  {
+    dl_log (2, 0, "dl_dedup_new(): error allocating memory\n");
+    return NULL;
+  }
+
+  dedup->window   = window;
+  dedup->mask     = tablesize - 1;
+  dedup->capacity = capacity;
+
+  if (!(dedup->table = (uint64_t *)calloc (tablesize, sizeof (uint64_t))) ||
+      !(dedup->ring = (DedupEntry *)malloc (capacity * sizeof (DedupEntry))))
+  {
+    dl_log (2, 0, "dl_dedup_new(): error allocating memory\n");
+    dl_dedup_free (dedup);
+    return NULL;
+  }
+
+  return dedup;
+} /* End of dl_dedup_new() */
+
+/***********************************************************************/ /**
+ * @brief Check if a packet is a duplicate
+ *
+ * Check if a packet has been seen within the window of a duplicate
+ * filter.  A packet not seen is remembered.
+ *
+ * @param dedup Duplicate filter
+ * @param packet Packet header information
+ * @param packetdata Packet data
+ *
+ * @return 1 if the packet is a duplicate, 0 if not and -1 on error.
+ ***************************************************************************/
+int
+dl_dedup_check (DLDedup *dedup, DLPacket *packet, void *packetdata)
+{
+  DedupEntry *entry;
+  uint64_t fingerprint;
+  uint64_t bucket;
+
+  if (!dedup || !packet || (!packetdata && packet->datasize > 0))
+    return -1;
+
+  fingerprint = dedup_fingerprint (packet, packetdata);
+  bucket      = dedup_find (dedup, fingerprint);
+
+  if (dedup->table[bucket])
+  {
+    dedup->stats.hits++;
+    return 1;
+  }
+
+  dedup->stats.misses++;
+
+  if (!dedup->havenewest || packet->datastart > dedup->newest)
+  {
+    dedup->newest     = packet->datastart;
+    dedup->havenewest = 1;
+  }
+
+  /* Packets beyond the window are not remembered */
+  if (packet->datastart < dedup->newest - dedup->window)
+    return 0;
+
+  dedup_expire (dedup);
+
+  /* Evict the oldest entry when full */
+  if (dedup->count == dedup->capacity)
+  {
+    dedup_remove (dedup, dedup_find (dedup, dedup->ring[dedup->head].fingerprint));
+    dedup->head = (dedup->head + 1) % dedup->capacity;
+    dedup->count--;
+    dedup->stats.evicted++;
+  }
+
+  /* Removals may have moved the empty bucket for the new fingerprint */
+  bucket               = dedup_find (dedup, fingerprint);
+  dedup->table[bucket] = fingerprint;
+
+  entry              = &dedup->ring[(dedup->head + dedup->count) % dedup->capacity];
+  entry->fingerprint = fingerprint;
+  entry->datastart   = packet->datastart;
+  dedup->count++;
+
+  return 0;
+} /* End of dl_dedup_check() */
+
+/***********************************************************************/ /**
+ * @brief Get statistics of a duplicate filter
+ *
+ * @param dedup Duplicate filter
+ * @param stats Statistics to populate
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_dedup_stats (DLDedup *dedup, DLDedupStats *stats)
+{
+  if (!dedup || !stats)
+    return -1;
+
+  memcpy (stats, &dedup->stats, sizeof (DLDedupStats));
+  stats->entries = dedup->count;
+
+  return 0;
+} /* End of dl_dedup_stats() */
+
+/***********************************************************************/ /**
+ * @brief Free a duplicate filter
+ *
+ * @param dedup Duplicate filter to free
+ ***************************************************************************/
+void
+dl_dedup_free (DLDedup *dedup)
+{
+  if (!dedup)
+    return;
+
+  if (dedup->table)
+    free (dedup->table);
+
+  if (dedup->ring)
+    free (dedup->ring);
+
+  free (dedup);
+} /* End of dl_dedup_free() */
+
+/***************************************************************************
+ * dedup_fingerprint:
+ *
+ * Calculate a 64-bit fingerprint of a packet's stream ID, data times
+ * and data.  The data is hashed 8 bytes at a time with a multiply and
+ * rotate mix, finished with the 64-bit finalizer from MurmurHash3.
+ *
+ * Returns the non-zero fingerprint.
+ ***************************************************************************/
+static uint64_t
+dedup_fingerprint (DLPacket *packet, void *packetdata)
+{
+  const uint64_t prime = 0x9E3779B97F4A7C15ULL;
+  const char *cp;
+  const uint8_t *bp = (const uint8_t *)packetdata;
+  uint64_t hash     = 0xCBF29CE484222325ULL;
+  uint64_t word;
+  size_t remaining;
+
+  /* Stream ID, FNV-1a */
+  for (cp = packet->streamid; *cp; cp++)
+    hash = (hash ^ (uint8_t)*cp) * 0x100000001B3ULL;
+
+  hash = (hash ^ (uint64_t)packet->datastart) * prime;
+  hash = (hash ^ (uint64_t)packet->dataend) * prime;
+  hash = (hash ^ (uint64_t)packet->datasize) * prime;
+
+  /* Data, 8 bytes at a time */
+  remaining = (packet->datasize > 0) ? (size_t)packet->datasize : 0;
+
+  while (remaining >= 8)
+  {
+    memcpy (&word, bp, 8);
+    hash = ((hash ^ word) * prime);
+    hash = (hash << 31) | (hash >> 33);
+    bp += 8;
+    remaining -= 8;
+  }
+
+  if (remaining > 0)
+  {
+    word = 0;
+    memcpy (&word, bp, remaining);
+    hash = ((hash ^ word) * prime);
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ULL;
+  hash ^= hash >> 33;
+
+  return (hash) ? hash : 1;
+} /* End of dedup_fingerprint() */
+
+/***************************************************************************
+ * dedup_find:
+ *
+ * Find the hash table bucket containing a fingerprint, or the empty
+ * bucket where it would be added, by linear probing.
+ *
+ * Returns the bucket index.
+ ***************************************************************************/
+static uint64_t
+dedup_find (DLDedup *dedup, uint64_t fingerprint)
+{
+  uint64_t bucket = fingerprint & dedup->mask;
+
+  while (dedup->table[bucket] && dedup->table[bucket] != fingerprint)
+    bucket = (bucket + 1) & dedup->mask;
+
+  return bucket;
+} /* End of dedup_find() */
+
+/***************************************************************************
+ * dedup_remove:
+ *
+ * Remove the fingerprint in a hash table bucket, shifting following
+ * fingerprints back so that no probe sequence is broken.
+ ***************************************************************************/
+static void
+dedup_remove (DLDedup *dedup, uint64_t bucket)
+{
+  uint64_t next = bucket;
+  uint64_t home;
+
+  dedup->table[bucket] = 0;
+
+  for (;;)
+  {
+    next = (next + 1) & dedup->mask;
+
+    if (!dedup->table[next])
+      break;
+
+    home = dedup->table[next] & dedup->mask;
+
+    /* Move back if the home bucket is not cyclically between the hole and here */
+    if (((next - home) & dedup->mask) >= ((next - bucket) & dedup->mask))
+    {
+      dedup->table[bucket] = dedup->table[next];
+      dedup->table[next]   = 0;
+      bucket               = next;
+    }
+  }
+} /* End of dedup_remove() */
+
+/***************************************************************************
+ * dedup_expire:
+ *
+ * Remove the oldest entries with data start times more than the
+ * window before the newest data start time.
+ ***************************************************************************/
+static void
+dedup_expire (DLDedup *dedup)
+{
+  DedupEntry *entry;
+
+  while (dedup->count > 0)
+  {
+    entry = &dedup->ring[dedup->head];
+
+    if (entry->datastart >= dedup->newest - dedup->window)
+      break;
+
+    dedup_remove (dedup, dedup_find (dedup, entry->fingerprint));
+    dedup->head = (dedup->head + 1) % dedup->capacity;
+    dedup->count--;
+    dedup->stats.expired++;
+  }
+} /* End of dedup_expire() */
@@ -0,0 +1,757 @@
+/***********************************************************************/ /**
+ * @file info.c
+ *
+ * Incremental parsing of DataLink INFO responses.
+ *
+ * INFO responses are XML documents of elements with attributes, e.g. a
+ * StreamList element containing a Stream element for each stream.
+ * Data is scanned for complete element tags, which are collected in a
+ * fixed size buffer, split into attributes in place and passed to a
+ * callback, so that a response can be parsed as it is received with
+ * memory independent of its size.  Text content is not reported.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+#define INFO_CHUNKSIZE 16384    /* Size of chunks received by dl_getinfo_parse() */
+
+/* Parser states */
+#define INFO_TEXT    0          /* Between elements */
+#define INFO_TAG     1          /* In an element tag */
+#define INFO_COMMENT 2          /* In a comment */
+
+struct DLInfoParser_s
+{
+  DLInfoCallback callback;
+  void *cbdata;
+  int state;
+  char quote;                   /* Quote of an attribute value in a tag, 0 when none */
+  int dashes;                   /* Consecutive dashes in a comment */
+  int depth;
+  int stopped;                  /* Parsing ended by the callback */
+  int64_t elements;             /* Elements passed to the callback */
+  size_t length;
+  char buf[DLINFO_MAXELEMENT];  /* Tag of the current element */
+  DLInfoElement element;
+};
+
+static int info_element (DLInfoParser *parser);
+static int info_attributes (DLInfoParser *parser, char *cp);
+static void info_fields (DLInfoElement *element);
+static void info_decode (char *value);
+static void info_copy (char *dest, size_t size, const char *value);
+static dltime_t info_time (const char *value);
+
+/***********************************************************************/ /**
+ * @brief Create an INFO parser
+ *
+ * Allocate and initialize a parser passing each element of an INFO
+ * response, as it is parsed, to @a callback.  Elements are reported
+ * in document order when their start tag is complete, including the
+ * root DataLink element and elements not otherwise recognized.  The
+ * fields of StreamList, Stream, ConnectionList and Connection elements
+ * are converted to typed values, all attributes are available with
+ * dl_info_attr().
+ *
+ * @param callback Function called for each element
+ * @param cbdata Pointer passed to @a callback
+ *
+ * @return allocated DLInfoParser on success, NULL on error.
+ ***************************************************************************/
+DLInfoParser *
+dl_info_new (DLInfoCallback callback, void *cbdata)
+{
+  DLInfoParser *parser;
+
+  if (!callback)
+    return NULL;
+
+  if (!(parser = (DLInfoParser *)calloc (1, sizeof (DLInfoParser))))
+  {
+    dl_log (2, 0, "dl_info_new(): error allocating memory\n");
+    return NULL;
+  }
+
+  parser->callback = callback;
+  parser->cbdata   = cbdata;
+  parser->state    = INFO_TEXT;
+
+  return parser;
+} /* End of dl_info_new() */
+
+/***********************************************************************/ /**
+ * @brief Parse a chunk of an INFO response
+ *
+ * Parse the next @a length bytes of an INFO response, calling the
+ * callback for each element completed.  An element may be split
+ * across chunks, the start of it is kept until it is completed by a
+ * later call.  Call with a @a length of 0 at the end of the response
+ * to check that it did not end within an element.
+ *
+ * Element tags larger than ::DLINFO_MAXELEMENT are errors, attributes
+ * beyond ::DLINFO_MAXATTRS are ignored.
+ *
+ * @param parser INFO parser
+ * @param data INFO response data
+ * @param length Length of @a data in bytes
+ *
+ * @return 0 on success, 1 when parsing was ended by the callback and
+ * -1 on error.
+ ***************************************************************************/
+int
+dl_info_feed (DLInfoParser *parser, const char *data, size_t length)
+{
+  const char *cp;
+  const char *end;
+  const char *quote;
+  size_t run;
+  char c;
+
+  if (!parser || (!data && length > 0))
+    return -1;
+
+  if (parser->stopped)
+    return 1;
+
+  if (length == 0)
+  {
+    if (parser->state != INFO_TEXT)
+    {
+      dl_log (2, 0, "dl_info_feed(): INFO response ended within an element\n");
+      return -1;
+    }
+
+    return 0;
+  }
+
+  cp  = data;
+  end = data + length;
+
+  while (cp < end)
+  {
+    if (parser->state == INFO_TEXT)
+    {
+      /* Skip text content to the next tag */
+      if (!(cp = (const char *)memchr (cp, '<', end - cp)))
+        break;
+
+      cp++;
+      parser->state  = INFO_TAG;
+      parser->quote  = 0;
+      parser->length = 0;
+    }
+    else if (parser->state == INFO_COMMENT)
+    {
+      c = *cp++;
+
+      if (c == '>' && parser->dashes >= 2)
+        parser->state = INFO_TEXT;
+      else
+        parser->dashes = (c == '-') ? parser->dashes + 1 : 0;
+    }
+    else
+    {
+      if (parser->quote)
+      {
+        /* Attribute value through the closing quote */
+        if ((quote = (const char *)memchr (cp, parser->quote, end - cp)))
+        {
+          run           = quote - cp + 1;
+          parser->quote = 0;
+        }
+        else
+        {
+          run = end - cp;
+        }
+      }
+      else
+      {
+        /* Run up to a quote or the end of the tag */
+        for (run = 0; cp + run < end; run++)
+        {
+          c = cp[run];
+
+          if (c == '>' || c == '"' || c == '\'')
+            break;
+        }
+
+        if (run == 0)
+        {
+          c = *cp;
+
+          if (c == '>')
+          {
+            cp++;
+            parser->buf[parser->length] = '\0';
+            parser->state               = INFO_TEXT;
+
+            if (info_element (parser))
+              return (parser->stopped) ? 1 : -1;
+
+            continue;
+          }
+
+          parser->quote = c;
+          run           = 1;
+        }
+      }
+
+      if (parser->length + run >= sizeof (parser->buf))
+      {
+        dl_log (2, 0, "dl_info_feed(): INFO element larger than %d bytes\n",
+                DLINFO_MAXELEMENT);
+        return -1;
+      }
+
+      memcpy (parser->buf + parser->length, cp, run);
+      parser->length += run;
+      cp += run;
+
+      /* Comments may contain anything, only the end is looked for */
+      if (parser->length >= 3 && parser->length - run < 3 &&
+          !memcmp (parser->buf, "!--", 3))
+      {
+        parser->state  = INFO_COMMENT;
+        parser->dashes = 0;
+
+        /* Dashes already copied after the start */
+        while (parser->dashes < 2 && parser->length - parser->dashes > 3 &&
+               parser->buf[parser->length - parser->dashes - 1] == '-')
+          parser->dashes++;
+      }
+    }
+  }
+
+  return 0;
+} /* End of dl_info_feed() */
+
+/***********************************************************************/ /**
+ * @brief Get an attribute value of an INFO element
+ *
+ * @param element INFO element passed to a DLInfoCallback
+ * @param name Attribute name
+ *
+ * @return Attribute value or NULL if the element has no such attribute.
+ ***************************************************************************/
+const char *
+dl_info_attr (const DLInfoElement *element, const char *name)
+{
+  int idx;
+
+  if (!element || !name)
+    return NULL;
+
+  for (idx = 0; idx < element->nattrs; idx++)
+  {
+    if (!strcmp (element->attrname[idx], name))
+      return element->attrvalue[idx];
+  }
+
+  return NULL;
+} /* End of dl_info_attr() */
+
+/***********************************************************************/ /**
+ * @brief Free an INFO parser
+ *
+ * @param parser INFO parser to free
+ ***************************************************************************/
+void
+dl_info_free (DLInfoParser *parser)
+{
+  if (parser)
+    free (parser);
+} /* End of dl_info_free() */
+
+/***********************************************************************/ /**
+ * @brief Request and parse information from the DataLink server
+ *
+ * Request information from the server using the DataLink INFO command,
+ * as dl_getinfo(), and parse the response while it is received, in
+ * chunks, passing each element to @a callback as described for
+ * dl_info_new().  The response is never held in memory as a whole,
+ * suitable for frequent STREAMS requests to servers with many streams.
+ *
+ * When parsing is ended early, by the callback or an error in the
+ * response, the rest of the response is received and discarded so
+ * the connection remains usable.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param infotype The INFO type to request
+ * @param infomatch An optional match pattern
+ * @param callback Function called for each element
+ * @param cbdata Pointer passed to @a callback
+ *
+ * @return The number of elements passed to @a callback on success and
+ * -1 on error.
+ ***************************************************************************/
+int64_t
+dl_getinfo_parse (DLCP *dlconn, const char *infotype, char *infomatch,
+                  DLInfoCallback callback, void *cbdata)
+{
+  DLInfoParser *parser;
+  char chunk[INFO_CHUNKSIZE];
+  int64_t elements;
+  int infosize;
+  int readlen;
+  int parsed = 0;
+  int rv;
+
+  if (!dlconn || !infotype || !callback)
+    return -1;
+
+  if (!(parser = dl_info_new (callback, cbdata)))
+    return -1;
+
+  if ((infosize = dlp_info_request (dlconn, infotype, infomatch, "dl_getinfo_parse")) < 0)
+  {
+    dl_info_free (parser);
+    return -1;
+  }
+
+  while (infosize > 0)
+  {
+    readlen = (infosize < (int)sizeof (chunk)) ? infosize : (int)sizeof (chunk);
+
+    /* Receive INFO data, blocking until the chunk is complete */
+    if ((rv = dl_recvdata (dlconn, chunk, readlen, 1)) != readlen)
+    {
+      /* Only log an error if the connection was not shut down */
+      if (rv < -1)
+        dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo_parse(): problem receiving INFO data\n",
+                  dlconn->addr);
+      dl_info_free (parser);
+      return -1;
+    }
+
+    infosize -= readlen;
+
+    /* Once ended the remaining data is only received */
+    if (parsed == 0)
+      parsed = dl_info_feed (parser, chunk, readlen);
+  }
+
+  if (parsed == 0)
+    parsed = dl_info_feed (parser, NULL, 0);
+
+  elements = parser->elements;
+  dl_info_free (parser);
+
+  if (parsed < 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_getinfo_parse(): cannot parse INFO %s response\n",
+              dlconn->addr, infotype);
+    return -1;
+  }
+
+  return elements;
+} /* End of dl_getinfo_parse() */
+
+/***************************************************************************
+ * info_element:
+ *
+ * Handle the complete tag in the parser buffer.  End tags reduce the
+ * nesting depth, declarations, processing instructions and comments
+ * are ignored and start tags are split into attributes and passed to
+ * the callback.
+ *
+ * Returns 0 on success, 1 when the callback ended parsing, with the
+ * parser marked as stopped, and -1 on error.
+ ***************************************************************************/
+static int
+info_element (DLInfoParser *parser)
+{
+  DLInfoElement *element = &parser->element;
+  char *cp               = parser->buf;
+  size_t length          = parser->length;
+  int selfclosing        = 0;
+
+  if (*cp == '?' || *cp == '!')
+    return 0;
+
+  if (*cp == '/')
+  {
+    if (parser->depth > 0)
+      parser->depth--;
+
+    return 0;
+  }
+
+  /* Trailing slash of an empty element */
+  while (length > 0 && isspace ((unsigned char)cp[length - 1]))
+    length--;
+
+  if (length > 0 && cp[length - 1] == '/')
+  {
+    selfclosing = 1;
+    length--;
+  }
+
+  cp[length] = '\0';
+
+  /* Element name */
+  element->tag = cp;
+
+  while (*cp && !isspace ((unsigned char)*cp))
+    cp++;
+
+  if (*cp)
+    *cp++ = '\0';
+
+  if (!*element->tag)
+  {
+    dl_log (2, 0, "dl_info_feed(): INFO element without a name\n");
+    return -1;
+  }
+
+  if (info_attributes (parser, cp))
+    return -1;
+
+  if (!strcmp (element->tag, "Stream"))
+    element->type = DLINFO_STREAM;
+  else if (!strcmp (element->tag, "StreamList"))
+    element->type = DLINFO_STREAMLIST;
+  else if (!strcmp (element->tag, "Connection"))
+    element->type = DLINFO_CONNECTION;
+  else if (!strcmp (element->tag, "ConnectionList"))
+    element->type = DLINFO_CONNECTIONLIST;
+  else if (!strcmp (element->tag, "DataLink"))
+    element->type = DLINFO_SERVER;
+  else
+    element->type = DLINFO_OTHER;
+
+  element->depth = parser->depth;
+
+  info_fields (element);
+
+  if (!selfclosing)
+    parser->depth++;
+
+  parser->elements++;
+
+  if (parser->callback (element, parser->cbdata))
+  {
+    parser->stopped = 1;
+    return 1;
+  }
+
+  return 0;
+} /* End of info_element() */
+
+/***************************************************************************
+ * info_attributes:
+ *
+ * Split the attributes of a start tag, in place, into the names and
+ * values of the parser element, decoding entities in values.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+info_attributes (DLInfoParser *parser, char *cp)
+{
+  DLInfoElement *element = &parser->element;
+  char *name;
+  char *nameend;
+  char *value;
+  char quote;
+
+  element->nattrs = 0;
+
+  for (;;)
+  {
+    while (isspace ((unsigned char)*cp))
+      cp++;
+
+    if (!*cp)
+      break;
+
+    name = cp;
+
+    while (*cp && *cp != '=' && !isspace ((unsigned char)*cp))
+      cp++;
+
+    nameend = cp;
+
+    while (isspace ((unsigned char)*cp))
+      cp++;
+
+    if (*cp != '=')
+    {
+      dl_log (2, 0, "dl_info_feed(): INFO attribute without a value in %s element\n",
+              element->tag);
+      return -1;
+    }
+
+    *nameend = '\0';
+    cp++;
+
+    while (isspace ((unsigned char)*cp))
+      cp++;
+
+    if (*cp != '"' && *cp != '\'')
+    {
+      dl_log (2, 0, "dl_info_feed(): INFO attribute value not quoted in %s element\n",
+              element->tag);
+      return -1;
+    }
+
+    quote = *cp++;
+    value = cp;
+
+    if (!(cp = strchr (cp, quote)))
+    {
+      dl_log (2, 0, "dl_info_feed(): INFO attribute value not terminated in %s element\n",
+              element->tag);
+      return -1;
+    }
+
+    *cp++ = '\0';
+
+    if (element->nattrs < DLINFO_MAXATTRS)
+    {
+      info_decode (value);
+
+      element->attrname[element->nattrs]  = name;
+      element->attrvalue[element->nattrs] = value;
+      element->nattrs++;
+    }
+  }
+
+  return 0;
+} /* End of info_attributes() */
+
+/***************************************************************************
+ * info_fields:
+ *
+ * Convert the attributes of StreamList, Stream, ConnectionList and
+ * Connection elements to the typed fields of the element.
+ ***************************************************************************/
+static void
+info_fields (DLInfoElement *element)
+{
+  const char *name;
+  const char *value;
+  int idx;
+
+  if (element->type == DLINFO_STREAMLIST || element->type == DLINFO_CONNECTIONLIST)
+  {
+    memset (&element->list, 0, sizeof (DLInfoList));
+
+    for (idx = 0; idx < element->nattrs; idx++)
+    {
+      name  = element->attrname[idx];
+      value = element->attrvalue[idx];
+
+      if (!strcmp (name, "TotalStreams") || !strcmp (name, "TotalConnections"))
+        element->list.total = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "SelectedStreams") || !strcmp (name, "SelectedConnections"))
+        element->list.selected = strtoll (value, NULL, 10);
+    }
+  }
+  else if (element->type == DLINFO_STREAM)
+  {
+    DLInfoStream *stream = &element->stream;
+
+    memset (stream, 0, sizeof (DLInfoStream));
+    stream->earlieststart = DLTERROR;
+    stream->earliestend   = DLTERROR;
+    stream->lateststart   = DLTERROR;
+    stream->latestend     = DLTERROR;
+
+    for (idx = 0; idx < element->nattrs; idx++)
+    {
+      name  = element->attrname[idx];
+      value = element->attrvalue[idx];
+
+      if (!strcmp (name, "Name"))
+        info_copy (stream->name, sizeof (stream->name), value);
+      else if (!strcmp (name, "EarliestPacketID"))
+        stream->earliestid = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "EarliestPacketDataStartTime"))
+        stream->earlieststart = info_time (value);
+      else if (!strcmp (name, "EarliestPacketDataEndTime"))
+        stream->earliestend = info_time (value);
+      else if (!strcmp (name, "LatestPacketID"))
+        stream->latestid = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "LatestPacketDataStartTime"))
+        stream->lateststart = info_time (value);
+      else if (!strcmp (name, "LatestPacketDataEndTime"))
+        stream->latestend = info_time (value);
+      else if (!strcmp (name, "DataLatency"))
+        stream->latency = strtod (value, NULL);
+    }
+  }
+  else if (element->type == DLINFO_CONNECTION)
+  {
+    DLInfoConnection *conn = &element->connection;
+
+    memset (conn, 0, sizeof (DLInfoConnection));
+    conn->conntime = DLTERROR;
+    conn->pkttime  = DLTERROR;
+
+    for (idx = 0; idx < element->nattrs; idx++)
+    {
+      name  = element->attrname[idx];
+      value = element->attrvalue[idx];
+
+      if (!strcmp (name, "Type"))
+        info_copy (conn->type, sizeof (conn->type), value);
+      else if (!strcmp (name, "Host"))
+        info_copy (conn->host, sizeof (conn->host), value);
+      else if (!strcmp (name, "IP"))
+        info_copy (conn->ip, sizeof (conn->ip), value);
+      else if (!strcmp (name, "Port"))
+        info_copy (conn->port, sizeof (conn->port), value);
+      else if (!strcmp (name, "ClientID"))
+        info_copy (conn->clientid, sizeof (conn->clientid), value);
+      else if (!strcmp (name, "ConnectionTime"))
+        conn->conntime = info_time (value);
+      else if (!strcmp (name, "StreamCount"))
+        conn->streamcount = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "PacketID"))
+        conn->pktid = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "PacketCreationTime"))
+        conn->pkttime = info_time (value);
+      else if (!strcmp (name, "TXPacketCount"))
+        conn->txpackets = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "TXByteCount"))
+        conn->txbytes = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "RXPacketCount"))
+        conn->rxpackets = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "RXByteCount"))
+        conn->rxbytes = strtoll (value, NULL, 10);
+      else if (!strcmp (name, "Latency"))
+        conn->latency = strtod (value, NULL);
+      else if (!strcmp (name, "PercentLag"))
+        conn->percentlag = strtod (value, NULL);
+    }
+  }
+} /* End of info_fields() */
+
+/***************************************************************************
+ * info_decode:
+ *
+ * Decode the predefined and numeric character entities of an attribute
+ * value in place, numeric references are encoded as UTF-8.  Decoded
+ * entities are never longer than the references, unrecognized
+ * references are left as is.
+ ***************************************************************************/
+static void
+info_decode (char *value)
+{
+  char *in;
+  char *out;
+  char *semi;
+  unsigned long code;
+  size_t namelen;
+
+  if (!(in = strchr (value, '&')))
+    return;
+
+  out = in;
+
+  while (*in)
+  {
+    if (*in == '&' && (semi = strchr (in, ';')) && (namelen = semi - in - 1) <= 8)
+    {
+      if (namelen == 3 && !strncmp (in + 1, "amp", 3))
+        *out++ = '&';
+      else if (namelen == 2 && !strncmp (in + 1, "lt", 2))
+        *out++ = '<';
+      else if (namelen == 2 && !strncmp (in + 1, "gt", 2))
+        *out++ = '>';
+      else if (namelen == 4 && !strncmp (in + 1, "quot", 4))
+        *out++ = '"';
+      else if (namelen == 4 && !strncmp (in + 1, "apos", 4))
+        *out++ = '\'';
+      else if (namelen >= 2 && in[1] == '#' &&
+               (code = (in[2] == 'x') ? strtoul (in + 3, NULL, 16) : strtoul (in + 2, NULL, 10)) > 0 &&
+               code <= 0x10FFFF)
+      {
+        if (code < 0x80)
+        {
+          *out++ = (char)code;
+        }
+        else if (code < 0x800)
+        {
+          *out++ = (char)(0xC0 | (code >> 6));
+          *out++ = (char)(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+          *out++ = (char)(0xE0 | (code >> 12));
+          *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+          *out++ = (char)(0x80 | (code & 0x3F));
+        }
+        else
+        {
+          *out++ = (char)(0xF0 | (code >> 18));
+          *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+          *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+          *out++ = (char)(0x80 | (code & 0x3F));
+        }
+      }
+      else
+      {
+        *out++ = *in++;
+        continue;
+      }
+
+      in = semi + 1;
+      continue;
+    }
+
+    *out++ = *in++;
+  }
+
+  *out = '\0';
+} /* End of info_decode() */
+
+/***************************************************************************
+ * info_copy:
+ *
+ * Copy an attribute value to a fixed size field, truncating if needed.
+ ***************************************************************************/
+static void
+info_copy (char *dest, size_t size, const char *value)
+{
+  strncpy (dest, value, size - 1);
+  dest[size - 1] = '\0';
+} /* End of info_copy() */
+
+/***************************************************************************
+ * info_time:
+ *
+ * Convert a time attribute value to a dltime_t.
+ *
+ * Returns the time or DLTERROR when empty or not a time.
+ ***************************************************************************/
+static dltime_t
+info_time (const char *value)
+{
+  if (!*value || !isdigit ((unsigned char)*value))
+    return DLTERROR;
+
+  return dl_timestr2dltime_len (value, NULL);
+} /* End of info_time() */
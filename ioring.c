@@ -0,0 +1,1288 @@
+/***********************************************************************/ /**
+ * @file ioring.c
+ *
+ * Shared I/O ring servicing many DataLink connections from one thread.
+ *
+ * With the io_uring backend all connections share a single ring set
+ * up directly with the io_uring system calls, no liburing is
+ * required.  Each connection has a multishot receive selecting from a
+ * registered ring of provided buffers, so idle connections hold no
+ * receive memory, and at most one send of its whole queued command
+ * data.  Received data is copied from the provided buffer to the
+ * connection receive buffer and the buffer is returned to the kernel
+ * immediately.  All operations queued in a cycle are submitted, and
+ * the completions waited for, with one io_uring_enter() call; frames
+ * are then decoded with dl_process() as for any other connection.
+ *
+ * When io_uring is not available, or not requested, the connections
+ * are waited on with poll() and use the socket calls of dl_process().
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+/* Provided buffer rings and multishot receives need Linux 6.0 headers */
+#if defined(__linux__) && defined(__has_include)
+  #if __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    #if defined(IORING_RECV_MULTISHOT)
+      #define DLP_URING 1
+    #endif
+  #endif
+#endif
+
+#if defined(DLP_URING)
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+/* Size of each provided receive buffer */
+#define RING_BUFSIZE 16384
+
+/* Operation types in the low byte of completion user data */
+#define RING_RECV   1
+#define RING_SEND   2
+#define RING_CANCEL 3
+
+/* Connection slot */
+typedef struct RingSlot_s
+{
+  DLCP *dlconn;                 /* Connection, NULL if the slot is free */
+  struct DLIORing_s *ring;
+  int index;
+  int8_t ready;                 /* Data, shutdown or error to process */
+  int8_t recvarmed;             /* Receive submitted and not completed */
+  int8_t sending;               /* Send submitted and not completed */
+  int8_t closing;               /* Operations are being cancelled */
+  int8_t eof;                   /* Peer completed an orderly shutdown */
+  int error;                    /* Error of a ring operation, 0 if none */
+  int inflight;                 /* Submitted operations not completed */
+  char *sendbuf;                /* Queued data being sent, swapped with DLCP.sendq */
+  size_t sendbufsize;
+  size_t sendoff;               /* Offset of unsent data in sendbuf */
+  size_t sendlen;               /* Offset of end of data in sendbuf */
+  int64_t sendtime;             /* Monotonic time of last send progress (microseconds) */
+} RingSlot;
+
+#if defined(DLP_URING)
+/* io_uring state */
+typedef struct RingUring_s
+{
+  int fd;
+  unsigned int sqentries;
+  unsigned int *sqhead;
+  unsigned int *sqtail;
+  unsigned int *sqarray;
+  unsigned int sqmask;
+  unsigned int sqlocal;         /* Local SQ tail, published on submit */
+  struct io_uring_sqe *sqes;
+  unsigned int *cqhead;
+  unsigned int *cqtail;
+  unsigned int cqmask;
+  struct io_uring_cqe *cqes;
+  void *sqring;
+  size_t sqringsize;
+  void *cqring;
+  size_t cqringsize;
+  size_t sqessize;
+  struct io_uring_buf_ring *bufring; /* Provided buffer ring, group 0 */
+  size_t bufringsize;
+  char *bufs;                   /* Provided buffer memory */
+  unsigned int nbufs;
+  unsigned short buftail;       /* Local provided buffer ring tail */
+  int8_t multishot;             /* Multishot receives are supported */
+} RingUring;
+#endif
+
+struct DLIORing_s
+{
+  int backend;
+  RingSlot *slots;
+  int maxconns;
+  int count;                    /* Connections added */
+  int next;                     /* Slot to process first, for fairness */
+  DLPPollFD *pollfds;           /* Sockets to wait on with poll() */
+  int *pollslots;               /* Slot index of each entry in pollfds */
+  DLPacket packet;
+  char *packetdata;
+  size_t maxdatasize;
+#if defined(DLP_URING)
+  RingUring uring;
+#endif
+};
+
+static int ring_process (DLIORing *ring, RingSlot *slot, DLIORingCallback callback,
+                         void *cbdata, int *count);
+static void ring_detach (DLIORing *ring, RingSlot *slot);
+static int64_t ring_deadline (RingSlot *slot);
+static int ring_poll (DLIORing *ring, int64_t wait);
+
+#if defined(DLP_URING)
+static int uring_setup (DLIORing *ring);
+static void uring_unmap (RingUring *uring);
+static void uring_provide (RingUring *uring, unsigned int bid);
+static struct io_uring_sqe *uring_getsqe (DLIORing *ring);
+static int uring_enter (DLIORing *ring, int64_t wait);
+static void uring_arm (DLIORing *ring, RingSlot *slot);
+static void uring_cancel (DLIORing *ring, RingSlot *slot, int op);
+static void uring_reap (DLIORing *ring);
+static void uring_complete (DLIORing *ring, struct io_uring_cqe *cqe);
+#endif
+
+/***********************************************************************/ /**
+ * @brief Create a shared I/O ring for many connections
+ *
+ * Allocate and initialize a ring to collect packets from, and send
+ * queued commands to, up to @a maxconns connections from a single
+ * thread, see dl_ioring_add() and dl_ioring_run().
+ *
+ * With @a backend ::DLIORING_URING the Linux io_uring interface is
+ * used, creation fails if it is not available.  With ::DLIORING_POLL
+ * the connections are waited on with poll() and use socket calls.
+ * With ::DLIORING_AUTO io_uring is used when available, otherwise
+ * poll(), see dl_ioring_backend().
+ *
+ * The io_uring backend requires Linux 5.19 or later for provided
+ * buffer rings, multishot receives are used with Linux 6.0 or later.
+ *
+ * @param maxconns Maximum number of connections
+ * @param backend I/O backend, ::DLIORING_AUTO, ::DLIORING_URING or ::DLIORING_POLL
+ *
+ * @return allocated DLIORing on success, NULL on error.
+ ***************************************************************************/
+DLIORing *
+dl_ioring_new (int maxconns, int backend)
+{
+  DLIORing *ring;
+  int idx;
+
+  if (maxconns <= 0)
+    return NULL;
+
+  if (backend != DLIORING_AUTO && backend != DLIORING_URING && backend != DLIORING_POLL)
+  {
+    dl_log (2, 0, "dl_ioring_new(): unrecognized backend: %d\n", backend);
+    return NULL;
+  }
+
+  if (!(ring = (DLIORing *)calloc (1, sizeof (DLIORing))))
+  {
+    dl_log (2, 0, "dl_ioring_new(): error allocating memory\n");
+    return NULL;
+  }
+
+  ring->maxconns = maxconns;
+  ring->backend  = DLIORING_POLL;
+#if defined(DLP_URING)
+  ring->uring.fd = -1;
+#endif
+
+  if (!(ring->slots = (RingSlot *)calloc (maxconns, sizeof (RingSlot))) ||
+      !(ring->pollfds = (DLPPollFD *)calloc (maxconns, sizeof (DLPPollFD))) ||
+      !(ring->pollslots = (int *)calloc (maxconns, sizeof (int))))
+  {
+    dl_log (2, 0, "dl_ioring_new(): error allocating memory\n");
+    dl_ioring_free (ring);
+    return NULL;
+  }
+
+  for (idx = 0; idx < maxconns; idx++)
+  {
+    ring->slots[idx].ring  = ring;
+    ring->slots[idx].index = idx;
+  }
+
+  if (backend != DLIORING_POLL)
+  {
+#if defined(DLP_URING)
+    if (uring_setup (ring) == 0)
+      ring->backend = DLIORING_URING;
+#endif
+
+    if (ring->backend != DLIORING_URING)
+    {
+      if (backend == DLIORING_URING)
+      {
+        dl_log (2, 0, "dl_ioring_new(): io_uring is not available\n");
+        dl_ioring_free (ring);
+        return NULL;
+      }
+
+      dl_log (1, 1, "io_uring is not available, using poll()\n");
+    }
+  }
+
+  return ring;
+} /* End of dl_ioring_new() */
+
+/***********************************************************************/ /**
+ * @brief Add a connection to a shared I/O ring
+ *
+ * Add a connected @a dlconn, see dl_connect() or dl_connect_step(),
+ * to a ring.  Its network I/O is then performed by dl_ioring_run():
+ * commands queued with dl_stream_nb() and dl_write_nb() are sent and
+ * received packets and replies are passed to the callback.  Data
+ * already received, e.g. by dl_process(), is kept and processed
+ * first.
+ *
+ * A connection in a ring must not be used with other routines
+ * performing network I/O, e.g. dl_collect() or dl_process(), until
+ * removed with dl_ioring_remove().  The connection is not owned by
+ * the ring, it is removed when disconnected or freed.
+ *
+ * @param ring Shared I/O ring
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return 0 on success and -1 on error, including a full ring.
+ ***************************************************************************/
+int
+dl_ioring_add (DLIORing *ring, DLCP *dlconn)
+{
+  RingSlot *slot = NULL;
+  size_t size;
+  char *newdata;
+  int idx;
+
+  if (!ring || !dlconn)
+    return -1;
+
+  if (dlconn->link < 0 || dlconn->connecting)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_ioring_add(): connection is not open\n", dlconn->addr);
+    return -1;
+  }
+
+  if (dlconn->ioring)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_ioring_add(): connection is already in a ring\n",
+              dlconn->addr);
+    return -1;
+  }
+
+  for (idx = 0; idx < ring->maxconns; idx++)
+  {
+    if (!ring->slots[idx].dlconn && !ring->slots[idx].inflight)
+    {
+      slot = &ring->slots[idx];
+      break;
+    }
+  }
+
+  if (!slot)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_ioring_add(): ring is full (%d connections)\n",
+              dlconn->addr, ring->maxconns);
+    return -1;
+  }
+
+  /* The packet buffer holds the largest packet of any connection */
+  size = (dlconn->maxpktsize > 0) ? (size_t)dlconn->maxpktsize : MAXPACKETSIZE;
+
+  if (size > ring->maxdatasize)
+  {
+    if (!(newdata = (char *)realloc (ring->packetdata, size)))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_ioring_add(): error allocating memory\n", dlconn->addr);
+      return -1;
+    }
+
+    ring->packetdata  = newdata;
+    ring->maxdatasize = size;
+  }
+
+  slot->dlconn    = dlconn;
+  slot->ready     = 1;
+  slot->recvarmed = 0;
+  slot->sending   = 0;
+  slot->closing   = 0;
+  slot->eof       = 0;
+  slot->error     = 0;
+  slot->sendoff   = 0;
+  slot->sendlen   = 0;
+  slot->sendtime  = 0;
+
+  dlconn->ioring = slot;
+  ring->count++;
+
+  return 0;
+} /* End of dl_ioring_add() */
+
+/***********************************************************************/ /**
+ * @brief Remove a connection from a shared I/O ring
+ *
+ * Remove @a dlconn from a ring, after which it may be used with any
+ * routine again.  Operations in progress are cancelled and waited
+ * for: data received is kept in the connection receive buffer and
+ * command data not yet sent stays queued, so no data is lost.
+ *
+ * @param ring Shared I/O ring
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return 0 on success and -1 if the connection is not in the ring.
+ ***************************************************************************/
+int
+dl_ioring_remove (DLIORing *ring, DLCP *dlconn)
+{
+  RingSlot *slot;
+
+  if (!ring || !dlconn || !(slot = (RingSlot *)dlconn->ioring) || slot->ring != ring)
+    return -1;
+
+  ring_detach (ring, slot);
+
+  return 0;
+} /* End of dl_ioring_remove() */
+
+/***********************************************************************/ /**
+ * @brief Perform network I/O for all connections of a shared I/O ring
+ *
+ * Submit queued commands and receives for all connections, wait for
+ * up to @a timeout microseconds for I/O to complete and pass each
+ * packet and reply received to @a callback with @a cbdata, in the
+ * manner of dl_process().  With the io_uring backend submitting and
+ * waiting is a single system call for all connections.  A @a timeout
+ * of 0 does not wait and a negative @a timeout waits without limit.
+ * The wait also ends when a connection needs attention, e.g. to send
+ * a keepalive, see dl_deadline().
+ *
+ * The callback is called with the connection and a type of
+ * ::DLPACKET for a packet, ::DLREPLY for a command reply, see
+ * dl_process(), ::DLENDED when the stream ending sequence was
+ * completed, the connection was shut down or terminated, or ::DLERROR
+ * on error, including the I/O timeout.  The packet and data are only
+ * valid for ::DLPACKET and ::DLREPLY and until the callback returns.
+ * Before the callback for ::DLENDED or ::DLERROR the connection is
+ * removed from the ring, the callback may reconnect it, e.g. with
+ * dl_reconnect(), and add it again.  Callbacks may queue commands
+ * with dl_stream_nb() and dl_write_nb(), which are sent on the next
+ * call.
+ *
+ * A non-zero return from the callback ends the call, remaining
+ * packets are passed on the next call, which does not wait.
+ *
+ * @param ring Shared I/O ring
+ * @param callback Function called for each packet, reply and connection end
+ * @param cbdata Pointer passed to @a callback
+ * @param timeout Maximum time to wait for I/O in microseconds
+ *
+ * @return The number of callbacks made, 0 if none, and -1 on error.
+ ***************************************************************************/
+int
+dl_ioring_run (DLIORing *ring, DLIORingCallback callback, void *cbdata, int64_t timeout)
+{
+  RingSlot *slot;
+  int64_t deadline = 0;
+  int64_t slotdeadline;
+  int64_t wait;
+  int64_t now;
+  int count = 0;
+  int rv = 0;
+  int idx;
+  int num;
+
+  if (!ring || !callback)
+    return -1;
+
+  now = dlp_monotime ();
+
+  if (timeout > 0)
+    deadline = now + timeout;
+
+  /* Wait until the earliest connection deadline, not at all if ready */
+  for (idx = 0; idx < ring->maxconns && timeout != 0; idx++)
+  {
+    slot = &ring->slots[idx];
+
+    if (!slot->dlconn)
+      continue;
+
+    if (slot->ready)
+    {
+      timeout = 0;
+      break;
+    }
+
+    if ((slotdeadline = ring_deadline (slot)) && (!deadline || slotdeadline < deadline))
+      deadline = slotdeadline;
+  }
+
+  if (timeout == 0)
+    wait = 0;
+  else if (deadline)
+    wait = (deadline > now) ? deadline - now : 0;
+  else
+    wait = -1;
+
+#if defined(DLP_URING)
+  if (ring->backend == DLIORING_URING)
+  {
+    for (idx = 0; idx < ring->maxconns; idx++)
+    {
+      if (ring->slots[idx].dlconn)
+        uring_arm (ring, &ring->slots[idx]);
+    }
+
+    rv = uring_enter (ring, wait);
+
+    if (rv >= 0)
+      uring_reap (ring);
+  }
+  else
+#endif
+  {
+    rv = ring_poll (ring, wait);
+  }
+
+  if (rv < 0)
+    return -1;
+
+  /* Process connections with I/O or a deadline passed, in turn */
+  now = dlp_monotime ();
+
+  for (num = 0; num < ring->maxconns; num++)
+  {
+    idx  = (ring->next + num) % ring->maxconns;
+    slot = &ring->slots[idx];
+
+    if (!slot->dlconn)
+      continue;
+
+    if (!slot->ready)
+    {
+      if (!(slotdeadline = ring_deadline (slot)) || slotdeadline > now)
+        continue;
+
+      /* Send making no progress, the receive timeout is checked by dl_process() */
+      if (slot->sending && slot->dlconn->iotimeout &&
+          (now - slot->sendtime) > (int64_t)abs (slot->dlconn->iotimeout) * 1000000)
+        slot->error = ETIMEDOUT;
+    }
+
+    if (ring_process (ring, slot, callback, cbdata, &count))
+    {
+      ring->next = idx;
+      break;
+    }
+  }
+
+  return count;
+} /* End of dl_ioring_run() */
+
+/***********************************************************************/ /**
+ * @brief Get the I/O backend of a shared I/O ring
+ *
+ * @param ring Shared I/O ring
+ *
+ * @return ::DLIORING_URING or ::DLIORING_POLL, -1 on error.
+ ***************************************************************************/
+int
+dl_ioring_backend (DLIORing *ring)
+{
+  if (!ring)
+    return -1;
+
+  return ring->backend;
+} /* End of dl_ioring_backend() */
+
+/***********************************************************************/ /**
+ * @brief Free a shared I/O ring
+ *
+ * Remove all connections from a ring, see dl_ioring_remove(), and
+ * free all memory associated with it.  The connections are not
+ * disconnected or freed.
+ *
+ * @param ring Shared I/O ring to free
+ ***************************************************************************/
+void
+dl_ioring_free (DLIORing *ring)
+{
+  int idx;
+
+  if (!ring)
+    return;
+
+  if (ring->slots)
+  {
+    for (idx = 0; idx < ring->maxconns; idx++)
+    {
+      if (ring->slots[idx].dlconn)
+        ring_detach (ring, &ring->slots[idx]);
+
+      if (ring->slots[idx].sendbuf)
+        free (ring->slots[idx].sendbuf);
+    }
+
+    free (ring->slots);
+  }
+
+#if defined(DLP_URING)
+  uring_unmap (&ring->uring);
+#endif
+
+  if (ring->pollfds)
+    free (ring->pollfds);
+
+  if (ring->pollslots)
+    free (ring->pollslots);
+
+  if (ring->packetdata)
+    free (ring->packetdata);
+
+  free (ring);
+} /* End of dl_ioring_free() */
+
+/***************************************************************************
+ * dlp_ioring_release:
+ *
+ * Remove a connection from the shared I/O ring it was added to, if
+ * any.  Used when a connection is disconnected or freed.
+ ***************************************************************************/
+void
+dlp_ioring_release (DLCP *dlconn)
+{
+  RingSlot *slot;
+
+  if (dlconn && (slot = (RingSlot *)dlconn->ioring))
+    ring_detach (slot->ring, slot);
+} /* End of dlp_ioring_release() */
+
+/***************************************************************************
+ * dlp_ioring_active:
+ *
+ * Returns 1 if the network I/O of a connection is performed by the
+ * io_uring backend of a shared I/O ring, otherwise 0.
+ ***************************************************************************/
+int
+dlp_ioring_active (DLCP *dlconn)
+{
+  RingSlot *slot;
+
+  if (!dlconn || !(slot = (RingSlot *)dlconn->ioring))
+    return 0;
+
+  return (slot->ring->backend == DLIORING_URING);
+} /* End of dlp_ioring_active() */
+
+/***************************************************************************
+ * ring_process:
+ *
+ * Pass the packets and replies received for a connection to the
+ * callback, followed by the end of the connection if it was shut down
+ * or failed, which removes it from the ring.
+ *
+ * Returns 1 if the callback ended processing, otherwise 0.
+ ***************************************************************************/
+static int
+ring_process (DLIORing *ring, RingSlot *slot, DLIORingCallback callback,
+              void *cbdata, int *count)
+{
+  DLCP *dlconn = slot->dlconn;
+  int rv;
+
+  for (;;)
+  {
+    rv = dl_process (dlconn, &ring->packet, ring->packetdata, ring->maxdatasize);
+
+    /* Received data is consumed, report a ring shutdown or error */
+    if (rv == DLNOPACKET)
+    {
+      if (slot->error)
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] dl_ioring_run(): %s\n",
+                  dlconn->addr, strerror (slot->error));
+        rv = DLERROR;
+      }
+      else if (slot->eof)
+      {
+        rv = DLENDED;
+      }
+      else
+      {
+        slot->ready = 0;
+        return 0;
+      }
+    }
+
+    if (rv == DLENDED || rv == DLERROR)
+      ring_detach (ring, slot);
+
+    (*count)++;
+
+    if (callback (dlconn, rv, &ring->packet, ring->packetdata, cbdata))
+      return 1;
+
+    /* Ended, or removed by the callback */
+    if (rv == DLENDED || rv == DLERROR || slot->dlconn != dlconn)
+      return 0;
+  }
+} /* End of ring_process() */
+
+/***************************************************************************
+ * ring_detach:
+ *
+ * Remove a connection from its slot, cancelling and waiting for any
+ * operations in progress.  Data received by them is delivered to the
+ * connection and command data not sent is returned to the front of
+ * its send queue.
+ ***************************************************************************/
+static void
+ring_detach (DLIORing *ring, RingSlot *slot)
+{
+  DLCP *dlconn = slot->dlconn;
+  size_t queued;
+  size_t needed;
+  char *newbuf;
+
+  if (!dlconn)
+    return;
+
+#if defined(DLP_URING)
+  if (ring->backend == DLIORING_URING && slot->inflight > 0)
+  {
+    slot->closing = 1;
+
+    if (slot->recvarmed)
+      uring_cancel (ring, slot, RING_RECV);
+    if (slot->sending)
+      uring_cancel (ring, slot, RING_SEND);
+
+    while (slot->inflight > 0)
+    {
+      if (uring_enter (ring, -1) < 0)
+        break;
+
+      uring_reap (ring);
+    }
+
+    slot->closing = 0;
+  }
+#endif
+
+  /* Return unsent data to the front of the send queue */
+  if (slot->sendoff < slot->sendlen && !slot->sending)
+  {
+    queued = dlconn->sendqtail - dlconn->sendqhead;
+    needed = slot->sendlen + queued;
+
+    if (needed > slot->sendbufsize)
+    {
+      if (!(newbuf = (char *)realloc (slot->sendbuf, needed)))
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] cannot allocate send queue, unsent data dropped\n",
+                  dlconn->addr);
+        needed = 0;
+      }
+      else
+      {
+        slot->sendbuf     = newbuf;
+        slot->sendbufsize = needed;
+      }
+    }
+
+    if (needed)
+    {
+      if (queued > 0)
+        memcpy (slot->sendbuf + slot->sendlen, dlconn->sendq + dlconn->sendqhead, queued);
+
+      newbuf            = dlconn->sendq;
+      needed            = dlconn->sendqsize;
+      dlconn->sendq     = slot->sendbuf;
+      dlconn->sendqsize = slot->sendbufsize;
+      dlconn->sendqhead = slot->sendoff;
+      dlconn->sendqtail = slot->sendlen + queued;
+      slot->sendbuf     = newbuf;
+      slot->sendbufsize = needed;
+    }
+  }
+
+  slot->sendoff   = 0;
+  slot->sendlen   = 0;
+  slot->sending   = 0;
+  slot->recvarmed = 0;
+  slot->ready     = 0;
+  slot->dlconn    = NULL;
+
+  dlconn->ioring = NULL;
+  ring->count--;
+} /* End of ring_detach() */
+
+/***************************************************************************
+ * ring_deadline:
+ *
+ * Returns the monotonic time a connection needs attention, see
+ * dl_deadline(), or to detect a send making no progress, or 0 if none.
+ ***************************************************************************/
+static int64_t
+ring_deadline (RingSlot *slot)
+{
+  DLCP *dlconn = slot->dlconn;
+  int64_t deadline;
+  int64_t senddeadline;
+
+  deadline = dl_deadline (dlconn);
+
+  if (slot->sending && dlconn->iotimeout)
+  {
+    senddeadline = slot->sendtime + (int64_t)abs (dlconn->iotimeout) * 1000000;
+
+    if (!deadline || senddeadline < deadline)
+      deadline = senddeadline;
+  }
+
+  return deadline;
+} /* End of ring_deadline() */
+
+/***************************************************************************
+ * ring_poll:
+ *
+ * Wait with poll() for up to @a wait microseconds, negative for no
+ * limit, for any connection socket to be ready for the events reported
+ * by dl_interest() and mark ready connections.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+ring_poll (DLIORing *ring, int64_t wait)
+{
+  DLCP *dlconn;
+  int interest;
+  int npoll = 0;
+  int idx;
+
+  for (idx = 0; idx < ring->maxconns; idx++)
+  {
+    if (!(dlconn = ring->slots[idx].dlconn) || !(interest = dl_interest (dlconn)))
+      continue;
+
+    ring->pollfds[npoll].fd      = dlconn->link;
+    ring->pollfds[npoll].events  = 0;
+    ring->pollfds[npoll].revents = 0;
+
+    if (interest & DLWANT_READ)
+      ring->pollfds[npoll].events |= POLLIN;
+    if (interest & DLWANT_WRITE)
+      ring->pollfds[npoll].events |= POLLOUT;
+
+    ring->pollslots[npoll] = idx;
+    npoll++;
+  }
+
+  /* Nothing to wait on, sleep for the wait time */
+  if (npoll == 0)
+  {
+    if (wait > 0)
+      dlp_usleep ((unsigned long int)wait);
+    return 0;
+  }
+
+  if (dlp_poll (ring->pollfds, npoll, wait) < 0)
+  {
+    if (errno == EINTR)
+      return 0;
+
+    dl_log (2, 0, "dl_ioring_run(): poll() error: %s\n", dlp_strerror ());
+    return -1;
+  }
+
+  for (idx = 0; idx < npoll; idx++)
+  {
+    if (ring->pollfds[idx].revents)
+      ring->slots[ring->pollslots[idx]].ready = 1;
+  }
+
+  return 0;
+} /* End of ring_poll() */
+
+#if defined(DLP_URING)
+
+/***************************************************************************
+ * uring_setup:
+ *
+ * Create the io_uring of a ring, sized for its maximum number of
+ * connections, verify that the kernel supports the operations and
+ * features used and register the provided buffer ring.
+ *
+ * Returns 0 on success and -1 when io_uring is not available.
+ ***************************************************************************/
+static int
+uring_setup (DLIORing *ring)
+{
+  RingUring *uring = &ring->uring;
+  struct io_uring_params params;
+  struct io_uring_probe *probe;
+  struct io_uring_buf_reg reg;
+  unsigned int entries;
+  unsigned int idx;
+  size_t probesize;
+  int supported = 0;
+
+  /* Submission entries for a receive and a send per connection */
+  entries = 64;
+  while (entries < 2 * (unsigned int)ring->maxconns && entries < 4096)
+    entries *= 2;
+
+  memset (&params, 0, sizeof (params));
+  params.flags      = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * 4;
+
+  if ((uring->fd = (int)syscall (__NR_io_uring_setup, entries, &params)) < 0)
+  {
+    dl_log (1, 2, "io_uring_setup() failed: %s\n", strerror (errno));
+    return -1;
+  }
+
+  /* Verify support for the required operations */
+  probesize = sizeof (struct io_uring_probe) + 256 * sizeof (struct io_uring_probe_op);
+
+  if ((probe = (struct io_uring_probe *)calloc (1, probesize)))
+  {
+    if (syscall (__NR_io_uring_register, uring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+        probe->last_op >= IORING_OP_RECV &&
+        (probe->ops[IORING_OP_RECV].flags & IO_URING_OP_SUPPORTED) &&
+        (probe->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED) &&
+        (probe->ops[IORING_OP_ASYNC_CANCEL].flags & IO_URING_OP_SUPPORTED))
+      supported = 1;
+
+    free (probe);
+  }
+
+  if (!supported || !(params.features & IORING_FEAT_NODROP) ||
+      !(params.features & IORING_FEAT_EXT_ARG))
+  {
+    dl_log (1, 2, "io_uring does not support required operations\n");
+    uring_unmap (uring);
+    return -1;
+  }
+
+  /* Map the submission and completion rings */
+  uring->sqringsize = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+  uring->cqringsize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (uring->cqringsize > uring->sqringsize)
+      uring->sqringsize = uring->cqringsize;
+    uring->cqringsize = 0;
+  }
+
+  uring->sqring = mmap (NULL, uring->sqringsize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+
+  if (uring->sqring == MAP_FAILED)
+  {
+    uring->sqring = NULL;
+    uring_unmap (uring);
+    return -1;
+  }
+
+  if (uring->cqringsize)
+  {
+    uring->cqring = mmap (NULL, uring->cqringsize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+
+    if (uring->cqring == MAP_FAILED)
+    {
+      uring->cqring = NULL;
+      uring_unmap (uring);
+      return -1;
+    }
+  }
+  else
+  {
+    uring->cqring = uring->sqring;
+  }
+
+  uring->sqessize = params.sq_entries * sizeof (struct io_uring_sqe);
+  uring->sqes = mmap (NULL, uring->sqessize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+
+  if (uring->sqes == MAP_FAILED)
+  {
+    uring->sqes = NULL;
+    uring_unmap (uring);
+    return -1;
+  }
+
+  uring->sqentries = params.sq_entries;
+  uring->sqhead    = (unsigned int *)((char *)uring->sqring + params.sq_off.head);
+  uring->sqtail    = (unsigned int *)((char *)uring->sqring + params.sq_off.tail);
+  uring->sqarray   = (unsigned int *)((char *)uring->sqring + params.sq_off.array);
+  uring->sqmask    = *(unsigned int *)((char *)uring->sqring + params.sq_off.ring_mask);
+  uring->sqlocal   = *uring->sqtail;
+
+  uring->cqhead = (unsigned int *)((char *)uring->cqring + params.cq_off.head);
+  uring->cqtail = (unsigned int *)((char *)uring->cqring + params.cq_off.tail);
+  uring->cqmask = *(unsigned int *)((char *)uring->cqring + params.cq_off.ring_mask);
+  uring->cqes   = (struct io_uring_cqe *)((char *)uring->cqring + params.cq_off.cqes);
+
+  /* Provided receive buffers, two per connection up to the ring limit */
+  uring->nbufs = 16;
+  while (uring->nbufs < 2 * (unsigned int)ring->maxconns && uring->nbufs < 32768)
+    uring->nbufs *= 2;
+
+  uring->bufringsize = uring->nbufs * sizeof (struct io_uring_buf);
+  uring->bufring = (struct io_uring_buf_ring *)mmap (NULL, uring->bufringsize,
+                                                     PROT_READ | PROT_WRITE,
+                                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (uring->bufring == MAP_FAILED)
+  {
+    uring->bufring = NULL;
+    uring_unmap (uring);
+    return -1;
+  }
+
+  if (!(uring->bufs = (char *)malloc ((size_t)uring->nbufs * RING_BUFSIZE)))
+  {
+    dl_log (2, 0, "dl_ioring_new(): error allocating memory\n");
+    uring_unmap (uring);
+    return -1;
+  }
+
+  memset (&reg, 0, sizeof (reg));
+  reg.ring_addr    = (uint64_t)(uintptr_t)uring->bufring;
+  reg.ring_entries = uring->nbufs;
+  reg.bgid         = 0;
+
+  if (syscall (__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+  {
+    dl_log (1, 2, "io_uring provided buffer ring not supported: %s\n", strerror (errno));
+    free (uring->bufs);
+    uring->bufs = NULL;
+    uring_unmap (uring);
+    return -1;
+  }
+
+  uring->buftail = 0;
+  for (idx = 0; idx < uring->nbufs; idx++)
+    uring_provide (uring, idx);
+
+  uring->multishot = 1;
+
+  dl_log (1, 2, "io_uring ring with %u entries and %u receive buffers\n",
+          uring->sqentries, uring->nbufs);
+
+  return 0;
+} /* End of uring_setup() */
+
+/***************************************************************************
+ * uring_unmap:
+ *
+ * Unmap the rings, free the provided buffers and close the ring
+ * descriptor, if any.
+ ***************************************************************************/
+static void
+uring_unmap (RingUring *uring)
+{
+  if (uring->sqes)
+    munmap (uring->sqes, uring->sqessize);
+  if (uring->cqring && uring->cqring != uring->sqring)
+    munmap (uring->cqring, uring->cqringsize);
+  if (uring->sqring)
+    munmap (uring->sqring, uring->sqringsize);
+
+  /* Closing the ring unregisters the provided buffer ring */
+  if (uring->fd >= 0)
+    close (uring->fd);
+
+  if (uring->bufring)
+    munmap (uring->bufring, uring->bufringsize);
+  if (uring->bufs)
+    free (uring->bufs);
+
+  memset (uring, 0, sizeof (RingUring));
+  uring->fd = -1;
+} /* End of uring_unmap() */
+
+/***************************************************************************
+ * uring_provide:
+ *
+ * Return provided buffer @a bid to the kernel.
+ ***************************************************************************/
+static void
+uring_provide (RingUring *uring, unsigned int bid)
+{
+  struct io_uring_buf *buf;
+
+  buf       = &uring->bufring->bufs[uring->buftail & (uring->nbufs - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(uring->bufs + (size_t)bid * RING_BUFSIZE);
+  buf->len  = RING_BUFSIZE;
+  buf->bid  = (unsigned short)bid;
+
+  uring->buftail++;
+  __atomic_store_n (&uring->bufring->tail, uring->buftail, __ATOMIC_RELEASE);
+} /* End of uring_provide() */
+
+/***************************************************************************
+ * uring_getsqe:
+ *
+ * Return the next cleared submission queue entry, submitting the
+ * queued entries first if the queue is full.
+ ***************************************************************************/
+static struct io_uring_sqe *
+uring_getsqe (DLIORing *ring)
+{
+  RingUring *uring = &ring->uring;
+  struct io_uring_sqe *sqe;
+  unsigned int index;
+
+  if (uring->sqlocal - __atomic_load_n (uring->sqhead, __ATOMIC_ACQUIRE) >= uring->sqentries)
+    uring_enter (ring, 0);
+
+  index = uring->sqlocal & uring->sqmask;
+  uring->sqarray[index] = index;
+  uring->sqlocal++;
+
+  sqe = &uring->sqes[index];
+  memset (sqe, 0, sizeof (struct io_uring_sqe));
+
+  return sqe;
+} /* End of uring_getsqe() */
+
+/***************************************************************************
+ * uring_enter:
+ *
+ * Submit all queued entries and wait for up to @a wait microseconds,
+ * negative for no limit, for at least one completion.  Completions are
+ * not reaped, see uring_reap().
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+uring_enter (DLIORing *ring, int64_t wait)
+{
+  RingUring *uring = &ring->uring;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned int tosubmit;
+  int rv;
+
+  __atomic_store_n (uring->sqtail, uring->sqlocal, __ATOMIC_RELEASE);
+  tosubmit = uring->sqlocal - __atomic_load_n (uring->sqhead, __ATOMIC_ACQUIRE);
+
+  memset (&arg, 0, sizeof (arg));
+
+  if (wait > 0)
+  {
+    ts.tv_sec  = wait / 1000000;
+    ts.tv_nsec = (wait % 1000000) * 1000;
+    arg.ts     = (uint64_t)(uintptr_t)&ts;
+  }
+
+  rv = (int)syscall (__NR_io_uring_enter, uring->fd, tosubmit, (wait != 0) ? 1 : 0,
+                     IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof (arg));
+
+  /* Timed out or interrupted waits and a full completion queue are not errors */
+  if (rv < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+  {
+    dl_log (2, 0, "dl_ioring_run(): io_uring_enter() error: %s\n", strerror (errno));
+    return -1;
+  }
+
+  return 0;
+} /* End of uring_enter() */
+
+/***************************************************************************
+ * uring_arm:
+ *
+ * Queue the operations a connection needs: a receive, when none is in
+ * progress, and a send of its queued command data, when no send is in
+ * progress.  The send queue is swapped with the slot send buffer so
+ * that the connection can queue more while the send is in progress.
+ ***************************************************************************/
+static void
+uring_arm (DLIORing *ring, RingSlot *slot)
+{
+  DLCP *dlconn = slot->dlconn;
+  struct io_uring_sqe *sqe;
+  char *buf;
+  size_t bufsize;
+
+  if (!slot->recvarmed && !slot->eof && !slot->error)
+  {
+    sqe = uring_getsqe (ring);
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = dlconn->link;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->ioprio    = (ring->uring.multishot) ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = ((uint64_t)slot->index << 8) | RING_RECV;
+
+    slot->recvarmed = 1;
+    slot->inflight++;
+  }
+
+  if (slot->sending || slot->error)
+    return;
+
+  /* Take the queued data when the previous send is complete */
+  if (slot->sendoff >= slot->sendlen && dlconn->sendqtail > dlconn->sendqhead)
+  {
+    buf     = slot->sendbuf;
+    bufsize = slot->sendbufsize;
+
+    slot->sendbuf     = dlconn->sendq;
+    slot->sendbufsize = dlconn->sendqsize;
+    slot->sendoff     = dlconn->sendqhead;
+    slot->sendlen     = dlconn->sendqtail;
+    slot->sendtime    = dlp_monotime ();
+
+    dlconn->sendq     = buf;
+    dlconn->sendqsize = bufsize;
+    dlconn->sendqhead = 0;
+    dlconn->sendqtail = 0;
+  }
+
+  if (slot->sendoff < slot->sendlen)
+  {
+    sqe = uring_getsqe (ring);
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->fd        = dlconn->link;
+    sqe->addr      = (uint64_t)(uintptr_t)(slot->sendbuf + slot->sendoff);
+    sqe->len       = (uint32_t)(slot->sendlen - slot->sendoff);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = ((uint64_t)slot->index << 8) | RING_SEND;
+
+    slot->sending = 1;
+    slot->inflight++;
+  }
+} /* End of uring_arm() */
+
+/***************************************************************************
+ * uring_cancel:
+ *
+ * Queue the cancellation of operation @a op of a connection.
+ ***************************************************************************/
+static void
+uring_cancel (DLIORing *ring, RingSlot *slot, int op)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_getsqe (ring);
+  sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+  sqe->fd        = -1;
+  sqe->addr      = ((uint64_t)slot->index << 8) | (uint64_t)op;
+  sqe->user_data = ((uint64_t)slot->index << 8) | RING_CANCEL;
+
+  slot->inflight++;
+} /* End of uring_cancel() */
+
+/***************************************************************************
+ * uring_reap:
+ *
+ * Handle all available completions.
+ ***************************************************************************/
+static void
+uring_reap (DLIORing *ring)
+{
+  RingUring *uring = &ring->uring;
+  unsigned int head;
+
+  head = *uring->cqhead;
+
+  while (head != __atomic_load_n (uring->cqtail, __ATOMIC_ACQUIRE))
+  {
+    uring_complete (ring, &uring->cqes[head & uring->cqmask]);
+    head++;
+  }
+
+  __atomic_store_n (uring->cqhead, head, __ATOMIC_RELEASE);
+} /* End of uring_reap() */
+
+/***************************************************************************
+ * uring_complete:
+ *
+ * Handle a completion: deliver received data to the connection and
+ * return the provided buffer, account for sent data or record the
+ * shutdown or error of a connection.
+ ***************************************************************************/
+static void
+uring_complete (DLIORing *ring, struct io_uring_cqe *cqe)
+{
+  RingUring *uring = &ring->uring;
+  RingSlot *slot;
+  unsigned int bid;
+  int op;
+
+  op   = (int)(cqe->user_data & 0xff);
+  slot = &ring->slots[cqe->user_data >> 8];
+
+  if (op == RING_RECV)
+  {
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+      bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+      if (cqe->res > 0 && slot->dlconn &&
+          dlp_recvdeliver (slot->dlconn, uring->bufs + (size_t)bid * RING_BUFSIZE, cqe->res))
+        slot->error = ENOMEM;
+
+      uring_provide (uring, bid);
+    }
+
+    /* A multishot receive continues while more completions are flagged */
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+      slot->recvarmed = 0;
+      slot->inflight--;
+    }
+
+    if (cqe->res == 0)
+      slot->eof = 1;
+    else if (cqe->res == -EINVAL && uring->multishot)
+      uring->multishot = 0;
+    else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+      slot->error = -cqe->res;
+  }
+  else if (op == RING_SEND)
+  {
+    slot->sending = 0;
+    slot->inflight--;
+
+    if (cqe->res > 0)
+    {
+      slot->sendoff += cqe->res;
+      slot->sendtime = dlp_monotime ();
+
+      if (slot->dlconn)
+        slot->dlconn->iotime = slot->sendtime;
+    }
+    else if (cqe->res < 0 && cqe->res != -ECANCELED)
+    {
+      slot->error = -cqe->res;
+    }
+  }
+  else
+  {
+    slot->inflight--;
+  }
+
+  if (slot->dlconn && !slot->closing && op == RING_RECV)
+    slot->ready = 1;
+  else if (slot->dlconn && !slot->closing && slot->error)
+    slot->ready = 1;
+} /* End of uring_complete() */
+
+#endif /* DLP_URING */
@@ -0,0 +1,248 @@
+/***********************************************************************/ /**
+ * @file latency.c
+ *
+ * Packet latency histograms.
+ *
+ * Latencies are counted in log-linear buckets: exact below 64
+ * microseconds and 32 buckets per power of two above, so quantiles
+ * are reported within about 3% with a fixed memory size per histogram
+ * and constant time recording, independent of the number of packets.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+#define LATENCY_SUBBITS  5                           /* 32 buckets per power of two */
+#define LATENCY_LINEAR   (2 << LATENCY_SUBBITS)      /* Exact buckets below this value */
+#define LATENCY_MAXBIT   40                          /* Values up to 2^41 microseconds */
+#define LATENCY_BUCKETS  (LATENCY_LINEAR + (LATENCY_MAXBIT - LATENCY_SUBBITS) * (1 << LATENCY_SUBBITS))
+
+/* Latency histogram */
+typedef struct LatencyHist_s
+{
+  uint64_t count;
+  int64_t sum;
+  int64_t min;
+  int64_t max;
+  uint64_t buckets[LATENCY_BUCKETS];
+} LatencyHist;
+
+static int latency_bucket (int64_t value);
+static int64_t latency_value (int bucket);
+
+/***********************************************************************/ /**
+ * @brief Get latency statistics of a connection
+ *
+ * Report the count, range, mean and quantiles of a latency recorded
+ * for packets returned by a connection with DLCP.latency set.
+ *
+ * The ::DLLATENCY_DELIVERY latency is from the packet time, when the
+ * server received the packet, to when the packet is returned to the
+ * caller, measured with the system clock.  It includes the time spent
+ * in the server and the network, and is only meaningful when the
+ * clocks of the client and server are synchronized.  Negative values,
+ * due to clock differences, are counted as 0 but reported in the
+ * minimum.
+ *
+ * With kernel receive timestamps, see DLSocketProfile.timestamps, the
+ * delivery latency is divided into the ::DLLATENCY_NETWORK latency,
+ * from the packet time to the kernel receiving the data completing
+ * the packet, the ::DLLATENCY_KERNEL latency, until the data is read
+ * from the socket, and the ::DLLATENCY_LIBRARY latency, until the
+ * packet is returned to the caller.  The library latency includes
+ * time buffered while the caller handles earlier packets and is
+ * recorded with or without kernel timestamps.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param type Latency type, e.g. ::DLLATENCY_DELIVERY
+ * @param stats Statistics to populate, in microseconds
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_latency_stats (DLCP *dlconn, int type, DLLatencyStats *stats)
+{
+  LatencyHist *hist;
+  uint64_t rank[3];
+  uint64_t seen = 0;
+  int64_t *quantile[3];
+  int idx;
+  int bucket;
+
+  if (!dlconn || !stats || type < 0 || type >= DLLATENCY_TYPES)
+    return -1;
+
+  memset (stats, 0, sizeof (DLLatencyStats));
+
+  if (!dlconn->latencystats)
+    return 0;
+
+  hist = (LatencyHist *)dlconn->latencystats + type;
+
+  if (hist->count == 0)
+    return 0;
+
+  stats->count = hist->count;
+  stats->min   = hist->min;
+  stats->max   = hist->max;
+  stats->mean  = hist->sum / (int64_t)hist->count;
+
+  /* Ranks of the 50th, 99th and 99.9th percentiles, 1-based */
+  rank[0]     = (hist->count * 500 + 999) / 1000;
+  rank[1]     = (hist->count * 990 + 999) / 1000;
+  rank[2]     = (hist->count * 999 + 999) / 1000;
+  quantile[0] = &stats->p50;
+  quantile[1] = &stats->p99;
+  quantile[2] = &stats->p999;
+
+  for (idx = 0, bucket = 0; bucket < LATENCY_BUCKETS && idx < 3; bucket++)
+  {
+    seen += hist->buckets[bucket];
+
+    while (idx < 3 && seen >= rank[idx])
+    {
+      *quantile[idx] = latency_value (bucket);
+
+      /* Not beyond the largest value recorded */
+      if (*quantile[idx] > hist->max)
+        *quantile[idx] = hist->max;
+
+      idx++;
+    }
+  }
+
+  return 0;
+} /* End of dl_latency_stats() */
+
+/***********************************************************************/ /**
+ * @brief Reset the latency statistics of a connection
+ *
+ * @param dlconn DataLink Connection Parameters
+ ***************************************************************************/
+void
+dl_latency_reset (DLCP *dlconn)
+{
+  if (dlconn && dlconn->latencystats)
+    memset (dlconn->latencystats, 0, DLLATENCY_TYPES * sizeof (LatencyHist));
+} /* End of dl_latency_reset() */
+
+/***************************************************************************
+ * dlp_latency_record:
+ *
+ * Record a latency, in microseconds, of a type for a connection,
+ * allocating the histograms on first use.
+ ***************************************************************************/
+void
+dlp_latency_record (DLCP *dlconn, int type, int64_t latency)
+{
+  LatencyHist *hist;
+
+  if (!dlconn->latencystats)
+  {
+    if (!(dlconn->latencystats = calloc (DLLATENCY_TYPES, sizeof (LatencyHist))))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] cannot allocate latency statistics\n", dlconn->addr);
+      dlconn->latency = 0;
+      return;
+    }
+  }
+
+  hist = (LatencyHist *)dlconn->latencystats + type;
+
+  if (hist->count == 0 || latency < hist->min)
+    hist->min = latency;
+  if (hist->count == 0 || latency > hist->max)
+    hist->max = latency;
+
+  hist->count++;
+  hist->sum += latency;
+  hist->buckets[latency_bucket (latency)]++;
+} /* End of dlp_latency_record() */
+
+/***************************************************************************
+ * dlp_latency_free:
+ *
+ * Free the latency histograms of a connection.
+ ***************************************************************************/
+void
+dlp_latency_free (DLCP *dlconn)
+{
+  if (dlconn->latencystats)
+  {
+    free (dlconn->latencystats);
+    dlconn->latencystats = NULL;
+  }
+} /* End of dlp_latency_free() */
+
+/***************************************************************************
+ * latency_bucket:
+ *
+ * Determine the histogram bucket of a value, negative values are
+ * counted as 0 and values beyond the range in the last bucket.
+ *
+ * Returns the bucket index.
+ ***************************************************************************/
+static int
+latency_bucket (int64_t value)
+{
+  uint64_t uvalue;
+  int msb = 0;
+
+  if (value < LATENCY_LINEAR)
+    return (value > 0) ? (int)value : 0;
+
+  uvalue = (uint64_t)value;
+
+  while (uvalue >> (msb + 1))
+    msb++;
+
+  if (msb > LATENCY_MAXBIT)
+    return LATENCY_BUCKETS - 1;
+
+  /* 32 sub-buckets from the bits following the most significant bit */
+  return LATENCY_LINEAR + (msb - LATENCY_SUBBITS - 1) * (1 << LATENCY_SUBBITS) +
+         (int)((uvalue >> (msb - LATENCY_SUBBITS)) - (1 << LATENCY_SUBBITS));
+} /* End of latency_bucket() */
+
+/***************************************************************************
+ * latency_value:
+ *
+ * Determine the value represented by a histogram bucket, the middle of
+ * the range of values counted in it.
+ *
+ * Returns the value.
+ ***************************************************************************/
+static int64_t
+latency_value (int bucket)
+{
+  int64_t low;
+  int shift;
+
+  if (bucket < LATENCY_LINEAR)
+    return bucket;
+
+  shift = (bucket - LATENCY_LINEAR) / (1 << LATENCY_SUBBITS) + 1;
+  low   = (int64_t)((1 << LATENCY_SUBBITS) + (bucket - LATENCY_LINEAR) % (1 << LATENCY_SUBBITS)) << shift;
+
+  return low + ((int64_t)1 << shift) / 2;
+} /* End of latency_value() */
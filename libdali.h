@@ -28,11 +28,19 @@
 extern "C" {
 #endif
 
-#define LIBDALI_VERSION "1.8.1"      /**< libdali version */
-#define LIBDALI_RELEASE "2023.335"   /**< libdali release date */
+#define LIBDALI_VERSION "2.0.0"      /**< libdali version */
+#define LIBDALI_RELEASE "2026.291"   /**< libdali release date */
 
 /** @defgroup connection Connection managment functions */
 /** @defgroup network Connection network functions */
+/** @defgroup capture Packet capture files */
+/** @defgroup pipeline Threaded collection pipeline */
+/** @defgroup backfill Parallel backfill */
+/** @defgroup dedup Duplicate packet suppression */
+/** @defgroup merge Time-ordered merge */
+/** @defgroup ioring Shared I/O ring for many connections */
+/** @defgroup latency Packet latency statistics */
+/** @defgroup info INFO response parsing */
 /** @defgroup time-related Time definitions and functions */
 /** @defgroup logging Central Logging */
 /** @defgroup utility-functions General Utility Functions */
@@ -139,6 +147,13 @@ extern "C" {
 #define MAXPACKETSIZE       16384    /**< Maximum packet size for libdali */
 #define MAXREGEXSIZE        16384    /**< Maximum regex pattern size */
 #define MAX_LOG_MSG_LENGTH  200      /**< Maximum length of log messages */
+#define DLRECVBUFSIZE       65536    /**< Size of connection receive buffer */
+#define DLRECONNECT_MINBACKOFF 500000 /**< Initial reconnect backoff (microseconds) */
+#define DLCONNECT_DELAY 250000       /**< Delay before racing the next server address (microseconds) */
+#define DLCONNECT_MAXADDRS 16        /**< Maximum server addresses tried per connection */
+#define DLCONNECT_POLL 10000         /**< Interval to check racing connection attempts without blocking (microseconds) */
+#define DLRESOLVE_TTL 300            /**< Default lifetime of cached server addresses (seconds) */
+#define DLRESOLVE_POLL 10000         /**< Interval to check a server address lookup without blocking (microseconds) */
 
 #define LIBDALI_POSITION_EARLIEST -2 /**< Earliest position in the buffer */
 #define LIBDALI_POSITION_LATEST   -3 /**< Latest position in the buffer */
@@ -146,11 +161,16 @@ extern "C" {
 /** Maximium stream ID string length */
 #define MAXSTREAMID 60
 
-/* Return values for dl_collect() and dl_collect_nb() */
+/* Return values for dl_collect(), dl_collect_nb() and dl_process() */
 #define DLERROR    -1      /**< Error occurred */
 #define DLENDED     0      /**< Connection terminated */
 #define DLPACKET    1      /**< Packet returned */
 #define DLNOPACKET  2      /**< No packet for non-blocking dl_collect_nb() */
+#define DLREPLY     3      /**< Command reply returned by dl_process() */
+
+/* Socket events reported by dl_interest() */
+#define DLWANT_READ  1     /**< Wait for the socket to be readable */
+#define DLWANT_WRITE 2     /**< Wait for the socket to be writable */
 
 /** @addtogroup time-related
     @brief Definitions and functions for related to library time values
@@ -174,6 +194,16 @@ extern "C" {
 /** Macro to scale a high precision time to a Unix/POSIX epoch time */
 #define DL_DLTIME2EPOCH(X) X / DLTMODULUS
 
+/** @def DLTIMEFORMAT_ISO
+    @brief Time string format: "YYYY-MM-DDThh:mm:ss.ffffff", see dl_dltime2isotimestr() */
+#define DLTIMEFORMAT_ISO      0
+/** @def DLTIMEFORMAT_MONTHDAY
+    @brief Time string format: "YYYY-MM-DD hh:mm:ss.ffffff", see dl_dltime2mdtimestr() */
+#define DLTIMEFORMAT_MONTHDAY 1
+/** @def DLTIMEFORMAT_SEED
+    @brief Time string format: "YYYY,DDD,hh:mm:ss.ffffff", see dl_dltime2seedtimestr() */
+#define DLTIMEFORMAT_SEED     2
+
 /** Data type for high-precision time values.
  *  Require a large (>= 64-bit) integer type */
 typedef int64_t dltime_t;
@@ -181,9 +211,18 @@ typedef int64_t dltime_t;
 extern char *dl_dltime2isotimestr (dltime_t dltime, char *isotimestr, int8_t subseconds);
 extern char *dl_dltime2mdtimestr (dltime_t dltime, char *mdtimestr, int8_t subseconds);
 extern char *dl_dltime2seedtimestr (dltime_t dltime, char *seedtimestr, int8_t subseconds);
+extern int64_t dl_dltime2timestr_batch (const dltime_t *dltimes, size_t count, char *timestrs,
+                                        size_t stride, int format, int8_t subseconds);
 extern dltime_t dl_time2dltime (int year, int day, int hour, int min, int sec, int usec);
+extern int dl_dltime2time_batch (const dltime_t *dltimes, size_t count,
+                                 int *year, int *yday, int *hour, int *min, int *sec, int *usec);
+extern int64_t dl_time2dltime_batch (const int *year, const int *yday, const int *hour,
+                                     const int *min, const int *sec, const int *usec,
+                                     size_t count, dltime_t *dltimes);
 extern dltime_t dl_seedtimestr2dltime (char *seedtimestr);
 extern dltime_t dl_timestr2dltime (char *timestr);
+extern dltime_t dl_seedtimestr2dltime_len (const char *seedtimestr, size_t *length);
+extern dltime_t dl_timestr2dltime_len (const char *timestr, size_t *length);
 extern int dl_doy2md (int year, int jday, int *month, int *mday);
 extern int dl_md2doy (int year, int month, int mday, int *jday);
 
@@ -231,6 +270,26 @@ typedef struct DLLog_s
 
     @{ */
 
+/* Receive buffer modes for DLSocketProfile.rcvbuf */
+#define DLSOCK_ADAPTIVE -1             /**< Size the receive buffer from measured throughput */
+#define DLSOCK_RCVBUFMAX 16777216      /**< Default maximum adaptive receive buffer (bytes) */
+#define DLSOCK_ADAPT_INTERVAL 1000000  /**< Interval of adaptive receive buffer sizing (microseconds) */
+
+/** Socket tuning profile applied when connecting, all 0 for system defaults */
+typedef struct DLSocketProfile_s
+{
+  int         rcvbuf;           /**< SO_RCVBUF (bytes), 0 for system default or ::DLSOCK_ADAPTIVE */
+  int         rcvbufmax;        /**< Maximum adaptive receive buffer (bytes), 0 for ::DLSOCK_RCVBUFMAX */
+  int         sndbuf;           /**< SO_SNDBUF (bytes), 0 for system default */
+  int8_t      nodelay;          /**< Boolean flag to set TCP_NODELAY */
+  int8_t      quickack;         /**< Boolean flag to set TCP_QUICKACK, where supported */
+  int         busypoll;         /**< SO_BUSY_POLL (microseconds), where supported, 0 to disable */
+  int         keepidle;         /**< TCP keepalive idle time (seconds), 0 to disable TCP keepalive */
+  int         keepintvl;        /**< TCP keepalive probe interval (seconds), 0 for system default */
+  int         keepcnt;          /**< TCP keepalive probe count, 0 for system default */
+  int8_t      timestamps;       /**< Boolean flag to request kernel receive timestamps, where supported */
+} DLSocketProfile;
+
 /** DataLink connection parameters */
 typedef struct DLCP_s
 {
@@ -247,11 +306,48 @@ typedef struct DLCP_s
   int64_t     pktid;            /**< Packet ID of last packet received, maintained internally */
   dltime_t    pkttime;          /**< Packet time of last packet received, maintained internally */
   int8_t      keepalive_trig;   /**< Send keepalive trigger, maintained internally */
-  dltime_t    keepalive_time;   /**< Keepalive time stamp, maintained internally */
+  int64_t     keepalive_time;   /**< Keepalive monotonic time stamp (microseconds), maintained internally */
   int8_t      terminate;        /**< Boolean flag to control connection termination, maintained internally */
   int8_t      streaming;        /**< Boolean flag to indicate streaming status, maintained internally */
 
   DLLog      *log;              /**< Logging parameters, maintained internally */
+
+  /* Additional connection parameters */
+  int         reconnect;        /**< Maximum reconnect backoff (seconds), 0 disables automatic reconnection */
+  int8_t      standby;          /**< Boolean flag to keep a standby connection for reconnection */
+  DLSocketProfile sockprofile;  /**< Socket tuning profile */
+  int         busypoll;         /**< Time to spin on receives in dl_collect() before waiting (microseconds), 0 to disable */
+  int         busypoll_cpu;     /**< CPU to pin the thread busy polling in dl_collect() to, -1 for none */
+  int8_t      latency;          /**< Boolean flag to record packet latency statistics, see dl_latency_stats() */
+
+  /* Additional connection parameters maintained internally */
+  int64_t     looptime;         /**< Monotonic time of current collection loop iteration (microseconds), maintained internally */
+  char       *recvbuf;          /**< Receive buffer, maintained internally */
+  size_t      recvhead;         /**< Offset of unconsumed data in receive buffer, maintained internally */
+  size_t      recvtail;         /**< Offset of end of data in receive buffer, maintained internally */
+  char       *matchpattern;     /**< Stream ID match expression, maintained internally */
+  char       *rejectpattern;    /**< Stream ID reject expression, maintained internally */
+  void       *addrinfo;         /**< Cached server address lookup, maintained internally */
+  struct DLCP_s *standbyconn;   /**< Standby connection, maintained internally */
+  int64_t     reconnect_time;   /**< Monotonic time of next reconnect attempt (microseconds), maintained internally */
+  int64_t     reconnect_backoff; /**< Current reconnect backoff (microseconds), maintained internally */
+  int64_t     reconnects;       /**< Count of successful reconnections, maintained internally */
+  void       *connecting;       /**< State of a non-blocking connection, maintained internally */
+  size_t      recvbufsize;      /**< Size of receive buffer, maintained internally */
+  char       *sendq;            /**< Queue of commands to send, maintained internally */
+  size_t      sendqsize;        /**< Size of send queue, maintained internally */
+  size_t      sendqhead;        /**< Offset of unsent data in send queue, maintained internally */
+  size_t      sendqtail;        /**< Offset of end of data in send queue, maintained internally */
+  int64_t     iotime;           /**< Monotonic time of last network I/O progress (microseconds), maintained internally */
+  int64_t     wakeup_rfd;       /**< Wakeup descriptor to wait on, maintained internally */
+  int64_t     wakeup_wfd;       /**< Wakeup descriptor to signal, maintained internally */
+  int64_t     rxbytes;          /**< Count of bytes received, maintained internally */
+  void       *socktune;         /**< Adaptive receive buffer state, maintained internally */
+  int8_t      busypoll_pinned;  /**< Boolean flag indicating the busy poll thread was pinned, maintained internally */
+  void       *latencystats;     /**< Packet latency histograms, maintained internally */
+  dltime_t    recvstamp;        /**< Kernel receive time of the last data received, maintained internally */
+  dltime_t    readstamp;        /**< Time the last data received was read from the socket, maintained internally */
+  void       *ioring;           /**< Shared I/O ring the connection is added to, see dl_ioring_add(), maintained internally */
 } DLCP;
 
 /** DataLink packet */
@@ -263,8 +359,34 @@ typedef struct DLPacket_s
   dltime_t    datastart;        /**< Data start time */
   dltime_t    dataend;          /**< Data end time */
   int32_t     datasize;         /**< Data size in bytes */
+  dltime_t    recvtime;         /**< Kernel receive time, 0 if not available, see DLSocketProfile.timestamps */
+  dltime_t    readtime;         /**< Time read from the socket, 0 if not recorded */
+  dltime_t    handofftime;      /**< Time returned to the caller, 0 if not recorded */
 } DLPacket;
 
+/** Socket tuning statistics of a connection, see dl_socket_stats() */
+typedef struct DLSocketStats_s
+{
+  int         rcvbuf;           /**< Receive buffer size reported by the system (bytes) */
+  int         sndbuf;           /**< Send buffer size reported by the system (bytes) */
+  int8_t      nodelay;          /**< Boolean flag indicating TCP_NODELAY is set */
+  int64_t     rtt;              /**< Smoothed round trip time (microseconds), 0 if unknown */
+  int64_t     backlog;          /**< Bytes received by the system not yet read, -1 if unknown */
+  int64_t     throughput;       /**< Receive throughput over the last adaptive interval (bytes/second) */
+  int64_t     rxbytes;          /**< Bytes received on the connection */
+  int64_t     rcvbufgrows;      /**< Receive buffer increases by adaptive sizing */
+} DLSocketStats;
+
+/** Callback for dl_read_range(), a non-zero return ends the range */
+typedef int (*DLReadCallback) (int64_t pktid, DLPacket *packet, void *packetdata,
+                               const char *error, void *cbdata);
+
+/** Default number of READ commands in flight for dl_read_range() */
+#define DLREAD_DEPTH 16
+
+/** Callback for dl_collect_batch(), a non-zero return ends the batch */
+typedef int (*DLCollectCallback) (DLPacket *packet, void *packetdata, void *cbdata);
+
 extern DLCP *  dl_newdlcp (char *address, char *progname);
 extern void    dl_freedlcp (DLCP *dlconn);
 extern int     dl_exchangeIDs (DLCP *dlconn, int parseresp);
@@ -276,26 +398,403 @@ extern int64_t dl_write (DLCP *dlconn, void *packet, int packetlen, char *stream
 			 dltime_t datastart, dltime_t dataend, int ack);
 extern int     dl_read (DLCP *dlconn, int64_t pktid, DLPacket *packet,
 			void *packetdata, size_t maxdatasize);
+extern int64_t dl_read_range (DLCP *dlconn, int64_t startid, int64_t endid,
+			      dltime_t endtime, int depth,
+			      void *packetdata, size_t maxdatasize,
+			      DLReadCallback callback, void *cbdata);
 extern int     dl_getinfo (DLCP *dlconn, const char *infotype, char *infomatch,
 			   char **infodata, size_t maxinfosize);
 extern int     dl_collect (DLCP *dlconn, DLPacket *packet, void *packetdata,
 			   size_t maxdatasize, int8_t endflag);
 extern int     dl_collect_nb (DLCP *dlconn, DLPacket *packet, void *packetdata,
 			      size_t maxdatasize, int8_t endflag);
+extern int     dl_collect_batch (DLCP *dlconn, DLPacket *packets, int maxpackets,
+				 void *arena, size_t arenasize,
+				 DLCollectCallback callback, void *cbdata,
+				 int64_t timeout, int *count);
+extern int     dl_stream_nb (DLCP *dlconn, int8_t endflag);
+extern int     dl_write_nb (DLCP *dlconn, void *packet, int packetlen, char *streamid,
+			    dltime_t datastart, dltime_t dataend, int ack);
+extern int     dl_process (DLCP *dlconn, DLPacket *packet, void *packetdata,
+			   size_t maxdatasize);
 extern int     dl_handlereply (DLCP *dlconn, void *buffer, int buflen, int64_t *value);
 extern void    dl_terminate (DLCP *dlconn);
+extern int64_t dl_wakeup_fd (DLCP *dlconn);
+extern int     dl_wakeup (DLCP *dlconn);
 extern char   *dl_read_streamlist (DLCP *dlconn, const char *streamfile);
 extern int     dl_recoverstate (DLCP *dlconn, const char *statefile);
 extern int     dl_savestate (DLCP *dlconn, const char *statefile);
 /** @} */
 
 
+/** @addtogroup capture
+    @brief Recording and reading streams of packets in local files
+
+    A capture file is a sequence of packets stored exactly as they are
+    sent by a DataLink server in streaming mode: a pre-header ('DL' and
+    header length), a "PACKET" header and the packet data.  A sparse
+    index of the file, one entry every @a DLCAPTURE_INDEXSTRIDE packets,
+    is maintained in a companion file with a '.idx' suffix and allows
+    positioning by packet ID or data time without reading the entire
+    capture.
+
+    @{ */
+
+/** Number of packets between capture index entries */
+#define DLCAPTURE_INDEXSTRIDE 256
+
+/** Capture file index entry */
+typedef struct DLCaptureIndex_s
+{
+  int64_t     offset;           /**< File offset of the indexed packet */
+  int64_t     maxpktid;         /**< Maximum packet ID up to and including the indexed packet */
+  dltime_t    maxdatastart;     /**< Maximum data start up to and including the indexed packet */
+} DLCaptureIndex;
+
+/** Packet capture file parameters */
+typedef struct DLCapture_s
+{
+  char        path[512];        /**< Path to capture file */
+  FILE       *fp;               /**< File stream of capture file, maintained internally */
+  int8_t      writable;         /**< Boolean flag to indicate writing mode, maintained internally */
+  int8_t      indexdirty;       /**< Boolean flag to indicate index needs saving, maintained internally */
+  int64_t     offset;           /**< Current file offset, maintained internally */
+  DLCaptureIndex *index;        /**< Sparse index entries, maintained internally */
+  int64_t     indexcount;       /**< Number of index entries, maintained internally */
+  int64_t     indexalloc;       /**< Number of allocated index entries, maintained internally */
+  int64_t     packetcount;      /**< Number of packets in the capture, maintained internally */
+  int64_t     maxpktid;         /**< Maximum packet ID in the capture, maintained internally */
+  dltime_t    maxdatastart;     /**< Maximum data start time in the capture, maintained internally */
+} DLCapture;
+
+extern DLCapture *dl_capture_open (const char *path, char perm);
+extern int     dl_capture_close (DLCapture *capture);
+extern int     dl_capture_write (DLCapture *capture, DLPacket *packet, void *packetdata);
+extern int     dl_capture_read (DLCapture *capture, DLPacket *packet, void *packetdata,
+				size_t maxdatasize);
+extern int64_t dl_capture_seek_pktid (DLCapture *capture, int64_t pktid);
+extern int64_t dl_capture_seek_time (DLCapture *capture, dltime_t datatime);
+/** @} */
+
+
+/** @addtogroup backfill
+    @brief Collecting a time range of packets over parallel connections
+
+    A backfill splits a time range into slices, each collected on its
+    own connection and thread, to use more than one TCP stream and
+    parsing thread for large historical requests.  Packets are merged
+    into a single callback and/or capture file.
+
+    @{ */
+extern int64_t dl_backfill (DLCP *dlconn, const char *match, const char *reject,
+                            dltime_t starttime, dltime_t endtime, int slices, int idletime,
+                            int8_t ordered, const char *spooldir,
+                            DLCollectCallback callback, void *cbdata, DLCapture *capture);
+/** @} */
+
+
+/** @addtogroup pipeline
+    @brief Collecting packets in an I/O thread for worker threads
+
+    A pipeline runs dl_collect() for a connection in a dedicated I/O
+    thread, receiving packets into a pool of buffers, and dispatches
+    them to a number of worker threads which call a handler for each
+    packet.  Packets are assigned to workers by a hash of the stream
+    ID, so packets of a stream are handled in the order received.
+
+    Each worker has a single-producer, single-consumer queue of a
+    configurable depth.  When the queue of a worker is full the I/O
+    thread waits, which is reported as backpressure in the statistics.
+
+    @{ */
+
+/** Default depth of pipeline worker queues */
+#define DLPIPELINE_QUEUEDEPTH 256
+
+/** Pipeline packet handler, a non-zero return terminates collection */
+typedef int (*DLPipelineHandler) (DLPacket *packet, void *packetdata,
+                                  int worker, void *handlerdata);
+
+/** Pipeline parameters, opaque */
+typedef struct DLPipeline_s DLPipeline;
+
+/** Pipeline statistics for a worker or all workers */
+typedef struct DLPipelineStats_s
+{
+  uint64_t    dispatched;       /**< Packets dispatched to worker queue(s) */
+  uint64_t    handled;          /**< Packets handled by worker(s) */
+  uint64_t    bytes;            /**< Packet data bytes handled by worker(s) */
+  uint64_t    highwater;        /**< Maximum queue depth observed */
+  uint64_t    queuefull;        /**< Dispatches that waited for a full queue */
+  uint64_t    stallusec;        /**< Time the I/O thread waited for full queues (microseconds) */
+} DLPipelineStats;
+
+extern DLPipeline *dl_pipeline_new (DLCP *dlconn, int workers, int queuedepth,
+                                    DLPipelineHandler handler, void *handlerdata);
+extern int     dl_pipeline_start (DLPipeline *pipeline);
+extern int     dl_pipeline_wait (DLPipeline *pipeline);
+extern int     dl_pipeline_stop (DLPipeline *pipeline);
+extern int     dl_pipeline_stats (DLPipeline *pipeline, int worker, DLPipelineStats *stats);
+extern void    dl_pipeline_free (DLPipeline *pipeline);
+/** @} */
+
+/** @addtogroup dedup
+    @brief Suppressing duplicate packets from redundant sources
+
+    A duplicate filter recognizes packets with the same stream ID, data
+    times and data within a time window, e.g. when the same streams are
+    collected from redundant servers.  Memory used is bounded by a
+    fixed capacity.  A filter may be used directly or attached to a
+    merge, see dl_merge_dedup().
+
+    @{ */
+
+/** Default maximum number of packets remembered by a duplicate filter */
+#define DLDEDUP_CAPACITY 65536
+
+/** Duplicate filter parameters, opaque */
+typedef struct DLDedup_s DLDedup;
+
+/** Duplicate filter statistics */
+typedef struct DLDedupStats_s
+{
+  uint64_t    hits;             /**< Packets found to be duplicates */
+  uint64_t    misses;           /**< Packets not seen before */
+  uint64_t    expired;          /**< Packets forgotten after the window */
+  uint64_t    evicted;          /**< Packets forgotten within the window due to capacity */
+  uint64_t    entries;          /**< Current number of packets remembered */
+} DLDedupStats;
+
+extern DLDedup *dl_dedup_new (dltime_t window, int capacity);
+extern int     dl_dedup_check (DLDedup *dedup, DLPacket *packet, void *packetdata);
+extern int     dl_dedup_stats (DLDedup *dedup, DLDedupStats *stats);
+extern void    dl_dedup_free (DLDedup *dedup);
+/** @} */
+
+/** @addtogroup latency
+    @brief Measuring packet latency
+
+    With DLCP.latency set, the latency of each packet returned by a
+    connection is counted in a fixed size histogram and the count,
+    range, mean and percentiles are reported by dl_latency_stats().
+
+    With kernel receive timestamps requested by
+    DLSocketProfile.timestamps the delivery latency is also divided
+    into the network, kernel queueing and library latencies, locating
+    where packets are delayed.
+
+    @{ */
+
+#define DLLATENCY_DELIVERY 0    /**< Packet time to return to the caller */
+#define DLLATENCY_NETWORK  1    /**< Packet time to kernel receive time */
+#define DLLATENCY_KERNEL   2    /**< Kernel receive time to read from the socket */
+#define DLLATENCY_LIBRARY  3    /**< Read from the socket to return to the caller */
+#define DLLATENCY_TYPES    4    /**< Number of latency types */
+
+/** Latency statistics (microseconds), percentiles are within about 3% */
+typedef struct DLLatencyStats_s
+{
+  uint64_t    count;            /**< Number of packets */
+  int64_t     min;              /**< Minimum latency */
+  int64_t     max;              /**< Maximum latency */
+  int64_t     mean;             /**< Mean latency */
+  int64_t     p50;              /**< Median latency */
+  int64_t     p99;              /**< 99th percentile latency */
+  int64_t     p999;             /**< 99.9th percentile latency */
+} DLLatencyStats;
+
+extern int     dl_latency_stats (DLCP *dlconn, int type, DLLatencyStats *stats);
+extern void    dl_latency_reset (DLCP *dlconn);
+/** @} */
+
+/** @addtogroup info
+    @brief Incremental parsing of INFO responses
+
+    INFO responses are XML documents that can be tens of megabytes for
+    servers with many streams.  An INFO parser reads a response in
+    chunks, as received, and passes each element to a callback with
+    the fields of StreamList, Stream, ConnectionList and Connection
+    elements converted to typed values.  Memory used is bounded by
+    ::DLINFO_MAXELEMENT, independent of the size of the response.
+
+    @{ */
+
+#define DLINFO_MAXELEMENT 8192  /**< Maximum size of an element tag (bytes) */
+#define DLINFO_MAXATTRS   64    /**< Maximum number of attributes of an element */
+
+/* INFO element types, see DLInfoElement.type */
+#define DLINFO_OTHER          0 /**< Element not otherwise recognized */
+#define DLINFO_SERVER         1 /**< DataLink, the root element with server identification */
+#define DLINFO_STREAMLIST     2 /**< StreamList, see DLInfoElement.list */
+#define DLINFO_STREAM         3 /**< Stream, see DLInfoElement.stream */
+#define DLINFO_CONNECTIONLIST 4 /**< ConnectionList, see DLInfoElement.list */
+#define DLINFO_CONNECTION     5 /**< Connection, see DLInfoElement.connection */
+
+/** INFO StreamList or ConnectionList element */
+typedef struct DLInfoList_s
+{
+  int64_t     total;            /**< Total number of streams or connections */
+  int64_t     selected;         /**< Number of streams or connections selected by the match */
+} DLInfoList;
+
+/** INFO Stream element, times are DLTERROR when not reported */
+typedef struct DLInfoStream_s
+{
+  char        name[MAXSTREAMID]; /**< Stream ID */
+  int64_t     earliestid;       /**< Earliest packet ID */
+  dltime_t    earlieststart;    /**< Earliest packet data start time */
+  dltime_t    earliestend;      /**< Earliest packet data end time */
+  int64_t     latestid;         /**< Latest packet ID */
+  dltime_t    lateststart;      /**< Latest packet data start time */
+  dltime_t    latestend;        /**< Latest packet data end time */
+  double      latency;          /**< Data latency (seconds) */
+} DLInfoStream;
+
+/** INFO Connection element, times are DLTERROR when not reported */
+typedef struct DLInfoConnection_s
+{
+  char        type[32];         /**< Connection type, e.g. "DataLink" */
+  char        host[100];        /**< Client host name */
+  char        ip[64];           /**< Client IP address */
+  char        port[16];         /**< Client port */
+  char        clientid[200];    /**< Client ID */
+  dltime_t    conntime;         /**< Connection time */
+  int64_t     streamcount;      /**< Number of streams selected */
+  int64_t     pktid;            /**< Packet ID of the current position */
+  dltime_t    pkttime;          /**< Packet creation time of the current position */
+  int64_t     txpackets;        /**< Packets sent to the client */
+  int64_t     txbytes;          /**< Bytes sent to the client */
+  int64_t     rxpackets;        /**< Packets received from the client */
+  int64_t     rxbytes;          /**< Bytes received from the client */
+  double      latency;          /**< Latency of the current position (seconds) */
+  double      percentlag;       /**< Position in the ring as a percent lag */
+} DLInfoConnection;
+
+/** INFO element passed to a DLInfoCallback, valid only during the call */
+typedef struct DLInfoElement_s
+{
+  int         type;             /**< Element type, e.g. ::DLINFO_STREAM */
+  int         depth;            /**< Nesting depth, 0 for the root element */
+  const char *tag;              /**< Element name */
+  int         nattrs;           /**< Number of attributes */
+  const char *attrname[DLINFO_MAXATTRS];  /**< Attribute names */
+  const char *attrvalue[DLINFO_MAXATTRS]; /**< Attribute values, entities decoded */
+  DLInfoList  list;             /**< Fields of a StreamList or ConnectionList */
+  DLInfoStream stream;          /**< Fields of a Stream */
+  DLInfoConnection connection;  /**< Fields of a Connection */
+} DLInfoElement;
+
+/** Callback for INFO elements, a non-zero return ends parsing */
+typedef int (*DLInfoCallback) (const DLInfoElement *element, void *cbdata);
+
+/** INFO parser, opaque */
+typedef struct DLInfoParser_s DLInfoParser;
+
+extern DLInfoParser *dl_info_new (DLInfoCallback callback, void *cbdata);
+extern int     dl_info_feed (DLInfoParser *parser, const char *data, size_t length);
+extern const char *dl_info_attr (const DLInfoElement *element, const char *name);
+extern void    dl_info_free (DLInfoParser *parser);
+extern int64_t dl_getinfo_parse (DLCP *dlconn, const char *infotype, char *infomatch,
+                                 DLInfoCallback callback, void *cbdata);
+/** @} */
+
+/** @addtogroup merge
+    @brief Time-ordered merging of packets from multiple connections
+
+    A merge collects packets from a set of connections and returns
+    them ordered by data start or packet time.  Packets are buffered
+    in a heap and released once every source has passed their time,
+    the reorder window has passed or the maximum delay is reached.
+    Packets arriving after later packets were released are reported
+    as late.
+
+    @{ */
+
+/** Order merged packets by data start time */
+#define DLMERGE_DATASTART 0
+/** Order merged packets by packet time */
+#define DLMERGE_PKTTIME 1
+
+/** Default maximum number of packets buffered by a merge */
+#define DLMERGE_MAXBUFFER 1024
+
+/** Merge parameters, opaque */
+typedef struct DLMerge_s DLMerge;
+
+/** Merge statistics */
+typedef struct DLMergeStats_s
+{
+  uint64_t    received;         /**< Packets received from all sources */
+  uint64_t    released;         /**< Packets released in order */
+  uint64_t    duplicates;       /**< Duplicate packets dropped, see dl_merge_dedup() */
+  uint64_t    late;             /**< Late packets reported and dropped */
+  uint64_t    expired;          /**< Packets released at the maximum delay */
+  uint64_t    overflow;         /**< Packets released because the buffer was full */
+  uint64_t    highwater;        /**< Maximum number of buffered packets */
+  uint64_t    buffered;         /**< Current number of buffered packets */
+} DLMergeStats;
+
+extern DLMerge *dl_merge_new (DLCP **dlconns, int count, int8_t keytype, dltime_t window,
+                              int64_t maxdelay, int maxbuffer,
+                              DLCollectCallback latecallback, void *latedata);
+extern int     dl_merge_next (DLMerge *merge, DLPacket *packet, void *packetdata,
+                              size_t maxdatasize, int *source, int64_t timeout);
+extern int     dl_merge_dedup (DLMerge *merge, DLDedup *dedup);
+extern int     dl_merge_stats (DLMerge *merge, DLMergeStats *stats);
+extern void    dl_merge_free (DLMerge *merge);
+/** @} */
+
+/** @addtogroup ioring
+    @brief Network I/O for many connections from one thread
+
+    A shared I/O ring performs the network I/O of many connections,
+    each driven as with dl_process(), from a single thread.  On Linux
+    the io_uring interface is used: all connections share one ring,
+    receive into provided buffers registered with the kernel and all
+    queued operations are submitted, and completions waited for, with
+    one system call.  Otherwise the connections are waited on with
+    poll().
+
+    @{ */
+
+/** Use io_uring when available, otherwise poll() */
+#define DLIORING_AUTO  0
+/** Use Linux io_uring */
+#define DLIORING_URING 1
+/** Use poll() and socket calls */
+#define DLIORING_POLL  2
+
+/** Shared I/O ring, opaque */
+typedef struct DLIORing_s DLIORing;
+
+/** Callback for dl_ioring_run(), a non-zero return ends the call */
+typedef int (*DLIORingCallback) (DLCP *dlconn, int type, DLPacket *packet,
+                                 void *packetdata, void *cbdata);
+
+extern DLIORing *dl_ioring_new (int maxconns, int backend);
+extern int     dl_ioring_add (DLIORing *ring, DLCP *dlconn);
+extern int     dl_ioring_remove (DLIORing *ring, DLCP *dlconn);
+extern int     dl_ioring_run (DLIORing *ring, DLIORingCallback callback, void *cbdata,
+                              int64_t timeout);
+extern int     dl_ioring_backend (DLIORing *ring);
+extern void    dl_ioring_free (DLIORing *ring);
+/** @} */
+
 /** @addtogroup network
     @brief Functions for network DataLink connections
 
     @{ */
 extern SOCKET  dl_connect (DLCP *dlconn);
+extern int     dl_connect_step (DLCP *dlconn);
+extern int     dl_interest (DLCP *dlconn);
+extern int64_t dl_deadline (DLCP *dlconn);
+extern int     dl_socket_stats (DLCP *dlconn, DLSocketStats *stats);
 extern void    dl_disconnect (DLCP *dlconn);
+extern int     dl_reconnect (DLCP *dlconn);
+extern int     dl_reconnect_step (DLCP *dlconn);
+extern int     dl_resolve_start (DLCP *dlconn);
+extern void    dl_resolve_ttl (int ttl);
+extern void    dl_resolve_flush (void);
 extern int     dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen);
 extern int     dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
 			      void *databuf, size_t datalen,
@@ -336,6 +835,8 @@ extern DLLog  *dl_loginit_rl (DLLog *log, int verbosity,
 extern const char *dlp_strerror (void);
 extern int     dlp_openfile (const char *filename, char perm);
 extern int64_t dlp_time (void);
+extern int64_t dlp_monotime (void);
+extern int64_t dl_monotime (void);
 extern void    dlp_usleep (unsigned long int useconds);
 extern int     dlp_genclientid (char *progname, char *clientid, size_t maxsize);
 extern int     dl_splitstreamid (char *streamid, char *w, char *x, char *y, char *z, char *type);
@@ -0,0 +1,397 @@
+/***********************************************************************/ /**
+ * @file libdali.hpp
+ *
+ * Header-only C++17 interface to the DataLink Library.
+ *
+ * A dali::Connection owns a DLCP and a packet data buffer, releasing
+ * both when destroyed.  Received packets are returned as dali::Packet
+ * views referencing the connection buffer, no data is copied or
+ * allocated beyond what the C routines do.  A view is valid until the
+ * next packet is received on the connection, moving the connection
+ * does not invalidate views.
+ *
+ * Errors reported by the C routines are thrown as dali::Error.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#ifndef LIBDALI_HPP
+#define LIBDALI_HPP 1
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(__has_include)
+  #if __has_include(<span>) && __cplusplus >= 202002L
+    #include <span>
+  #endif
+#endif
+
+#include "libdali.h"
+
+namespace dali
+{
+
+#if defined(__cpp_lib_span)
+
+/** Contiguous read-only bytes, std::span when available */
+using Bytes = std::span<const std::byte>;
+
+#else
+
+/** Contiguous read-only bytes, a minimal std::span<const std::byte> */
+class Bytes
+{
+public:
+  constexpr Bytes () noexcept = default;
+  constexpr Bytes (const std::byte *data, std::size_t size) noexcept
+      : data_ (data), size_ (size) {}
+
+  constexpr const std::byte *data () const noexcept { return data_; }
+  constexpr std::size_t size () const noexcept { return size_; }
+  constexpr std::size_t size_bytes () const noexcept { return size_; }
+  constexpr bool empty () const noexcept { return size_ == 0; }
+  constexpr const std::byte *begin () const noexcept { return data_; }
+  constexpr const std::byte *end () const noexcept { return data_ + size_; }
+  constexpr const std::byte &operator[] (std::size_t idx) const noexcept { return data_[idx]; }
+
+  constexpr Bytes subspan (std::size_t offset, std::size_t count = static_cast<std::size_t> (-1)) const noexcept
+  {
+    return Bytes (data_ + offset, (count == static_cast<std::size_t> (-1)) ? size_ - offset : count);
+  }
+
+private:
+  const std::byte *data_ = nullptr;
+  std::size_t size_      = 0;
+};
+
+#endif
+
+/** Error reported by a libdali routine */
+class Error : public std::runtime_error
+{
+public:
+  explicit Error (const std::string &message) : std::runtime_error (message) {}
+};
+
+/***********************************************************************/ /**
+ * @brief View of a received DataLink packet
+ *
+ * References the packet description and data held by the connection
+ * that received it, valid until the next packet is received.
+ ***************************************************************************/
+class Packet
+{
+public:
+  Packet () noexcept = default;
+  Packet (const DLPacket *packet, const std::byte *data) noexcept
+      : packet_ (packet), data_ (data) {}
+
+  /** Stream ID */
+  std::string_view streamid () const noexcept { return std::string_view (packet_->streamid); }
+  /** Packet ID */
+  int64_t pktid () const noexcept { return packet_->pktid; }
+  /** Packet time */
+  dltime_t pkttime () const noexcept { return packet_->pkttime; }
+  /** Data start time */
+  dltime_t datastart () const noexcept { return packet_->datastart; }
+  /** Data end time */
+  dltime_t dataend () const noexcept { return packet_->dataend; }
+  /** Packet data */
+  Bytes payload () const noexcept
+  {
+    return Bytes (data_, static_cast<std::size_t> (packet_->datasize));
+  }
+  /** Underlying C packet description */
+  const DLPacket &raw () const noexcept { return *packet_; }
+
+private:
+  const DLPacket *packet_ = nullptr;
+  const std::byte *data_  = nullptr;
+};
+
+/***********************************************************************/ /**
+ * @brief A DataLink connection owning its DLCP
+ *
+ * Move-only, the DLCP, packet description and data buffer are held
+ * in a heap allocated block that moves with the connection, so
+ * packets and ranges remain valid when the connection is moved.  A
+ * moved-from connection may only be assigned to or destroyed.  The
+ * DLCP is disconnected and freed on destruction.
+ ***************************************************************************/
+class Connection
+{
+public:
+  class iterator;
+  class Range;
+
+  /**
+   * Create connection parameters for a server @a address, see
+   * dl_newdlcp().  The connection is not opened.
+   */
+  Connection (const std::string &address, const std::string &progname)
+      : state_ (new State)
+  {
+    if (!(state_->dlconn = dl_newdlcp (const_cast<char *> (address.c_str ()),
+                                       const_cast<char *> (progname.c_str ()))))
+      throw Error ("dl_newdlcp() failed");
+  }
+
+  Connection (const Connection &) = delete;
+  Connection &operator= (const Connection &) = delete;
+  Connection (Connection &&) noexcept = default;
+  Connection &operator= (Connection &&) noexcept = default;
+
+  /** Underlying C connection parameters */
+  DLCP *get () const noexcept { return (state_) ? state_->dlconn : nullptr; }
+  DLCP *operator-> () const noexcept { return state_->dlconn; }
+
+  /** Open the connection, see dl_connect() */
+  void connect ()
+  {
+    if (dl_connect (state_->dlconn) < 0)
+      throw Error (std::string ("cannot connect to ") + state_->dlconn->addr);
+  }
+
+  /** Close the connection, see dl_disconnect() */
+  void disconnect () noexcept { dl_disconnect (state_->dlconn); }
+
+  /** Set the terminate flag, see dl_terminate() */
+  void terminate () noexcept { dl_terminate (state_->dlconn); }
+
+  /** Position to a packet ID and time, see dl_position() */
+  int64_t position (int64_t pktid, dltime_t pkttime = 0)
+  {
+    return check (dl_position (state_->dlconn, pktid, pkttime), "dl_position()");
+  }
+
+  /** Position after a data time, see dl_position_after() */
+  int64_t position_after (dltime_t datatime)
+  {
+    return check (dl_position_after (state_->dlconn, datatime), "dl_position_after()");
+  }
+
+  /** Set stream ID match expression, see dl_match() */
+  int64_t match (const std::string &pattern)
+  {
+    return check (dl_match (state_->dlconn, const_cast<char *> (pattern.c_str ())), "dl_match()");
+  }
+
+  /** Set stream ID reject expression, see dl_reject() */
+  int64_t reject (const std::string &pattern)
+  {
+    return check (dl_reject (state_->dlconn, const_cast<char *> (pattern.c_str ())), "dl_reject()");
+  }
+
+  /** Write a packet, see dl_write() */
+  int64_t write (Bytes data, const std::string &streamid,
+                 dltime_t datastart, dltime_t dataend, bool ack = false)
+  {
+    return check (dl_write (state_->dlconn, const_cast<std::byte *> (data.data ()),
+                            static_cast<int> (data.size ()),
+                            const_cast<char *> (streamid.c_str ()),
+                            datastart, dataend, ack ? 1 : 0),
+                  "dl_write()");
+  }
+
+  /** Read a specific packet, see dl_read() */
+  Packet read (int64_t pktid)
+  {
+    State &state = *state_;
+
+    state.ensure_buffer ();
+    check (dl_read (state.dlconn, pktid, &state.packet, state.buffer.get (), state.buffersize),
+           "dl_read()");
+    return Packet (&state.packet, state.buffer.get ());
+  }
+
+  /**
+   * Collect the next packet in streaming mode, see dl_collect().
+   * Returns false when the connection is terminated.
+   */
+  bool collect (Packet &packet, bool endflag = false)
+  {
+    return state_->collect (packet, endflag);
+  }
+
+  /**
+   * Collect a packet without blocking, see dl_collect_nb().  Returns
+   * DLPACKET when @a packet is set, DLNOPACKET or DLENDED.
+   */
+  int collect_nb (Packet &packet, bool endflag = false)
+  {
+    State &state = *state_;
+
+    state.ensure_buffer ();
+
+    int rv = dl_collect_nb (state.dlconn, &state.packet, state.buffer.get (),
+                            state.buffersize, endflag ? 1 : 0);
+
+    if (rv == DLERROR)
+      throw Error ("dl_collect_nb() failed");
+
+    if (rv == DLPACKET)
+      packet = Packet (&state.packet, state.buffer.get ());
+
+    return rv;
+  }
+
+  /**
+   * Perform available network I/O without blocking, see dl_process().
+   * Returns DLPACKET when @a packet is set to a received packet,
+   * DLREPLY when @a packet is set to a command reply, with the status
+   * as the stream ID, the reply value as the packet ID and the server
+   * message as the payload, DLNOPACKET or DLENDED.
+   */
+  int process (Packet &packet)
+  {
+    State &state = *state_;
+
+    state.ensure_buffer ();
+
+    int rv = dl_process (state.dlconn, &state.packet, state.buffer.get (), state.buffersize);
+
+    if (rv == DLERROR)
+      throw Error ("dl_process() failed");
+
+    if (rv == DLPACKET || rv == DLREPLY)
+      packet = Packet (&state.packet, state.buffer.get ());
+
+    return rv;
+  }
+
+private:
+  /* Connection state, heap allocated so that it does not move */
+  struct State
+  {
+    DLCP *dlconn = nullptr;
+    std::unique_ptr<std::byte[]> buffer;
+    std::size_t buffersize = 0;
+    DLPacket packet {};
+
+    State () = default;
+    State (const State &) = delete;
+    State &operator= (const State &) = delete;
+
+    ~State ()
+    {
+      if (dlconn)
+      {
+        dl_disconnect (dlconn);
+        dl_freedlcp (dlconn);
+      }
+    }
+
+    /* Allocate packet data buffer for the server maximum packet size */
+    void ensure_buffer ()
+    {
+      std::size_t size = (dlconn->maxpktsize > 0) ? static_cast<std::size_t> (dlconn->maxpktsize)
+                                                  : static_cast<std::size_t> (MAXPACKETSIZE);
+
+      if (!buffer || buffersize < size)
+      {
+        buffer.reset (new std::byte[size]);
+        buffersize = size;
+      }
+    }
+
+    bool collect (Packet &packet, bool endflag)
+    {
+      ensure_buffer ();
+
+      int rv = dl_collect (dlconn, &this->packet, buffer.get (), buffersize, endflag ? 1 : 0);
+
+      if (rv == DLERROR)
+        throw Error ("dl_collect() failed");
+
+      if (rv != DLPACKET)
+        return false;
+
+      packet = Packet (&this->packet, buffer.get ());
+      return true;
+    }
+  };
+
+public:
+
+  /** Input iterator over collected packets, ends when terminated */
+  class iterator
+  {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type        = Packet;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const Packet *;
+    using reference         = const Packet &;
+
+    iterator () noexcept = default;
+    explicit iterator (State *state) : state_ (state) { ++*this; }
+
+    reference operator* () const noexcept { return packet_; }
+    pointer operator-> () const noexcept { return &packet_; }
+
+    iterator &operator++ ()
+    {
+      if (state_ && !state_->collect (packet_, false))
+        state_ = nullptr;
+      return *this;
+    }
+
+    void operator++ (int) { ++*this; }
+
+    friend bool operator== (const iterator &a, const iterator &b) noexcept { return a.state_ == b.state_; }
+    friend bool operator!= (const iterator &a, const iterator &b) noexcept { return a.state_ != b.state_; }
+
+  private:
+    State *state_ = nullptr;
+    Packet packet_;
+  };
+
+  /** Range of collected packets for range-based for loops */
+  class Range
+  {
+  public:
+    explicit Range (State *state) noexcept : state_ (state) {}
+    iterator begin () { return iterator (state_); }
+    iterator end () noexcept { return iterator (); }
+
+  private:
+    State *state_;
+  };
+
+  /** Packets collected in streaming mode, see collect() */
+  Range packets () noexcept { return Range (state_.get ()); }
+
+private:
+  static int64_t check (int64_t rv, const char *function)
+  {
+    if (rv < 0)
+      throw Error (std::string (function) + " failed");
+    return rv;
+  }
+
+  std::unique_ptr<State> state_;
+};
+
+} /* namespace dali */
+
+#endif /* LIBDALI_HPP */
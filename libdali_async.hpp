@@ -0,0 +1,605 @@
+/***********************************************************************/ /**
+ * @file libdali_async.hpp
+ *
+ * C++20 coroutine interface to the DataLink Library (Linux).
+ *
+ * A dali::Scheduler drives any number of dali::AsyncConnection objects
+ * from a single thread using epoll.  Coroutines suspend in
+ * `co_await conn.connect()` until the connection is made, in
+ * `co_await conn.next_packet()` until a packet arrives and in
+ * `co_await conn.write(...)` until the server acknowledges the
+ * packet, while the scheduler services the other connections.
+ *
+ * All network I/O is done without blocking with dl_connect_step(),
+ * dl_reconnect_step(), dl_write_nb() and dl_process(), a coroutine
+ * suspends until the socket events reported by dl_interest() or the
+ * time reported by dl_deadline(), so keepalives, I/O timeouts and the
+ * reconnection backoff are handled while waiting.  Partially sent
+ * commands and partially received packets are completed on later
+ * wakeups.
+ *
+ * Only one coroutine at a time may await each connection.
+ *
+ * Example:
+ * @code
+ * dali::Task<void> consume (dali::AsyncConnection &conn)
+ * {
+ *   co_await conn.connect ();
+ *
+ *   while (auto packet = co_await conn.next_packet ())
+ *     handle (*packet);
+ * }
+ *
+ * dali::Scheduler scheduler;
+ * dali::AsyncConnection conn (scheduler, "localhost:16000", "client");
+ * scheduler.spawn (consume (conn));
+ * scheduler.run ();
+ * @endcode
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#ifndef LIBDALI_ASYNC_HPP
+#define LIBDALI_ASYNC_HPP 1
+
+#if __cplusplus < 202002L || !defined(__linux__)
+  #error "libdali_async.hpp requires C++20 and Linux"
+#endif
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "libdali.hpp"
+
+namespace dali
+{
+
+template <typename T> class Task;
+
+namespace detail
+{
+
+/* Promise state shared by all task types */
+struct PromiseBase
+{
+  std::coroutine_handle<> continuation = std::noop_coroutine ();
+  std::exception_ptr exception;
+
+  std::suspend_always initial_suspend () noexcept { return {}; }
+
+  /* Resume the awaiting coroutine when finished */
+  struct FinalAwaiter
+  {
+    bool await_ready () noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend (std::coroutine_handle<P> handle) noexcept
+    {
+      return handle.promise ().continuation;
+    }
+    void await_resume () noexcept {}
+  };
+
+  FinalAwaiter final_suspend () noexcept { return {}; }
+  void unhandled_exception () noexcept { exception = std::current_exception (); }
+};
+
+template <typename T>
+struct Promise : PromiseBase
+{
+  std::optional<T> value;
+
+  Task<T> get_return_object () noexcept;
+  template <typename U>
+  void return_value (U &&result) { value.emplace (std::forward<U> (result)); }
+
+  T take ()
+  {
+    if (exception)
+      std::rethrow_exception (exception);
+    return std::move (*value);
+  }
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+  Task<void> get_return_object () noexcept;
+  void return_void () noexcept {}
+
+  void take ()
+  {
+    if (exception)
+      std::rethrow_exception (exception);
+  }
+};
+
+} /* namespace detail */
+
+/***********************************************************************/ /**
+ * @brief Lazily started coroutine returning a @a T
+ *
+ * A task starts when awaited and resumes the awaiting coroutine when
+ * it completes.  Exceptions propagate to the awaiting coroutine.
+ ***************************************************************************/
+template <typename T = void>
+class [[nodiscard]] Task
+{
+public:
+  using promise_type = detail::Promise<T>;
+  using handle_type  = std::coroutine_handle<promise_type>;
+
+  explicit Task (handle_type handle) noexcept : handle_ (handle) {}
+  Task (Task &&other) noexcept : handle_ (std::exchange (other.handle_, nullptr)) {}
+  Task (const Task &) = delete;
+  Task &operator= (const Task &) = delete;
+  ~Task ()
+  {
+    if (handle_)
+      handle_.destroy ();
+  }
+
+  bool await_ready () const noexcept { return !handle_ || handle_.done (); }
+
+  std::coroutine_handle<> await_suspend (std::coroutine_handle<> awaiting) noexcept
+  {
+    handle_.promise ().continuation = awaiting;
+    return handle_;
+  }
+
+  T await_resume () { return handle_.promise ().take (); }
+
+private:
+  handle_type handle_;
+};
+
+namespace detail
+{
+
+template <typename T>
+Task<T> Promise<T>::get_return_object () noexcept
+{
+  return Task<T> (std::coroutine_handle<Promise<T>>::from_promise (*this));
+}
+
+inline Task<void> Promise<void>::get_return_object () noexcept
+{
+  return Task<void> (std::coroutine_handle<Promise<void>>::from_promise (*this));
+}
+
+/* Eagerly started, self-destroying coroutine used by Scheduler::spawn() */
+struct Detached
+{
+  struct promise_type
+  {
+    Detached get_return_object () noexcept { return {}; }
+    std::suspend_never initial_suspend () noexcept { return {}; }
+    std::suspend_never final_suspend () noexcept { return {}; }
+    void return_void () noexcept {}
+    void unhandled_exception () noexcept { std::terminate (); }
+  };
+};
+
+} /* namespace detail */
+
+/***********************************************************************/ /**
+ * @brief Single-threaded epoll scheduler for coroutines
+ *
+ * Coroutines wait for a descriptor to become readable or writable,
+ * until an optional deadline, or only for a deadline.  Descriptors are
+ * registered one-shot, so idle connections cost nothing until data
+ * arrives.
+ ***************************************************************************/
+class Scheduler
+{
+public:
+  Scheduler ()
+  {
+    if ((epollfd_ = epoll_create1 (EPOLL_CLOEXEC)) < 0)
+      throw Error ("epoll_create1() failed");
+  }
+
+  ~Scheduler () { ::close (epollfd_); }
+
+  Scheduler (const Scheduler &) = delete;
+  Scheduler &operator= (const Scheduler &) = delete;
+
+  /** Start a task, run() returns when all spawned tasks are done */
+  void spawn (Task<void> &&task)
+  {
+    tasks_++;
+    detach (std::move (task));
+  }
+
+  /**
+   * Run until all spawned tasks are done.  An exception thrown by a
+   * spawned task is rethrown from here after the remaining tasks have
+   * finished.
+   */
+  void run ()
+  {
+    std::vector<struct epoll_event> events (256);
+
+    while (tasks_ > 0)
+    {
+      int timeout = -1;
+
+      if (!timers_.empty ())
+      {
+        int64_t wait = (timers_.top ().deadline - dl_monotime () + 999) / 1000;
+        timeout      = (wait > 0) ? static_cast<int> (wait) : 0;
+      }
+
+      int count = epoll_wait (epollfd_, events.data (), static_cast<int> (events.size ()), timeout);
+
+      if (count < 0 && errno != EINTR)
+        throw Error ("epoll_wait() failed");
+
+      for (int idx = 0; idx < count; idx++)
+        wake (events[idx].data.u64);
+
+      /* Wake waiters with expired deadlines */
+      int64_t now = dl_monotime ();
+      while (!timers_.empty () && timers_.top ().deadline <= now)
+      {
+        uint64_t id = timers_.top ().id;
+        timers_.pop ();
+        wake (id);
+      }
+    }
+
+    if (exception_)
+      std::rethrow_exception (std::exchange (exception_, nullptr));
+  }
+
+  /**
+   * Awaitable: resume when @a fd is ready for the @a interest events
+   * or at @a deadline.  Resumes immediately when there is nothing to
+   * wait for.
+   */
+  struct Ready
+  {
+    Scheduler &scheduler;
+    int fd;
+    int interest;
+    int64_t deadline;
+
+    bool await_ready () const noexcept { return (fd < 0 || !interest) && deadline <= 0; }
+
+    void await_suspend (std::coroutine_handle<> handle)
+    {
+      scheduler.wait ((interest) ? fd : -1, interest, deadline, handle);
+    }
+
+    void await_resume () const noexcept {}
+  };
+
+  /**
+   * Wait for @a fd to be ready for the @a interest events, a
+   * combination of DLWANT_READ and DLWANT_WRITE as reported by
+   * dl_interest(), or until @a deadline, a dl_monotime() time as
+   * reported by dl_deadline().  A @a deadline of 0 is no deadline, a
+   * @a fd of -1 or no @a interest only waits for the deadline.
+   */
+  Ready ready (int fd, int interest, int64_t deadline = 0) noexcept
+  {
+    return Ready {*this, fd, interest, deadline};
+  }
+
+  /** Wait until @a deadline, a dl_monotime() time */
+  Ready sleep_until (int64_t deadline) noexcept
+  {
+    return Ready {*this, -1, 0, deadline};
+  }
+
+private:
+  struct Waiter
+  {
+    int fd;
+    int64_t deadline;
+    std::coroutine_handle<> handle;
+  };
+
+  struct Timer
+  {
+    int64_t deadline;
+    uint64_t id;
+    bool operator> (const Timer &other) const noexcept { return deadline > other.deadline; }
+  };
+
+  detail::Detached detach (Task<void> task)
+  {
+    try
+    {
+      co_await task;
+    }
+    catch (...)
+    {
+      if (!exception_)
+        exception_ = std::current_exception ();
+    }
+    tasks_--;
+  }
+
+  void wait (int fd, int interest, int64_t deadline, std::coroutine_handle<> handle)
+  {
+    uint64_t id = ++nextid_;
+
+    if (fd >= 0)
+    {
+      struct epoll_event event {};
+
+      event.events = EPOLLONESHOT;
+      if (interest & DLWANT_READ)
+        event.events |= EPOLLIN | EPOLLRDHUP;
+      if (interest & DLWANT_WRITE)
+        event.events |= EPOLLOUT;
+      event.data.u64 = id;
+
+      if (epoll_ctl (epollfd_, EPOLL_CTL_MOD, fd, &event) < 0)
+      {
+        if (errno != ENOENT || epoll_ctl (epollfd_, EPOLL_CTL_ADD, fd, &event) < 0)
+          throw Error ("epoll_ctl() failed");
+      }
+    }
+
+    if (deadline <= 0)
+      deadline = -1;
+
+    waiters_.emplace (id, Waiter {fd, deadline, handle});
+
+    if (deadline >= 0)
+    {
+      /* Timers of waiters woken by their descriptor stay queued until
+         expiry, rebuild the queue from live waiters when mostly stale */
+      if (timers_.size () > 2 * waiters_.size () + 64)
+      {
+        std::vector<Timer> live;
+        for (const auto &entry : waiters_)
+          if (entry.second.deadline >= 0)
+            live.push_back (Timer {entry.second.deadline, entry.first});
+        timers_ = decltype (timers_) (std::greater<Timer> (), std::move (live));
+      }
+      else
+      {
+        timers_.push (Timer {deadline, id});
+      }
+    }
+  }
+
+  void wake (uint64_t id)
+  {
+    auto it = waiters_.find (id);
+
+    if (it == waiters_.end ())
+      return;
+
+    Waiter waiter = it->second;
+    waiters_.erase (it);
+
+    /* Disarm the descriptor in case the wait timed out, it may
+       already be closed */
+    if (waiter.fd >= 0)
+    {
+      struct epoll_event event {};
+      epoll_ctl (epollfd_, EPOLL_CTL_MOD, waiter.fd, &event);
+    }
+
+    waiter.handle.resume ();
+  }
+
+  int epollfd_ = -1;
+  uint64_t nextid_ = 0;
+  int64_t tasks_   = 0;
+  std::exception_ptr exception_;
+  std::unordered_map<uint64_t, Waiter> waiters_;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+};
+
+/***********************************************************************/ /**
+ * @brief A DataLink connection driven by a Scheduler
+ *
+ * Wraps a dali::Connection, see libdali.hpp, adding awaitable
+ * connection, packet collection and acknowledged writes.  None of the
+ * awaitables block the scheduler.  The blocking routines of the
+ * wrapped connection should not be used while the connection is
+ * awaited, see dl_process().
+ ***************************************************************************/
+class AsyncConnection
+{
+public:
+  AsyncConnection (Scheduler &scheduler, const std::string &address, const std::string &progname)
+      : scheduler_ (scheduler), conn_ (address, progname) {}
+
+  /** Underlying connection */
+  Connection &connection () noexcept { return conn_; }
+  DLCP *get () const noexcept { return conn_.get (); }
+
+  /**
+   * Open the connection, see dl_connect_step(), suspending until it
+   * is made.  Throws Error when the connection cannot be made.
+   */
+  Task<void> connect ()
+  {
+    DLCP *dlconn = conn_.get ();
+    int rv;
+
+    while ((rv = dl_connect_step (dlconn)) == 0)
+      co_await wait_io ();
+
+    if (rv < 0)
+      throw Error (std::string ("cannot connect to ") + dlconn->addr);
+  }
+
+  /**
+   * Collect the next packet in streaming mode, suspending until one
+   * arrives.  Returns no packet when the connection is terminated or
+   * the stream is ended.  The packet view is valid until the next
+   * packet is collected.
+   *
+   * When DLCP.reconnect is set a lost connection is reconnected with
+   * dl_reconnect_step(), waiting for the backoff between attempts,
+   * and streaming resumes after the last packet received.
+   */
+  Task<std::optional<Packet>> next_packet ()
+  {
+    DLCP *dlconn = conn_.get ();
+    Packet packet;
+    int rv;
+
+    for (;;)
+    {
+      if (dlconn->terminate)
+        co_return std::nullopt;
+
+      /* Reconnection in progress or waiting for the next attempt */
+      if (dlconn->link < 0 || dlconn->connecting)
+      {
+        if (dlconn->reconnect <= 0)
+          throw Error ("next_packet(): connection not open");
+
+        if (dl_reconnect_step (dlconn) != 1)
+        {
+          co_await wait_io ();
+          continue;
+        }
+      }
+
+      if (dl_stream_nb (dlconn, 0) < 0)
+        throw Error ("next_packet(): problem queuing STREAM command");
+
+      try
+      {
+        rv = conn_.process (packet);
+      }
+      catch (const Error &)
+      {
+        if (dlconn->reconnect <= 0 || dlconn->terminate)
+          throw;
+
+        rv = DLERROR;
+      }
+
+      if (rv == DLPACKET)
+        co_return packet;
+
+      /* Replies to the commands restoring a reconnected stream */
+      if (rv == DLREPLY)
+        continue;
+
+      if (rv == DLENDED && (dlconn->terminate || dlconn->streaming != 1))
+        co_return std::nullopt;
+
+      /* Connection lost, start reconnecting */
+      if (rv == DLENDED || rv == DLERROR)
+      {
+        if (dlconn->reconnect <= 0)
+          co_return std::nullopt;
+
+        dlconn->reconnect_time = 0;
+        if (dl_reconnect_step (dlconn) != 1)
+          co_await wait_io ();
+        continue;
+      }
+
+      co_await wait_io ();
+    }
+  }
+
+  /**
+   * Write a packet, see dl_write_nb().  With @a ack the coroutine
+   * suspends until the server reply arrives and the reply value is
+   * returned, -1 for an error reply, otherwise 0 is returned once the
+   * packet is sent.  Throws Error when no reply arrives within
+   * DLCP.iotimeout.
+   */
+  Task<int64_t> write (Bytes data, std::string streamid,
+                       dltime_t datastart, dltime_t dataend, bool ack = true)
+  {
+    DLCP *dlconn = conn_.get ();
+    Packet reply;
+    int64_t replydeadline = 0;
+    int rv;
+
+    if (dlconn->link < 0 || dlconn->connecting || dlconn->streaming)
+      throw Error ("write(): connection not open or in streaming mode");
+
+    if (dl_write_nb (dlconn, const_cast<std::byte *> (data.data ()),
+                     static_cast<int> (data.size ()), streamid.data (),
+                     datastart, dataend, (ack) ? 1 : 0) < 0)
+      throw Error ("write(): problem queuing WRITE command");
+
+    if (ack && dlconn->iotimeout)
+      replydeadline = dl_monotime () + (int64_t)std::abs (dlconn->iotimeout) * 1000000;
+
+    for (;;)
+    {
+      rv = conn_.process (reply);
+
+      if (rv == DLREPLY)
+        co_return (reply.streamid () == "OK") ? reply.pktid () : -1;
+
+      /* Packets are not expected when not streaming, skip them */
+      if (rv == DLPACKET)
+        continue;
+
+      if (rv == DLENDED)
+        throw Error ("write(): connection closed");
+
+      if (!ack && dlconn->sendqtail == dlconn->sendqhead)
+        co_return 0;
+
+      if (replydeadline && dl_monotime () >= replydeadline)
+        throw Error ("write(): timeout waiting for reply");
+
+      co_await wait_io (replydeadline);
+    }
+  }
+
+  /** Set the terminate flag, see dl_terminate() */
+  void terminate () noexcept { conn_.terminate (); }
+
+private:
+  /* Wait for the events and deadline of the connection, or an earlier
+     deadline */
+  Scheduler::Ready wait_io (int64_t deadline = 0) noexcept
+  {
+    DLCP *dlconn         = conn_.get ();
+    int64_t conndeadline = dl_deadline (dlconn);
+
+    if (conndeadline && (!deadline || conndeadline < deadline))
+      deadline = conndeadline;
+
+    return scheduler_.ready (static_cast<int> (dlconn->link), dl_interest (dlconn), deadline);
+  }
+
+  Scheduler &scheduler_;
+  Connection conn_;
+};
+
+} /* namespace dali */
+
+#endif /* LIBDALI_ASYNC_HPP */
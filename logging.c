@@ -346,7 +346,7 @@ dl_log_rl (DLLog *log, int level, int verb, const char *format, ...)
 int
 dl_log_main (DLLog *logp, int level, int verb, const char *format, va_list *varlist)
 {
-  static char message[MAX_LOG_MSG_LENGTH];
+  char message[MAX_LOG_MSG_LENGTH];
   int retvalue = 0;
   int presize;
 
@@ -0,0 +1,683 @@
+/***********************************************************************/ /**
+ * @file merge.c
+ *
+ * Time-ordered merge of packets collected from multiple connections.
+ *
+ * Packets collected from each connection are buffered in a binary
+ * min-heap keyed by data start or packet time and released in time
+ * order once no earlier packet can be expected: every source has
+ * delivered a packet at or after the key, the newest key seen is more
+ * than the reorder window later, or the packet has been held for the
+ * maximum delay.  Packets arriving earlier than the last released
+ * packet are late and reported separately.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+/* Longest wait between collection attempts, for keepalive timing (microseconds) */
+#define MERGE_MAXWAIT 500000
+
+/* Buffered packet */
+typedef struct MergeSlot_s
+{
+  DLPacket packet;
+  char *data;
+  dltime_t key;
+  uint64_t sequence;            /* Arrival order, breaks ties between equal keys */
+  int64_t arrival;              /* Monotonic time of arrival (microseconds) */
+  int source;
+} MergeSlot;
+
+/* Packet source */
+typedef struct MergeSource_s
+{
+  DLCP *dlconn;
+  dltime_t lastkey;             /* Latest key received from source */
+  int8_t havekey;
+  int8_t ended;
+} MergeSource;
+
+struct DLMerge_s
+{
+  MergeSource *sources;
+  int sourcecount;
+  DLPPollFD *pollfds;           /* Sockets to wait on, one per source */
+  int8_t keytype;
+  dltime_t window;
+  int64_t maxdelay;
+  DLCollectCallback latecallback;
+  void *latedata;
+  DLDedup *dedup;
+
+  MergeSlot *slots;             /* Buffer pool */
+  int slotcount;
+  MergeSlot **freeslots;
+  int freecount;
+  MergeSlot **heap;             /* Buffered packets ordered by key */
+  int heapcount;
+  size_t maxdatasize;
+
+  uint64_t sequence;
+  dltime_t maxkey;              /* Latest key received from any source */
+  int8_t havemax;
+  dltime_t lastkey;             /* Key of last released packet */
+  int8_t released;
+
+  DLMergeStats stats;
+};
+
+static int merge_poll (DLMerge *merge, int *source);
+static MergeSlot *merge_ready (DLMerge *merge, int64_t now);
+static int merge_ended (DLMerge *merge);
+static int merge_wait (DLMerge *merge, int64_t wait);
+static int merge_before (const MergeSlot *a, const MergeSlot *b);
+static void merge_push (DLMerge *merge, MergeSlot *slot);
+static MergeSlot *merge_pop (DLMerge *merge);
+
+/***********************************************************************/ /**
+ * @brief Create a time-ordered merge of packets from connections
+ *
+ * Allocate and initialize a merge of the packets collected from @a
+ * count connections in @a dlconns, which must be connected and
+ * configured, e.g. positioned and with match expressions set.  The
+ * connections are not owned by the merge and must remain valid until
+ * it is freed.
+ *
+ * Packets are ordered by data start time when @a keytype is
+ * ::DLMERGE_DATASTART or by packet time when ::DLMERGE_PKTTIME.  A
+ * buffered packet is released when every source still collecting has
+ * received a packet with the same or a later time, when a packet more
+ * than @a window later has been received from any source, or when it
+ * has been buffered for @a maxdelay microseconds, whichever is first.
+ * A @a window or @a maxdelay of 0 disables that condition.  At most
+ * @a maxbuffer packets are buffered, when full the earliest packet is
+ * released.
+ *
+ * A packet with a time earlier than the last released packet is late,
+ * it is passed to @a latecallback, if not NULL, and not released.
+ *
+ * @param dlconns Array of DataLink Connection Parameters
+ * @param count Number of connections in @a dlconns
+ * @param keytype Packet time to order by, ::DLMERGE_DATASTART or ::DLMERGE_PKTTIME
+ * @param window Reorder window (dltime_t ticks)
+ * @param maxdelay Maximum time a packet is buffered (microseconds)
+ * @param maxbuffer Maximum number of buffered packets, 0 for ::DLMERGE_MAXBUFFER
+ * @param latecallback Function called for late packets, NULL for none
+ * @param latedata Pointer passed to @a latecallback
+ *
+ * @return allocated DLMerge on success, NULL on error.
+ ***************************************************************************/
+DLMerge *
+dl_merge_new (DLCP **dlconns, int count, int8_t keytype, dltime_t window,
+              int64_t maxdelay, int maxbuffer,
+              DLCollectCallback latecallback, void *latedata)
+{
+  DLMerge *merge;
+  size_t maxdatasize = 0;
+  size_t size;
+  int idx;
+
+  if (!dlconns || count <= 0)
+    return NULL;
+
+  if (keytype != DLMERGE_DATASTART && keytype != DLMERGE_PKTTIME)
+  {
+    dl_log (2, 0, "dl_merge_new(): unrecognized key type: %d\n", keytype);
+    return NULL;
+  }
+
+  if (maxbuffer <= 0)
+    maxbuffer = DLMERGE_MAXBUFFER;
+
+  /* Buffers hold the largest packet of any source */
+  for (idx = 0; idx < count; idx++)
+  {
+    if (!dlconns[idx])
+      return NULL;
+
+    size = (dlconns[idx]->maxpktsize > 0) ? (size_t)dlconns[idx]->maxpktsize : MAXPACKETSIZE;
+
+    if (size > maxdatasize)
+      maxdatasize = size;
+  }
+
+  if (!(merge = (DLMerge *)calloc (1, sizeof (DLMerge))))
+  {
+    dl_log (2, 0, "dl_merge_new(): error allocating memory\n");
+    return NULL;
+  }
+
+  merge->sourcecount  = count;
+  merge->keytype      = keytype;
+  merge->window       = window;
+  merge->maxdelay     = maxdelay;
+  merge->latecallback = latecallback;
+  merge->latedata     = latedata;
+  merge->slotcount    = maxbuffer;
+  merge->maxdatasize  = maxdatasize;
+
+  if (!(merge->sources = (MergeSource *)calloc (count, sizeof (MergeSource))) ||
+      !(merge->pollfds = (DLPPollFD *)calloc (count, sizeof (DLPPollFD))) ||
+      !(merge->slots = (MergeSlot *)calloc (maxbuffer, sizeof (MergeSlot))) ||
+      !(merge->freeslots = (MergeSlot **)malloc (maxbuffer * sizeof (MergeSlot *))) ||
+      !(merge->heap = (MergeSlot **)malloc (maxbuffer * sizeof (MergeSlot *))))
+  {
+    dl_log (2, 0, "dl_merge_new(): error allocating memory\n");
+    dl_merge_free (merge);
+    return NULL;
+  }
+
+  for (idx = 0; idx < count; idx++)
+    merge->sources[idx].dlconn = dlconns[idx];
+
+  /* Packet data buffers are allocated as first used */
+  for (idx = 0; idx < maxbuffer; idx++)
+    merge->freeslots[merge->freecount++] = &merge->slots[maxbuffer - 1 - idx];
+
+  return merge;
+} /* End of dl_merge_new() */
+
+/***********************************************************************/ /**
+ * @brief Return the next packet of a merge in time order
+ *
+ * Collect packets from all sources of a merge, with dl_collect_nb(),
+ * and return the next packet released in time order.  If no packet
+ * can be released wait for up to @a timeout microseconds for packets
+ * to arrive or buffered packets to be released, or do not wait if @a
+ * timeout is 0.
+ *
+ * A source ends when its connection is terminated, see
+ * dl_terminate().  When all sources have ended the remaining buffered
+ * packets are released in order and then DLENDED is returned.
+ *
+ * @param merge Merge to collect from
+ * @param packet Pointer to a DLPacket struct for the packet header information
+ * @param packetdata Pointer to a buffer for packet data
+ * @param maxdatasize Maximum data size to write to @a packetdata
+ * @param source Index of the source connection of the packet, or of
+ * the failed connection on error, may be NULL
+ * @param timeout Maximum time to wait (microseconds)
+ *
+ * @retval DLPACKET when a packet is returned.
+ * @retval DLNOPACKET when no packet was released within the timeout.
+ * @retval DLENDED when all sources have ended and no packets remain.
+ * @retval DLERROR when an error occurred.  If a source connection
+ * failed it is excluded from the merge, which may continue.
+ ***************************************************************************/
+int
+dl_merge_next (DLMerge *merge, DLPacket *packet, void *packetdata,
+               size_t maxdatasize, int *source, int64_t timeout)
+{
+  MergeSlot *slot;
+  int64_t deadline = 0;
+  int64_t now;
+  int64_t wait;
+
+  if (!merge || !packet || !packetdata)
+    return DLERROR;
+
+  if (timeout > 0)
+    deadline = dlp_monotime () + timeout;
+
+  for (;;)
+  {
+    if (merge_poll (merge, source) < 0)
+      return DLERROR;
+
+    now = dlp_monotime ();
+
+    if ((slot = merge_ready (merge, now)))
+      break;
+
+    if (merge_ended (merge))
+      return DLENDED;
+
+    if (timeout <= 0 || (wait = deadline - now) <= 0)
+      return DLNOPACKET;
+
+    /* Wake when the earliest buffered packet reaches the maximum delay */
+    if (merge->maxdelay > 0 && merge->heapcount > 0 &&
+        merge->heap[0]->arrival + merge->maxdelay - now < wait)
+      wait = merge->heap[0]->arrival + merge->maxdelay - now;
+
+    if (wait > MERGE_MAXWAIT)
+      wait = MERGE_MAXWAIT;
+
+    if (merge_wait (merge, wait) < 0)
+      return DLERROR;
+  }
+
+  if ((size_t)slot->packet.datasize > maxdatasize)
+  {
+    dl_log (2, 0, "dl_merge_next(): packet data larger (%d) than receiving buffer (%" PRIsize_t ")\n",
+            slot->packet.datasize, maxdatasize);
+    merge->freeslots[merge->freecount++] = slot;
+    return DLERROR;
+  }
+
+  memcpy (packet, &slot->packet, sizeof (DLPacket));
+  memcpy (packetdata, slot->data, slot->packet.datasize);
+
+  if (source)
+    *source = slot->source;
+
+  merge->freeslots[merge->freecount++] = slot;
+
+  return DLPACKET;
+} /* End of dl_merge_next() */
+
+/***********************************************************************/ /**
+ * @brief Attach a duplicate filter to a merge
+ *
+ * Packets received by the merge are checked with dl_dedup_check()
+ * and duplicates are dropped before ordering, so the same streams may
+ * be collected from redundant servers.  The filter is not owned by the
+ * merge and must remain valid until it is detached, by attaching NULL,
+ * or the merge is freed.
+ *
+ * @param merge Merge to attach to
+ * @param dedup Duplicate filter, NULL to detach
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_merge_dedup (DLMerge *merge, DLDedup *dedup)
+{
+  if (!merge)
+    return -1;
+
+  merge->dedup = dedup;
+
+  return 0;
+} /* End of dl_merge_dedup() */
+
+/***********************************************************************/ /**
+ * @brief Get statistics of a merge
+ *
+ * @param merge Merge to get statistics for
+ * @param stats Statistics to populate
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_merge_stats (DLMerge *merge, DLMergeStats *stats)
+{
+  if (!merge || !stats)
+    return -1;
+
+  memcpy (stats, &merge->stats, sizeof (DLMergeStats));
+  stats->buffered = merge->heapcount;
+
+  return 0;
+} /* End of dl_merge_stats() */
+
+/***********************************************************************/ /**
+ * @brief Free a merge
+ *
+ * Free all memory associated with a merge, the source connections are
+ * not disconnected or freed.
+ *
+ * @param merge Merge to free
+ ***************************************************************************/
+void
+dl_merge_free (DLMerge *merge)
+{
+  int idx;
+
+  if (!merge)
+    return;
+
+  if (merge->slots)
+  {
+    for (idx = 0; idx < merge->slotcount; idx++)
+    {
+      if (merge->slots[idx].data)
+        free (merge->slots[idx].data);
+    }
+
+    free (merge->slots);
+  }
+
+  if (merge->sources)
+    free (merge->sources);
+
+  if (merge->pollfds)
+    free (merge->pollfds);
+
+  if (merge->freeslots)
+    free (merge->freeslots);
+
+  if (merge->heap)
+    free (merge->heap);
+
+  free (merge);
+} /* End of dl_merge_free() */
+
+/***************************************************************************
+ * merge_poll:
+ *
+ * Collect the packets available from the sources into the buffer, one
+ * packet from each source in turn, until no more are available or the
+ * buffer is full.  Late packets are reported and dropped.
+ *
+ * Returns 0 on success and -1 when a source failed, setting the
+ * source index.
+ ***************************************************************************/
+static int
+merge_poll (DLMerge *merge, int *source)
+{
+  MergeSource *src;
+  MergeSlot *slot;
+  int collected;
+  int idx;
+  int rv;
+
+  do
+  {
+    collected = 0;
+
+    for (idx = 0; idx < merge->sourcecount && merge->freecount > 0; idx++)
+    {
+      src = &merge->sources[idx];
+
+      if (src->ended)
+        continue;
+
+      slot = merge->freeslots[merge->freecount - 1];
+
+      if (!slot->data && !(slot->data = (char *)malloc (merge->maxdatasize)))
+      {
+        dl_log (2, 0, "merge_poll(): error allocating memory\n");
+        return -1;
+      }
+
+      rv = dl_collect_nb (src->dlconn, &slot->packet, slot->data, merge->maxdatasize, 0);
+
+      if (rv == DLNOPACKET)
+        continue;
+
+      if (rv != DLPACKET)
+      {
+        src->ended = 1;
+
+        if (rv == DLERROR)
+        {
+          dl_log_r (src->dlconn, 2, 0, "[%s] merge source %d failed, excluding from merge\n",
+                    src->dlconn->addr, idx);
+
+          if (source)
+            *source = idx;
+
+          return -1;
+        }
+
+        continue;
+      }
+
+      collected = 1;
+      merge->stats.received++;
+
+      slot->key = (merge->keytype == DLMERGE_PKTTIME) ? slot->packet.pkttime : slot->packet.datastart;
+
+      if (!src->havekey || slot->key > src->lastkey)
+      {
+        src->lastkey = slot->key;
+        src->havekey = 1;
+      }
+
+      if (!merge->havemax || slot->key > merge->maxkey)
+      {
+        merge->maxkey  = slot->key;
+        merge->havemax = 1;
+      }
+
+      /* Drop duplicates, e.g. from redundant sources */
+      if (merge->dedup && dl_dedup_check (merge->dedup, &slot->packet, slot->data) == 1)
+      {
+        merge->stats.duplicates++;
+        continue;
+      }
+
+      /* Report and drop packets earlier than already released */
+      if (merge->released && slot->key < merge->lastkey)
+      {
+        merge->stats.late++;
+
+        if (merge->latecallback)
+          merge->latecallback (&slot->packet, slot->data, merge->latedata);
+
+        continue;
+      }
+
+      slot->sequence = merge->sequence++;
+      slot->arrival  = dlp_monotime ();
+      slot->source   = idx;
+
+      merge->freecount--;
+      merge_push (merge, slot);
+
+      if ((uint64_t)merge->heapcount > merge->stats.highwater)
+        merge->stats.highwater = merge->heapcount;
+    }
+  } while (collected && merge->freecount > 0);
+
+  return 0;
+} /* End of merge_poll() */
+
+/***************************************************************************
+ * merge_ready:
+ *
+ * Remove and return the earliest buffered packet if it can be released.
+ *
+ * Returns the released packet or NULL if none.
+ ***************************************************************************/
+static MergeSlot *
+merge_ready (DLMerge *merge, int64_t now)
+{
+  MergeSlot *top;
+  MergeSource *src;
+  int passed = 1;
+  int idx;
+
+  if (merge->heapcount == 0)
+    return NULL;
+
+  top = merge->heap[0];
+
+  /* Released when all sources still collecting have passed the key */
+  for (idx = 0; idx < merge->sourcecount; idx++)
+  {
+    src = &merge->sources[idx];
+
+    if (!src->ended && (!src->havekey || src->lastkey < top->key))
+    {
+      passed = 0;
+      break;
+    }
+  }
+
+  /* Otherwise released when beyond the reorder window, held for the
+   * maximum delay or the buffer is full */
+  if (!passed && !(merge->window > 0 && merge->maxkey - top->key > merge->window))
+  {
+    if (merge->maxdelay > 0 && now - top->arrival >= merge->maxdelay)
+      merge->stats.expired++;
+    else if (merge->freecount == 0)
+      merge->stats.overflow++;
+    else
+      return NULL;
+  }
+
+  merge_pop (merge);
+
+  merge->lastkey  = top->key;
+  merge->released = 1;
+  merge->stats.released++;
+
+  return top;
+} /* End of merge_ready() */
+
+/***************************************************************************
+ * merge_ended:
+ *
+ * Returns 1 when all sources have ended and no packets are buffered,
+ * otherwise 0.
+ ***************************************************************************/
+static int
+merge_ended (DLMerge *merge)
+{
+  int idx;
+
+  if (merge->heapcount > 0)
+    return 0;
+
+  for (idx = 0; idx < merge->sourcecount; idx++)
+  {
+    if (!merge->sources[idx].ended)
+      return 0;
+  }
+
+  return 1;
+} /* End of merge_ended() */
+
+/***************************************************************************
+ * merge_wait:
+ *
+ * Wait for up to @a wait microseconds for data from any source still
+ * collecting.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+merge_wait (DLMerge *merge, int64_t wait)
+{
+  int npoll = 0;
+  int idx;
+
+  for (idx = 0; idx < merge->sourcecount; idx++)
+  {
+    if (merge->sources[idx].ended || merge->sources[idx].dlconn->link < 0)
+      continue;
+
+    merge->pollfds[npoll].fd      = merge->sources[idx].dlconn->link;
+    merge->pollfds[npoll].events  = POLLIN;
+    merge->pollfds[npoll].revents = 0;
+    npoll++;
+  }
+
+  /* Nothing to wait on, sleep for the wait time */
+  if (npoll == 0)
+  {
+    if (wait > 0)
+      dlp_usleep ((unsigned long int)wait);
+    return 0;
+  }
+
+  if (dlp_poll (merge->pollfds, npoll, wait) < 0 && errno != EINTR)
+  {
+    dl_log (2, 0, "merge_wait(): poll() error: %s\n", dlp_strerror ());
+    return -1;
+  }
+
+  return 0;
+} /* End of merge_wait() */
+
+/***************************************************************************
+ * merge_before:
+ *
+ * Returns 1 if buffered packet @a a is ordered before @a b, otherwise 0.
+ ***************************************************************************/
+static int
+merge_before (const MergeSlot *a, const MergeSlot *b)
+{
+  if (a->key != b->key)
+    return (a->key < b->key);
+
+  return (a->sequence < b->sequence);
+} /* End of merge_before() */
+
+/***************************************************************************
+ * merge_push:
+ *
+ * Add a packet to the heap of buffered packets.
+ ***************************************************************************/
+static void
+merge_push (DLMerge *merge, MergeSlot *slot)
+{
+  int idx = merge->heapcount++;
+  int parent;
+
+  /* Sift up */
+  while (idx > 0)
+  {
+    parent = (idx - 1) / 2;
+
+    if (!merge_before (slot, merge->heap[parent]))
+      break;
+
+    merge->heap[idx] = merge->heap[parent];
+    idx              = parent;
+  }
+
+  merge->heap[idx] = slot;
+} /* End of merge_push() */
+
+/***************************************************************************
+ * merge_pop:
+ *
+ * Remove and return the earliest packet from the heap of buffered
+ * packets.
+ ***************************************************************************/
+static MergeSlot *
+merge_pop (DLMerge *merge)
+{
+  MergeSlot *top;
+  MergeSlot *last;
+  int idx = 0;
+  int child;
+
+  if (merge->heapcount == 0)
+    return NULL;
+
+  top  = merge->heap[0];
+  last = merge->heap[--merge->heapcount];
+
+  /* Sift down */
+  while ((child = 2 * idx + 1) < merge->heapcount)
+  {
+    if (child + 1 < merge->heapcount && merge_before (merge->heap[child + 1], merge->heap[child]))
+      child++;
+
+    if (!merge_before (merge->heap[child], last))
+      break;
+
+    merge->heap[idx] = merge->heap[child];
+    idx              = child;
+  }
+
+  if (merge->heapcount > 0)
+    merge->heap[idx] = last;
+
+  return top;
+} /* End of merge_pop() */
@@ -27,6 +27,55 @@
 #include "libdali.h"
 #include "portable.h"
 
+/* Connection attempts raced across server addresses */
+typedef struct ConnectRace_s
+{
+  struct addrinfo *order[DLCONNECT_MAXADDRS];    /* Addresses in order of attempts */
+  struct addrinfo *pendaddr[DLCONNECT_MAXADDRS]; /* Addresses of attempts in progress */
+  SOCKET pending[DLCONNECT_MAXADDRS];            /* Sockets of attempts in progress */
+  int naddrs;
+  int npending;
+  int next;                     /* Index of next address to attempt */
+  int64_t nextstart;            /* Monotonic time to start the next attempt */
+  int64_t deadline;             /* Monotonic time to give up, 0 for none */
+} ConnectRace;
+
+/* Non-blocking connection state, see dl_connect_step() */
+typedef struct ConnectState_s
+{
+  int state;                    /* CONNECT_RESOLVING, _RACING, _SENDID or _RECVID */
+  int8_t cached;                /* Flag indicating addresses are from the cache */
+  ConnectRace race;
+  char sendbuf[258];            /* ID command */
+  size_t sendlen;
+  size_t sent;
+} ConnectState;
+
+#define CONNECT_RESOLVING 0
+#define CONNECT_RACING    1
+#define CONNECT_SENDID    2
+#define CONNECT_RECVID    3
+
+static SOCKET connect_addresses (DLCP *dlconn, struct addrinfo *addr0, int *family);
+static void race_init (DLCP *dlconn, ConnectRace *race, struct addrinfo *addr0);
+static int race_step (DLCP *dlconn, ConnectRace *race, SOCKET *sock, int *family,
+                      int64_t maxwait);
+static void race_cancel (ConnectRace *race);
+static int connect_opened (DLCP *dlconn, SOCKET sock, int family);
+static void connect_abort (DLCP *dlconn);
+static int64_t frame_datasize (const char *header);
+static void connect_standby (DLCP *dlconn);
+static int standby_alive (DLCP *standby);
+static int restore_stream (DLCP *dlconn);
+static int restore_stream_nb (DLCP *dlconn);
+static void reconnect_backoff (DLCP *dlconn);
+static void swap_connection (DLCP *a, DLCP *b);
+static int recv_block (DLCP *dlconn, int blocking);
+static int recv_socket (DLCP *dlconn, void *buffer, size_t len);
+static int recv_stamped (DLCP *dlconn, void *buffer, size_t len);
+static int recv_buffer (DLCP *dlconn);
+static int recv_fill (DLCP *dlconn, size_t needed);
+
 /***********************************************************************/ /**
  * @brief Connect to a DataLink server
  *
@@ -38,6 +87,14 @@
  * neither is specified (only a separator) then 'localhost' and port
  * '16000' are assumed.
  *
+ * When the server address resolves to several addresses connection
+ * attempts are raced, see DLCONNECT_DELAY, and the first to connect is
+ * used.
+ *
+ * Resolved addresses are cached for DLRESOLVE_TTL seconds, see
+ * dl_resolve_ttl(), and resolved again if none can be connected.  The
+ * resolution can be started in advance with dl_resolve_start().
+ *
  * If a permanent error is detected (invalid port specified) the
  * dlconn->terminate flag will be set so the dl_collect() family of
  * routines will not continue trying to connect.
@@ -50,15 +107,7 @@
 SOCKET
 dl_connect (DLCP *dlconn)
 {
-  struct addrinfo *addr0 = NULL;
-  struct addrinfo *addr = NULL;
-  struct addrinfo hints;
-  SOCKET sock;
-  long int nport;
-  char nodename[300] = {0};
-  char nodeport[100] = {0};
-  char *ptr, *tail;
-  int timeout;
+  SOCKET sock = -1;
   int socket_family = -1;
 
   if (dlp_sockstartup ())
@@ -67,296 +116,1251 @@ dl_connect (DLCP *dlconn)
     return -1;
   }
 
-  /* Search address host-port separator, first for '@', then ':' */
-  if ((ptr = strchr (dlconn->addr, '@')) == NULL && (ptr = strchr (dlconn->addr, ':')))
+  /* Abandon a connection started with dl_connect_step() */
+  if (dlconn->connecting)
+    dl_disconnect (dlconn);
+
+  /* Use addresses resolved for this connection if still current */
+  if (dlconn->addrinfo && !dlp_resolve_current (dlconn->addrinfo))
   {
-    /* If first ':' is not the last, this is not a separator */
-    if (strrchr (dlconn->addr, ':') != ptr)
-      ptr = NULL;
+    dlp_resolve_release (dlconn->addrinfo);
+    dlconn->addrinfo = NULL;
   }
 
-  /* If address begins with the separator */
-  if (dlconn->addr == ptr)
+  if (dlconn->addrinfo)
   {
-    if (dlconn->addr[1] == '\0')  /* Only a separator */
+    if (dlp_resolve_wait (dlconn, dlconn->addrinfo) == 0)
+      sock = connect_addresses (dlconn, dlp_resolve_addr (dlconn->addrinfo), &socket_family);
+
+    /* Resolve again if the cached addresses do not work */
+    if (sock < 0)
     {
-      strcpy (nodename, LD_DEFAULT_HOST);
-      strcpy (nodeport, LD_DEFAULT_PORT);
+      dlp_resolve_invalidate (dlconn->addrinfo);
+      dlp_resolve_release (dlconn->addrinfo);
+      dlconn->addrinfo = NULL;
     }
-    else /* Only a port */
+  }
+
+  /* Resolve server address and try all resulting addresses */
+  if (sock < 0)
+  {
+    if (!(dlconn->addrinfo = dlp_resolve (dlconn, 1)))
+      return -1;
+
+    if ((sock = connect_addresses (dlconn, dlp_resolve_addr (dlconn->addrinfo), &socket_family)) < 0)
     {
-      strcpy (nodename, LD_DEFAULT_HOST);
-      strncpy (nodeport, dlconn->addr + 1, sizeof (nodeport) - 1);
+      dl_log_r (dlconn, 2, 0, "[%s] Cannot connect: %s\n", dlconn->addr, dlp_strerror ());
+      return -1;
     }
   }
-  /* Otherwise if no separator, use default port */
-  else if (ptr == NULL)
+
+  if (connect_opened (dlconn, sock, socket_family))
+    return -1;
+
+  /* Everything should be connected, exchange IDs */
+  if (dl_exchangeIDs (dlconn, 1) == -1)
   {
-    strncpy (nodename, dlconn->addr, sizeof (nodename));
-    strcpy (nodeport, LD_DEFAULT_PORT);
+    dlp_sockclose (sock);
+    dlconn->link = -1;
+    return -1;
   }
-  /* Otherwise separate host and port */
-  else if ((ptr - dlconn->addr) < sizeof (nodename))
+
+  /* Open a standby connection if requested */
+  if (dlconn->standby && !dlconn->standbyconn)
+    connect_standby (dlconn);
+
+  return sock;
+} /* End of dl_connect() */
+
+/***********************************************************************/ /**
+ * @brief Connect to a DataLink server without blocking
+ *
+ * Advance a non-blocking connection to a DataLink server, for use
+ * with an application's event loop.  The first call starts the
+ * connection, following calls continue it through resolving the
+ * server address, connecting, sending the client ID and receiving and
+ * parsing the server ID.  No call blocks.
+ *
+ * While the connection is in progress 'dlconn->link' is the socket to
+ * wait on, if any, and dl_interest() reports the events to wait for.
+ * Call this function again when one of those events occurs or at the
+ * time returned by dl_deadline(), whichever is first.  The socket may
+ * change between calls as attempts are made to different addresses,
+ * while several attempts are in progress only the latest is on
+ * 'dlconn->link' and dl_deadline() reports a short interval to check
+ * the others.
+ *
+ * The connection is otherwise made as by dl_connect(), except that no
+ * standby connection is opened.  The connection is abandoned with
+ * dl_disconnect().
+ *
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return 1 when connected, 0 when in progress and -1 on error.
+ ***************************************************************************/
+int
+dl_connect_step (DLCP *dlconn)
+{
+  ConnectState *cs;
+  SOCKET sock = -1;
+  char header[256];
+  int socket_family = -1;
+  int64_t now;
+  int rv;
+
+  if (!dlconn)
+    return -1;
+
+  /* Start a new connection */
+  if (!(cs = (ConnectState *)dlconn->connecting))
   {
-    strncpy (nodename, dlconn->addr, (ptr - dlconn->addr));
-    nodename[(ptr - dlconn->addr)] = '\0';
-    strncpy (nodeport, ptr + 1, sizeof (nodeport) - 1);
+    if (dlconn->link >= 0)
+      return 1;
+
+    if (dlp_sockstartup ())
+    {
+      dl_log_r (dlconn, 2, 0, "could not initialize network sockets\n");
+      return -1;
+    }
+
+    if (!(cs = (ConnectState *)calloc (1, sizeof (ConnectState))))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_connect_step(): error allocating memory\n", dlconn->addr);
+      return -1;
+    }
+
+    dlconn->connecting = cs;
+
+    /* Use addresses resolved for this connection if still current */
+    if (dlconn->addrinfo && !dlp_resolve_current (dlconn->addrinfo))
+    {
+      dlp_resolve_release (dlconn->addrinfo);
+      dlconn->addrinfo = NULL;
+    }
+
+    if (dlconn->addrinfo)
+      cs->cached = 1;
+    else if (!(dlconn->addrinfo = dlp_resolve (dlconn, 0)))
+      goto failed;
+
+    cs->state = CONNECT_RESOLVING;
   }
 
-  /* Sanity test the port number */
-  nport = strtoul (nodeport, &tail, 10);
-  if (*tail || (nport <= 0 || nport > 0xffff))
+  now = dlp_monotime ();
+
+  if (cs->state != CONNECT_RESOLVING && cs->race.deadline && now >= cs->race.deadline)
   {
-    dl_log_r (dlconn, 2, 0, "server port specified incorrectly\n");
-    dlconn->terminate = 1;
-    return -1;
+    dl_log_r (dlconn, 2, 0, "[%s] Cannot connect: timeout\n", dlconn->addr);
+    goto failed;
   }
 
-  /* Resolve for either IPv4 or IPv6 (PF_UNSPEC) for a TCP stream (SOCK_STREAM) */
-  memset (&hints, 0, sizeof (hints));
-  hints.ai_family   = PF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-
-  /* Resolve server address */
-  if (getaddrinfo (nodename, nodeport, &hints, &addr0))
+  if (cs->state == CONNECT_RESOLVING)
   {
-    dl_log_r (dlconn, 2, 0, "cannot resolve hostname %s\n", nodename);
-    return -1;
+    if (!dlp_resolve_done (dlconn->addrinfo))
+      return 0;
+
+    if (dlp_resolve_wait (dlconn, dlconn->addrinfo))
+      goto failed;
+
+    race_init (dlconn, &cs->race, dlp_resolve_addr (dlconn->addrinfo));
+    cs->state = CONNECT_RACING;
   }
 
-  /* Traverse addresses trying to connect */
-  sock = -1;
-  for (addr = addr0; addr != NULL; addr = addr->ai_next)
+  if (cs->state == CONNECT_RACING)
   {
-    /* Create socket */
-    if ((sock = socket (addr->ai_family, addr->ai_socktype, addr->ai_protocol)) < 0)
+    rv = race_step (dlconn, &cs->race, &sock, &socket_family, 0);
+
+    if (rv == 0)
     {
-      continue;
+      /* Wait on the most recent attempt */
+      dlconn->link = cs->race.pending[cs->race.npending - 1];
+      return 0;
     }
 
-    /* Set socket I/O timeouts if possible */
-    if (dlconn->iotimeout)
-    {
-      timeout = (dlconn->iotimeout > 0) ? dlconn->iotimeout : -dlconn->iotimeout;
+    dlconn->link = -1;
 
-      if (dlp_setsocktimeo (sock, timeout) == 1)
+    if (rv < 0)
+    {
+      /* Resolve again if the cached addresses do not work */
+      if (cs->cached)
       {
-        /* Negate timeout to indicate socket timeouts are set */
-        dlconn->iotimeout = -timeout;
+        dlp_resolve_invalidate (dlconn->addrinfo);
+        dlp_resolve_release (dlconn->addrinfo);
+
+        if (!(dlconn->addrinfo = dlp_resolve (dlconn, 0)))
+          goto failed;
+
+        cs->cached = 0;
+        cs->state  = CONNECT_RESOLVING;
+        return 0;
       }
+
+      dl_log_r (dlconn, 2, 0, "[%s] Cannot connect: %s\n", dlconn->addr, dlp_strerror ());
+      goto failed;
     }
 
-    /* Connect socket */
-    if ((dlp_sockconnect (sock, addr->ai_addr, addr->ai_addrlen)))
+    if (connect_opened (dlconn, sock, socket_family))
+      goto failed;
+
+    /* Prepare ID command including client ID */
+    rv = snprintf (header, sizeof (header), "ID %s", dlconn->clientid);
+    if (rv > 254)
+      rv = 254;
+
+    dl_log_r (dlconn, 1, 2, "[%s] sending: %s\n", dlconn->addr, header);
+
+    cs->sendbuf[0] = 'D';
+    cs->sendbuf[1] = 'L';
+    cs->sendbuf[2] = (uint8_t)rv;
+    memcpy (cs->sendbuf + 3, header, rv);
+    cs->sendlen = 3 + rv;
+    cs->sent    = 0;
+    cs->state   = CONNECT_SENDID;
+  }
+
+  if (cs->state == CONNECT_SENDID)
+  {
+    while (cs->sent < cs->sendlen)
     {
-      dlp_sockclose (sock);
-      sock = -1;
-      continue;
+      if ((rv = (int)send (dlconn->link, cs->sendbuf + cs->sent, cs->sendlen - cs->sent, 0)) < 0)
+      {
+        if (!dlp_noblockcheck ())
+          return 0;
+
+        dl_log_r (dlconn, 2, 0, "[%s] error sending data: %s\n", dlconn->addr, dlp_strerror ());
+        goto failed;
+      }
+
+      cs->sent += rv;
     }
 
-    socket_family = addr->ai_family;
-    break;
+    cs->state = CONNECT_RECVID;
   }
 
-  if (sock < 0)
+  if (cs->state == CONNECT_RECVID)
   {
-    dl_log_r (dlconn, 2, 0, "[%s] Cannot connect: %s\n", dlconn->addr, dlp_strerror ());
-    dlp_sockclose (sock);
-    freeaddrinfo (addr0);
-    return -1;
-  }
+    if ((rv = dlp_recvframe (dlconn, header, NULL, NULL)) == 0)
+      return 0;
 
-  freeaddrinfo(addr0);
+    if (rv < 0)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] %s receiving server ID\n", dlconn->addr,
+                (rv == -1) ? "connection closed" : "error");
+      goto failed;
+    }
 
-  if (dlconn->iotimeout < 0)
-  {
-    dl_log_r (dlconn, 1, 2, "[%s] using system socket timeouts\n", dlconn->addr);
+    if (dlp_serverid (dlconn, header, rv, 1))
+      goto failed;
   }
 
-  /* Set socket to non-blocking */
-  if (dlp_socknoblock (sock))
+  free (cs);
+  dlconn->connecting = NULL;
+
+  return 1;
+
+failed:
+  connect_abort (dlconn);
+  dl_disconnect (dlconn);
+  return -1;
+} /* End of dl_connect_step() */
+
+/***********************************************************************/ /**
+ * @brief Get the socket events a connection is waiting for
+ *
+ * Report the events on 'dlconn->link' an application's event loop
+ * should wait for before calling dl_connect_step() for a connection in
+ * progress, or dl_process() for a connected socket.  A connected
+ * socket waits for data from the server and, while commands queued
+ * with dl_stream_nb() or dl_write_nb() remain to be sent, to be
+ * writable.
+ *
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return A combination of ::DLWANT_READ and ::DLWANT_WRITE, 0 when no
+ * socket events are waited for, e.g. while resolving the server address.
+ ***************************************************************************/
+int
+dl_interest (DLCP *dlconn)
+{
+  ConnectState *cs;
+
+  if (!dlconn)
+    return 0;
+
+  if ((cs = (ConnectState *)dlconn->connecting))
   {
-    dl_log_r (dlconn, 2, 0, "Error setting socket to non-blocking\n");
-    dlp_sockclose (sock);
-    return -1;
+    switch (cs->state)
+    {
+    case CONNECT_RACING:
+    case CONNECT_SENDID:
+      return (dlconn->link >= 0) ? DLWANT_WRITE : 0;
+    case CONNECT_RECVID:
+      return DLWANT_READ;
+    default:
+      return 0;
+    }
   }
 
-  /* Socket connected */
-  dl_log_r (dlconn, 1, 1, "[%s] network socket opened ", dlconn->addr);
-  switch (socket_family)
+  if (dlconn->link < 0)
+    return 0;
+
+  return (dlconn->sendqtail > dlconn->sendqhead) ? (DLWANT_READ | DLWANT_WRITE) : DLWANT_READ;
+} /* End of dl_interest() */
+
+/***********************************************************************/ /**
+ * @brief Get the time a connection needs attention
+ *
+ * Report the time at which dl_connect_step() must be called for a
+ * connection in progress even if no socket events occurred: to start
+ * the next connection attempt, to check attempts other than the one on
+ * 'dlconn->link', every ::DLCONNECT_POLL microseconds, to check for
+ * completion of the server address lookup or to time out.
+ *
+ * For a connected socket, report the time at which dl_process() must
+ * be called to send a keepalive to the server or to detect the I/O
+ * timeout, DLCP.iotimeout, while sending or receiving a packet.
+ *
+ * For a lost connection waiting to be reconnected, report the time of
+ * the next attempt with dl_reconnect_step(), 'dlconn->reconnect_time'.
+ *
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return Monotonic time, see dl_monotime(), in microseconds, or 0 if
+ * there is no deadline.
+ ***************************************************************************/
+int64_t
+dl_deadline (DLCP *dlconn)
+{
+  ConnectState *cs;
+  int64_t deadline = 0;
+  int64_t iodeadline;
+  int64_t recheck;
+
+  if (!dlconn)
+    return 0;
+
+  if (!(cs = (ConnectState *)dlconn->connecting))
   {
-  case PF_INET:
-    dl_log_r (dlconn, 1, 1, "(IPv4)\n");
-    break;
-  case PF_INET6:
-    dl_log_r (dlconn, 1, 1, "(IPv6)\n");
-    break;
-  default:
-    dl_log_r (dlconn, 1, 1, "(Unknown protocol)\n");
+    if (dlconn->link < 0)
+      return (dlconn->reconnect_time > 0) ? dlconn->reconnect_time : 0;
+
+    /* Keepalive while streaming */
+    if (dlconn->streaming && dlconn->keepalive > 0 && dlconn->keepalive_trig >= 0)
+      deadline = dlconn->keepalive_time + (int64_t)dlconn->keepalive * 1000000;
+
+    /* I/O timeout while a send or a frame is incomplete */
+    if (dlconn->iotimeout &&
+        (dlconn->sendqtail > dlconn->sendqhead || dlconn->recvtail > dlconn->recvhead))
+    {
+      iodeadline = dlconn->iotime + (int64_t)abs (dlconn->iotimeout) * 1000000;
+
+      if (!deadline || iodeadline < deadline)
+        deadline = iodeadline;
+    }
+
+    return deadline;
   }
 
-  dlconn->link = sock;
+  if (cs->state == CONNECT_RESOLVING)
+    return dlp_monotime () + DLRESOLVE_POLL;
 
-  /* Everything should be connected, exchange IDs */
-  if (dl_exchangeIDs (dlconn, 1) == -1)
+  if (cs->state == CONNECT_RACING && cs->race.next < cs->race.naddrs)
+    deadline = cs->race.nextstart;
+
+  /* Only the latest attempt is waited on, check the others regularly */
+  if (cs->state == CONNECT_RACING && cs->race.npending > 1)
   {
-    dlp_sockclose (sock);
-    return -1;
+    recheck = dlp_monotime () + DLCONNECT_POLL;
+
+    if (!deadline || recheck < deadline)
+      deadline = recheck;
   }
 
-  return sock;
-} /* End of dl_connect() */
+  if (cs->race.deadline && (!deadline || cs->race.deadline < deadline))
+    deadline = cs->race.deadline;
+
+  return deadline;
+} /* End of dl_deadline() */
 
 /***********************************************************************/ /**
  * @brief Disconnect a DataLink connection
  *
  * Close the network socket associated with connection and set
- * 'dlconn->link' to -1.
+ * 'dlconn->link' to -1.  A standby connection is also closed.
  *
  * @param dlconn DataLink Connection Parameters
  ***************************************************************************/
 void
 dl_disconnect (DLCP *dlconn)
 {
+  DLCP *standby = dlconn->standbyconn;
+
+  if (dlconn->connecting)
+    connect_abort (dlconn);
+
+  if (standby)
+  {
+    dlconn->standbyconn = NULL;
+    standby->log        = NULL;
+    dl_disconnect (standby);
+    dl_freedlcp (standby);
+  }
+
   if (dlconn->link >= 0)
   {
+    dlp_ioring_release (dlconn);
+
     dlp_sockclose (dlconn->link);
     dlconn->link = -1;
 
+    dlconn->recvhead  = 0;
+    dlconn->recvtail  = 0;
+    dlconn->sendqhead = 0;
+    dlconn->sendqtail = 0;
+
     dl_log_r (dlconn, 1, 1, "[%s] network socket closed\n", dlconn->addr);
   }
 } /* End of dl_disconnect() */
 
 /***********************************************************************/ /**
- * @brief Send arbitrary data to a DataLink server
+ * @brief Reconnect to a DataLink server and resume streaming
  *
- * This fundamental routine is used by other library routines to send
- * data via a DataLink connection.  Before data is sent the socket to
- * set to blocking mode and back to non-blocking before returning
- * unless there was an error in which case the socket should be
- * disconnected.
+ * Replace the connection of @a dlconn with a new connection to the
+ * server, switching to the standby connection if one is open and has
+ * not been closed, and restore the state of the previous connection,
+ * connecting anew if that fails on the standby: the match and reject
+ * expressions set with dl_match() and dl_reject() are sent again and,
+ * if a packet has been received, the connection is positioned to the
+ * last packet received so streaming resumes with the following
+ * packet.  If that packet is no longer in the server buffer streaming
+ * resumes from the server's default position.
  *
- * If a user specified network I/O timeout was not applied at the
- * system socket level this routine will implement the timeout using
- * an alarm timer to interrupt the blocked send.
+ * This is used by dl_collect() and dl_collect_nb() to reconnect
+ * automatically when 'dlconn->reconnect' is set, but may also be
+ * called directly.  A single attempt is made.  When it fails the time
+ * of the next attempt is set in 'dlconn->reconnect_time' using an
+ * exponential backoff, from ::DLRECONNECT_MINBACKOFF up to
+ * 'dlconn->reconnect' seconds, with random jitter so that many
+ * clients do not reconnect in lockstep.
  *
  * @param dlconn DataLink Connection Parameters
- * @param buffer Buffer containing data to send
- * @param sendlen Number of bytes to send from buffer
  *
- * @retval 0 on success
- * @retval -1 on error.
+ * @return 0 on success and -1 on error.
  ***************************************************************************/
 int
-dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
+dl_reconnect (DLCP *dlconn)
 {
-  /* Set socket to blocking */
-  if (dlp_sockblock (dlconn->link))
-  {
-    dl_log_r (dlconn, 2, 0, "[%s] error setting socket to blocking\n",
-              dlconn->addr);
+  DLCP *standby;
+  int8_t switched = 0;
+
+  if (!dlconn)
     return -1;
-  }
 
-  /* Set timeout alarm if needed */
-  if (dlconn->iotimeout > 0)
+  /* Detach standby so it is not closed with the failed connection */
+  standby             = dlconn->standbyconn;
+  dlconn->standbyconn = NULL;
+
+  dl_disconnect (dlconn);
+  dlconn->streaming      = 0;
+  dlconn->keepalive_trig = -1;
+
+  if (standby)
   {
-    if (dlp_setioalarm (dlconn->iotimeout))
+    if (standby_alive (standby))
     {
-      dl_log_r (dlconn, 2, 0, "[%s] error setting network I/O timeout\n",
-                dlconn->addr);
+      dl_log_r (dlconn, 1, 1, "[%s] switching to standby connection\n", dlconn->addr);
+      swap_connection (dlconn, standby);
+      switched = 1;
+    }
+    else if (standby->link >= 0)
+    {
+      dl_log_r (dlconn, 1, 1, "[%s] standby connection lost\n", dlconn->addr);
     }
+
+    standby->log = NULL;
+    dl_disconnect (standby);
+    dl_freedlcp (standby);
   }
 
-  /* Send data */
-  if (send (dlconn->link, buffer, sendlen, 0) != (int64_t)sendlen)
+  if (switched && restore_stream (dlconn))
   {
-    dl_log_r (dlconn, 2, 0, "[%s] error sending data\n", dlconn->addr);
-    return -1;
+    /* The standby failed after the check, connect immediately */
+    dl_log_r (dlconn, 1, 1, "[%s] standby connection failed, connecting\n", dlconn->addr);
+    dl_disconnect (dlconn);
+    switched = 0;
   }
 
-  /* Cancel timeout alarm if set */
-  if (dlconn->iotimeout > 0)
+  if (switched)
   {
-    if (dlp_setioalarm (0))
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] error cancelling network I/O timeout\n",
-                dlconn->addr);
-    }
+    if (dlconn->standby)
+      connect_standby (dlconn);
   }
-
-  /* Set socket to non-blocking */
-  if (dlp_socknoblock (dlconn->link))
+  else if (dl_connect (dlconn) < 0 || restore_stream (dlconn))
   {
-    dl_log_r (dlconn, 2, 0, "[%s] error setting socket to non-blocking\n",
-              dlconn->addr);
-    return -1;
+    goto failed;
   }
 
+  dlconn->reconnect_time    = 0;
+  dlconn->reconnect_backoff = 0;
+  dlconn->reconnects++;
+
+  dl_log_r (dlconn, 1, 1, "[%s] reconnected\n", dlconn->addr);
+
   return 0;
-} /* End of dl_senddata() */
+
+failed:
+  dl_disconnect (dlconn);
+  reconnect_backoff (dlconn);
+
+  return -1;
+} /* End of dl_reconnect() */
 
 /***********************************************************************/ /**
- * @brief Create and send a DataLink packet
+ * @brief Reconnect to a DataLink server without blocking
  *
- * Send a DataLink packet created by combining an appropriate
- * preheader with @a headerbuf and, optionally, @a databuf.
+ * Advance a non-blocking reconnection of a lost connection, for use
+ * with an application's event loop in the manner of
+ * dl_connect_step().  The first call closes the lost connection and
+ * starts a new one, following calls continue it, waiting for the
+ * socket events reported by dl_interest() or the time reported by
+ * dl_deadline().  No call blocks.
  *
- * The header length must be larger than 0 but the packet length can
- * be 0 resulting in a header-only packet, commonly used for sending
- * commands.
+ * When connected the match and reject expressions set with
+ * dl_match() and dl_reject() and, if a packet has been received, the
+ * position after the last packet received are queued to be sent by
+ * dl_process(), which returns the server replies as ::DLREPLY.  The
+ * connection is not in streaming mode, queue the STREAM command with
+ * dl_stream_nb() to resume streaming.  No standby connection is used.
  *
- * If the response buffer @a respbuf is not NULL then read up to @a
- * resplen bytes into @a respbuf using dl_recvheader() after sending
- * the packet.  This is only designed for small pieces of data,
- * specifically the server acknowledgement to a command, which are a
- * header-only packets.
+ * When an attempt fails the time of the next attempt is set in
+ * 'dlconn->reconnect_time' as by dl_reconnect(), and reported by
+ * dl_deadline().  Calls before that time return 0 without starting
+ * the attempt.
  *
  * @param dlconn DataLink Connection Parameters
- * @param headerbuf Buffer containing DataLink packet header
- * @param headerlen Length of header buffer to send
- * @param databuf Buffer containing DataLink packet data
- * @param datalen Length of data buffer to send
- * @param respbuf Buffer to place response from server
- * @param resplen Length of response buffer
  *
- * @return number of bytes of response received
- * @retval 0 on success and @a respbuf is NULL
- * @retval -1 on error
+ * @return 1 when reconnected, 0 when in progress or waiting for the
+ * next attempt and -1 when an attempt failed.
  ***************************************************************************/
 int
-dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
-               void *databuf, size_t datalen,
-               void *respbuf, int resplen)
+dl_reconnect_step (DLCP *dlconn)
 {
-  int bytesread = 0; /* bytes read into resp buffer */
-  char wirepacket[MAXPACKETSIZE];
+  int rv;
 
-  if (!dlconn || !headerbuf)
+  if (!dlconn)
     return -1;
 
-  /* Sanity check that the header is not too large or zero */
-  if (headerlen > 255 || headerlen == 0)
+  /* Start an attempt when the backoff has passed */
+  if (!dlconn->connecting)
   {
-    dl_log_r (dlconn, 2, 0, "[%s] packet header size is invalid: %" PRIsize_t "\n",
-              dlconn->addr, headerlen);
-    return -1;
+    if (dlconn->reconnect_time > 0 && dlp_monotime () < dlconn->reconnect_time)
+      return 0;
+
+    dl_disconnect (dlconn);
+    dlconn->streaming      = 0;
+    dlconn->keepalive_trig = -1;
   }
 
-  /* Sanity check that the header + packet data is not too large */
-  if ((3 + headerlen + datalen) > MAXPACKETSIZE)
+  if ((rv = dl_connect_step (dlconn)) == 0)
+    return 0;
+
+  if (rv < 0 || restore_stream_nb (dlconn))
   {
-    dl_log_r (dlconn, 2, 0, "[%s] packet is too large (%" PRIsize_t "), max is %d\n",
-              dlconn->addr, (headerlen + datalen), MAXPACKETSIZE);
+    dl_disconnect (dlconn);
+    reconnect_backoff (dlconn);
     return -1;
   }
 
-  /* Set the synchronization and header size bytes */
-  wirepacket[0] = 'D';
-  wirepacket[1] = 'L';
-  wirepacket[2] = (uint8_t)headerlen;
+  dlconn->reconnect_time    = 0;
+  dlconn->reconnect_backoff = 0;
+  dlconn->reconnects++;
 
-  /* Copy header into the wire packet */
+  dl_log_r (dlconn, 1, 1, "[%s] reconnected\n", dlconn->addr);
+
+  return 1;
+} /* End of dl_reconnect_step() */
+
+/***************************************************************************
+ * connect_addresses:
+ *
+ * Connect to the first of a list of addresses to accept a connection,
+ * racing attempts in the manner of "Happy Eyeballs" (RFC 8305), see
+ * race_init() and race_step().
+ *
+ * Returns the connected socket, setting the address family, or -1 if
+ * no address could be connected.
+ ***************************************************************************/
+static SOCKET
+connect_addresses (DLCP *dlconn, struct addrinfo *addr0, int *family)
+{
+  ConnectRace race;
+  SOCKET sock = -1;
+
+  if (!addr0)
+    return -1;
+
+  race_init (dlconn, &race, addr0);
+
+  if (race_step (dlconn, &race, &sock, family, -1) != 1)
+    return -1;
+
+  return sock;
+} /* End of connect_addresses() */
+
+/***************************************************************************
+ * race_init:
+ *
+ * Initialize racing connection attempts to a list of addresses.  The
+ * addresses are ordered alternating between the family of the first
+ * and other families.  Attempts are abandoned after DLCP.iotimeout
+ * seconds if set.
+ ***************************************************************************/
+static void
+race_init (DLCP *dlconn, ConnectRace *race, struct addrinfo *addr0)
+{
+  struct addrinfo *first[DLCONNECT_MAXADDRS];
+  struct addrinfo *other[DLCONNECT_MAXADDRS];
+  struct addrinfo *addr;
+  int nfirst = 0;
+  int nother = 0;
+  int timeout;
+  int idx;
+
+  memset (race, 0, sizeof (ConnectRace));
+
+  /* Order addresses alternating between the family of the first and others */
+  for (addr = addr0; addr != NULL && nfirst + nother < DLCONNECT_MAXADDRS; addr = addr->ai_next)
+  {
+    if (addr->ai_family == addr0->ai_family)
+      first[nfirst++] = addr;
+    else
+      other[nother++] = addr;
+  }
+
+  for (idx = 0; idx < nfirst || idx < nother; idx++)
+  {
+    if (idx < nfirst)
+      race->order[race->naddrs++] = first[idx];
+    if (idx < nother)
+      race->order[race->naddrs++] = other[idx];
+  }
+
+  race->nextstart = dlp_monotime ();
+
+  if (dlconn->iotimeout)
+  {
+    timeout        = (dlconn->iotimeout > 0) ? dlconn->iotimeout : -dlconn->iotimeout;
+    race->deadline = race->nextstart + (int64_t)timeout * 1000000;
+  }
+} /* End of race_init() */
+
+/***************************************************************************
+ * race_step:
+ *
+ * Advance racing connection attempts: a non-blocking connect is
+ * started on the first address and on the next every DLCONNECT_DELAY
+ * microseconds, or as soon as an attempt fails, while earlier attempts
+ * continue.  The first to complete is kept and the others closed.
+ *
+ * Waits up to @a maxwait microseconds for attempts to complete, 0 to
+ * only check, or if negative until an attempt succeeds or all fail.
+ *
+ * Returns 1 when connected, setting the socket and address family, 0
+ * when attempts are in progress and -1 when all attempts failed.
+ ***************************************************************************/
+static int
+race_step (DLCP *dlconn, ConnectRace *race, SOCKET *sock, int *family,
+           int64_t maxwait)
+{
+  struct addrinfo *addr = NULL;
+  DLPPollFD pollfds[DLCONNECT_MAXADDRS];
+  SOCKET attempt;
+  int failed;
+  int npoll;
+  int pollidx;
+  int idx;
+  int timeout;
+  int64_t now;
+  int64_t wait;
+
+  for (;;)
+  {
+    now = dlp_monotime ();
+
+    /* Start the next attempt when due or when none are pending */
+    while (race->next < race->naddrs && (now >= race->nextstart || race->npending == 0))
+    {
+      addr = race->order[race->next++];
+
+      if ((attempt = socket (addr->ai_family, addr->ai_socktype, addr->ai_protocol)) < 0)
+        continue;
+
+      /* Apply the socket profile before connecting */
+      dlp_sockopt_apply (dlconn, attempt);
+
+      /* Set socket I/O timeouts if possible */
+      if (dlconn->iotimeout)
+      {
+        timeout = (dlconn->iotimeout > 0) ? dlconn->iotimeout : -dlconn->iotimeout;
+
+        if (dlp_setsocktimeo (attempt, timeout) == 1)
+        {
+          /* Negate timeout to indicate socket timeouts are set */
+          dlconn->iotimeout = -timeout;
+        }
+      }
+
+      /* Start a non-blocking connect */
+      if (dlp_socknoblock (attempt) ||
+          dlp_sockconnect (attempt, addr->ai_addr, addr->ai_addrlen))
+      {
+        dlp_sockclose (attempt);
+        continue;
+      }
+
+      race->pending[race->npending]  = attempt;
+      race->pendaddr[race->npending] = addr;
+      race->npending++;
+      race->nextstart = now + DLCONNECT_DELAY;
+    }
+
+    if (race->npending == 0)
+      return -1;
+
+    if (race->deadline && now >= race->deadline)
+    {
+      race_cancel (race);
+#if !defined(DLP_WIN)
+      errno = ETIMEDOUT;
+#endif
+      return -1;
+    }
+
+    /* Wait for an attempt to complete or the next to be due */
+    wait = (race->next < race->naddrs) ? race->nextstart - now : -1;
+
+    if (race->deadline && (wait < 0 || race->deadline - now < wait))
+      wait = race->deadline - now;
+
+    if (maxwait >= 0 && (wait < 0 || maxwait < wait))
+      wait = maxwait;
+
+    if (wait < 0)
+      wait = 1000000;
+
+    npoll = race->npending;
+
+    for (idx = 0; idx < npoll; idx++)
+    {
+      pollfds[idx].fd      = race->pending[idx];
+      pollfds[idx].events  = POLLOUT;
+      pollfds[idx].revents = 0;
+    }
+
+    failed = 0;
+
+    if (dlp_poll (pollfds, npoll, wait) > 0)
+    {
+      /* Keep the first connected socket, drop failed attempts */
+      for (pollidx = 0; pollidx < npoll; pollidx++)
+      {
+        if (!(pollfds[pollidx].revents & (POLLOUT | POLLERR | POLLHUP)))
+          continue;
+
+        for (idx = 0; idx < race->npending; idx++)
+          if (race->pending[idx] == (SOCKET)pollfds[pollidx].fd)
+            break;
+
+        if (dlp_sockconnected (race->pending[idx]) == 0)
+        {
+          *sock   = race->pending[idx];
+          *family = race->pendaddr[idx]->ai_family;
+
+          race->pending[idx] = race->pending[race->npending - 1];
+          race->npending--;
+          race_cancel (race);
+
+          return 1;
+        }
+
+        dlp_sockclose (race->pending[idx]);
+        race->nextstart = now;
+        failed          = 1;
+
+        race->pending[idx]  = race->pending[race->npending - 1];
+        race->pendaddr[idx] = race->pendaddr[race->npending - 1];
+        race->npending--;
+      }
+    }
+
+    /* When only checking, continue only to start attempts replacing failures */
+    if (maxwait == 0 && !failed)
+      return 0;
+  }
+} /* End of race_step() */
+
+/***************************************************************************
+ * race_cancel:
+ *
+ * Close the sockets of all connection attempts in progress.
+ ***************************************************************************/
+static void
+race_cancel (ConnectRace *race)
+{
+  int idx;
+
+  for (idx = 0; idx < race->npending; idx++)
+    dlp_sockclose (race->pending[idx]);
+
+  race->npending = 0;
+} /* End of race_cancel() */
+
+/***************************************************************************
+ * connect_opened:
+ *
+ * Set up a newly connected socket as the connection of 'dlconn'.
+ *
+ * Returns 0 on success and -1 on error, closing the socket.
+ ***************************************************************************/
+static int
+connect_opened (DLCP *dlconn, SOCKET sock, int family)
+{
+  if (dlconn->iotimeout < 0)
+  {
+    dl_log_r (dlconn, 1, 2, "[%s] using system socket timeouts\n", dlconn->addr);
+  }
+
+  /* Set socket to non-blocking */
+  if (dlp_socknoblock (sock))
+  {
+    dl_log_r (dlconn, 2, 0, "Error setting socket to non-blocking\n");
+    dlp_sockclose (sock);
+    return -1;
+  }
+
+  /* Socket connected */
+  dl_log_r (dlconn, 1, 1, "[%s] network socket opened ", dlconn->addr);
+  switch (family)
+  {
+  case PF_INET:
+    dl_log_r (dlconn, 1, 1, "(IPv4)\n");
+    break;
+  case PF_INET6:
+    dl_log_r (dlconn, 1, 1, "(IPv6)\n");
+    break;
+  default:
+    dl_log_r (dlconn, 1, 1, "(Unknown protocol)\n");
+  }
+
+  dlconn->link = sock;
+
+  /* Discard any data buffered from a previous connection */
+  dlconn->recvhead = 0;
+  dlconn->recvtail = 0;
+
+  dlp_sockopt_reset (dlconn);
+
+  return 0;
+} /* End of connect_opened() */
+
+/***************************************************************************
+ * connect_abort:
+ *
+ * Abandon a connection started with dl_connect_step(), closing the
+ * sockets of connection attempts in progress.  A socket already
+ * connected remains in 'dlconn->link'.
+ ***************************************************************************/
+static void
+connect_abort (DLCP *dlconn)
+{
+  ConnectState *cs = (ConnectState *)dlconn->connecting;
+
+  if (!cs)
+    return;
+
+  if (cs->state == CONNECT_RACING && cs->race.npending > 0)
+  {
+    race_cancel (&cs->race);
+    dlconn->link = -1;
+  }
+
+  free (cs);
+  dlconn->connecting = NULL;
+} /* End of connect_abort() */
+
+/***************************************************************************
+ * connect_standby:
+ *
+ * Open a standby connection to the server of a connection, failures
+ * are logged but not otherwise reported.
+ ***************************************************************************/
+static void
+connect_standby (DLCP *dlconn)
+{
+  DLCP *standby;
+
+  if (!(standby = dl_newdlcp (dlconn->addr, NULL)))
+    return;
+
+  strcpy (standby->clientid, dlconn->clientid);
+  standby->keepalive   = dlconn->keepalive;
+  standby->iotimeout   = dlconn->iotimeout;
+  standby->sockprofile = dlconn->sockprofile;
+  standby->log         = dlconn->log;
+
+  if (dl_connect (standby) < 0)
+  {
+    dl_log_r (dlconn, 1, 1, "[%s] cannot open standby connection\n", dlconn->addr);
+
+    standby->log = NULL;
+    dl_freedlcp (standby);
+    return;
+  }
+
+  dl_log_r (dlconn, 1, 2, "[%s] standby connection opened\n", dlconn->addr);
+
+  dlconn->standbyconn = standby;
+} /* End of connect_standby() */
+
+/***************************************************************************
+ * standby_alive:
+ *
+ * Check that an idle standby connection is still open: the socket has
+ * no pending error and is not readable.  Nothing is expected on an
+ * idle connection, data or the end of the connection means it cannot
+ * be used.
+ *
+ * Returns 1 if the connection is usable, otherwise 0.
+ ***************************************************************************/
+static int
+standby_alive (DLCP *standby)
+{
+  DLPPollFD pollfd;
+
+  if (standby->link < 0 || dlp_sockconnected (standby->link))
+    return 0;
+
+  pollfd.fd      = standby->link;
+  pollfd.events  = POLLIN;
+  pollfd.revents = 0;
+
+  return (dlp_poll (&pollfd, 1, 0) == 0) ? 1 : 0;
+} /* End of standby_alive() */
+
+/***************************************************************************
+ * restore_stream:
+ *
+ * Restore the stream selection and position of a connection after
+ * reconnecting, see dl_reconnect().
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+restore_stream (DLCP *dlconn)
+{
+  int64_t rv;
+
+  /* Restore stream selection */
+  if (dlconn->matchpattern && dl_match (dlconn, dlconn->matchpattern) < 0)
+    return -1;
+
+  if (dlconn->rejectpattern && dl_reject (dlconn, dlconn->rejectpattern) < 0)
+    return -1;
+
+  /* Resume after the last packet received */
+  if (dlconn->pktid > 0)
+  {
+    if ((rv = dl_position (dlconn, dlconn->pktid, dlconn->pkttime)) < 0)
+      return -1;
+
+    if (rv == 0)
+      dl_log_r (dlconn, 1, 0, "[%s] packet %" PRId64 " not found, resuming from server default position\n",
+                dlconn->addr, dlconn->pktid);
+  }
+
+  return 0;
+} /* End of restore_stream() */
+
+/***************************************************************************
+ * restore_stream_nb:
+ *
+ * Queue the commands restoring the stream selection and position of a
+ * new connection, as restore_stream() does without waiting for the
+ * replies, see dl_reconnect_step().
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+restore_stream_nb (DLCP *dlconn)
+{
+  char header[255];
+  int headerlen;
+
+  /* Restore stream selection */
+  if (dlconn->matchpattern)
+  {
+    headerlen = snprintf (header, sizeof (header), "MATCH %ld",
+                          (long int)strlen (dlconn->matchpattern));
+
+    if (dlp_sendqueue (dlconn, header, headerlen, dlconn->matchpattern,
+                       strlen (dlconn->matchpattern)) < 0)
+      return -1;
+  }
+
+  if (dlconn->rejectpattern)
+  {
+    headerlen = snprintf (header, sizeof (header), "REJECT %ld",
+                          (long int)strlen (dlconn->rejectpattern));
+
+    if (dlp_sendqueue (dlconn, header, headerlen, dlconn->rejectpattern,
+                       strlen (dlconn->rejectpattern)) < 0)
+      return -1;
+  }
+
+  /* Resume after the last packet received */
+  if (dlconn->pktid > 0)
+  {
+    headerlen = snprintf (header, sizeof (header), "POSITION SET %lld %lld",
+                          (long long int)dlconn->pktid, (long long int)dlconn->pkttime);
+
+    if (dlp_sendqueue (dlconn, header, headerlen, NULL, 0) < 0)
+      return -1;
+  }
+
+  return 0;
+} /* End of restore_stream_nb() */
+
+/***************************************************************************
+ * reconnect_backoff:
+ *
+ * Set the time of the next reconnection attempt after a failed
+ * attempt, using an exponential backoff from DLRECONNECT_MINBACKOFF up
+ * to DLCP.reconnect seconds with the delay randomly in the upper half.
+ ***************************************************************************/
+static void
+reconnect_backoff (DLCP *dlconn)
+{
+  int64_t maxbackoff;
+  int64_t backoff;
+  uint64_t jitter;
+
+  maxbackoff = (int64_t)((dlconn->reconnect > 0) ? dlconn->reconnect : 1) * 1000000;
+  backoff    = (dlconn->reconnect_backoff > 0) ? dlconn->reconnect_backoff * 2 : DLRECONNECT_MINBACKOFF;
+
+  if (backoff > maxbackoff)
+    backoff = maxbackoff;
+
+  dlconn->reconnect_backoff = backoff;
+
+  jitter = (uint64_t)dlp_monotime () ^ ((uint64_t)(uintptr_t)dlconn * 0x9E3779B97F4A7C15ULL);
+  jitter ^= jitter >> 29;
+  jitter *= 0xBF58476D1CE4E5B9ULL;
+  jitter ^= jitter >> 32;
+
+  dlconn->reconnect_time = dlp_monotime () + backoff / 2 + (int64_t)(jitter % (uint64_t)(backoff / 2 + 1));
+
+  dl_log_r (dlconn, 1, 1, "[%s] reconnect failed, retrying in %.1f seconds\n",
+            dlconn->addr, (double)(dlconn->reconnect_time - dlp_monotime ()) / 1000000.0);
+} /* End of reconnect_backoff() */
+
+/***************************************************************************
+ * swap_connection:
+ *
+ * Exchange the network connection state of two connections.
+ ***************************************************************************/
+static void
+swap_connection (DLCP *a, DLCP *b)
+{
+  DLCP tmp;
+
+  tmp.link        = a->link;
+  tmp.iotimeout   = a->iotimeout;
+  tmp.serverproto = a->serverproto;
+  tmp.maxpktsize  = a->maxpktsize;
+  tmp.writeperm   = a->writeperm;
+  tmp.recvbuf     = a->recvbuf;
+  tmp.recvbufsize = a->recvbufsize;
+  tmp.recvhead    = a->recvhead;
+  tmp.recvtail    = a->recvtail;
+  tmp.socktune    = a->socktune;
+  tmp.recvstamp   = a->recvstamp;
+  tmp.readstamp   = a->readstamp;
+
+  a->link        = b->link;
+  a->iotimeout   = b->iotimeout;
+  a->serverproto = b->serverproto;
+  a->maxpktsize  = b->maxpktsize;
+  a->writeperm   = b->writeperm;
+  a->recvbuf     = b->recvbuf;
+  a->recvbufsize = b->recvbufsize;
+  a->recvhead    = b->recvhead;
+  a->recvtail    = b->recvtail;
+  a->socktune    = b->socktune;
+  a->recvstamp   = b->recvstamp;
+  a->readstamp   = b->readstamp;
+
+  b->link        = tmp.link;
+  b->iotimeout   = tmp.iotimeout;
+  b->serverproto = tmp.serverproto;
+  b->maxpktsize  = tmp.maxpktsize;
+  b->writeperm   = tmp.writeperm;
+  b->recvbuf     = tmp.recvbuf;
+  b->recvbufsize = tmp.recvbufsize;
+  b->recvhead    = tmp.recvhead;
+  b->recvtail    = tmp.recvtail;
+  b->socktune    = tmp.socktune;
+  b->recvstamp   = tmp.recvstamp;
+  b->readstamp   = tmp.readstamp;
+} /* End of swap_connection() */
+
+/***********************************************************************/ /**
+ * @brief Send arbitrary data to a DataLink server
+ *
+ * This fundamental routine is used by other library routines to send
+ * data via a DataLink connection.  Before data is sent the socket to
+ * set to blocking mode and back to non-blocking before returning
+ * unless there was an error in which case the socket should be
+ * disconnected.
+ *
+ * If a user specified network I/O timeout was not applied at the
+ * system socket level this routine will implement the timeout using
+ * an alarm timer to interrupt the blocked send.
+ *
+ * Commands still queued to be sent without blocking, see
+ * dl_stream_nb(), are sent first so that commands stay in order.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param buffer Buffer containing data to send
+ * @param sendlen Number of bytes to send from buffer
+ *
+ * @retval 0 on success
+ * @retval -1 on error.
+ ***************************************************************************/
+int
+dl_senddata (DLCP *dlconn, void *buffer, size_t sendlen)
+{
+  size_t queuelen = dlconn->sendqtail - dlconn->sendqhead;
+
+  /* Set socket to blocking */
+  if (dlp_sockblock (dlconn->link))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] error setting socket to blocking\n",
+              dlconn->addr);
+    return -1;
+  }
+
+  /* Set timeout alarm if needed */
+  if (dlconn->iotimeout > 0)
+  {
+    if (dlp_setioalarm (dlconn->iotimeout))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] error setting network I/O timeout\n",
+                dlconn->addr);
+    }
+  }
+
+  /* Send queued commands and data */
+  if (queuelen > 0)
+  {
+    if (send (dlconn->link, dlconn->sendq + dlconn->sendqhead, queuelen, 0) != (int64_t)queuelen)
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] error sending data\n", dlconn->addr);
+      return -1;
+    }
+
+    dlconn->sendqhead = 0;
+    dlconn->sendqtail = 0;
+  }
+
+  if (send (dlconn->link, buffer, sendlen, 0) != (int64_t)sendlen)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] error sending data\n", dlconn->addr);
+    return -1;
+  }
+
+  /* Cancel timeout alarm if set */
+  if (dlconn->iotimeout > 0)
+  {
+    if (dlp_setioalarm (0))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] error cancelling network I/O timeout\n",
+                dlconn->addr);
+    }
+  }
+
+  /* Set socket to non-blocking */
+  if (dlp_socknoblock (dlconn->link))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] error setting socket to non-blocking\n",
+              dlconn->addr);
+    return -1;
+  }
+
+  return 0;
+} /* End of dl_senddata() */
+
+/***********************************************************************/ /**
+ * @brief Create and send a DataLink packet
+ *
+ * Send a DataLink packet created by combining an appropriate
+ * preheader with @a headerbuf and, optionally, @a databuf.
+ *
+ * The header length must be larger than 0 but the packet length can
+ * be 0 resulting in a header-only packet, commonly used for sending
+ * commands.
+ *
+ * If the response buffer @a respbuf is not NULL then read up to @a
+ * resplen bytes into @a respbuf using dl_recvheader() after sending
+ * the packet.  This is only designed for small pieces of data,
+ * specifically the server acknowledgement to a command, which are a
+ * header-only packets.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param headerbuf Buffer containing DataLink packet header
+ * @param headerlen Length of header buffer to send
+ * @param databuf Buffer containing DataLink packet data
+ * @param datalen Length of data buffer to send
+ * @param respbuf Buffer to place response from server
+ * @param resplen Length of response buffer
+ *
+ * @return number of bytes of response received
+ * @retval 0 on success and @a respbuf is NULL
+ * @retval -1 on error
+ ***************************************************************************/
+int
+dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
+               void *databuf, size_t datalen,
+               void *respbuf, int resplen)
+{
+  int bytesread = 0; /* bytes read into resp buffer */
+  int sendrv = 0;
+  char wirepacket[MAXPACKETSIZE];
+
+  if (!dlconn || !headerbuf)
+    return -1;
+
+  /* Sanity check that the header is not too large or zero */
+  if (headerlen > 255 || headerlen == 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] packet header size is invalid: %" PRIsize_t "\n",
+              dlconn->addr, headerlen);
+    return -1;
+  }
+
+  /* Sanity check that the header + packet data is not too large */
+  if ((3 + headerlen + datalen) > MAXPACKETSIZE)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] packet is too large (%" PRIsize_t "), max is %d\n",
+              dlconn->addr, (headerlen + datalen), MAXPACKETSIZE);
+    return -1;
+  }
+
+  /* Set the synchronization and header size bytes */
+  wirepacket[0] = 'D';
+  wirepacket[1] = 'L';
+  wirepacket[2] = (uint8_t)headerlen;
+
+  /* Copy header into the wire packet */
   memcpy (wirepacket + 3, headerbuf, headerlen);
 
   /* Copy packet data into the wire packet if supplied */
@@ -364,7 +1368,9 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
     memcpy (wirepacket + 3 + headerlen, databuf, datalen);
 
   /* Send data */
-  if (dl_senddata (dlconn, wirepacket, (3 + headerlen + datalen)) < 0)
+  sendrv = dl_senddata (dlconn, wirepacket, (3 + headerlen + datalen));
+
+  if (sendrv < 0)
   {
     /* Check for a message from the server */
     if ((bytesread = dl_recvheader (dlconn, respbuf, resplen, 0)) > 0)
@@ -397,6 +1403,11 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
  * receive data from a DataLink server.  Up to @a readlen bytes of
  * received data is placed into @a buffer.
  *
+ * Data is received into a connection buffer of ::DLRECVBUFSIZE bytes
+ * and served from there, so the headers and data of many small
+ * packets are collected with a single receive.  Requests larger than
+ * the buffer are received directly into @a buffer.
+ *
  * If @a blockflag is true (1) this function will block until @a
  * readlen bytes have been read.  If @a blockflag is false (0) and no
  * data is available for reading this function will immediately
@@ -420,6 +1431,9 @@ dl_sendpacket (DLCP *dlconn, void *headerbuf, size_t headerlen,
 int
 dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
 {
+  size_t avail;
+  int blocking = 0;
+  int direct;
   int nrecv;
   int nread  = 0;
   char *bptr = buffer;
@@ -429,49 +1443,62 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
     return -2;
   }
 
-  /* Set socket to blocking if requested */
-  if (blockflag)
-  {
-    if (dlp_sockblock (dlconn->link))
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] Error setting socket to blocking: %s\n",
-                dlconn->addr, dlp_strerror ());
-      return -2;
-    }
-  }
-
-  /* Set timeout alarm if needed */
-  if (dlconn->iotimeout > 0)
-  {
-    if (dlp_setioalarm (dlconn->iotimeout))
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] error setting network I/O timeout\n",
-                dlconn->addr);
-    }
-  }
+  /* Allocate receive buffer on first use */
+  if (recv_buffer (dlconn))
+    return -2;
 
   /* Recv until readlen bytes have been read */
   while (nread < (int64_t)readlen)
   {
-    if ((nrecv = recv (dlconn->link, bptr, readlen - nread, 0)) < 0)
+    /* Copy any buffered data */
+    if (dlconn->recvtail > dlconn->recvhead)
     {
-      /* The only acceptable error is no data on non-blocking */
-      if (!blockflag && !dlp_noblockcheck ())
-      {
-        /* Only break out if no data has yet been received */
-        if (nread == 0)
-          break;
+      avail = dlconn->recvtail - dlconn->recvhead;
 
-        /* Corner case: if some data has been received in non-blocking
-		 mode we will loop forever until readlen bytes are read */
-      }
-      else
+      if (avail > readlen - nread)
+        avail = readlen - nread;
+
+      memcpy (bptr, dlconn->recvbuf + dlconn->recvhead, avail);
+      dlconn->recvhead += avail;
+      bptr += avail;
+      nread += (int)avail;
+      continue;
+    }
+
+    dlconn->recvhead = 0;
+    dlconn->recvtail = 0;
+
+    /* Block if requested or once some data has been received */
+    if (!blocking && (blockflag || nread > 0))
+    {
+      if (recv_block (dlconn, 1))
       {
-        dl_log_r (dlconn, 2, 0, "[%s] recv(%d): %d %s\n",
-                  dlconn->addr, dlconn->link, nrecv, dlp_strerror ());
         nread = -2;
         break;
       }
+
+      blocking = 1;
+    }
+
+    /* Receive large remainders directly, otherwise fill the buffer */
+    direct = ((readlen - nread) >= DLRECVBUFSIZE);
+
+    if (direct)
+      nrecv = recv_socket (dlconn, bptr, readlen - nread);
+    else
+      nrecv = recv_socket (dlconn, dlconn->recvbuf, DLRECVBUFSIZE);
+
+    if (nrecv < 0)
+    {
+      /* The only acceptable error is no data on non-blocking, nothing
+         has been received if not blocking */
+      if (!blocking && !dlp_noblockcheck ())
+        break;
+
+      dl_log_r (dlconn, 2, 0, "[%s] recv(%d): %d %s\n",
+                dlconn->addr, dlconn->link, nrecv, dlp_strerror ());
+      nread = -2;
+      break;
     }
 
     /* Peer completed an orderly shutdown */
@@ -481,33 +1508,23 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
       break;
     }
 
-    /* Update recv pointer and byte count */
-    if (nrecv > 0)
+    /* Update recv pointer and byte count or buffered byte count */
+    if (direct)
     {
       bptr += nrecv;
       nread += nrecv;
     }
-  }
-
-  /* Cancel timeout alarm if set */
-  if (dlconn->iotimeout > 0)
-  {
-    if (dlp_setioalarm (0))
+    else
     {
-      dl_log_r (dlconn, 2, 0, "[%s] error cancelling network I/O timeout\n",
-                dlconn->addr);
+      dlconn->recvtail = nrecv;
     }
   }
 
-  /* Set socket to non-blocking if set to blocking */
-  if (blockflag)
-  {
-    if (dlp_socknoblock (dlconn->link))
-    {
-      dl_log_r (dlconn, 2, 0, "[%s] Error setting socket to non-blocking: %s\n",
-                dlconn->addr, dlp_strerror ());
+  /* Restore non-blocking mode if set to blocking */
+  if (blocking)
+  {
+    if (recv_block (dlconn, 0))
       return -2;
-    }
   }
 
   return nread;
@@ -523,8 +1540,12 @@ dl_recvdata (DLCP *dlconn, void *buffer, size_t readlen, uint8_t blockflag)
  * terminated.  The buffer must be at least 255 bytes in size.  The
  * maximum header length is effectively 254 bytes.
  *
+ * If @a blockflag is false (0) a header is only returned once it has
+ * been completely received, data of a partial header is kept in the
+ * receive buffer and 0 is returned, so this function never blocks.
+ *
  * @return number of bytes read on success
- * @retval 0 when no data available on non-blocking socket
+ * @retval 0 when no complete header is available on non-blocking socket
  * @retval -1 on connection shutdown
  * @retval -2 on error.
  ***************************************************************************/
@@ -533,6 +1554,7 @@ dl_recvheader (DLCP *dlconn, void *buffer, size_t buflen, uint8_t blockflag)
 {
   int bytesread = 0;
   int headerlen;
+  int rv;
   char *cbuffer = buffer;
 
   if (!dlconn || !buffer)
@@ -547,6 +1569,22 @@ dl_recvheader (DLCP *dlconn, void *buffer, size_t buflen, uint8_t blockflag)
     return -2;
   }
 
+  /* Without blocking, wait until the complete header is buffered so
+     that a partial header is never consumed */
+  if (!blockflag)
+  {
+    if (recv_buffer (dlconn))
+      return -2;
+
+    if ((rv = recv_fill (dlconn, 3)) <= 0)
+      return rv;
+
+    headerlen = (uint8_t)dlconn->recvbuf[dlconn->recvhead + 2];
+
+    if ((rv = recv_fill (dlconn, 3 + headerlen)) <= 0)
+      return rv;
+  }
+
   /* Receive synchronization bytes and header length */
   if ((bytesread = dl_recvdata (dlconn, buffer, 3, blockflag)) != 3)
   {
@@ -586,3 +1624,559 @@ dl_recvheader (DLCP *dlconn, void *buffer, size_t buflen, uint8_t blockflag)
 
   return bytesread;
 } /* End of dl_recvheader() */
+
+/***************************************************************************
+ * recv_block:
+ *
+ * Prepare the connection for blocking receives, including setting the
+ * timeout alarm if needed, or restore non-blocking mode.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+recv_block (DLCP *dlconn, int blocking)
+{
+  if (blocking)
+  {
+    /* Set socket to blocking */
+    if (dlp_sockblock (dlconn->link))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] Error setting socket to blocking: %s\n",
+                dlconn->addr, dlp_strerror ());
+      return -1;
+    }
+
+    /* Set timeout alarm if needed */
+    if (dlconn->iotimeout > 0)
+    {
+      if (dlp_setioalarm (dlconn->iotimeout))
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] error setting network I/O timeout\n",
+                  dlconn->addr);
+      }
+    }
+  }
+  else
+  {
+    /* Cancel timeout alarm if set */
+    if (dlconn->iotimeout > 0)
+    {
+      if (dlp_setioalarm (0))
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] error cancelling network I/O timeout\n",
+                  dlconn->addr);
+      }
+    }
+
+    /* Set socket to non-blocking */
+    if (dlp_socknoblock (dlconn->link))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] Error setting socket to non-blocking: %s\n",
+                dlconn->addr, dlp_strerror ());
+      return -1;
+    }
+  }
+
+  return 0;
+} /* End of recv_block() */
+
+/***************************************************************************
+ * recv_socket:
+ *
+ * Receive up to @a len bytes from the connection socket, with kernel
+ * receive timestamps when requested.
+ *
+ * Returns the number of bytes received, 0 on orderly shutdown or a
+ * negative value on error, see dlp_noblockcheck() for no data.
+ ***************************************************************************/
+static int
+recv_socket (DLCP *dlconn, void *buffer, size_t len)
+{
+  int nrecv;
+
+  if (dlconn->sockprofile.timestamps)
+    nrecv = recv_stamped (dlconn, buffer, len);
+  else
+    nrecv = (int)recv (dlconn->link, buffer, len, 0);
+
+  if (nrecv > 0)
+  {
+    dlconn->rxbytes += nrecv;
+
+    if (dlconn->latency || dlconn->sockprofile.timestamps)
+      dlconn->readstamp = dlp_time ();
+  }
+
+  return nrecv;
+} /* End of recv_socket() */
+
+/***************************************************************************
+ * recv_stamped:
+ *
+ * Receive up to @a len bytes from the socket with recvmsg(), setting
+ * DLCP.recvstamp to the kernel receive timestamp of the data, or 0 if
+ * none was returned.  Timestamps are requested for the socket with
+ * DLSocketProfile.timestamps, see dlp_sockopt_apply().  Under WIN
+ * kernel timestamps are not supported and recv() is used.
+ *
+ * Returns the number of bytes received, 0 on orderly shutdown or a
+ * negative value on error.
+ ***************************************************************************/
+static int
+recv_stamped (DLCP *dlconn, void *buffer, size_t len)
+{
+#if defined(DLP_WIN)
+  dlconn->recvstamp = 0;
+
+  return (int)recv (dlconn->link, buffer, len, 0);
+#else
+  union
+  {
+    char buf[CMSG_SPACE (sizeof (struct timespec)) + CMSG_SPACE (sizeof (struct timeval))];
+    struct cmsghdr align;
+  } control;
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  int nrecv;
+
+  iov.iov_base = buffer;
+  iov.iov_len  = len;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  if ((nrecv = (int)recvmsg (dlconn->link, &msg, 0)) <= 0)
+    return nrecv;
+
+  dlconn->recvstamp = 0;
+
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+  {
+    if (cmsg->cmsg_level != SOL_SOCKET)
+      continue;
+
+#if defined(SCM_TIMESTAMPNS)
+    if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+    {
+      struct timespec ts;
+
+      memcpy (&ts, CMSG_DATA (cmsg), sizeof (ts));
+      dlconn->recvstamp = (dltime_t)ts.tv_sec * DLTMODULUS + ts.tv_nsec / (1000000000 / DLTMODULUS);
+    }
+#endif
+#if defined(SCM_TIMESTAMP)
+    if (cmsg->cmsg_type == SCM_TIMESTAMP)
+    {
+      struct timeval tv;
+
+      memcpy (&tv, CMSG_DATA (cmsg), sizeof (tv));
+      dlconn->recvstamp = (dltime_t)tv.tv_sec * DLTMODULUS + tv.tv_usec / (1000000 / DLTMODULUS);
+    }
+#endif
+  }
+
+  return nrecv;
+#endif
+} /* End of recv_stamped() */
+
+/***************************************************************************
+ * recv_buffer:
+ *
+ * Allocate the receive buffer of a connection on first use.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+recv_buffer (DLCP *dlconn)
+{
+  if (dlconn->recvbuf)
+    return 0;
+
+  if (!(dlconn->recvbuf = (char *)malloc (DLRECVBUFSIZE)))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] cannot allocate receive buffer\n",
+              dlconn->addr);
+    return -1;
+  }
+
+  dlconn->recvbufsize = DLRECVBUFSIZE;
+  dlconn->recvhead    = 0;
+  dlconn->recvtail    = 0;
+
+  return 0;
+} /* End of recv_buffer() */
+
+/***************************************************************************
+ * recv_fill:
+ *
+ * Receive without blocking until at least @a needed bytes are
+ * buffered, unconsumed, in the receive buffer.  Buffered data is moved
+ * to the start of the buffer when the remainder would not fit and the
+ * buffer is grown if @a needed is larger than it.  Nothing is consumed,
+ * data received is kept for later calls when not enough is available.
+ *
+ * A connection added to a shared I/O ring using io_uring does not
+ * receive from the socket, the ring delivers data to the receive
+ * buffer.
+ *
+ * Returns 1 when @a needed bytes are buffered, 0 when not yet, -1 on
+ * connection shutdown and -2 on error.
+ ***************************************************************************/
+static int
+recv_fill (DLCP *dlconn, size_t needed)
+{
+  size_t avail;
+  char *newbuf;
+  int nrecv;
+
+  while ((avail = dlconn->recvtail - dlconn->recvhead) < needed)
+  {
+    /* Data is delivered by the shared I/O ring, see dlp_recvdeliver() */
+    if (dlconn->ioring && dlp_ioring_active (dlconn))
+      return 0;
+
+    /* Grow the buffer to hold the needed data */
+    if (needed > dlconn->recvbufsize)
+    {
+      if (!(newbuf = (char *)realloc (dlconn->recvbuf, needed)))
+      {
+        dl_log_r (dlconn, 2, 0, "[%s] cannot allocate receive buffer\n",
+                  dlconn->addr);
+        return -2;
+      }
+
+      dlconn->recvbuf     = newbuf;
+      dlconn->recvbufsize = needed;
+    }
+
+    /* Move buffered data to the start of the buffer */
+    if (dlconn->recvhead + needed > dlconn->recvbufsize || avail == 0)
+    {
+      memmove (dlconn->recvbuf, dlconn->recvbuf + dlconn->recvhead, avail);
+      dlconn->recvhead = 0;
+      dlconn->recvtail = avail;
+    }
+
+    nrecv = recv_socket (dlconn, dlconn->recvbuf + dlconn->recvtail,
+                         dlconn->recvbufsize - dlconn->recvtail);
+
+    if (nrecv < 0)
+    {
+      if (!dlp_noblockcheck ())
+        return 0;
+
+      dl_log_r (dlconn, 2, 0, "[%s] recv(%d): %d %s\n",
+                dlconn->addr, dlconn->link, nrecv, dlp_strerror ());
+      return -2;
+    }
+
+    /* Peer completed an orderly shutdown */
+    if (nrecv == 0)
+      return -1;
+
+    dlconn->recvtail += nrecv;
+    dlconn->iotime = dlp_monotime ();
+  }
+
+  return 1;
+} /* End of recv_fill() */
+
+/***************************************************************************
+ * dlp_recvdeliver:
+ *
+ * Append @a len bytes received for a connection by other means than
+ * recv_socket(), e.g. the shared I/O ring, to its receive buffer,
+ * moving buffered data to the start of the buffer or growing it as
+ * needed.  The received byte count and I/O time are updated as for
+ * data received from the socket.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dlp_recvdeliver (DLCP *dlconn, const void *data, size_t len)
+{
+  size_t avail;
+  size_t newsize;
+  char *newbuf;
+
+  if (recv_buffer (dlconn))
+    return -1;
+
+  avail = dlconn->recvtail - dlconn->recvhead;
+
+  /* Move buffered data to the start of the buffer */
+  if (dlconn->recvtail + len > dlconn->recvbufsize && dlconn->recvhead > 0)
+  {
+    memmove (dlconn->recvbuf, dlconn->recvbuf + dlconn->recvhead, avail);
+    dlconn->recvhead = 0;
+    dlconn->recvtail = avail;
+  }
+
+  /* Grow the buffer to hold the data */
+  if (dlconn->recvtail + len > dlconn->recvbufsize)
+  {
+    newsize = dlconn->recvbufsize;
+    while (newsize < dlconn->recvtail + len)
+      newsize *= 2;
+
+    if (!(newbuf = (char *)realloc (dlconn->recvbuf, newsize)))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] cannot allocate receive buffer\n",
+                dlconn->addr);
+      return -1;
+    }
+
+    dlconn->recvbuf     = newbuf;
+    dlconn->recvbufsize = newsize;
+  }
+
+  memcpy (dlconn->recvbuf + dlconn->recvtail, data, len);
+  dlconn->recvtail += len;
+  dlconn->rxbytes += len;
+  dlconn->iotime = dlp_monotime ();
+
+  if (dlconn->latency || dlconn->sockprofile.timestamps)
+  {
+    dlconn->recvstamp = 0;
+    dlconn->readstamp = dlp_time ();
+  }
+
+  return 0;
+} /* End of dlp_recvdeliver() */
+
+/***************************************************************************
+ * dlp_recvframe:
+ *
+ * Receive a complete DataLink frame, a header and any data following
+ * it, without blocking.  A partially received frame is kept in the
+ * receive buffer, which is grown if needed to hold the frame, and
+ * completed on later calls.
+ *
+ * The header is placed in @a header, which must be at least 256 bytes,
+ * and NULL terminated.  If @a data is not NULL it is set to the frame
+ * data in the receive buffer, valid until the next receive, and
+ * @a datasize to its length.  The length of data following a header is
+ * determined by the header type, see frame_datasize(), and may not
+ * exceed the server maximum packet size, or MAXPACKETSIZE if unknown.
+ *
+ * Returns the header length when a frame is complete, 0 when not yet
+ * complete, -1 on connection shutdown and -2 on error.
+ ***************************************************************************/
+int
+dlp_recvframe (DLCP *dlconn, char *header, char **data, size_t *datasize)
+{
+  int64_t fdatasize;
+  int64_t maxdatasize;
+  int headerlen;
+  int rv;
+
+  if (recv_buffer (dlconn))
+    return -2;
+
+  /* Synchronization bytes and header length */
+  if ((rv = recv_fill (dlconn, 3)) <= 0)
+    return rv;
+
+  if (dlconn->recvbuf[dlconn->recvhead] != 'D' ||
+      dlconn->recvbuf[dlconn->recvhead + 1] != 'L')
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] No DataLink packet detected\n",
+              dlconn->addr);
+    return -2;
+  }
+
+  if ((headerlen = (uint8_t)dlconn->recvbuf[dlconn->recvhead + 2]) == 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] Empty DataLink packet header\n",
+              dlconn->addr);
+    return -2;
+  }
+
+  /* Header */
+  if ((rv = recv_fill (dlconn, 3 + headerlen)) <= 0)
+    return rv;
+
+  memcpy (header, dlconn->recvbuf + dlconn->recvhead + 3, headerlen);
+  header[headerlen] = '\0';
+
+  if ((fdatasize = frame_datasize (header)) < 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] Cannot parse data size from header: %s\n",
+              dlconn->addr, header);
+    return -2;
+  }
+
+  /* Reject data larger than a packet before growing the buffer for it */
+  maxdatasize = (dlconn->maxpktsize > 0) ? dlconn->maxpktsize : MAXPACKETSIZE;
+
+  if (fdatasize > maxdatasize)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] Frame data size (%lld) larger than maximum packet size (%lld)\n",
+              dlconn->addr, (long long int)fdatasize, (long long int)maxdatasize);
+    return -2;
+  }
+
+  /* Data */
+  if ((rv = recv_fill (dlconn, 3 + headerlen + (size_t)fdatasize)) <= 0)
+    return rv;
+
+  if (data)
+    *data = dlconn->recvbuf + dlconn->recvhead + 3 + headerlen;
+  if (datasize)
+    *datasize = (size_t)fdatasize;
+
+  dlconn->recvhead += 3 + headerlen + (size_t)fdatasize;
+
+  return headerlen;
+} /* End of dlp_recvframe() */
+
+/***************************************************************************
+ * dlp_sendqueue:
+ *
+ * Add a DataLink frame, a header and optional data, to the send queue
+ * of a connection, to be sent by dlp_sendflush().
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dlp_sendqueue (DLCP *dlconn, const char *header, size_t headerlen,
+               const void *data, size_t datalen)
+{
+  size_t framesize;
+  size_t needed;
+  size_t newsize;
+  char *newbuf;
+
+  if (headerlen == 0 || headerlen > 254)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] packet header size is invalid: %" PRIsize_t "\n",
+              dlconn->addr, headerlen);
+    return -1;
+  }
+
+  framesize = 3 + headerlen + ((data) ? datalen : 0);
+
+  /* Drop sent data from the front of the queue */
+  if (dlconn->sendqhead > 0)
+  {
+    memmove (dlconn->sendq, dlconn->sendq + dlconn->sendqhead,
+             dlconn->sendqtail - dlconn->sendqhead);
+    dlconn->sendqtail -= dlconn->sendqhead;
+    dlconn->sendqhead = 0;
+  }
+
+  needed = dlconn->sendqtail + framesize;
+
+  if (needed > dlconn->sendqsize)
+  {
+    newsize = (dlconn->sendqsize) ? dlconn->sendqsize : 1024;
+    while (newsize < needed)
+      newsize *= 2;
+
+    if (!(newbuf = (char *)realloc (dlconn->sendq, newsize)))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] cannot allocate send queue\n", dlconn->addr);
+      return -1;
+    }
+
+    dlconn->sendq     = newbuf;
+    dlconn->sendqsize = newsize;
+  }
+
+  /* Start the I/O timeout when the queue becomes non-empty */
+  if (dlconn->sendqtail == 0)
+    dlconn->iotime = dlp_monotime ();
+
+  dlconn->sendq[dlconn->sendqtail]     = 'D';
+  dlconn->sendq[dlconn->sendqtail + 1] = 'L';
+  dlconn->sendq[dlconn->sendqtail + 2] = (uint8_t)headerlen;
+  memcpy (dlconn->sendq + dlconn->sendqtail + 3, header, headerlen);
+
+  if (data && datalen > 0)
+    memcpy (dlconn->sendq + dlconn->sendqtail + 3 + headerlen, data, datalen);
+
+  dlconn->sendqtail += framesize;
+
+  return 0;
+} /* End of dlp_sendqueue() */
+
+/***************************************************************************
+ * dlp_sendflush:
+ *
+ * Send as much of the send queue of a connection as possible without
+ * blocking.  A connection added to a shared I/O ring using io_uring
+ * does not send to the socket, the ring submits the queue.
+ *
+ * Returns 1 when the queue is empty, 0 when data remains queued and -1
+ * on error.
+ ***************************************************************************/
+int
+dlp_sendflush (DLCP *dlconn)
+{
+  int nsent;
+
+  if (dlconn->ioring && dlp_ioring_active (dlconn))
+    return (dlconn->sendqtail > dlconn->sendqhead) ? 0 : 1;
+
+  while (dlconn->sendqhead < dlconn->sendqtail)
+  {
+    nsent = (int)send (dlconn->link, dlconn->sendq + dlconn->sendqhead,
+                       dlconn->sendqtail - dlconn->sendqhead, 0);
+
+    if (nsent < 0)
+    {
+      if (!dlp_noblockcheck ())
+        return 0;
+
+      dl_log_r (dlconn, 2, 0, "[%s] error sending data: %s\n",
+                dlconn->addr, dlp_strerror ());
+      return -1;
+    }
+
+    dlconn->sendqhead += nsent;
+    dlconn->iotime = dlp_monotime ();
+  }
+
+  dlconn->sendqhead = 0;
+  dlconn->sendqtail = 0;
+
+  return 1;
+} /* End of dlp_sendflush() */
+
+/***************************************************************************
+ * frame_datasize:
+ *
+ * Determine the length of data following a DataLink header: the last
+ * field of PACKET headers, the third field of OK, ERROR and INFO
+ * headers and none for others.
+ *
+ * Returns the data length or -1 if it cannot be parsed.
+ ***************************************************************************/
+static int64_t
+frame_datasize (const char *header)
+{
+  long long int size;
+  const char *cp;
+
+  if (!strncmp (header, "PACKET ", 7))
+  {
+    if (!(cp = strrchr (header, ' ')) || sscanf (cp, " %lld", &size) != 1)
+      return -1;
+  }
+  else if (!strncmp (header, "OK ", 3) || !strncmp (header, "ERROR ", 6) ||
+           !strncmp (header, "INFO ", 5))
+  {
+    if (sscanf (header, "%*s %*s %lld", &size) != 1)
+      return -1;
+  }
+  else
+  {
+    return 0;
+  }
+
+  return (size >= 0) ? (int64_t)size : -1;
+} /* End of frame_datasize() */
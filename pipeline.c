@@ -0,0 +1,657 @@
+/***********************************************************************/ /**
+ * @file pipeline.c
+ *
+ * Threaded collection pipeline: an I/O thread collects packets from a
+ * connection into pooled buffers and dispatches them to worker
+ * threads over single-producer, single-consumer queues.
+ *
+ * Buffers cycle between the I/O thread and the workers through two
+ * rings per worker: a work queue carrying received packets to the
+ * worker and a return ring carrying handled buffers back.  Each ring
+ * has exactly one writer and one reader so no locks are needed.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+/* Cache line size used to separate ring indexes written by different threads */
+#define PIPELINE_CACHELINE 64
+
+/* Longest sleep while waiting on an empty or full ring (microseconds) */
+#define PIPELINE_MAXBACKOFF 1000
+
+/* Packet buffer */
+typedef struct PipelineSlot_s
+{
+  DLPacket packet;
+  char *data;
+} PipelineSlot;
+
+/* Single-producer, single-consumer ring of buffers */
+typedef struct PipelineRing_s
+{
+  PipelineSlot **slots;
+  uint64_t mask;
+  uint64_t limit;
+  char pad0[PIPELINE_CACHELINE];
+  uint64_t head;                /* Next to read, written by consumer */
+  char pad1[PIPELINE_CACHELINE];
+  uint64_t tail;                /* Next to write, written by producer */
+  char pad2[PIPELINE_CACHELINE];
+} PipelineRing;
+
+/* Worker thread parameters */
+typedef struct PipelineWorker_s
+{
+  DLPipeline *pipeline;
+  int index;
+  DLPThread thread;
+  int8_t running;
+  PipelineRing queue;           /* Received packets, I/O thread to worker */
+  PipelineRing done;            /* Handled buffers, worker to I/O thread */
+
+  /* Statistics written by the I/O thread */
+  uint64_t dispatched;
+  uint64_t highwater;
+  uint64_t queuefull;
+  uint64_t stallusec;
+
+  /* Statistics written by the worker thread */
+  uint64_t handled;
+  uint64_t bytes;
+} PipelineWorker;
+
+struct DLPipeline_s
+{
+  DLCP *dlconn;
+  DLPipelineHandler handler;
+  void *handlerdata;
+  int workercount;
+  int queuedepth;
+  PipelineWorker *workers;
+
+  PipelineSlot *slots;          /* Buffer pool */
+  char *slotdata;
+  size_t maxdatasize;
+  int slotcount;
+  PipelineSlot **freeslots;     /* Free buffers, used only by I/O thread */
+  int freecount;
+
+  DLPThread iothread;
+  int8_t iorunning;
+  uint64_t iodone;              /* Set by I/O thread when collection ends */
+  int collectrv;
+};
+
+static int ring_init (PipelineRing *ring, uint64_t limit);
+static int ring_push (PipelineRing *ring, PipelineSlot *slot);
+static PipelineSlot *ring_pop (PipelineRing *ring);
+static void pipeline_backoff (unsigned long int *backoff);
+static PipelineSlot *pipeline_getslot (DLPipeline *pipeline);
+static void pipeline_io (void *arg);
+static void pipeline_worker (void *arg);
+
+/***********************************************************************/ /**
+ * @brief Create a collection pipeline for a connection
+ *
+ * Allocate and initialize a pipeline that will collect packets from
+ * @a dlconn in an I/O thread and call @a handler for each packet in
+ * one of @a workers worker threads.  The worker for a packet is
+ * chosen by a hash of the stream ID, so all packets of a stream are
+ * handled by the same worker in the order they were received.
+ *
+ * The handler is called with the packet, its data, the index of the
+ * worker (0 to @a workers - 1) and @a handlerdata.  The packet and
+ * data are only valid for the duration of the call.  A non-zero
+ * return from the handler terminates the connection, see
+ * dl_terminate().
+ *
+ * @param dlconn DataLink Connection Parameters, connected and configured
+ * @param workers Number of worker threads
+ * @param queuedepth Depth of each worker queue, 0 for ::DLPIPELINE_QUEUEDEPTH
+ * @param handler Function called for each packet
+ * @param handlerdata Pointer passed to @a handler
+ *
+ * @return allocated DLPipeline on success, NULL on error.
+ ***************************************************************************/
+DLPipeline *
+dl_pipeline_new (DLCP *dlconn, int workers, int queuedepth,
+                 DLPipelineHandler handler, void *handlerdata)
+{
+  DLPipeline *pipeline;
+  int idx;
+
+  if (!dlconn || !handler)
+    return NULL;
+
+  if (workers <= 0 || queuedepth < 0)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_pipeline_new(): invalid worker count (%d) or queue depth (%d)\n",
+              dlconn->addr, workers, queuedepth);
+    return NULL;
+  }
+
+  if (!(pipeline = (DLPipeline *)calloc (1, sizeof (DLPipeline))))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_pipeline_new(): error allocating memory\n", dlconn->addr);
+    return NULL;
+  }
+
+  pipeline->dlconn      = dlconn;
+  pipeline->handler     = handler;
+  pipeline->handlerdata = handlerdata;
+  pipeline->workercount = workers;
+  pipeline->queuedepth  = (queuedepth) ? queuedepth : DLPIPELINE_QUEUEDEPTH;
+  pipeline->collectrv   = DLENDED;
+
+  /* Each worker holds at most a full queue and one buffer being handled */
+  pipeline->slotcount = workers * (pipeline->queuedepth + 1) + 1;
+
+  if (!(pipeline->workers = (PipelineWorker *)calloc (workers, sizeof (PipelineWorker))))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_pipeline_new(): error allocating memory\n", dlconn->addr);
+    free (pipeline);
+    return NULL;
+  }
+
+  for (idx = 0; idx < workers; idx++)
+  {
+    pipeline->workers[idx].pipeline = pipeline;
+    pipeline->workers[idx].index    = idx;
+
+    /* The return ring can hold every buffer, it never fills */
+    if (ring_init (&pipeline->workers[idx].queue, pipeline->queuedepth) ||
+        ring_init (&pipeline->workers[idx].done, pipeline->slotcount))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_pipeline_new(): error allocating memory\n", dlconn->addr);
+      pipeline->workercount = idx + 1;
+      dl_pipeline_free (pipeline);
+      return NULL;
+    }
+  }
+
+  return pipeline;
+} /* End of dl_pipeline_new() */
+
+/***********************************************************************/ /**
+ * @brief Start the threads of a collection pipeline
+ *
+ * Allocate the buffer pool, sized for the maximum packet size of the
+ * server, and start the worker threads and the I/O thread.  The I/O
+ * thread calls dl_collect() until the connection is terminated or an
+ * error occurs.
+ *
+ * The connection must not be used by the calling thread until the
+ * pipeline has finished, see dl_pipeline_wait() and dl_pipeline_stop().
+ *
+ * @param pipeline Pipeline from dl_pipeline_new()
+ *
+ * @retval 0 on success
+ * @retval -1 on error
+ ***************************************************************************/
+int
+dl_pipeline_start (DLPipeline *pipeline)
+{
+  DLCP *dlconn;
+  int idx;
+
+  if (!pipeline)
+    return -1;
+
+  dlconn = pipeline->dlconn;
+
+  if (pipeline->iorunning || pipeline->slots)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_pipeline_start(): pipeline already started\n", dlconn->addr);
+    return -1;
+  }
+
+  pipeline->maxdatasize = (dlconn->maxpktsize > 0) ? (size_t)dlconn->maxpktsize : MAXPACKETSIZE;
+
+  pipeline->slots     = (PipelineSlot *)calloc (pipeline->slotcount, sizeof (PipelineSlot));
+  pipeline->slotdata  = (char *)malloc ((size_t)pipeline->slotcount * pipeline->maxdatasize);
+  pipeline->freeslots = (PipelineSlot **)malloc (pipeline->slotcount * sizeof (PipelineSlot *));
+
+  if (!pipeline->slots || !pipeline->slotdata || !pipeline->freeslots)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_pipeline_start(): error allocating buffer pool\n", dlconn->addr);
+    return -1;
+  }
+
+  for (idx = 0; idx < pipeline->slotcount; idx++)
+  {
+    pipeline->slots[idx].data = pipeline->slotdata + (size_t)idx * pipeline->maxdatasize;
+    pipeline->freeslots[idx]  = &pipeline->slots[idx];
+  }
+  pipeline->freecount = pipeline->slotcount;
+
+  dl_log_r (dlconn, 1, 2, "[%s] starting pipeline with %d workers, queue depth %d\n",
+            dlconn->addr, pipeline->workercount, pipeline->queuedepth);
+
+  for (idx = 0; idx < pipeline->workercount; idx++)
+  {
+    if (dlp_thread_create (&pipeline->workers[idx].thread, pipeline_worker,
+                           &pipeline->workers[idx]))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] dl_pipeline_start(): cannot start worker thread\n", dlconn->addr);
+      DLP_STORE_RELEASE (&pipeline->iodone, 1);
+      dl_pipeline_wait (pipeline);
+      return -1;
+    }
+
+    pipeline->workers[idx].running = 1;
+  }
+
+  if (dlp_thread_create (&pipeline->iothread, pipeline_io, pipeline))
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dl_pipeline_start(): cannot start I/O thread\n", dlconn->addr);
+    DLP_STORE_RELEASE (&pipeline->iodone, 1);
+    dl_pipeline_wait (pipeline);
+    return -1;
+  }
+
+  pipeline->iorunning = 1;
+
+  return 0;
+} /* End of dl_pipeline_start() */
+
+/***********************************************************************/ /**
+ * @brief Wait for a collection pipeline to finish
+ *
+ * Wait for the I/O thread to end collection, which happens when the
+ * connection is terminated (e.g. with dl_terminate() or by a handler
+ * returning non-zero) or on error, then wait for the workers to
+ * handle all queued packets.
+ *
+ * @param pipeline Pipeline from dl_pipeline_new()
+ *
+ * @return the final return value of dl_collect(), DLENDED or DLERROR.
+ ***************************************************************************/
+int
+dl_pipeline_wait (DLPipeline *pipeline)
+{
+  int idx;
+
+  if (!pipeline)
+    return DLERROR;
+
+  if (pipeline->iorunning)
+  {
+    dlp_thread_join (pipeline->iothread);
+    pipeline->iorunning = 0;
+  }
+
+  for (idx = 0; idx < pipeline->workercount; idx++)
+  {
+    if (pipeline->workers[idx].running)
+    {
+      dlp_thread_join (pipeline->workers[idx].thread);
+      pipeline->workers[idx].running = 0;
+    }
+  }
+
+  return pipeline->collectrv;
+} /* End of dl_pipeline_wait() */
+
+/***********************************************************************/ /**
+ * @brief Stop a collection pipeline
+ *
+ * Terminate the connection with dl_terminate() and wait for the
+ * pipeline to finish with dl_pipeline_wait().  Packets already
+ * received are handled before returning.
+ *
+ * @param pipeline Pipeline from dl_pipeline_new()
+ *
+ * @return the final return value of dl_collect(), DLENDED or DLERROR.
+ ***************************************************************************/
+int
+dl_pipeline_stop (DLPipeline *pipeline)
+{
+  if (!pipeline)
+    return DLERROR;
+
+  if (pipeline->iorunning)
+    dl_terminate (pipeline->dlconn);
+
+  return dl_pipeline_wait (pipeline);
+} /* End of dl_pipeline_stop() */
+
+/***********************************************************************/ /**
+ * @brief Get statistics of a collection pipeline
+ *
+ * Populate @a stats with the statistics of the worker numbered @a
+ * worker, or of all workers when @a worker is -1, in which case the
+ * high water mark is the maximum of any worker queue.  Statistics may
+ * be retrieved while the pipeline is running.
+ *
+ * The @a queuefull and @a stallusec statistics count the times and
+ * total duration that the I/O thread waited to dispatch a packet to a
+ * full queue, i.e. the backpressure from slow workers that delays
+ * reading from the connection.
+ *
+ * @param pipeline Pipeline from dl_pipeline_new()
+ * @param worker Worker index or -1 for all workers
+ * @param stats Statistics to populate
+ *
+ * @retval 0 on success
+ * @retval -1 on error
+ ***************************************************************************/
+int
+dl_pipeline_stats (DLPipeline *pipeline, int worker, DLPipelineStats *stats)
+{
+  PipelineWorker *pworker;
+  uint64_t highwater;
+  int idx;
+
+  if (!pipeline || !stats || worker < -1 || worker >= pipeline->workercount)
+    return -1;
+
+  memset (stats, 0, sizeof (DLPipelineStats));
+
+  for (idx = 0; idx < pipeline->workercount; idx++)
+  {
+    if (worker >= 0 && idx != worker)
+      continue;
+
+    pworker = &pipeline->workers[idx];
+
+    stats->dispatched += DLP_LOAD_ACQUIRE (&pworker->dispatched);
+    stats->handled += DLP_LOAD_ACQUIRE (&pworker->handled);
+    stats->bytes += DLP_LOAD_ACQUIRE (&pworker->bytes);
+    stats->queuefull += DLP_LOAD_ACQUIRE (&pworker->queuefull);
+    stats->stallusec += DLP_LOAD_ACQUIRE (&pworker->stallusec);
+
+    highwater = DLP_LOAD_ACQUIRE (&pworker->highwater);
+    if (highwater > stats->highwater)
+      stats->highwater = highwater;
+  }
+
+  return 0;
+} /* End of dl_pipeline_stats() */
+
+/***********************************************************************/ /**
+ * @brief Free all memory associated with a collection pipeline
+ *
+ * A running pipeline is stopped with dl_pipeline_stop() first.  The
+ * connection is not disconnected or freed.
+ *
+ * @param pipeline Pipeline from dl_pipeline_new()
+ ***************************************************************************/
+void
+dl_pipeline_free (DLPipeline *pipeline)
+{
+  int idx;
+
+  if (!pipeline)
+    return;
+
+  dl_pipeline_stop (pipeline);
+
+  for (idx = 0; idx < pipeline->workercount; idx++)
+  {
+    free (pipeline->workers[idx].queue.slots);
+    free (pipeline->workers[idx].done.slots);
+  }
+
+  free (pipeline->workers);
+  free (pipeline->slots);
+  free (pipeline->slotdata);
+  free (pipeline->freeslots);
+  free (pipeline);
+} /* End of dl_pipeline_free() */
+
+/***************************************************************************
+ * pipeline_io:
+ *
+ * I/O thread: collect packets into free buffers and dispatch each to
+ * the worker selected by a hash (FNV-1a) of the stream ID, waiting
+ * while the worker queue is full.
+ ***************************************************************************/
+static void
+pipeline_io (void *arg)
+{
+  DLPipeline *pipeline = (DLPipeline *)arg;
+  PipelineWorker *worker;
+  PipelineSlot *slot;
+  unsigned long int backoff;
+  uint64_t depth;
+  uint32_t hash;
+  int64_t stallstart;
+  const char *cp;
+  int rv = DLENDED;
+
+  for (;;)
+  {
+    if (!(slot = pipeline_getslot (pipeline)))
+    {
+      rv = DLERROR;
+      break;
+    }
+
+    rv = dl_collect (pipeline->dlconn, &slot->packet, slot->data,
+                     pipeline->maxdatasize, 0);
+
+    if (rv != DLPACKET)
+    {
+      pipeline->freeslots[pipeline->freecount++] = slot;
+      break;
+    }
+
+    hash = 2166136261u;
+    for (cp = slot->packet.streamid; *cp; cp++)
+      hash = (hash ^ (uint8_t)*cp) * 16777619u;
+
+    worker = &pipeline->workers[hash % (uint32_t)pipeline->workercount];
+
+    /* Wait for space in a full queue, tracking backpressure */
+    if (ring_push (&worker->queue, slot))
+    {
+      DLP_STORE_RELEASE (&worker->queuefull, worker->queuefull + 1);
+      stallstart = dlp_monotime ();
+      backoff    = 0;
+
+      while (ring_push (&worker->queue, slot))
+        pipeline_backoff (&backoff);
+
+      DLP_STORE_RELEASE (&worker->stallusec,
+                         worker->stallusec + (uint64_t)(dlp_monotime () - stallstart));
+    }
+
+    DLP_STORE_RELEASE (&worker->dispatched, worker->dispatched + 1);
+
+    depth = worker->queue.tail - DLP_LOAD_ACQUIRE (&worker->queue.head);
+    if (depth > worker->highwater)
+      DLP_STORE_RELEASE (&worker->highwater, depth);
+  }
+
+  pipeline->collectrv = rv;
+  DLP_STORE_RELEASE (&pipeline->iodone, 1);
+} /* End of pipeline_io() */
+
+/***************************************************************************
+ * pipeline_worker:
+ *
+ * Worker thread: handle packets from the worker queue and return the
+ * buffers to the I/O thread.  Exits when collection has ended and the
+ * queue is empty.
+ ***************************************************************************/
+static void
+pipeline_worker (void *arg)
+{
+  PipelineWorker *worker = (PipelineWorker *)arg;
+  DLPipeline *pipeline   = worker->pipeline;
+  PipelineSlot *slot;
+  unsigned long int backoff = 0;
+
+  for (;;)
+  {
+    if (!(slot = ring_pop (&worker->queue)))
+    {
+      /* Check the queue again after the I/O thread is done, it may
+         have dispatched a last packet before setting the flag */
+      if (DLP_LOAD_ACQUIRE (&pipeline->iodone))
+      {
+        if (!(slot = ring_pop (&worker->queue)))
+          break;
+      }
+      else
+      {
+        pipeline_backoff (&backoff);
+        continue;
+      }
+    }
+
+    backoff = 0;
+
+    if (pipeline->handler (&slot->packet, slot->data, worker->index, pipeline->handlerdata))
+    {
+      if (!pipeline->dlconn->terminate)
+        dl_terminate (pipeline->dlconn);
+    }
+
+    DLP_STORE_RELEASE (&worker->handled, worker->handled + 1);
+    DLP_STORE_RELEASE (&worker->bytes, worker->bytes + (uint64_t)slot->packet.datasize);
+
+    ring_push (&worker->done, slot);
+  }
+} /* End of pipeline_worker() */
+
+/***************************************************************************
+ * pipeline_getslot:
+ *
+ * Return a free buffer, reclaiming handled buffers from the workers
+ * when none are free.  The pool is sized so a buffer is always
+ * available.
+ ***************************************************************************/
+static PipelineSlot *
+pipeline_getslot (DLPipeline *pipeline)
+{
+  PipelineSlot *slot;
+  int idx;
+
+  if (pipeline->freecount == 0)
+  {
+    for (idx = 0; idx < pipeline->workercount; idx++)
+    {
+      while ((slot = ring_pop (&pipeline->workers[idx].done)))
+        pipeline->freeslots[pipeline->freecount++] = slot;
+    }
+  }
+
+  if (pipeline->freecount == 0)
+  {
+    dl_log_r (pipeline->dlconn, 2, 0, "[%s] pipeline buffer pool exhausted\n",
+              pipeline->dlconn->addr);
+    return NULL;
+  }
+
+  return pipeline->freeslots[--pipeline->freecount];
+} /* End of pipeline_getslot() */
+
+/***************************************************************************
+ * pipeline_backoff:
+ *
+ * Wait for another thread: yield at first, then sleep for increasing
+ * intervals up to PIPELINE_MAXBACKOFF microseconds.
+ ***************************************************************************/
+static void
+pipeline_backoff (unsigned long int *backoff)
+{
+  if (*backoff < 16)
+  {
+    dlp_thread_yield ();
+    *backoff += 1;
+    return;
+  }
+
+  dlp_usleep (*backoff);
+
+  if (*backoff < PIPELINE_MAXBACKOFF)
+    *backoff *= 2;
+} /* End of pipeline_backoff() */
+
+/***************************************************************************
+ * ring_init:
+ *
+ * Initialize a ring holding up to @a limit buffers.  Returns 0 on
+ * success and -1 on error.
+ ***************************************************************************/
+static int
+ring_init (PipelineRing *ring, uint64_t limit)
+{
+  uint64_t size = 1;
+
+  while (size < limit)
+    size <<= 1;
+
+  if (!(ring->slots = (PipelineSlot **)calloc ((size_t)size, sizeof (PipelineSlot *))))
+    return -1;
+
+  ring->mask  = size - 1;
+  ring->limit = limit;
+  ring->head  = 0;
+  ring->tail  = 0;
+
+  return 0;
+} /* End of ring_init() */
+
+/***************************************************************************
+ * ring_push:
+ *
+ * Add a buffer to a ring, called only by the producer thread.
+ * Returns 0 on success and -1 if the ring is full.
+ ***************************************************************************/
+static int
+ring_push (PipelineRing *ring, PipelineSlot *slot)
+{
+  uint64_t tail = ring->tail;
+
+  if (tail - DLP_LOAD_ACQUIRE (&ring->head) >= ring->limit)
+    return -1;
+
+  ring->slots[tail & ring->mask] = slot;
+  DLP_STORE_RELEASE (&ring->tail, tail + 1);
+
+  return 0;
+} /* End of ring_push() */
+
+/***************************************************************************
+ * ring_pop:
+ *
+ * Remove a buffer from a ring, called only by the consumer thread.
+ * Returns the buffer or NULL if the ring is empty.
+ ***************************************************************************/
+static PipelineSlot *
+ring_pop (PipelineRing *ring)
+{
+  PipelineSlot *slot;
+  uint64_t head = ring->head;
+
+  if (head == DLP_LOAD_ACQUIRE (&ring->tail))
+    return NULL;
+
+  slot = ring->slots[head & ring->mask];
+  DLP_STORE_RELEASE (&ring->head, head + 1);
+
+  return slot;
+} /* End of ring_pop() */
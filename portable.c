@@ -20,6 +20,14 @@
  * limitations under the License.
  ***************************************************************************/
 
+/* Request 64-bit file offsets for fseeko()/ftello() */
+#define _FILE_OFFSET_BITS 64
+
+/* Request CPU affinity interfaces for dlp_thread_pin() */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -28,6 +36,10 @@
 #include <sys/types.h>
 #include <time.h>
 
+#if defined(__linux__)
+  #include <sys/eventfd.h>
+#endif
+
 #include "libdali.h"
 #include "portable.h"
 
@@ -88,6 +100,82 @@ dlp_sockconnect (SOCKET socket, struct sockaddr *inetaddr, int addrlen)
   return 0;
 } /* End of dlp_sockconnect() */
 
+/***********************************************************************/ /**
+ * @brief Check the result of a non-blocking connect
+ *
+ * Check the pending error of a socket for which a non-blocking
+ * connect has completed, as reported by dlp_poll().  On failure the
+ * global error status is set to the connect error so it is reported
+ * by dlp_strerror().
+ *
+ * @param socket Network socket descriptor
+ *
+ * @return -1 if the connect failed and 0 if connected.
+ ***************************************************************************/
+int
+dlp_sockconnected (SOCKET socket)
+{
+  int sockerr = 0;
+#if defined(DLP_WIN)
+  int errlen = sizeof (sockerr);
+
+  if (getsockopt (socket, SOL_SOCKET, SO_ERROR, (char *)&sockerr, &errlen))
+    return -1;
+
+  if (sockerr)
+  {
+    WSASetLastError (sockerr);
+    return -1;
+  }
+#else
+  socklen_t errlen = sizeof (sockerr);
+
+  if (getsockopt (socket, SOL_SOCKET, SO_ERROR, &sockerr, &errlen))
+    return -1;
+
+  if (sockerr)
+  {
+    errno = sockerr;
+    return -1;
+  }
+#endif
+
+  return 0;
+} /* End of dlp_sockconnected() */
+
+/***********************************************************************/ /**
+ * @brief Wait for events on network sockets
+ *
+ * Wait for the events requested for each socket, as poll().  Unlike
+ * select() there is no limit on the socket descriptor values.  Under
+ * WIN use WSAPoll() and for all others poll().
+ *
+ * @param fds Sockets and requested events, the returned events are set
+ * @param nfds Number of entries in @a fds
+ * @param timeout Maximum time to wait (microseconds), negative for no limit
+ *
+ * @return The number of sockets with events, 0 on timeout and -1 on error.
+ ***************************************************************************/
+int
+dlp_poll (DLPPollFD *fds, int nfds, int64_t timeout)
+{
+  int timeout_ms;
+
+  /* Round up so that a wait is not shorter than requested */
+  if (timeout < 0)
+    timeout_ms = -1;
+  else if (timeout > (int64_t)INT32_MAX * 1000)
+    timeout_ms = INT32_MAX;
+  else
+    timeout_ms = (int)((timeout + 999) / 1000);
+
+#if defined(DLP_WIN)
+  return WSAPoll (fds, (ULONG)nfds, timeout_ms);
+#else
+  return poll (fds, (nfds_t)nfds, timeout_ms);
+#endif
+} /* End of dlp_poll() */
+
 /***********************************************************************/ /**
  * @brief Close a network socket
  *
@@ -317,6 +405,88 @@ dlp_openfile (const char *filename, char perm)
   return open (filename, flags, mode);
 } /* End of dlp_openfile() */
 
+/***********************************************************************/ /**
+ * @brief Create a uniquely named private directory
+ *
+ * Create a new directory named from @a dirtemplate, which must end
+ * with "XXXXXX" and is modified in place to the name of the directory
+ * created.  The directory is only accessible to the current user
+ * where supported and an existing file or directory is never used.
+ *
+ * @param dirtemplate Directory name template, modified in place
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_mkdtemp (char *dirtemplate)
+{
+#if defined(DLP_WIN)
+  if (_mktemp_s (dirtemplate, strlen (dirtemplate) + 1))
+    return -1;
+
+  return (CreateDirectoryA (dirtemplate, NULL)) ? 0 : -1;
+#else
+  return (mkdtemp (dirtemplate)) ? 0 : -1;
+#endif
+} /* End of dlp_mkdtemp() */
+
+/***********************************************************************/ /**
+ * @brief Remove an empty directory
+ *
+ * @param path Directory to remove
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_rmdir (const char *path)
+{
+#if defined(DLP_WIN)
+  return (RemoveDirectoryA (path)) ? 0 : -1;
+#else
+  return rmdir (path);
+#endif
+} /* End of dlp_rmdir() */
+
+/***********************************************************************/ /**
+ * @brief Set the position of a file stream
+ *
+ * Set the position of a file stream to an absolute byte offset from
+ * the beginning of the file, supporting offsets beyond 2 GB on all
+ * platforms.
+ *
+ * @param stream File stream to position
+ * @param offset Byte offset from the beginning of the file
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_fseek (FILE *stream, int64_t offset)
+{
+#if defined(DLP_WIN)
+  return _fseeki64 (stream, offset, SEEK_SET);
+#else
+  return fseeko (stream, (off_t)offset, SEEK_SET);
+#endif
+} /* End of dlp_fseek() */
+
+/***********************************************************************/ /**
+ * @brief Return the current position of a file stream
+ *
+ * @param stream File stream to query
+ *
+ * @return The current byte offset from the beginning of the file on
+ * success and -1 on error.
+ ***************************************************************************/
+int64_t
+dlp_ftell (FILE *stream)
+{
+#if defined(DLP_WIN)
+  return (int64_t)_ftelli64 (stream);
+#else
+  return (int64_t)ftello (stream);
+#endif
+} /* End of dlp_ftell() */
+
 /***********************************************************************/ /**
  * @brief Return a description of the last system error.
  *
@@ -395,6 +565,68 @@ dlp_time (void)
 #endif
 } /* End of dlp_time() */
 
+/***********************************************************************/ /**
+ * @brief Determine the current monotonic time
+ *
+ * Determine the current time from a monotonic system clock in
+ * microseconds.  The value has no relation to calendar time and is
+ * only useful for measuring intervals and deadlines, which are then
+ * unaffected by changes to the system clock.  On Linux the clock is
+ * read through the vDSO without a system call.
+ *
+ * Where no monotonic clock is available the system time is returned.
+ *
+ * @return Current monotonic time in microseconds.
+ ***************************************************************************/
+int64_t
+dlp_monotime (void)
+{
+#if defined(DLP_WIN)
+
+  static LARGE_INTEGER frequency = {0};
+  LARGE_INTEGER counter;
+
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency (&frequency);
+
+  QueryPerformanceCounter (&counter);
+
+  return (int64_t) ((counter.QuadPart / frequency.QuadPart) * 1000000 +
+                    ((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart);
+
+#elif defined(CLOCK_MONOTONIC)
+
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts))
+  {
+    return dlp_time ();
+  }
+
+  return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+
+#else
+
+  return dlp_time ();
+
+#endif
+} /* End of dlp_monotime() */
+
+/***********************************************************************/ /**
+ * @brief Determine the current monotonic time
+ *
+ * Return the monotonic clock used by the library for deadlines, see
+ * dlp_monotime(), for comparison with the time returned by
+ * dl_deadline().
+ *
+ * @return Current monotonic time in microseconds.
+ ***************************************************************************/
+int64_t
+dl_monotime (void)
+{
+  return dlp_monotime ();
+} /* End of dl_monotime() */
+
 /***********************************************************************/ /**
  * @brief Sleep for a specified number of microseconds
  *
@@ -423,6 +655,373 @@ dlp_usleep (unsigned long int useconds)
 #endif
 } /* End of dlp_usleep() */
 
+/* Start parameters for dlp_thread_create() */
+typedef struct DLPThreadStart_s
+{
+  void (*function) (void *);
+  void *arg;
+} DLPThreadStart;
+
+/***************************************************************************
+ * dlp_thread_start:
+ *
+ * Thread entry point calling the function given to dlp_thread_create().
+ ***************************************************************************/
+#if defined(DLP_WIN)
+static unsigned __stdcall
+#else
+static void *
+#endif
+dlp_thread_start (void *arg)
+{
+  DLPThreadStart start = *(DLPThreadStart *)arg;
+
+  free (arg);
+
+  start.function (start.arg);
+
+  return 0;
+} /* End of dlp_thread_start() */
+
+/***********************************************************************/ /**
+ * @brief Start a new thread
+ *
+ * Start a thread running @a function with the argument @a arg.  Under
+ * WIN use _beginthreadex() and for all others use POSIX threads.
+ *
+ * @param thread Thread handle to set
+ * @param function Function to run in the new thread
+ * @param arg Argument passed to @a function
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_thread_create (DLPThread *thread, void (*function) (void *), void *arg)
+{
+  DLPThreadStart *start;
+
+  if (!thread || !function)
+    return -1;
+
+  if (!(start = (DLPThreadStart *)malloc (sizeof (DLPThreadStart))))
+    return -1;
+
+  start->function = function;
+  start->arg      = arg;
+
+#if defined(DLP_WIN)
+
+  if (!(*thread = (HANDLE)_beginthreadex (NULL, 0, dlp_thread_start, start, 0, NULL)))
+  {
+    free (start);
+    return -1;
+  }
+
+#else
+
+  if (pthread_create (thread, NULL, dlp_thread_start, start))
+  {
+    free (start);
+    return -1;
+  }
+
+#endif
+
+  return 0;
+} /* End of dlp_thread_create() */
+
+/***********************************************************************/ /**
+ * @brief Wait for a thread to finish
+ *
+ * @param thread Thread handle from dlp_thread_create()
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_thread_join (DLPThread thread)
+{
+#if defined(DLP_WIN)
+
+  if (WaitForSingleObject (thread, INFINITE) != WAIT_OBJECT_0)
+    return -1;
+
+  CloseHandle (thread);
+
+#else
+
+  if (pthread_join (thread, NULL))
+    return -1;
+
+#endif
+
+  return 0;
+} /* End of dlp_thread_join() */
+
+/***********************************************************************/ /**
+ * @brief Yield the processor to other threads
+ ***************************************************************************/
+void
+dlp_thread_yield (void)
+{
+#if defined(DLP_WIN)
+  SwitchToThread ();
+#else
+  sched_yield ();
+#endif
+} /* End of dlp_thread_yield() */
+
+/***********************************************************************/ /**
+ * @brief Pin the calling thread to a CPU
+ *
+ * Restrict the calling thread to run only on the CPU numbered @a cpu.
+ * Under Linux use sched_setaffinity() and under WIN
+ * SetThreadAffinityMask(), not supported on other platforms.
+ *
+ * @param cpu CPU number, starting at 0
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_thread_pin (int cpu)
+{
+  if (cpu < 0)
+    return -1;
+
+#if defined(DLP_WIN)
+
+  if (cpu >= (int)(sizeof (DWORD_PTR) * 8))
+    return -1;
+
+  if (!SetThreadAffinityMask (GetCurrentThread (), (DWORD_PTR)1 << cpu))
+    return -1;
+
+  return 0;
+
+#elif defined(__linux__)
+  cpu_set_t cpuset;
+
+  if (cpu >= CPU_SETSIZE)
+    return -1;
+
+  CPU_ZERO (&cpuset);
+  CPU_SET (cpu, &cpuset);
+
+  if (sched_setaffinity (0, sizeof (cpuset), &cpuset))
+    return -1;
+
+  return 0;
+
+#else
+
+  return -1;
+
+#endif
+} /* End of dlp_thread_pin() */
+
+/***********************************************************************/ /**
+ * @brief Initialize a mutex
+ *
+ * A mutex with static storage can instead be initialized with
+ * DLP_MUTEX_INITIALIZER.  Under WIN a slim reader/writer lock is used
+ * in exclusive mode, for all others a POSIX threads mutex.
+ *
+ * @param mutex Mutex to initialize
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_mutex_init (DLPMutex *mutex)
+{
+#if defined(DLP_WIN)
+  InitializeSRWLock (mutex);
+#else
+  if (pthread_mutex_init (mutex, NULL))
+    return -1;
+#endif
+
+  return 0;
+} /* End of dlp_mutex_init() */
+
+/***********************************************************************/ /**
+ * @brief Release resources of a mutex initialized by dlp_mutex_init()
+ ***************************************************************************/
+void
+dlp_mutex_destroy (DLPMutex *mutex)
+{
+#if !defined(DLP_WIN)
+  pthread_mutex_destroy (mutex);
+#endif
+} /* End of dlp_mutex_destroy() */
+
+/***********************************************************************/ /**
+ * @brief Lock a mutex, waiting until it is available
+ ***************************************************************************/
+void
+dlp_mutex_lock (DLPMutex *mutex)
+{
+#if defined(DLP_WIN)
+  AcquireSRWLockExclusive (mutex);
+#else
+  pthread_mutex_lock (mutex);
+#endif
+} /* End of dlp_mutex_lock() */
+
+/***********************************************************************/ /**
+ * @brief Unlock a mutex locked by dlp_mutex_lock()
+ ***************************************************************************/
+void
+dlp_mutex_unlock (DLPMutex *mutex)
+{
+#if defined(DLP_WIN)
+  ReleaseSRWLockExclusive (mutex);
+#else
+  pthread_mutex_unlock (mutex);
+#endif
+} /* End of dlp_mutex_unlock() */
+
+/***********************************************************************/ /**
+ * @brief Open a wakeup descriptor
+ *
+ * Open a non-blocking descriptor that can be waited on with select()
+ * and signaled, with dlp_wakeup_signal(), from another thread or a
+ * signal handler.  Under Linux an eventfd is used, for other Unix-like
+ * systems a pipe and under WIN a UDP socket connected to itself.  For
+ * the eventfd and socket @a rfd and @a wfd are the same.
+ *
+ * @param rfd Descriptor to wait on
+ * @param wfd Descriptor to signal
+ *
+ * @return -1 on errors and 0 on success.
+ ***************************************************************************/
+int
+dlp_wakeup_open (SOCKET *rfd, SOCKET *wfd)
+{
+#if defined(DLP_WIN)
+  struct sockaddr_in addr;
+  int addrlen = sizeof (addr);
+  SOCKET sock;
+
+  if ((sock = socket (AF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET)
+    return -1;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  if (bind (sock, (struct sockaddr *)&addr, sizeof (addr)) ||
+      getsockname (sock, (struct sockaddr *)&addr, &addrlen) ||
+      connect (sock, (struct sockaddr *)&addr, addrlen) ||
+      dlp_socknoblock (sock))
+  {
+    closesocket (sock);
+    return -1;
+  }
+
+  *rfd = sock;
+  *wfd = sock;
+#elif defined(__linux__)
+  int fd;
+
+  if ((fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    return -1;
+
+  *rfd = fd;
+  *wfd = fd;
+#else
+  int fds[2];
+
+  if (pipe (fds))
+    return -1;
+
+  if (dlp_socknoblock (fds[0]) || dlp_socknoblock (fds[1]) ||
+      fcntl (fds[0], F_SETFD, FD_CLOEXEC) == -1 ||
+      fcntl (fds[1], F_SETFD, FD_CLOEXEC) == -1)
+  {
+    close (fds[0]);
+    close (fds[1]);
+    return -1;
+  }
+
+  *rfd = fds[0];
+  *wfd = fds[1];
+#endif
+
+  return 0;
+} /* End of dlp_wakeup_open() */
+
+/***********************************************************************/ /**
+ * @brief Signal a wakeup descriptor
+ *
+ * Make the wait descriptor of a wakeup descriptor readable.  This
+ * routine is safe to call from a signal handler, errno is preserved.
+ *
+ * @param wfd Descriptor to signal, from dlp_wakeup_open()
+ *
+ * @return -1 on errors and 0 on success, including when already signaled.
+ ***************************************************************************/
+int
+dlp_wakeup_signal (SOCKET wfd)
+{
+#if defined(DLP_WIN)
+  char byte = 1;
+
+  if (send (wfd, &byte, 1, 0) < 0 && WSAGetLastError () != WSAEWOULDBLOCK)
+    return -1;
+#else
+  int saveerrno = errno;
+  int rv        = 0;
+#if defined(__linux__)
+  uint64_t count = 1;
+
+  if (write (wfd, &count, sizeof (count)) < 0 && errno != EAGAIN)
+    rv = -1;
+#else
+  char byte = 1;
+
+  if (write (wfd, &byte, 1) < 0 && errno != EAGAIN)
+    rv = -1;
+#endif
+
+  errno = saveerrno;
+
+  if (rv)
+    return -1;
+#endif
+
+  return 0;
+} /* End of dlp_wakeup_signal() */
+
+/***********************************************************************/ /**
+ * @brief Clear all pending signals of a wakeup descriptor
+ *
+ * @param rfd Descriptor to wait on, from dlp_wakeup_open()
+ ***************************************************************************/
+void
+dlp_wakeup_drain (SOCKET rfd)
+{
+  char buffer[64];
+
+#if defined(DLP_WIN)
+  while (recv (rfd, buffer, sizeof (buffer), 0) > 0)
+    ;
+#else
+  while (read (rfd, buffer, sizeof (buffer)) > 0)
+    ;
+#endif
+} /* End of dlp_wakeup_drain() */
+
+/***********************************************************************/ /**
+ * @brief Close a wakeup descriptor opened with dlp_wakeup_open()
+ ***************************************************************************/
+void
+dlp_wakeup_close (SOCKET rfd, SOCKET wfd)
+{
+  dlp_sockclose (rfd);
+
+  if (wfd != rfd)
+    dlp_sockclose (wfd);
+} /* End of dlp_wakeup_close() */
+
 /***********************************************************************/ /**
  * @brief Generate a DataLink client ID from system & process information
  *
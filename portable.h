@@ -29,14 +29,99 @@ extern "C" {
 
 #include "libdali.h"
 
+/* Thread-local storage class, left undefined when not supported */
+#if defined(_MSC_VER)
+  #define DLP_THREADLOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+  #define DLP_THREADLOCAL __thread
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+  #define DLP_THREADLOCAL _Thread_local
+#endif
+
+/* Thread handle and mutex types */
+#if defined(DLP_WIN)
+  typedef HANDLE DLPThread;
+  typedef SRWLOCK DLPMutex;
+  #define DLP_MUTEX_INITIALIZER SRWLOCK_INIT
+#else
+  #include <pthread.h>
+  #include <sched.h>
+  typedef pthread_t DLPThread;
+  typedef pthread_mutex_t DLPMutex;
+  #define DLP_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#endif
+
+/* Socket event polling, see dlp_poll() */
+#if defined(DLP_WIN)
+  typedef WSAPOLLFD DLPPollFD;
+#else
+  #include <poll.h>
+  typedef struct pollfd DLPPollFD;
+#endif
+
+/* Atomic access to 64-bit values shared between threads */
+#if defined(_MSC_VER)
+  #define DLP_LOAD_ACQUIRE(ptr) ((uint64_t)InterlockedOr64 ((volatile LONG64 *)(ptr), 0))
+  #define DLP_STORE_RELEASE(ptr, value) InterlockedExchange64 ((volatile LONG64 *)(ptr), (LONG64)(value))
+#else
+  #define DLP_LOAD_ACQUIRE(ptr) __atomic_load_n ((ptr), __ATOMIC_ACQUIRE)
+  #define DLP_STORE_RELEASE(ptr, value) __atomic_store_n ((ptr), (value), __ATOMIC_RELEASE)
+#endif
+
 extern int dlp_sockstartup (void);
 extern int dlp_sockconnect (SOCKET socket, struct sockaddr * inetaddr, int addrlen);
+extern int dlp_sockconnected (SOCKET socket);
+extern int dlp_poll (DLPPollFD *fds, int nfds, int64_t timeout);
 extern int dlp_sockclose (SOCKET socket);
 extern int dlp_sockblock (SOCKET socket);
 extern int dlp_socknoblock (SOCKET socket);
 extern int dlp_noblockcheck (void);
 extern int dlp_setsocktimeo (SOCKET socket, int timeout);
 extern int dlp_setioalarm (int timeout);
+extern int dlp_fseek (FILE *stream, int64_t offset);
+extern int64_t dlp_ftell (FILE *stream);
+extern int dlp_mkdtemp (char *dirtemplate);
+extern int dlp_rmdir (const char *path);
+extern int dlp_thread_create (DLPThread *thread, void (*function) (void *), void *arg);
+extern int dlp_thread_join (DLPThread thread);
+extern void dlp_thread_yield (void);
+extern int dlp_thread_pin (int cpu);
+extern int dlp_mutex_init (DLPMutex *mutex);
+extern void dlp_mutex_destroy (DLPMutex *mutex);
+extern void dlp_mutex_lock (DLPMutex *mutex);
+extern void dlp_mutex_unlock (DLPMutex *mutex);
+extern int dlp_wakeup_open (SOCKET *rfd, SOCKET *wfd);
+extern int dlp_wakeup_signal (SOCKET wfd);
+extern void dlp_wakeup_drain (SOCKET rfd);
+extern void dlp_wakeup_close (SOCKET rfd, SOCKET wfd);
+
+extern void *dlp_resolve (DLCP *dlconn, int wait);
+extern int dlp_resolve_wait (DLCP *dlconn, void *entry);
+extern int dlp_resolve_done (void *entry);
+extern int dlp_resolve_current (void *entry);
+extern struct addrinfo *dlp_resolve_addr (void *entry);
+extern void dlp_resolve_invalidate (void *entry);
+extern void dlp_resolve_release (void *entry);
+
+extern int dlp_recvframe (DLCP *dlconn, char *header, char **data, size_t *datasize);
+extern int dlp_sendqueue (DLCP *dlconn, const char *header, size_t headerlen,
+                          const void *data, size_t datalen);
+extern int dlp_sendflush (DLCP *dlconn);
+extern int dlp_recvdeliver (DLCP *dlconn, const void *data, size_t len);
+extern int dlp_serverid (DLCP *dlconn, char *respstr, int respsize, int parseresp);
+extern int dlp_info_request (DLCP *dlconn, const char *infotype, char *infomatch,
+                             const char *caller);
+
+extern void dlp_sockopt_apply (DLCP *dlconn, SOCKET sock);
+extern void dlp_sockopt_reset (DLCP *dlconn);
+extern void dlp_sockopt_adapt (DLCP *dlconn);
+extern void dlp_sockopt_free (DLCP *dlconn);
+
+extern void dlp_latency_record (DLCP *dlconn, int type, int64_t latency);
+extern void dlp_latency_free (DLCP *dlconn);
+
+extern void dlp_ioring_release (DLCP *dlconn);
+extern int dlp_ioring_active (DLCP *dlconn);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,544 @@
+/***********************************************************************/ /**
+ * @file resolver.c
+ *
+ * Cached, asynchronous server address resolution.
+ *
+ * Server addresses are resolved with getaddrinfo() in a thread per
+ * lookup and the results are kept in a process wide cache keyed by
+ * host and port for a time-to-live, so that connections to the same
+ * server share one lookup and reconnections do not wait for the
+ * resolver.  A cache entry is reference counted: it may be removed
+ * from the cache, when expired or found not to work, while still in
+ * use by connections.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+#define RESOLVE_PENDING 0
+#define RESOLVE_DONE    1
+#define RESOLVE_FAILED  2
+
+/* Address cache entry */
+typedef struct ResolveEntry_s
+{
+  char nodename[300];
+  char nodeport[100];
+  struct addrinfo *addr0;       /* Resolved addresses when done */
+  int64_t state;                /* RESOLVE_PENDING, _DONE or _FAILED */
+  int64_t expires;              /* Monotonic time the entry expires (microseconds) */
+  int refs;                     /* References, including the cache */
+  int8_t cached;                /* Flag indicating the entry is in the cache */
+  DLPThread thread;             /* Resolver thread */
+  int8_t joinable;              /* Flag indicating the thread is to be joined */
+  DLPMutex joinlock;            /* Serializes joining of the thread */
+  struct ResolveEntry_s *next;
+} ResolveEntry;
+
+static DLPMutex cachelock = DLP_MUTEX_INITIALIZER;
+static ResolveEntry *cache = NULL;
+static int cachettl = DLRESOLVE_TTL;
+
+static int resolve_parse (DLCP *dlconn, char *nodename, char *nodeport);
+static void resolve_thread (void *arg);
+static void resolve_unlink (ResolveEntry *entry);
+static void resolve_free (ResolveEntry *entry);
+
+/***********************************************************************/ /**
+ * @brief Start resolving the server address of a connection
+ *
+ * Start resolving the server address in @a dlconn->addr in a
+ * background thread, if it is not already cached, so that a later
+ * dl_connect() does not wait for the resolver.  Calling this for a
+ * number of connections before connecting them resolves their
+ * addresses in parallel.
+ *
+ * Calling this function is optional, dl_connect() resolves the
+ * address as needed.
+ *
+ * @param dlconn DataLink Connection Parameters
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_resolve_start (DLCP *dlconn)
+{
+  void *entry;
+
+  if (!dlconn)
+    return -1;
+
+  /* Already resolving or resolved and usable */
+  if (dlconn->addrinfo && dlp_resolve_current (dlconn->addrinfo))
+    return 0;
+
+  if (!(entry = dlp_resolve (dlconn, 0)))
+    return -1;
+
+  if (dlconn->addrinfo)
+    dlp_resolve_release (dlconn->addrinfo);
+
+  dlconn->addrinfo = entry;
+
+  return 0;
+} /* End of dl_resolve_start() */
+
+/***********************************************************************/ /**
+ * @brief Set the lifetime of cached server addresses
+ *
+ * Set the time resolved server addresses are cached, applying to
+ * addresses resolved after the call.  A value of 0 disables caching,
+ * connections resolve the address each time they connect.
+ *
+ * @param ttl Cache lifetime in seconds, default ::DLRESOLVE_TTL
+ ***************************************************************************/
+void
+dl_resolve_ttl (int ttl)
+{
+  dlp_mutex_lock (&cachelock);
+  cachettl = (ttl > 0) ? ttl : 0;
+  dlp_mutex_unlock (&cachelock);
+} /* End of dl_resolve_ttl() */
+
+/***********************************************************************/ /**
+ * @brief Remove all cached server addresses
+ *
+ * Remove all addresses from the cache, later connections will resolve
+ * server addresses again.  Lookups in progress are waited for unless
+ * used by a connection.  Memory is released when no longer used by
+ * any connection.
+ ***************************************************************************/
+void
+dl_resolve_flush (void)
+{
+  ResolveEntry *entry;
+  ResolveEntry *freelist = NULL;
+
+  dlp_mutex_lock (&cachelock);
+
+  while ((entry = cache))
+  {
+    resolve_unlink (entry);
+
+    if (entry->refs == 0)
+    {
+      entry->next = freelist;
+      freelist    = entry;
+    }
+  }
+
+  dlp_mutex_unlock (&cachelock);
+
+  while ((entry = freelist))
+  {
+    freelist = entry->next;
+    resolve_free (entry);
+  }
+} /* End of dl_resolve_flush() */
+
+/***************************************************************************
+ * dlp_resolve:
+ *
+ * Find the cache entry for the server address of a connection,
+ * starting a lookup in a new thread if no current entry is cached.
+ * Expired entries are removed from the cache.  If @a wait is true
+ * wait for the lookup to complete.
+ *
+ * If a permanent error is detected (invalid port specified) the
+ * dlconn->terminate flag will be set.
+ *
+ * Returns a reference to the entry, to be released with
+ * dlp_resolve_release(), or NULL on error.
+ ***************************************************************************/
+void *
+dlp_resolve (DLCP *dlconn, int wait)
+{
+  ResolveEntry *entry;
+  ResolveEntry *next;
+  ResolveEntry *found    = NULL;
+  ResolveEntry *freelist = NULL;
+  char nodename[300]     = {0};
+  char nodeport[100]     = {0};
+  int64_t now;
+
+  if (resolve_parse (dlconn, nodename, nodeport))
+    return NULL;
+
+  now = dlp_monotime ();
+
+  dlp_mutex_lock (&cachelock);
+
+  /* Remove expired entries and search for the address */
+  for (entry = cache; entry; entry = next)
+  {
+    next = entry->next;
+
+    if (DLP_LOAD_ACQUIRE (&entry->state) != RESOLVE_PENDING && entry->expires <= now)
+    {
+      resolve_unlink (entry);
+
+      if (entry->refs == 0)
+      {
+        entry->next = freelist;
+        freelist    = entry;
+      }
+
+      continue;
+    }
+
+    if (!strcmp (entry->nodename, nodename) && !strcmp (entry->nodeport, nodeport))
+      found = entry;
+  }
+
+  if (found)
+  {
+    found->refs++;
+  }
+  else if ((found = (ResolveEntry *)calloc (1, sizeof (ResolveEntry))))
+  {
+    strcpy (found->nodename, nodename);
+    strcpy (found->nodeport, nodeport);
+    found->state  = RESOLVE_PENDING;
+    found->refs   = 2;
+    found->cached = 1;
+    dlp_mutex_init (&found->joinlock);
+
+    if (dlp_thread_create (&found->thread, resolve_thread, found) == 0)
+      found->joinable = 1;
+
+    found->next = cache;
+    cache       = found;
+  }
+
+  dlp_mutex_unlock (&cachelock);
+
+  while ((entry = freelist))
+  {
+    freelist = entry->next;
+    resolve_free (entry);
+  }
+
+  if (!found)
+  {
+    dl_log_r (dlconn, 2, 0, "[%s] dlp_resolve(): error allocating memory\n", dlconn->addr);
+    return NULL;
+  }
+
+  /* Resolve in this thread if a resolver thread could not be started */
+  if (!found->joinable && DLP_LOAD_ACQUIRE (&found->state) == RESOLVE_PENDING)
+  {
+    dlp_mutex_lock (&found->joinlock);
+    if (DLP_LOAD_ACQUIRE (&found->state) == RESOLVE_PENDING)
+      resolve_thread (found);
+    dlp_mutex_unlock (&found->joinlock);
+  }
+
+  if (wait && dlp_resolve_wait (dlconn, found))
+  {
+    dlp_resolve_release (found);
+    return NULL;
+  }
+
+  return found;
+} /* End of dlp_resolve() */
+
+/***************************************************************************
+ * dlp_resolve_wait:
+ *
+ * Wait for the lookup of a cache entry to complete.
+ *
+ * Returns 0 when addresses were resolved and -1 on error.
+ ***************************************************************************/
+int
+dlp_resolve_wait (DLCP *dlconn, void *entry)
+{
+  ResolveEntry *rentry = (ResolveEntry *)entry;
+
+  if (!rentry)
+    return -1;
+
+  dlp_mutex_lock (&rentry->joinlock);
+  if (rentry->joinable)
+  {
+    dlp_thread_join (rentry->thread);
+    rentry->joinable = 0;
+  }
+  dlp_mutex_unlock (&rentry->joinlock);
+
+  if (DLP_LOAD_ACQUIRE (&rentry->state) != RESOLVE_DONE)
+  {
+    dl_log_r (dlconn, 2, 0, "cannot resolve hostname %s\n", rentry->nodename);
+    return -1;
+  }
+
+  return 0;
+} /* End of dlp_resolve_wait() */
+
+/***************************************************************************
+ * dlp_resolve_done:
+ *
+ * Returns 1 if the lookup of a cache entry has completed, successfully
+ * or not, and 0 if in progress.
+ ***************************************************************************/
+int
+dlp_resolve_done (void *entry)
+{
+  ResolveEntry *rentry = (ResolveEntry *)entry;
+
+  if (!rentry)
+    return 1;
+
+  return (DLP_LOAD_ACQUIRE (&rentry->state) != RESOLVE_PENDING);
+} /* End of dlp_resolve_done() */
+
+/***************************************************************************
+ * dlp_resolve_current:
+ *
+ * Check if a cache entry is still current: in the cache and either
+ * being resolved or resolved and not expired.
+ *
+ * Returns 1 if current and 0 if not.
+ ***************************************************************************/
+int
+dlp_resolve_current (void *entry)
+{
+  ResolveEntry *rentry = (ResolveEntry *)entry;
+  int current;
+
+  if (!rentry)
+    return 0;
+
+  dlp_mutex_lock (&cachelock);
+  current = (rentry->cached &&
+             (DLP_LOAD_ACQUIRE (&rentry->state) == RESOLVE_PENDING ||
+              rentry->expires > dlp_monotime ()));
+  dlp_mutex_unlock (&cachelock);
+
+  return current;
+} /* End of dlp_resolve_current() */
+
+/***************************************************************************
+ * dlp_resolve_addr:
+ *
+ * Returns the list of resolved addresses of a cache entry, NULL if the
+ * lookup is not complete or failed.
+ ***************************************************************************/
+struct addrinfo *
+dlp_resolve_addr (void *entry)
+{
+  ResolveEntry *rentry = (ResolveEntry *)entry;
+
+  if (!rentry || DLP_LOAD_ACQUIRE (&rentry->state) != RESOLVE_DONE)
+    return NULL;
+
+  return rentry->addr0;
+} /* End of dlp_resolve_addr() */
+
+/***************************************************************************
+ * dlp_resolve_invalidate:
+ *
+ * Remove a cache entry from the cache, e.g. when none of the addresses
+ * could be connected, so the next lookup resolves the address again.
+ ***************************************************************************/
+void
+dlp_resolve_invalidate (void *entry)
+{
+  ResolveEntry *rentry = (ResolveEntry *)entry;
+
+  if (!rentry)
+    return;
+
+  dlp_mutex_lock (&cachelock);
+  if (rentry->cached)
+    resolve_unlink (rentry);
+  dlp_mutex_unlock (&cachelock);
+} /* End of dlp_resolve_invalidate() */
+
+/***************************************************************************
+ * dlp_resolve_release:
+ *
+ * Release a reference to a cache entry, freeing it when no longer
+ * referenced.
+ ***************************************************************************/
+void
+dlp_resolve_release (void *entry)
+{
+  ResolveEntry *rentry = (ResolveEntry *)entry;
+  int refs;
+
+  if (!rentry)
+    return;
+
+  dlp_mutex_lock (&cachelock);
+  refs = --rentry->refs;
+  dlp_mutex_unlock (&cachelock);
+
+  if (refs == 0)
+    resolve_free (rentry);
+} /* End of dlp_resolve_release() */
+
+/***************************************************************************
+ * resolve_parse:
+ *
+ * Parse the server address in 'dlconn->addr' into host and port.
+ * Expects 'dlconn->addr' to be in 'host:port' or 'host@port' format,
+ * missing host or port default to LD_DEFAULT_HOST and LD_DEFAULT_PORT.
+ *
+ * If a permanent error is detected (invalid port specified) the
+ * dlconn->terminate flag will be set.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+resolve_parse (DLCP *dlconn, char *nodename, char *nodeport)
+{
+  long int nport;
+  char *ptr, *tail;
+
+  /* Search address host-port separator, first for '@', then ':' */
+  if ((ptr = strchr (dlconn->addr, '@')) == NULL && (ptr = strchr (dlconn->addr, ':')))
+  {
+    /* If first ':' is not the last, this is not a separator */
+    if (strrchr (dlconn->addr, ':') != ptr)
+      ptr = NULL;
+  }
+
+  /* If address begins with the separator */
+  if (dlconn->addr == ptr)
+  {
+    if (dlconn->addr[1] == '\0')  /* Only a separator */
+    {
+      strcpy (nodename, LD_DEFAULT_HOST);
+      strcpy (nodeport, LD_DEFAULT_PORT);
+    }
+    else /* Only a port */
+    {
+      strcpy (nodename, LD_DEFAULT_HOST);
+      strncpy (nodeport, dlconn->addr + 1, 99);
+    }
+  }
+  /* Otherwise if no separator, use default port */
+  else if (ptr == NULL)
+  {
+    strncpy (nodename, dlconn->addr, 299);
+    strcpy (nodeport, LD_DEFAULT_PORT);
+  }
+  /* Otherwise separate host and port */
+  else if ((ptr - dlconn->addr) < 300)
+  {
+    strncpy (nodename, dlconn->addr, (ptr - dlconn->addr));
+    nodename[(ptr - dlconn->addr)] = '\0';
+    strncpy (nodeport, ptr + 1, 99);
+  }
+
+  /* Sanity test the port number */
+  nport = strtoul (nodeport, &tail, 10);
+  if (*tail || (nport <= 0 || nport > 0xffff))
+  {
+    dl_log_r (dlconn, 2, 0, "server port specified incorrectly\n");
+    dlconn->terminate = 1;
+    return -1;
+  }
+
+  return 0;
+} /* End of resolve_parse() */
+
+/***************************************************************************
+ * resolve_thread:
+ *
+ * Resolve the address of a cache entry, run in a resolver thread.
+ * Failed lookups expire immediately so they are not reused.
+ ***************************************************************************/
+static void
+resolve_thread (void *arg)
+{
+  ResolveEntry *entry = (ResolveEntry *)arg;
+  struct addrinfo hints;
+  struct addrinfo *addr0 = NULL;
+  int64_t state;
+
+  /* Resolve for either IPv4 or IPv6 (PF_UNSPEC) for a TCP stream (SOCK_STREAM) */
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family   = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo (entry->nodename, entry->nodeport, &hints, &addr0))
+  {
+    addr0 = NULL;
+    state = RESOLVE_FAILED;
+  }
+  else
+  {
+    state = RESOLVE_DONE;
+  }
+
+  dlp_mutex_lock (&cachelock);
+  entry->addr0   = addr0;
+  entry->expires = dlp_monotime () + ((state == RESOLVE_DONE) ? (int64_t)cachettl * 1000000 : 0);
+  DLP_STORE_RELEASE (&entry->state, state);
+  dlp_mutex_unlock (&cachelock);
+} /* End of resolve_thread() */
+
+/***************************************************************************
+ * resolve_unlink:
+ *
+ * Remove an entry from the cache and drop the cache's reference, the
+ * cache lock must be held.
+ ***************************************************************************/
+static void
+resolve_unlink (ResolveEntry *entry)
+{
+  ResolveEntry **link;
+
+  for (link = &cache; *link; link = &(*link)->next)
+  {
+    if (*link == entry)
+    {
+      *link = entry->next;
+      break;
+    }
+  }
+
+  entry->next   = NULL;
+  entry->cached = 0;
+  entry->refs--;
+} /* End of resolve_unlink() */
+
+/***************************************************************************
+ * resolve_free:
+ *
+ * Free an entry no longer referenced, waiting for the resolver thread
+ * if still running.
+ ***************************************************************************/
+static void
+resolve_free (ResolveEntry *entry)
+{
+  if (entry->joinable)
+    dlp_thread_join (entry->thread);
+
+  if (entry->addr0)
+    freeaddrinfo (entry->addr0);
+
+  dlp_mutex_destroy (&entry->joinlock);
+  free (entry);
+} /* End of resolve_free() */
@@ -0,0 +1,374 @@
+/***********************************************************************/ /**
+ * @file sockopt.c
+ *
+ * Socket tuning: the socket profile of a connection and adaptive
+ * receive buffer sizing.
+ *
+ * The profile in DLCP.sockprofile is applied to each socket when it is
+ * created, before connecting, so that a fixed receive buffer is taken
+ * into account for the TCP window scale.  In adaptive mode the receive
+ * buffer is grown, at most once per ::DLSOCK_ADAPT_INTERVAL, to twice
+ * the bandwidth-delay product measured from the receive throughput
+ * and the round trip time reported by TCP_INFO, or doubled when data
+ * waiting in the socket exceeds half of the buffer.  The buffer is
+ * never shrunk, and is left to the system, e.g. Linux receive buffer
+ * auto-tuning, until the measurements call for more than the size the
+ * system reports.
+ *
+ * This file is part of the DataLink Library.
+ *
+ * Copyright (c) 2023 Chad Trabant, EarthScope Data Services
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdali.h"
+#include "portable.h"
+
+#if !defined(DLP_WIN)
+  #include <netinet/tcp.h>
+  #include <sys/ioctl.h>
+#endif
+
+/* Adaptive receive buffer state of a connection */
+typedef struct SockTune_s
+{
+  int rcvbuf;                   /* Receive buffer size last set */
+  int64_t time;                 /* Monotonic time of the last interval */
+  int64_t rxbytes;              /* Bytes received at the last interval */
+  int64_t throughput;           /* Throughput over the last interval (bytes/second) */
+  int64_t grows;                /* Receive buffer increases */
+} SockTune;
+
+static int sockopt_set (DLCP *dlconn, SOCKET sock, int level, int option,
+                        int value, const char *name);
+static int sockopt_get (SOCKET sock, int level, int option);
+static int64_t sockopt_rtt (SOCKET sock);
+static int64_t sockopt_backlog (SOCKET sock);
+
+/***********************************************************************/ /**
+ * @brief Get the socket tuning statistics of a connection
+ *
+ * Report the socket options in effect for the connected socket, as
+ * reported by the system, with the measurements used by the adaptive
+ * receive buffer sizing.
+ *
+ * @param dlconn DataLink Connection Parameters
+ * @param stats Statistics to populate
+ *
+ * @return 0 on success and -1 on error, e.g. when not connected.
+ ***************************************************************************/
+int
+dl_socket_stats (DLCP *dlconn, DLSocketStats *stats)
+{
+  SockTune *tune;
+
+  if (!dlconn || !stats || dlconn->link < 0)
+    return -1;
+
+  memset (stats, 0, sizeof (DLSocketStats));
+
+  stats->rcvbuf  = sockopt_get (dlconn->link, SOL_SOCKET, SO_RCVBUF);
+  stats->sndbuf  = sockopt_get (dlconn->link, SOL_SOCKET, SO_SNDBUF);
+  stats->nodelay = (sockopt_get (dlconn->link, IPPROTO_TCP, TCP_NODELAY) > 0);
+  stats->rtt     = sockopt_rtt (dlconn->link);
+  stats->backlog = sockopt_backlog (dlconn->link);
+  stats->rxbytes = dlconn->rxbytes;
+
+  if ((tune = (SockTune *)dlconn->socktune))
+  {
+    stats->throughput  = tune->throughput;
+    stats->rcvbufgrows = tune->grows;
+  }
+
+  return 0;
+} /* End of dl_socket_stats() */
+
+/***************************************************************************
+ * dlp_sockopt_apply:
+ *
+ * Apply the socket profile of a connection to a new socket, before it
+ * is connected.  Options that cannot be set are logged and otherwise
+ * ignored, the socket remains usable.
+ ***************************************************************************/
+void
+dlp_sockopt_apply (DLCP *dlconn, SOCKET sock)
+{
+  DLSocketProfile *profile = &dlconn->sockprofile;
+
+  if (profile->rcvbuf > 0)
+    sockopt_set (dlconn, sock, SOL_SOCKET, SO_RCVBUF, profile->rcvbuf, "SO_RCVBUF");
+
+  if (profile->sndbuf > 0)
+    sockopt_set (dlconn, sock, SOL_SOCKET, SO_SNDBUF, profile->sndbuf, "SO_SNDBUF");
+
+  if (profile->nodelay)
+    sockopt_set (dlconn, sock, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+#if defined(TCP_QUICKACK)
+  if (profile->quickack)
+    sockopt_set (dlconn, sock, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+#endif
+
+#if defined(SO_BUSY_POLL)
+  if (profile->busypoll > 0)
+    sockopt_set (dlconn, sock, SOL_SOCKET, SO_BUSY_POLL, profile->busypoll, "SO_BUSY_POLL");
+#endif
+
+#if defined(SO_TIMESTAMPNS)
+  if (profile->timestamps)
+    sockopt_set (dlconn, sock, SOL_SOCKET, SO_TIMESTAMPNS, 1, "SO_TIMESTAMPNS");
+#elif defined(SO_TIMESTAMP)
+  if (profile->timestamps)
+    sockopt_set (dlconn, sock, SOL_SOCKET, SO_TIMESTAMP, 1, "SO_TIMESTAMP");
+#endif
+
+  if (profile->keepidle > 0)
+  {
+    sockopt_set (dlconn, sock, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#if defined(TCP_KEEPIDLE)
+    sockopt_set (dlconn, sock, IPPROTO_TCP, TCP_KEEPIDLE, profile->keepidle, "TCP_KEEPIDLE");
+#elif defined(TCP_KEEPALIVE)
+    sockopt_set (dlconn, sock, IPPROTO_TCP, TCP_KEEPALIVE, profile->keepidle, "TCP_KEEPALIVE");
+#endif
+#if defined(TCP_KEEPINTVL)
+    if (profile->keepintvl > 0)
+      sockopt_set (dlconn, sock, IPPROTO_TCP, TCP_KEEPINTVL, profile->keepintvl, "TCP_KEEPINTVL");
+#endif
+#if defined(TCP_KEEPCNT)
+    if (profile->keepcnt > 0)
+      sockopt_set (dlconn, sock, IPPROTO_TCP, TCP_KEEPCNT, profile->keepcnt, "TCP_KEEPCNT");
+#endif
+  }
+} /* End of dlp_sockopt_apply() */
+
+/***************************************************************************
+ * dlp_sockopt_reset:
+ *
+ * Start adaptive receive buffer sizing for a newly connected socket,
+ * from the receive buffer size reported by the system.  Nothing is
+ * done unless the profile receive buffer is ::DLSOCK_ADAPTIVE.
+ ***************************************************************************/
+void
+dlp_sockopt_reset (DLCP *dlconn)
+{
+  SockTune *tune;
+
+  if (dlconn->sockprofile.rcvbuf != DLSOCK_ADAPTIVE)
+    return;
+
+  if (!(tune = (SockTune *)dlconn->socktune))
+  {
+    if (!(tune = (SockTune *)calloc (1, sizeof (SockTune))))
+    {
+      dl_log_r (dlconn, 2, 0, "[%s] cannot allocate socket tuning state\n", dlconn->addr);
+      return;
+    }
+
+    dlconn->socktune = tune;
+  }
+
+  tune->rcvbuf     = sockopt_get (dlconn->link, SOL_SOCKET, SO_RCVBUF);
+  tune->time       = dlp_monotime ();
+  tune->rxbytes    = dlconn->rxbytes;
+  tune->throughput = 0;
+} /* End of dlp_sockopt_reset() */
+
+/***************************************************************************
+ * dlp_sockopt_adapt:
+ *
+ * Grow the receive buffer of a connection in adaptive mode if the
+ * measured bandwidth-delay product or the data waiting in the socket
+ * indicate it is limiting throughput.  Measurements are taken at most
+ * once per ::DLSOCK_ADAPT_INTERVAL, calls in between return quickly.
+ * TCP_QUICKACK, which the system clears, is set again at each interval.
+ ***************************************************************************/
+void
+dlp_sockopt_adapt (DLCP *dlconn)
+{
+  SockTune *tune = (SockTune *)dlconn->socktune;
+  int64_t now;
+  int64_t elapsed;
+  int64_t rtt;
+  int64_t backlog;
+  int64_t target;
+  int64_t maxsize;
+  int current;
+
+  if (!tune || dlconn->link < 0)
+    return;
+
+  now     = dlp_monotime ();
+  elapsed = now - tune->time;
+
+  if (elapsed < DLSOCK_ADAPT_INTERVAL)
+    return;
+
+  tune->throughput = (dlconn->rxbytes - tune->rxbytes) * 1000000 / elapsed;
+  tune->time       = now;
+  tune->rxbytes    = dlconn->rxbytes;
+
+#if defined(TCP_QUICKACK)
+  if (dlconn->sockprofile.quickack)
+    sockopt_set (dlconn, dlconn->link, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+#endif
+
+  /* The system may have tuned the buffer itself since last set */
+  if ((current = sockopt_get (dlconn->link, SOL_SOCKET, SO_RCVBUF)) > tune->rcvbuf)
+    tune->rcvbuf = current;
+
+  rtt     = sockopt_rtt (dlconn->link);
+  backlog = sockopt_backlog (dlconn->link);
+  maxsize = (dlconn->sockprofile.rcvbufmax > 0) ? dlconn->sockprofile.rcvbufmax : DLSOCK_RCVBUFMAX;
+
+  /* Twice the bandwidth-delay product */
+  target = 2 * tune->throughput * rtt / 1000000;
+
+  /* Data is waiting in the socket faster than it is read */
+  if (backlog > tune->rcvbuf / 2 && target < 2 * (int64_t)tune->rcvbuf)
+    target = 2 * (int64_t)tune->rcvbuf;
+
+  if (target > maxsize)
+    target = maxsize;
+
+  if (target <= tune->rcvbuf)
+    return;
+
+  if (sockopt_set (dlconn, dlconn->link, SOL_SOCKET, SO_RCVBUF, (int)target, "SO_RCVBUF"))
+    return;
+
+  /* The system may report more than requested, for overhead, or less
+     when limited, e.g. by net.core.rmem_max on Linux */
+  current = sockopt_get (dlconn->link, SOL_SOCKET, SO_RCVBUF);
+
+  tune->rcvbuf = (current > (int)target) ? current : (int)target;
+  tune->grows++;
+
+  dl_log_r (dlconn, 1, 2, "[%s] receive buffer set to %lld bytes, system reports %d (throughput %lld B/s, RTT %lld us, backlog %lld)\n",
+            dlconn->addr, (long long int)target, current, (long long int)tune->throughput,
+            (long long int)rtt, (long long int)backlog);
+} /* End of dlp_sockopt_adapt() */
+
+/***************************************************************************
+ * dlp_sockopt_free:
+ *
+ * Free the adaptive receive buffer state of a connection.
+ ***************************************************************************/
+void
+dlp_sockopt_free (DLCP *dlconn)
+{
+  if (dlconn->socktune)
+  {
+    free (dlconn->socktune);
+    dlconn->socktune = NULL;
+  }
+} /* End of dlp_sockopt_free() */
+
+/***************************************************************************
+ * sockopt_set:
+ *
+ * Set an integer socket option, logging a failure.
+ *
+ * Returns 0 on success and -1 on error.
+ ***************************************************************************/
+static int
+sockopt_set (DLCP *dlconn, SOCKET sock, int level, int option,
+             int value, const char *name)
+{
+  if (setsockopt (sock, level, option, (char *)&value, sizeof (value)))
+  {
+    dl_log_r (dlconn, 1, 1, "[%s] cannot set %s to %d: %s\n",
+              dlconn->addr, name, value, dlp_strerror ());
+    return -1;
+  }
+
+  return 0;
+} /* End of sockopt_set() */
+
+/***************************************************************************
+ * sockopt_get:
+ *
+ * Get an integer socket option.
+ *
+ * Returns the option value or -1 on error.
+ ***************************************************************************/
+static int
+sockopt_get (SOCKET sock, int level, int option)
+{
+  int value = 0;
+#if defined(DLP_WIN)
+  int optlen = sizeof (value);
+#else
+  socklen_t optlen = sizeof (value);
+#endif
+
+  if (getsockopt (sock, level, option, (char *)&value, &optlen))
+    return -1;
+
+  return value;
+} /* End of sockopt_get() */
+
+/***************************************************************************
+ * sockopt_rtt:
+ *
+ * Get the smoothed round trip time of a TCP socket from TCP_INFO.
+ *
+ * Returns the round trip time in microseconds, 0 if not available.
+ ***************************************************************************/
+static int64_t
+sockopt_rtt (SOCKET sock)
+{
+#if defined(TCP_INFO) && defined(__linux__)
+  struct tcp_info info;
+  socklen_t optlen = sizeof (info);
+
+  memset (&info, 0, sizeof (info));
+
+  if (getsockopt (sock, IPPROTO_TCP, TCP_INFO, &info, &optlen) == 0)
+    return (int64_t)info.tcpi_rtt;
+#else
+  (void)sock;
+#endif
+
+  return 0;
+} /* End of sockopt_rtt() */
+
+/***************************************************************************
+ * sockopt_backlog:
+ *
+ * Get the number of bytes received by the system for a socket and not
+ * yet read.
+ *
+ * Returns the number of bytes, -1 if not available.
+ ***************************************************************************/
+static int64_t
+sockopt_backlog (SOCKET sock)
+{
+#if defined(DLP_WIN)
+  u_long count = 0;
+
+  if (ioctlsocket (sock, FIONREAD, &count))
+    return -1;
+#else
+  int count = 0;
+
+  if (ioctl (sock, FIONREAD, &count))
+    return -1;
+#endif
+
+  return (int64_t)count;
+} /* End of sockopt_backlog() */
@@ -0,0 +1,536 @@
+/***************************************************************************
+ * Loopback test and benchmark of the shared I/O ring, dl_ioring_run().
+ *
+ * A server thread on the loopback interface streams packets to many
+ * connections, each collected with both ring backends: io_uring, when
+ * available, and poll().  Every packet must arrive in order with the
+ * expected data, a batch of pipelined writes must be acknowledged in
+ * order and the stream ending sequence must complete.  One connection
+ * is removed from and added back to the ring mid-stream, which must
+ * not lose data.  Collection rates are reported for each backend.
+ *
+ * Usage: ioring [connections [packets]]
+ ***************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "libdali.h"
+
+#define DATASIZE 512
+#define WRITES 100
+
+typedef struct
+{
+  int sock;
+  int index;
+  int packets;
+} ServerConn;
+
+typedef struct
+{
+  DLCP *dlconn;
+  int64_t nextpktid;
+  int64_t nextreply;
+  int8_t ended;
+} ClientConn;
+
+typedef struct
+{
+  DLIORing *ring;
+  ClientConn *conns;
+  int count;
+  int packets;
+  int ended;
+  int failed;
+  int64_t received;
+  int64_t bytes;
+} Client;
+
+static uint8_t
+pattern (int conn, int64_t pktid, int offset)
+{
+  return (uint8_t)(pktid * 31 + offset + conn);
+}
+
+static int
+recvall (int sock, void *buffer, size_t len)
+{
+  size_t nread = 0;
+  ssize_t rv;
+
+  while (nread < len)
+  {
+    if ((rv = recv (sock, (char *)buffer + nread, len - nread, 0)) <= 0)
+      return -1;
+    nread += rv;
+  }
+
+  return 0;
+}
+
+static int
+sendall (int sock, const void *buffer, size_t len)
+{
+  size_t nsent = 0;
+  ssize_t rv;
+
+  while (nsent < len)
+  {
+    if ((rv = send (sock, (const char *)buffer + nsent, len - nsent, MSG_NOSIGNAL)) <= 0)
+      return -1;
+    nsent += rv;
+  }
+
+  return 0;
+}
+
+/* Append a frame to a buffer, returning the new length */
+static size_t
+frame (char *buffer, size_t len, const char *header, const void *data, size_t datalen)
+{
+  size_t headerlen = strlen (header);
+
+  buffer[len]     = 'D';
+  buffer[len + 1] = 'L';
+  buffer[len + 2] = (char)headerlen;
+  memcpy (buffer + len + 3, header, headerlen);
+
+  if (datalen)
+    memcpy (buffer + len + 3 + headerlen, data, datalen);
+
+  return len + 3 + headerlen + datalen;
+}
+
+/* Stream packets in batches of frames */
+static int
+server_stream (ServerConn *sc)
+{
+  char buffer[65536];
+  char header[255];
+  uint8_t data[DATASIZE];
+  size_t len = 0;
+  int64_t pktid;
+  dltime_t start;
+  int idx;
+
+  for (pktid = 1; pktid <= sc->packets; pktid++)
+  {
+    for (idx = 0; idx < DATASIZE; idx++)
+      data[idx] = pattern (sc->index, pktid, idx);
+
+    start = 1600000000000000LL + pktid * 1000000;
+    snprintf (header, sizeof (header), "PACKET XX_C%d_00_BHZ/MSEED %lld %lld %lld %lld %d",
+              sc->index, (long long int)pktid, (long long int)start,
+              (long long int)start, (long long int)start + 900000, DATASIZE);
+
+    if (len + 3 + 255 + DATASIZE > sizeof (buffer))
+    {
+      if (sendall (sc->sock, buffer, len))
+        return -1;
+      len = 0;
+    }
+
+    len = frame (buffer, len, header, data, DATASIZE);
+  }
+
+  return (len) ? sendall (sc->sock, buffer, len) : 0;
+}
+
+static void *
+server_conn (void *arg)
+{
+  ServerConn *sc = (ServerConn *)arg;
+  char buffer[512];
+  char header[256];
+  char data[DATASIZE];
+  long long int size;
+  int64_t writes = 0;
+  size_t len;
+  uint8_t sync[3];
+  char ack;
+
+  while (recvall (sc->sock, sync, 3) == 0 && recvall (sc->sock, header, sync[2]) == 0)
+  {
+    header[sync[2]] = '\0';
+
+    if (!strncmp (header, "ID", 2))
+    {
+      len = frame (buffer, 0, "ID DataLink 2023.1 :: DLPROTO:1.0 PACKETSIZE:16384 WRITE", NULL, 0);
+      if (sendall (sc->sock, buffer, len))
+        break;
+    }
+    else if (!strcmp (header, "STREAM"))
+    {
+      if (server_stream (sc))
+        break;
+    }
+    else if (!strcmp (header, "ENDSTREAM"))
+    {
+      len = frame (buffer, 0, "ENDSTREAM", NULL, 0);
+      if (sendall (sc->sock, buffer, len))
+        break;
+    }
+    else if (sscanf (header, "WRITE %*s %*s %*s %c %lld", &ack, &size) == 2 &&
+             size >= 0 && size <= DATASIZE)
+    {
+      if (recvall (sc->sock, data, (size_t)size))
+        break;
+
+      writes++;
+
+      if (ack == 'A')
+      {
+        snprintf (header, sizeof (header), "OK %lld 0", (long long int)writes);
+        len = frame (buffer, 0, header, NULL, 0);
+        if (sendall (sc->sock, buffer, len))
+          break;
+      }
+    }
+    else
+    {
+      fprintf (stderr, "server: unexpected command: %s\n", header);
+      break;
+    }
+  }
+
+  close (sc->sock);
+  free (sc);
+  return NULL;
+}
+
+typedef struct
+{
+  int listener;
+  int count;
+  int packets;
+} Server;
+
+static void *
+server_accept (void *arg)
+{
+  Server *server = (Server *)arg;
+  ServerConn *sc;
+  pthread_t thread;
+  int sock;
+  int idx;
+
+  for (idx = 0; idx < server->count; idx++)
+  {
+    if ((sock = accept (server->listener, NULL, NULL)) < 0)
+      break;
+
+    if (!(sc = (ServerConn *)malloc (sizeof (ServerConn))))
+      break;
+
+    sc->sock    = sock;
+    sc->index   = idx;
+    sc->packets = server->packets;
+
+    if (pthread_create (&thread, NULL, server_conn, sc))
+      break;
+    pthread_detach (thread);
+  }
+
+  return NULL;
+}
+
+static int
+collect_callback (DLCP *dlconn, int type, DLPacket *packet, void *packetdata, void *cbdata)
+{
+  Client *client = (Client *)cbdata;
+  ClientConn *cc;
+  uint8_t *data = (uint8_t *)packetdata;
+  int conn = -1;
+  int idx;
+
+  /* Packets carry the connection number, otherwise search */
+  if (type == DLPACKET && sscanf (packet->streamid, "XX_C%d_", &conn) == 1 &&
+      conn >= 0 && conn < client->count && client->conns[conn].dlconn == dlconn)
+    ;
+  else
+    for (conn = 0; conn < client->count && client->conns[conn].dlconn != dlconn; conn++)
+      ;
+
+  if (conn >= client->count)
+  {
+    fprintf (stderr, "FAIL: callback for unknown connection\n");
+    client->failed = 1;
+    return 1;
+  }
+
+  cc = &client->conns[conn];
+
+  if (type == DLPACKET)
+  {
+    /* The server numbers connections in order of acceptance */
+    if (sscanf (packet->streamid, "XX_C%d_", &idx) != 1 || idx != conn)
+    {
+      fprintf (stderr, "FAIL: connection %d: unexpected stream %s\n", conn, packet->streamid);
+      client->failed = 1;
+      return 1;
+    }
+
+    if (packet->pktid != cc->nextpktid || packet->datasize != DATASIZE)
+    {
+      fprintf (stderr, "FAIL: connection %d: packet %lld (%d bytes), expected %lld\n",
+               conn, (long long int)packet->pktid, packet->datasize,
+               (long long int)cc->nextpktid);
+      client->failed = 1;
+      return 1;
+    }
+
+    for (idx = 0; idx < DATASIZE; idx++)
+    {
+      if (data[idx] != pattern (conn, packet->pktid, idx))
+      {
+        fprintf (stderr, "FAIL: connection %d: packet %lld data differs at %d\n",
+                 conn, (long long int)packet->pktid, idx);
+        client->failed = 1;
+        return 1;
+      }
+    }
+
+    cc->nextpktid++;
+    client->received++;
+    client->bytes += packet->datasize;
+
+    /* Removing and adding back mid-stream must not lose data */
+    if (conn == 0 && packet->pktid == client->packets / 2)
+    {
+      if (dl_ioring_remove (client->ring, dlconn) || dl_ioring_add (client->ring, dlconn))
+      {
+        fprintf (stderr, "FAIL: connection %d: cannot remove and add back\n", conn);
+        client->failed = 1;
+        return 1;
+      }
+    }
+
+    /* All packets received, pipeline acknowledged writes and end the stream */
+    if (packet->pktid == client->packets)
+    {
+      for (idx = 0; idx < WRITES; idx++)
+      {
+        if (dl_write_nb (dlconn, data, DATASIZE, "XX_W_00_BHZ/MSEED",
+                         packet->datastart, packet->dataend, 1))
+        {
+          fprintf (stderr, "FAIL: connection %d: dl_write_nb() failed\n", conn);
+          client->failed = 1;
+          return 1;
+        }
+      }
+
+      if (dl_stream_nb (dlconn, 1))
+      {
+        fprintf (stderr, "FAIL: connection %d: dl_stream_nb() failed\n", conn);
+        client->failed = 1;
+        return 1;
+      }
+    }
+  }
+  else if (type == DLREPLY)
+  {
+    if (strcmp (packet->streamid, "OK") || packet->pktid != cc->nextreply)
+    {
+      fprintf (stderr, "FAIL: connection %d: reply %s %lld, expected OK %lld\n",
+               conn, packet->streamid, (long long int)packet->pktid,
+               (long long int)cc->nextreply);
+      client->failed = 1;
+      return 1;
+    }
+
+    cc->nextreply++;
+  }
+  else if (type == DLENDED)
+  {
+    if (cc->nextpktid != client->packets + 1 || cc->nextreply != WRITES + 1)
+    {
+      fprintf (stderr, "FAIL: connection %d: ended after %lld packets and %lld replies\n",
+               conn, (long long int)cc->nextpktid - 1, (long long int)cc->nextreply - 1);
+      client->failed = 1;
+      return 1;
+    }
+
+    cc->ended = 1;
+    client->ended++;
+  }
+  else
+  {
+    fprintf (stderr, "FAIL: connection %d: error reported\n", conn);
+    client->failed = 1;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int
+run_backend (int backend, const char *name, int count, int packets)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof (addr);
+  pthread_t thread;
+  Server server;
+  Client client;
+  char address[64];
+  int64_t start;
+  int64_t elapsed;
+  int result = 0;
+  int idx;
+
+  memset (&client, 0, sizeof (client));
+  client.count   = count;
+  client.packets = packets;
+
+  if (!(client.ring = dl_ioring_new (count, backend)))
+  {
+    if (backend == DLIORING_URING)
+    {
+      printf ("ioring: %s backend not available, skipped\n", name);
+      return 0;
+    }
+
+    fprintf (stderr, "FAIL: cannot create %s ring\n", name);
+    return 1;
+  }
+
+  if (dl_ioring_backend (client.ring) != backend)
+  {
+    fprintf (stderr, "FAIL: %s ring reports backend %d\n", name, dl_ioring_backend (client.ring));
+    dl_ioring_free (client.ring);
+    return 1;
+  }
+
+  /* Loopback server on an ephemeral port */
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  if ((server.listener = socket (AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind (server.listener, (struct sockaddr *)&addr, sizeof (addr)) ||
+      listen (server.listener, 128) ||
+      getsockname (server.listener, (struct sockaddr *)&addr, &addrlen))
+  {
+    fprintf (stderr, "FAIL: cannot start loopback server: %s\n", strerror (errno));
+    dl_ioring_free (client.ring);
+    return 1;
+  }
+
+  server.count   = count;
+  server.packets = packets;
+
+  if (pthread_create (&thread, NULL, server_accept, &server))
+  {
+    fprintf (stderr, "FAIL: cannot start server thread\n");
+    close (server.listener);
+    dl_ioring_free (client.ring);
+    return 1;
+  }
+
+  snprintf (address, sizeof (address), "127.0.0.1:%d", ntohs (addr.sin_port));
+
+  if (!(client.conns = (ClientConn *)calloc (count, sizeof (ClientConn))))
+  {
+    fprintf (stderr, "FAIL: cannot allocate connections\n");
+    return 1;
+  }
+
+  /* Connections are accepted, and numbered by the server, in order */
+  for (idx = 0; idx < count; idx++)
+  {
+    client.conns[idx].nextpktid = 1;
+    client.conns[idx].nextreply = 1;
+
+    if (!(client.conns[idx].dlconn = dl_newdlcp (address, "ioring")) ||
+        dl_connect (client.conns[idx].dlconn) < 0 ||
+        dl_ioring_add (client.ring, client.conns[idx].dlconn) ||
+        dl_stream_nb (client.conns[idx].dlconn, 0))
+    {
+      fprintf (stderr, "FAIL: cannot connect connection %d\n", idx);
+      result = 1;
+      break;
+    }
+  }
+
+  /* Stop the server waiting for connections not made */
+  if (result)
+    shutdown (server.listener, SHUT_RDWR);
+
+  pthread_join (thread, NULL);
+  close (server.listener);
+
+  start = dl_monotime ();
+
+  while (!result && !client.failed && client.ended < count)
+  {
+    if (dl_ioring_run (client.ring, collect_callback, &client, 1000000) < 0)
+    {
+      fprintf (stderr, "FAIL: dl_ioring_run() failed\n");
+      result = 1;
+    }
+
+    if (dl_monotime () - start > 60000000)
+    {
+      fprintf (stderr, "FAIL: %s: timed out, %d of %d connections ended\n",
+               name, client.ended, count);
+      result = 1;
+    }
+  }
+
+  elapsed = dl_monotime () - start;
+
+  if (client.failed)
+    result = 1;
+
+  if (!result)
+    printf ("ioring: %-6s %d connections, %lld packets in %.3f s, %.0f packets/s, %.1f MB/s\n",
+            name, count, (long long int)client.received, elapsed / 1e6,
+            client.received * 1e6 / ((elapsed > 0) ? elapsed : 1),
+            (double)client.bytes / ((elapsed > 0) ? elapsed : 1) * 1e6 / 1048576);
+
+  dl_ioring_free (client.ring);
+
+  for (idx = 0; idx < count; idx++)
+  {
+    if (client.conns[idx].dlconn)
+    {
+      dl_disconnect (client.conns[idx].dlconn);
+      dl_freedlcp (client.conns[idx].dlconn);
+    }
+  }
+
+  free (client.conns);
+
+  return result;
+}
+
+int
+main (int argc, char **argv)
+{
+  int count   = (argc > 1) ? atoi (argv[1]) : 64;
+  int packets = (argc > 2) ? atoi (argv[2]) : 2000;
+  int failed  = 0;
+
+  if (count <= 0 || packets < 2)
+  {
+    fprintf (stderr, "Usage: %s [connections [packets]]\n", argv[0]);
+    return 1;
+  }
+
+  failed |= run_backend (DLIORING_URING, "uring", count, packets);
+  failed |= run_backend (DLIORING_POLL, "poll", count, packets);
+
+  if (failed)
+    return 1;
+
+  printf ("ioring: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,470 @@
+/***************************************************************************
+ * timestr.c
+ *
+ * Tests for the time string routines of libdali: format -> parse round
+ * trips, years outside 1000 - 9999, rounding of fractional seconds and
+ * truncated or garbage input.
+ *
+ * Exits with 0 when all tests pass and 1 otherwise.
+ ***************************************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdali.h>
+
+/* Microseconds from the epoch to 1900-01-01 and 2100-12-31T23:59:59.999999 */
+#define TIME1900 -2208988800000000LL
+#define TIME2101 4133980800000000LL
+
+static int failures = 0;
+static int checks   = 0;
+
+static void quiet_print (const char *message);
+static void fail (const char *format, ...);
+static uint64_t lcg (uint64_t *state);
+static void test_roundtrip (void);
+static void test_years (void);
+static void test_rounding (void);
+static void test_truncated (void);
+static void test_garbage (void);
+
+/* Check a condition, reporting the expression and location on failure */
+#define CHECK(X, ...)     \
+  do                      \
+  {                       \
+    checks++;             \
+    if (!(X))             \
+      fail (__VA_ARGS__); \
+  } while (0)
+
+int
+main (void)
+{
+  /* Parsing errors are expected, do not print them */
+  dl_loginit (0, NULL, NULL, quiet_print, NULL);
+
+  test_roundtrip ();
+  test_years ();
+  test_rounding ();
+  test_truncated ();
+  test_garbage ();
+
+  printf ("timestr: %d of %d checks failed\n", failures, checks);
+
+  return (failures) ? 1 : 0;
+} /* End of main() */
+
+/***************************************************************************
+ * test_roundtrip:
+ *
+ * Format pseudo-random times in each format, with and without
+ * subseconds, and parse them back.  The batch formatter must produce
+ * the same strings as the single value formatters.
+ ***************************************************************************/
+static void
+test_roundtrip (void)
+{
+  dltime_t times[1000];
+  char single[27];
+  char batch[1000 * 27];
+  dltime_t parsed;
+  dltime_t expected;
+  uint64_t state = 12345;
+  size_t length;
+  int format;
+  int subseconds;
+  int idx;
+
+  for (idx = 0; idx < 1000; idx++)
+  {
+    times[idx] = TIME1900 + (dltime_t) (lcg (&state) % (uint64_t) (TIME2101 - TIME1900));
+
+    /* Runs of times on the same day exercise the batch date cache */
+    if (idx % 4)
+      times[idx] = times[idx - 1] + (dltime_t) (lcg (&state) % 1000000000);
+  }
+
+  /* The first and last microseconds of the parsable range */
+  times[0] = TIME1900;
+  times[1] = TIME2101 - 1;
+  times[2] = 0;
+  times[3] = -1;
+
+  for (format = DLTIMEFORMAT_ISO; format <= DLTIMEFORMAT_SEED; format++)
+  {
+    for (subseconds = 0; subseconds <= 1; subseconds++)
+    {
+      CHECK (dl_dltime2timestr_batch (times, 1000, batch, 27, format, subseconds) == 1000,
+             "batch format %d did not convert all times", format);
+
+      for (idx = 0; idx < 1000; idx++)
+      {
+        if (format == DLTIMEFORMAT_ISO)
+          dl_dltime2isotimestr (times[idx], single, subseconds);
+        else if (format == DLTIMEFORMAT_MONTHDAY)
+          dl_dltime2mdtimestr (times[idx], single, subseconds);
+        else
+          dl_dltime2seedtimestr (times[idx], single, subseconds);
+
+        CHECK (strcmp (single, batch + idx * 27) == 0,
+               "batch string '%s' != '%s'", batch + idx * 27, single);
+
+        if (format == DLTIMEFORMAT_SEED)
+          parsed = dl_seedtimestr2dltime_len (single, &length);
+        else
+          parsed = dl_timestr2dltime_len (single, &length);
+
+        /* Without subseconds the time is truncated to the second */
+        expected = times[idx];
+        if (!subseconds)
+          expected -= ((expected % 1000000) + 1000000) % 1000000;
+
+        CHECK (parsed == expected, "'%s' parsed to %lld, expected %lld",
+               single, (long long)parsed, (long long)expected);
+        CHECK (length == strlen (single), "'%s' parsed %d characters",
+               single, (int)length);
+      }
+    }
+  }
+
+  /* SEED time strings are parsed for years up to 3000 */
+  CHECK (dl_seedtimestr2dltime ("3000,366,23:59:59.999999") != DLTERROR,
+         "SEED time string in 3000 not parsed");
+} /* End of test_roundtrip() */
+
+/***************************************************************************
+ * test_years:
+ *
+ * Years outside 1000 - 9999 are formatted without the date cache, the
+ * year must fit in 4 characters.  The batch conversions round trip
+ * over the full range of dltime_t years.
+ ***************************************************************************/
+static void
+test_years (void)
+{
+  static const int years[] = {-290000, -1000, -999, 0, 1, 999, 1000,
+                              9999, 10000, 290000};
+  static const char *const isostrs[] = {NULL, NULL,
+                                        "-999-01-01T00:00:00.000000",
+                                        "   0-01-01T00:00:00.000000",
+                                        "   1-01-01T00:00:00.000000",
+                                        " 999-01-01T00:00:00.000000",
+                                        "1000-01-01T00:00:00.000000",
+                                        "9999-01-01T00:00:00.000000",
+                                        NULL, NULL};
+  int count = (int)(sizeof (years) / sizeof (years[0]));
+  int yday[10], hour[10], min[10], sec[10], usec[10];
+  int ryear[10], ryday[10], rhour[10], rmin[10], rsec[10], rusec[10];
+  int badyear[2] = {-290001, 290001};
+  dltime_t times[10];
+  char isostr[27];
+  char seedstr[25];
+  char batch[10 * 27];
+  char *result;
+  int converted;
+  int idx;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    yday[idx] = 1;
+    hour[idx] = min[idx] = sec[idx] = usec[idx] = 0;
+  }
+
+  CHECK (dl_time2dltime_batch (years, yday, hour, min, sec, usec, count, times) == 0,
+         "years not converted by dl_time2dltime_batch()");
+  CHECK (dl_dltime2time_batch (times, count, ryear, ryday, rhour, rmin, rsec, rusec) == 0,
+         "times not converted by dl_dltime2time_batch()");
+
+  converted = 0;
+  for (idx = 0; idx < count; idx++)
+  {
+    CHECK (ryear[idx] == years[idx] && ryday[idx] == 1 && rhour[idx] == 0 &&
+               rmin[idx] == 0 && rsec[idx] == 0 && rusec[idx] == 0,
+           "year %d converted back to %d,%03d", years[idx], ryear[idx], ryday[idx]);
+
+    result = dl_dltime2isotimestr (times[idx], isostr, 1);
+
+    if (isostrs[idx])
+    {
+      converted++;
+      CHECK (result && strcmp (isostr, isostrs[idx]) == 0,
+             "year %d formatted as '%s'", years[idx], (result) ? isostr : "NULL");
+    }
+    else
+    {
+      CHECK (result == NULL, "year %d formatted as '%s'", years[idx], isostr);
+    }
+  }
+
+  CHECK (dl_dltime2timestr_batch (times, count, batch, 27, DLTIMEFORMAT_ISO, 1) == converted,
+         "batch did not convert %d of %d years", converted, count);
+
+  for (idx = 0; idx < count; idx++)
+  {
+    if (isostrs[idx])
+      CHECK (strcmp (batch + idx * 27, isostrs[idx]) == 0,
+             "batch year %d formatted as '%s'", years[idx], batch + idx * 27);
+    else
+      CHECK (batch[idx * 27] == '\0',
+             "batch year %d formatted as '%s'", years[idx], batch + idx * 27);
+  }
+
+  /* Without subseconds and in SEED format */
+  result = dl_dltime2isotimestr (times[5], isostr, 0);
+  CHECK (result && strcmp (isostr, " 999-01-01T00:00:00") == 0,
+         "year 999 formatted as '%s' without subseconds", isostr);
+  result = dl_dltime2seedtimestr (times[2], seedstr, 1);
+  CHECK (result && strcmp (seedstr, "-999,001,00:00:00.000000") == 0,
+         "year -999 formatted as '%s' in SEED format", seedstr);
+
+  /* Years outside the parsable range are rejected */
+  CHECK (dl_timestr2dltime (" 999-01-01T00:00:00.000000") == DLTERROR,
+         "year 999 parsed");
+  CHECK (dl_timestr2dltime ("1899-12-31T23:59:59.999999") == DLTERROR,
+         "year 1899 parsed");
+  CHECK (dl_seedtimestr2dltime ("3001,001") == DLTERROR,
+         "SEED year 3001 parsed");
+
+  /* Years outside the representable range are rejected in batches */
+  CHECK (dl_time2dltime_batch (badyear, yday, hour, min, sec, usec, 2, times) == 2 &&
+             times[0] == DLTERROR && times[1] == DLTERROR,
+         "out of range years converted by dl_time2dltime_batch()");
+} /* End of test_years() */
+
+/***************************************************************************
+ * test_rounding:
+ *
+ * Digits beyond microseconds are rounded, rounding up to 1000000
+ * microseconds carries into the seconds.
+ ***************************************************************************/
+static void
+test_rounding (void)
+{
+  static const struct
+  {
+    const char *timestr;
+    const char *expected;
+  } cases[] = {
+      {"2020-01-01T00:00:00.1234564", "2020-01-01T00:00:00.123456"},
+      {"2020-01-01T00:00:00.1234565", "2020-01-01T00:00:00.123457"},
+      {"2020-01-01T00:00:00.12345649999", "2020-01-01T00:00:00.123456"},
+      {"2020-01-01T00:00:00.0000005", "2020-01-01T00:00:00.000001"},
+      {"2020-01-01T00:00:00.5", "2020-01-01T00:00:00.500000"},
+      {"2020-01-01T00:00:58.9999995", "2020-01-01T00:00:59.000000"},
+      {"2020-01-01T00:00:59.9999994", "2020-01-01T00:00:59.999999"},
+      {"2020-01-01T00:00:59.9999995", "2020-01-01T00:01:00.000000"},
+      {"2020-12-31T23:59:59.99999999", "2021-01-01T00:00:00.000000"},
+      {"2020,366,23:59:59.9999995", "2021-01-01T00:00:00.000000"},
+      {"2020,060,12:00:00.9999995", "2020-02-29T12:00:01.000000"},
+  };
+  char isostr[27];
+  dltime_t parsed;
+  size_t length;
+  size_t idx;
+
+  for (idx = 0; idx < sizeof (cases) / sizeof (cases[0]); idx++)
+  {
+    if (strchr (cases[idx].timestr, ','))
+      parsed = dl_seedtimestr2dltime_len (cases[idx].timestr, &length);
+    else
+      parsed = dl_timestr2dltime_len (cases[idx].timestr, &length);
+
+    CHECK (parsed != DLTERROR, "'%s' not parsed", cases[idx].timestr);
+
+    if (parsed == DLTERROR)
+      continue;
+
+    dl_dltime2isotimestr (parsed, isostr, 1);
+    CHECK (strcmp (isostr, cases[idx].expected) == 0, "'%s' parsed as '%s', expected '%s'",
+           cases[idx].timestr, isostr, cases[idx].expected);
+    CHECK (length == strlen (cases[idx].timestr), "'%s' parsed %d characters",
+           cases[idx].timestr, (int)length);
+  }
+} /* End of test_rounding() */
+
+/***************************************************************************
+ * test_truncated:
+ *
+ * Every prefix of a time string is either a valid short time string
+ * or rejected.  Prefixes ending with a delimiter are parsed up to the
+ * delimiter.
+ ***************************************************************************/
+static void
+test_truncated (void)
+{
+  static const char *const timestrs[2] = {"2020-03-04T05:06:07.891234",
+                                          "2020,064,05:06:07.891234"};
+  /* Time of each prefix in the same format, NULL when rejected */
+  static const char *const expect[2][27] = {
+      {NULL, NULL, NULL, NULL,
+       "2020-01-01T00:00:00.000000", "2020-01-01T00:00:00.000000", NULL,
+       "2020-03-01T00:00:00.000000", "2020-03-01T00:00:00.000000", NULL,
+       "2020-03-04T00:00:00.000000", "2020-03-04T00:00:00.000000",
+       "2020-03-04T00:00:00.000000", "2020-03-04T05:00:00.000000",
+       "2020-03-04T05:00:00.000000", "2020-03-04T05:00:00.000000",
+       "2020-03-04T05:06:00.000000", "2020-03-04T05:06:00.000000",
+       "2020-03-04T05:06:00.000000", "2020-03-04T05:06:07.000000",
+       "2020-03-04T05:06:07.000000", "2020-03-04T05:06:07.800000",
+       "2020-03-04T05:06:07.890000", "2020-03-04T05:06:07.891000",
+       "2020-03-04T05:06:07.891200", "2020-03-04T05:06:07.891230",
+       "2020-03-04T05:06:07.891234"},
+      {NULL, NULL, NULL, NULL,
+       "2020,001,00:00:00.000000", "2020,001,00:00:00.000000", NULL,
+       "2020,006,00:00:00.000000", "2020,064,00:00:00.000000",
+       "2020,064,00:00:00.000000", "2020,064,00:00:00.000000",
+       "2020,064,05:00:00.000000", "2020,064,05:00:00.000000",
+       "2020,064,05:00:00.000000", "2020,064,05:06:00.000000",
+       "2020,064,05:06:00.000000", "2020,064,05:06:00.000000",
+       "2020,064,05:06:07.000000", "2020,064,05:06:07.000000",
+       "2020,064,05:06:07.800000", "2020,064,05:06:07.890000",
+       "2020,064,05:06:07.891000", "2020,064,05:06:07.891200",
+       "2020,064,05:06:07.891230", "2020,064,05:06:07.891234"}};
+  char prefix[32];
+  char timestr[27];
+  dltime_t parsed;
+  size_t length;
+  size_t plen;
+  int idx;
+
+  for (idx = 0; idx < 2; idx++)
+  {
+    for (plen = 0; plen <= strlen (timestrs[idx]); plen++)
+    {
+      memcpy (prefix, timestrs[idx], plen);
+      prefix[plen] = '\0';
+
+      if (idx)
+        parsed = dl_seedtimestr2dltime_len (prefix, &length);
+      else
+        parsed = dl_timestr2dltime_len (prefix, &length);
+
+      if (!expect[idx][plen])
+      {
+        CHECK (parsed == DLTERROR, "truncated '%s' parsed", prefix);
+        continue;
+      }
+
+      CHECK (parsed != DLTERROR, "truncated '%s' not parsed", prefix);
+
+      if (parsed == DLTERROR)
+        continue;
+
+      if (idx)
+        dl_dltime2seedtimestr (parsed, timestr, 1);
+      else
+        dl_dltime2isotimestr (parsed, timestr, 1);
+
+      CHECK (strcmp (timestr, expect[idx][plen]) == 0, "truncated '%s' parsed as '%s'",
+             prefix, timestr);
+      CHECK (length == plen || (length == plen - 1 && strchr (",-T:.", prefix[length])),
+             "truncated '%s' parsed %d characters", prefix, (int)length);
+    }
+  }
+} /* End of test_truncated() */
+
+/***************************************************************************
+ * test_garbage:
+ *
+ * Strings without a valid leading time are rejected, trailing garbage
+ * is not included in the reported length.
+ ***************************************************************************/
+static void
+test_garbage (void)
+{
+  static const char *const rejected[] = {
+      "", " ", "abc", "T2020", ".5", "-", "+", "--2020", "-2020",
+      "20x20", "99999999999999-01-01", "2020-00-01", "2020-13-01",
+      "2020-01-00", "2020-01-32", "2019-02-29", "2020-01-01T24:00:00",
+      "2020-01-01T00:60:00", "2020-01-01T00:00:61", "2020-01-01T99",
+      "2020,000", "2020,367", "2020,001,24", "2020,001,00:00:61"};
+  static const struct
+  {
+    const char *timestr;
+    size_t length;
+  } partial[] = {
+      {"2020x", 4},
+      {"2020-01-01Z", 10},
+      {"2020-01-01T00:00:00Z", 19},
+      {"2020-01-01T00:00:00.", 19},
+      {"2020-01-01T00:00:00.abc", 19},
+      {"2020-01-01T00:00:00.5Z", 21},
+      {"2020-01-01T00:00:00-07:00", 19},
+      {"2020-01-01 ", 10},
+      {"2020,001,00:00:00,5", 17},
+  };
+  dltime_t parsed;
+  size_t length;
+  size_t idx;
+
+  CHECK (dl_timestr2dltime_len (NULL, &length) == DLTERROR, "NULL time string parsed");
+  CHECK (dl_seedtimestr2dltime_len (NULL, &length) == DLTERROR, "NULL SEED time string parsed");
+
+  for (idx = 0; idx < sizeof (rejected) / sizeof (rejected[0]); idx++)
+  {
+    if (strchr (rejected[idx], ','))
+      parsed = dl_seedtimestr2dltime_len (rejected[idx], NULL);
+    else
+      parsed = dl_timestr2dltime_len (rejected[idx], NULL);
+
+    CHECK (parsed == DLTERROR, "'%s' parsed", rejected[idx]);
+  }
+
+  for (idx = 0; idx < sizeof (partial) / sizeof (partial[0]); idx++)
+  {
+    if (strchr (partial[idx].timestr, ','))
+      parsed = dl_seedtimestr2dltime_len (partial[idx].timestr, &length);
+    else
+      parsed = dl_timestr2dltime_len (partial[idx].timestr, &length);
+
+    CHECK (parsed != DLTERROR, "'%s' not parsed", partial[idx].timestr);
+    CHECK (length == partial[idx].length, "'%s' parsed %d characters, expected %d",
+           partial[idx].timestr, (int)length, (int)partial[idx].length);
+  }
+} /* End of test_garbage() */
+
+/***************************************************************************
+ * quiet_print:
+ *
+ * Discard diagnostic messages.
+ ***************************************************************************/
+static void
+quiet_print (const char *message)
+{
+  (void)message;
+} /* End of quiet_print() */
+
+/***************************************************************************
+ * fail:
+ *
+ * Report a failed check.
+ ***************************************************************************/
+static void
+fail (const char *format, ...)
+{
+  va_list argptr;
+
+  failures++;
+
+  printf ("FAIL: ");
+  va_start (argptr, format);
+  vprintf (format, argptr);
+  va_end (argptr);
+  printf ("\n");
+} /* End of fail() */
+
+/***************************************************************************
+ * lcg:
+ *
+ * Return the next value of a 64-bit linear congruential generator,
+ * so that the tested times are the same on every platform.
+ ***************************************************************************/
+static uint64_t
+lcg (uint64_t *state)
+{
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+
+  return *state >> 11;
+} /* End of lcg() */
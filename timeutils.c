@@ -21,6 +21,7 @@
  * limitations under the License.
  ***************************************************************************/
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,9 +29,53 @@
 
 #include "gmtime64.h"
 #include "libdali.h"
+#include "portable.h"
 
+/* Date of a day, cached to avoid date calculations for times on the same day */
+typedef struct DLDateCache_s
+{
+  int64_t day;   /* Days since the epoch */
+  int year;
+  int month;
+  int mday;
+  int yday;
+  int valid;
+} DLDateCache;
+
+/* Selects the thread-local date cache in dltime2timestr_int() */
+#define DATECACHE_THREAD ((DLDateCache *)NULL)
+
+/* Range of years converted by dl_time2dltime_batch(), all times in
+   these years are representable as dltime_t values */
+#define BATCH_MINYEAR -290000
+#define BATCH_MAXYEAR 290000
+
+#if defined(DLP_THREADLOCAL)
+static DLP_THREADLOCAL DLDateCache thread_datecache = {0, 0, 0, 0, 0, 0};
+#endif
+
+/* Two-digit strings for values 0 - 99 */
+static const char digitpairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/* Write the two digits of X (0 - 99) to P and advance P */
+#define PUTDIGITS2(P, X)                   \
+  do                                       \
+  {                                        \
+    memcpy ((P), digitpairs + 2 * (X), 2); \
+    (P) += 2;                              \
+  } while (0)
+
+static int dltime2date_int (dltime_t dltime, DLDateCache *cache, int *secofday, int *usec);
+static char *dltime2timestr_int (dltime_t dltime, char *timestr, int format,
+                                 int8_t subseconds, DLDateCache *cache);
 static dltime_t time2dltime_int (int year, int day, int hour,
                                  int min, int sec, int usec);
+static int parsetimestr_int (const char *timestr, int maxfields, const char *const *delims,
+                             int *values, int *usec, size_t *length);
 
 /***********************************************************************/ /**
  * @brief Compute the month and day-of-month from day-of-year
@@ -183,42 +228,8 @@ dl_md2doy (int year, int month, int mday, int *jday)
 char *
 dl_dltime2isotimestr (dltime_t dltime, char *isotimestr, int8_t subseconds)
 {
-  struct tm tms;
-  int64_t isec;
-  int ifract;
-  int ret;
-
-  if (isotimestr == NULL)
-    return NULL;
-
-  /* Reduce to Unix/POSIX epoch time and fractional seconds */
-  isec   = DL_DLTIME2EPOCH (dltime);
-  ifract = (int)(dltime - (isec * DLTMODULUS));
-
-  /* Adjust for negative epoch times */
-  if (dltime < 0 && ifract != 0)
-  {
-    isec -= 1;
-    ifract = DLTMODULUS - (-ifract);
-  }
-
-  if (!(dl_gmtime64_r (&isec, &tms)))
-    return NULL;
-
-  if (subseconds)
-    /* Assuming ifract has at least microsecond precision */
-    ret = snprintf (isotimestr, 27, "%4d-%02d-%02dT%02d:%02d:%02d.%06d",
-                    tms.tm_year + 1900, tms.tm_mon + 1, tms.tm_mday,
-                    tms.tm_hour, tms.tm_min, tms.tm_sec, ifract);
-  else
-    ret = snprintf (isotimestr, 20, "%4d-%02d-%02dT%02d:%02d:%02d",
-                    tms.tm_year + 1900, tms.tm_mon + 1, tms.tm_mday,
-                    tms.tm_hour, tms.tm_min, tms.tm_sec);
-
-  if (ret != 26 && ret != 19)
-    return NULL;
-  else
-    return isotimestr;
+  return dltime2timestr_int (dltime, isotimestr, DLTIMEFORMAT_ISO, subseconds,
+                             DATECACHE_THREAD);
 } /* End of dl_dltime2isotimestr() */
 
 /***********************************************************************/ /**
@@ -242,42 +253,8 @@ dl_dltime2isotimestr (dltime_t dltime, char *isotimestr, int8_t subseconds)
 char *
 dl_dltime2mdtimestr (dltime_t dltime, char *mdtimestr, int8_t subseconds)
 {
-  struct tm tms;
-  int64_t isec;
-  int ifract;
-  int ret;
-
-  if (mdtimestr == NULL)
-    return NULL;
-
-  /* Reduce to Unix/POSIX epoch time and fractional seconds */
-  isec   = DL_DLTIME2EPOCH (dltime);
-  ifract = (int)(dltime - (isec * DLTMODULUS));
-
-  /* Adjust for negative epoch times */
-  if (dltime < 0 && ifract != 0)
-  {
-    isec -= 1;
-    ifract = DLTMODULUS - (-ifract);
-  }
-
-  if (!(dl_gmtime64_r (&isec, &tms)))
-    return NULL;
-
-  if (subseconds)
-    /* Assuming ifract has at least microsecond precision */
-    ret = snprintf (mdtimestr, 27, "%4d-%02d-%02d %02d:%02d:%02d.%06d",
-                    tms.tm_year + 1900, tms.tm_mon + 1, tms.tm_mday,
-                    tms.tm_hour, tms.tm_min, tms.tm_sec, ifract);
-  else
-    ret = snprintf (mdtimestr, 20, "%4d-%02d-%02d %02d:%02d:%02d",
-                    tms.tm_year + 1900, tms.tm_mon + 1, tms.tm_mday,
-                    tms.tm_hour, tms.tm_min, tms.tm_sec);
-
-  if (ret != 26 && ret != 19)
-    return NULL;
-  else
-    return mdtimestr;
+  return dltime2timestr_int (dltime, mdtimestr, DLTIMEFORMAT_MONTHDAY, subseconds,
+                             DATECACHE_THREAD);
 } /* End of dl_dltime2mdtimestr() */
 
 /***********************************************************************/ /**
@@ -300,44 +277,376 @@ dl_dltime2mdtimestr (dltime_t dltime, char *mdtimestr, int8_t subseconds)
 char *
 dl_dltime2seedtimestr (dltime_t dltime, char *seedtimestr, int8_t subseconds)
 {
-  struct tm tms;
-  int64_t isec;
-  int ifract;
-  int ret;
+  return dltime2timestr_int (dltime, seedtimestr, DLTIMEFORMAT_SEED, subseconds,
+                             DATECACHE_THREAD);
+} /* End of dl_dltime2seedtimestr() */
 
-  if (seedtimestr == NULL)
-    return NULL;
+/***********************************************************************/ /**
+ * @brief Generate time strings for an array of dltime_t values
+ *
+ * Build time strings in one of the formats produced by
+ * dl_dltime2isotimestr(), dl_dltime2mdtimestr() or
+ * dl_dltime2seedtimestr() for an array of time values.  The date of
+ * the previous value is reused when consecutive values are on the same
+ * day, making this routine efficient for runs of nearby times such as
+ * the start and end times of packets.
+ *
+ * The string for @a dltimes[N] is written to @a timestrs + N * @a
+ * stride, the @a stride must be at least 27 for the @a
+ * DLTIMEFORMAT_ISO and @a DLTIMEFORMAT_MONTHDAY formats and at least
+ * 25 for the @a DLTIMEFORMAT_SEED format.
+ *
+ * @param dltimes Array of dltime_t time values
+ * @param count Number of values in @a dltimes
+ * @param timestrs Buffer for returned time strings
+ * @param stride Distance in bytes between returned time strings
+ * @param format Time string format, one of the DLTIMEFORMAT_ values
+ * @param subseconds Flag to control the inclusion of subseconds
+ *
+ * @return The number of time strings generated on success and -1 on
+ * error, a time value that cannot be converted results in an empty
+ * string and is not counted.
+ ***************************************************************************/
+int64_t
+dl_dltime2timestr_batch (const dltime_t *dltimes, size_t count, char *timestrs,
+                         size_t stride, int format, int8_t subseconds)
+{
+  DLDateCache cache;
+  int64_t converted = 0;
+  size_t idx;
 
-  /* Reduce to Unix/POSIX epoch time and fractional seconds */
-  isec   = DL_DLTIME2EPOCH (dltime);
-  ifract = (int)(dltime - (isec * DLTMODULUS));
+  if (!dltimes || !timestrs)
+    return -1;
 
-  /* Adjust for negative epoch times */
-  if (dltime < 0 && ifract != 0)
+  if (format != DLTIMEFORMAT_ISO && format != DLTIMEFORMAT_MONTHDAY &&
+      format != DLTIMEFORMAT_SEED)
+  {
+    dl_log (2, 0, "dl_dltime2timestr_batch(): unrecognized format: %d\n", format);
+    return -1;
+  }
+
+  if (stride < ((format == DLTIMEFORMAT_SEED) ? 25 : 27))
+  {
+    dl_log (2, 0, "dl_dltime2timestr_batch(): stride (%" PRIsize_t ") too small for format\n",
+            stride);
+    return -1;
+  }
+
+  cache.valid = 0;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    if (dltime2timestr_int (dltimes[idx], timestrs + idx * stride, format, subseconds, &cache))
+      converted++;
+    else
+      timestrs[idx * stride] = '\0';
+  }
+
+  return converted;
+} /* End of dl_dltime2timestr_batch() */
+
+/***********************************************************************/ /**
+ * @brief Convert an array of dltime_t values to time values
+ *
+ * Convert an array of high precision epoch times to year, day-of-year,
+ * hour, minute, second and microsecond values, the same values
+ * produced by dl_gmtime64_r() for each time, over the full range of
+ * dltime_t.
+ *
+ * The conversion uses branch-free civil calendar arithmetic on arrays
+ * of values (one array per time value) so that compilers may
+ * vectorize the loop.
+ *
+ * @param dltimes Array of dltime_t time values
+ * @param count Number of values in @a dltimes and each returned array
+ * @param year Returned array of years
+ * @param yday Returned array of days-of-year (1 - 366)
+ * @param hour Returned array of hours (0 - 23)
+ * @param min Returned array of minutes (0 - 59)
+ * @param sec Returned array of seconds (0 - 59)
+ * @param usec Returned array of microseconds (0 - 999999)
+ *
+ * @return 0 on success and -1 on error.
+ ***************************************************************************/
+int
+dl_dltime2time_batch (const dltime_t *dltimes, size_t count,
+                      int *year, int *yday, int *hour, int *min, int *sec, int *usec)
+{
+  size_t idx;
+
+  if (!dltimes || !year || !yday || !hour || !min || !sec || !usec)
+    return -1;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    int64_t isec, fract, days, secofday;
+    int64_t z, era, doe, yoe, doy, y, jan, leap;
+
+    /* Floor division to seconds and days */
+    isec  = dltimes[idx] / DLTMODULUS;
+    fract = dltimes[idx] - isec * DLTMODULUS;
+    isec -= (fract < 0);
+    fract += (fract < 0) * DLTMODULUS;
+
+    days     = isec / 86400;
+    secofday = isec - days * 86400;
+    days -= (secofday < 0);
+    secofday += (secofday < 0) * 86400;
+
+    /* Civil year and day-of-year from days since the epoch, with years
+     * starting on March 1 within 400-year eras (after H. Hinnant) */
+    z   = days + 719468;
+    era = (z - (z < 0) * 146096) / 146097;
+    doe = z - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    y   = yoe + era * 400;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+
+    /* Days from March 1 of 306 or more are January or February of the next year */
+    jan  = (doy >= 306);
+    leap = ((y % 4 == 0) & (y % 100 != 0)) | (y % 400 == 0);
+
+    year[idx] = (int)(y + jan);
+    yday[idx] = (int)(doy + 1 + jan * -306 + (1 - jan) * (59 + leap));
+    hour[idx] = (int)(secofday / 3600);
+    min[idx]  = (int)((secofday / 60) % 60);
+    sec[idx]  = (int)(secofday % 60);
+    usec[idx] = (int)fract;
+  }
+
+  return 0;
+} /* End of dl_dltime2time_batch() */
+
+/***********************************************************************/ /**
+ * @brief Convert arrays of time values to dltime_t values
+ *
+ * Convert arrays of year, day-of-year, hour, minute, second and
+ * microsecond values to high precision epoch times.  The result for
+ * each set of values is identical to dl_time2dltime() except that the
+ * year is not limited to 1900 - 2100 but to -290000 - 290000, the
+ * range representable as dltime_t values.  Values that are out of
+ * range result in DLTERROR for that time.
+ *
+ * The conversion uses branch-free arithmetic on arrays of values so
+ * that compilers may vectorize the loop.
+ *
+ * @param year Array of years (-290000 - 290000)
+ * @param yday Array of days-of-year (1 - 366)
+ * @param hour Array of hours (0 - 23)
+ * @param min Array of minutes (0 - 59)
+ * @param sec Array of seconds (0 - 60)
+ * @param usec Array of microseconds (0 - 999999)
+ * @param count Number of values in each array and @a dltimes
+ * @param dltimes Returned array of dltime_t time values
+ *
+ * @return The number of times that were out of range on success and
+ * -1 on error.
+ ***************************************************************************/
+int64_t
+dl_time2dltime_batch (const int *year, const int *yday, const int *hour,
+                      const int *min, const int *sec, const int *usec,
+                      size_t count, dltime_t *dltimes)
+{
+  int64_t invalid = 0;
+  size_t idx;
+
+  if (!year || !yday || !hour || !min || !sec || !usec || !dltimes)
+    return -1;
+
+  for (idx = 0; idx < count; idx++)
+  {
+    int64_t y, days, dltime, bad, keep;
+
+    bad = (year[idx] < BATCH_MINYEAR) | (year[idx] > BATCH_MAXYEAR) |
+          (yday[idx] < 1) | (yday[idx] > 366) |
+          (hour[idx] < 0) | (hour[idx] > 23) |
+          (min[idx] < 0) | (min[idx] > 59) |
+          (sec[idx] < 0) | (sec[idx] > 60) |
+          (usec[idx] < 0) | (usec[idx] > 999999);
+
+    /* Out of range values are zeroed so the arithmetic cannot overflow */
+    keep = 1 - bad;
+
+    /* Days from the epoch to January 1 of the year with floor divisions */
+    y    = (int64_t)year[idx] * keep - 1;
+    days = 365 * y +
+           (y - (y < 0) * 3) / 4 -
+           (y - (y < 0) * 99) / 100 +
+           (y - (y < 0) * 399) / 400 -
+           719162;
+
+    dltime = ((((days + yday[idx] * keep - 1) * 24 + hour[idx] * keep) * 60 +
+               min[idx] * keep) * 60 + sec[idx] * keep) *
+                 (int64_t)DLTMODULUS +
+             usec[idx] * keep;
+
+    dltimes[idx] = (bad) ? DLTERROR : dltime;
+    invalid += bad;
+  }
+
+  return invalid;
+} /* End of dl_time2dltime_batch() */
+
+/***************************************************************************
+ * INTERNAL Determine the date and time of day for a high precision
+ * epoch time.
+ *
+ * The date is taken from the cache when the time is on the cached
+ * day, otherwise it is determined with dl_gmtime64_r() and cached.
+ * Only years 1000 - 9999, which are always 4 digits, are cached.
+ *
+ * Returns 0 on success, 1 when the year is outside the cached range
+ * and -1 on error.
+ ***************************************************************************/
+static int
+dltime2date_int (dltime_t dltime, DLDateCache *cache, int *secofday, int *usec)
+{
+  struct tm tms;
+  int64_t isec;
+  int64_t day;
+
+  /* Reduce to Unix/POSIX epoch time and fractional seconds (floor) */
+  isec  = dltime / DLTMODULUS;
+  *usec = (int)(dltime - isec * DLTMODULUS);
+  if (*usec < 0)
   {
     isec -= 1;
-    ifract = DLTMODULUS - (-ifract);
+    *usec += DLTMODULUS;
   }
 
+  /* Reduce to day and second of day (floor) */
+  day       = isec / 86400;
+  *secofday = (int)(isec - day * 86400);
+  if (*secofday < 0)
+  {
+    day -= 1;
+    *secofday += 86400;
+  }
+
+  if (cache->valid && cache->day == day)
+    return 0;
+
   if (!(dl_gmtime64_r (&isec, &tms)))
+    return -1;
+
+  if (tms.tm_year + 1900 < 1000 || tms.tm_year + 1900 > 9999)
+    return 1;
+
+  cache->day   = day;
+  cache->year  = tms.tm_year + 1900;
+  cache->month = tms.tm_mon + 1;
+  cache->mday  = tms.tm_mday;
+  cache->yday  = tms.tm_yday + 1;
+  cache->valid = 1;
+
+  return 0;
+} /* End of dltime2date_int() */
+
+/***************************************************************************
+ * INTERNAL Generate a time string in the specified format.
+ *
+ * Digits are emitted in pairs from a lookup table, the date is
+ * determined using dltime2date_int() with the supplied cache.  Years
+ * outside the cached range are formatted with snprintf().
+ *
+ * Returns a pointer to the resulting string or NULL on error.
+ ***************************************************************************/
+static char *
+dltime2timestr_int (dltime_t dltime, char *timestr, int format, int8_t subseconds,
+                    DLDateCache *cache)
+{
+  struct tm tms;
+  char *cp;
+  int64_t isec;
+  int secofday;
+  int usec;
+  int value;
+  int rv;
+
+  if (timestr == NULL)
     return NULL;
 
-  if (subseconds)
-    /* Assuming ifract has at least microsecond precision */
-    ret = snprintf (seedtimestr, 25, "%4d,%03d,%02d:%02d:%02d.%06d",
-                    tms.tm_year + 1900, tms.tm_yday + 1,
-                    tms.tm_hour, tms.tm_min, tms.tm_sec, ifract);
-  else
-    /* Assuming ifract has at least microsecond precision */
-    ret = snprintf (seedtimestr, 18, "%4d,%03d,%02d:%02d:%02d",
-                    tms.tm_year + 1900, tms.tm_yday + 1,
-                    tms.tm_hour, tms.tm_min, tms.tm_sec);
+#if defined(DLP_THREADLOCAL)
+  if (cache == DATECACHE_THREAD)
+    cache = &thread_datecache;
+#else
+  DLDateCache local_datecache = {0, 0, 0, 0, 0, 0};
+  if (cache == DATECACHE_THREAD)
+    cache = &local_datecache;
+#endif
 
-  if (ret != 24 && ret != 17)
+  if ((rv = dltime2date_int (dltime, cache, &secofday, &usec)) < 0)
     return NULL;
+
+  /* Format unusual years with snprintf(), without subseconds the
+   * string is truncated at the fractional seconds */
+  if (rv > 0)
+  {
+    isec = (dltime - usec) / DLTMODULUS;
+
+    if (!(dl_gmtime64_r (&isec, &tms)))
+      return NULL;
+
+    if (format == DLTIMEFORMAT_SEED)
+      rv = snprintf (timestr, (subseconds) ? 25 : 18, "%4d,%03d,%02d:%02d:%02d.%06d",
+                     tms.tm_year + 1900, tms.tm_yday + 1,
+                     tms.tm_hour, tms.tm_min, tms.tm_sec, usec);
+    else
+      rv = snprintf (timestr, (subseconds) ? 27 : 20, "%4d-%02d-%02d%c%02d:%02d:%02d.%06d",
+                     tms.tm_year + 1900, tms.tm_mon + 1, tms.tm_mday,
+                     (format == DLTIMEFORMAT_ISO) ? 'T' : ' ',
+                     tms.tm_hour, tms.tm_min, tms.tm_sec, usec);
+
+    if (format == DLTIMEFORMAT_SEED)
+      return (rv == 24) ? timestr : NULL;
+    else
+      return (rv == 26) ? timestr : NULL;
+  }
+
+  cp = timestr;
+
+  /* Date portion */
+  PUTDIGITS2 (cp, cache->year / 100);
+  PUTDIGITS2 (cp, cache->year % 100);
+
+  if (format == DLTIMEFORMAT_SEED)
+  {
+    *cp++ = ',';
+    *cp++ = (char)('0' + cache->yday / 100);
+    PUTDIGITS2 (cp, cache->yday % 100);
+    *cp++ = ',';
+  }
   else
-    return seedtimestr;
-} /* End of dl_dltime2seedtimestr() */
+  {
+    *cp++ = '-';
+    PUTDIGITS2 (cp, cache->month);
+    *cp++ = '-';
+    PUTDIGITS2 (cp, cache->mday);
+    *cp++ = (format == DLTIMEFORMAT_ISO) ? 'T' : ' ';
+  }
+
+  /* Time portion */
+  value = secofday / 3600;
+  PUTDIGITS2 (cp, value);
+  *cp++ = ':';
+  value = (secofday / 60) % 60;
+  PUTDIGITS2 (cp, value);
+  *cp++ = ':';
+  value = secofday % 60;
+  PUTDIGITS2 (cp, value);
+
+  if (subseconds)
+  {
+    *cp++ = '.';
+    PUTDIGITS2 (cp, usec / 10000);
+    PUTDIGITS2 (cp, (usec / 100) % 100);
+    PUTDIGITS2 (cp, usec % 100);
+  }
+
+  *cp = '\0';
+
+  return timestr;
+} /* End of dltime2timestr_int() */
 
 
 /***************************************************************************
@@ -452,23 +761,46 @@ dl_time2dltime (int year, int day, int hour, int min, int sec, int usec)
 dltime_t
 dl_seedtimestr2dltime (char *seedtimestr)
 {
+  return dl_seedtimestr2dltime_len (seedtimestr, NULL);
+} /* End of dl_seedtimestr2dltime() */
+
+/***********************************************************************/ /**
+ * @brief Convert a SEED time string to a dltime_t value, reporting length
+ *
+ * Convert a SEED time string to a high precision epoch time as
+ * described for dl_seedtimestr2dltime(), additionally reporting the
+ * number of characters of @a seedtimestr that were converted.  This
+ * allows time strings embedded in larger strings to be parsed without
+ * copying.
+ *
+ * Fractional seconds are converted exactly to microseconds, digits
+ * beyond microseconds are rounded, carrying into the seconds when
+ * needed.
+ *
+ * @param seedtimestr SEED time string to convert
+ * @param length Returned number of characters converted, may be NULL
+ *
+ * @return dltime_t time value on success and DLTERROR on error.
+ ***************************************************************************/
+dltime_t
+dl_seedtimestr2dltime_len (const char *seedtimestr, size_t *length)
+{
+  static const char *const delims[5] = {",:.", ",:.", ",:.", ",:.", ""};
+  int values[5] = {0, 1, 0, 0, 0};
   int fields;
-  int year    = 0;
-  int day     = 1;
-  int hour    = 0;
-  int min     = 0;
-  int sec     = 0;
-  float fusec = 0.0;
-  int usec    = 0;
+  int usec = 0;
+  int year, day, hour, min, sec;
+
+  if (!seedtimestr)
+    return DLTERROR;
 
-  fields = sscanf (seedtimestr, "%d%*[,:.]%d%*[,:.]%d%*[,:.]%d%*[,:.]%d%f",
-                   &year, &day, &hour, &min, &sec, &fusec);
+  fields = parsetimestr_int (seedtimestr, 5, delims, values, &usec, length);
 
-  /* Convert fractional seconds to microseconds */
-  if (fusec != 0.0)
-  {
-    usec = (int)(fusec * 1000000.0 + 0.5);
-  }
+  year = values[0];
+  day  = values[1];
+  hour = values[2];
+  min  = values[3];
+  sec  = values[4];
 
   if (fields < 1)
   {
@@ -506,14 +838,15 @@ dl_seedtimestr2dltime (char *seedtimestr)
     return DLTERROR;
   }
 
-  if (usec < 0 || usec > 999999)
+  /* Rounding may result in 1000000 microseconds, carried into the seconds */
+  if (usec < 0 || usec > 1000000)
   {
     dl_log (2, 0, "dl_seedtimestr2dltime(): Error with fractional second value: %d\n", usec);
     return DLTERROR;
   }
 
   return time2dltime_int (year, day, hour, min, sec, usec);
-} /* End of dl_seedtimestr2dltime() */
+} /* End of dl_seedtimestr2dltime_len() */
 
 /***********************************************************************/ /**
  * @brief Convert a time string to a dltime_t value
@@ -538,25 +871,48 @@ dl_seedtimestr2dltime (char *seedtimestr)
 dltime_t
 dl_timestr2dltime (char *timestr)
 {
+  return dl_timestr2dltime_len (timestr, NULL);
+} /* End of dl_timestr2dltime() */
+
+/***********************************************************************/ /**
+ * @brief Convert a time string to a dltime_t value, reporting length
+ *
+ * Convert a generic time string to a high precision epoch time as
+ * described for dl_timestr2dltime(), additionally reporting the
+ * number of characters of @a timestr that were converted.  This
+ * allows time strings embedded in larger strings to be parsed without
+ * copying.
+ *
+ * Fractional seconds are converted exactly to microseconds, digits
+ * beyond microseconds are rounded, carrying into the seconds when
+ * needed.
+ *
+ * @param timestr Time string to convert
+ * @param length Returned number of characters converted, may be NULL
+ *
+ * @return dltime_t time value on success and DLTERROR on error.
+ ***************************************************************************/
+dltime_t
+dl_timestr2dltime_len (const char *timestr, size_t *length)
+{
+  static const char *const delims[6] = {"-/:.", "-/:.", "-/:.T ", "-/:.", "- /:.", ""};
+  int values[6] = {0, 1, 1, 0, 0, 0};
   int fields;
-  int year    = 0;
-  int mon     = 1;
-  int mday    = 1;
-  int day     = 1;
-  int hour    = 0;
-  int min     = 0;
-  int sec     = 0;
-  float fusec = 0.0;
-  int usec    = 0;
+  int usec = 0;
+  int day  = 1;
+  int year, mon, mday, hour, min, sec;
 
-  fields = sscanf (timestr, "%d%*[-/:.]%d%*[-/:.]%d%*[-/:.T ]%d%*[-/:.]%d%*[- /:.]%d%f",
-                   &year, &mon, &mday, &hour, &min, &sec, &fusec);
+  if (!timestr)
+    return DLTERROR;
 
-  /* Convert fractional seconds to microseconds */
-  if (fusec != 0.0)
-  {
-    usec = (int)(fusec * 1000000.0 + 0.5);
-  }
+  fields = parsetimestr_int (timestr, 6, delims, values, &usec, length);
+
+  year = values[0];
+  mon  = values[1];
+  mday = values[2];
+  hour = values[3];
+  min  = values[4];
+  sec  = values[5];
 
   if (fields < 1)
   {
@@ -606,11 +962,102 @@ dl_timestr2dltime (char *timestr)
     return DLTERROR;
   }
 
-  if (usec < 0 || usec > 999999)
+  /* Rounding may result in 1000000 microseconds, carried into the seconds */
+  if (usec < 0 || usec > 1000000)
   {
     dl_log (2, 0, "dl_timestr2dltime(): Error with fractional second value: %d\n", usec);
     return DLTERROR;
   }
 
   return time2dltime_int (year, day, hour, min, sec, usec);
-} /* End of dl_timestr2dltime() */
+} /* End of dl_timestr2dltime_len() */
+
+/***************************************************************************
+ * INTERNAL Parse integer fields and fractional seconds of a time string.
+ *
+ * Up to maxfields integers are parsed into values, the string for
+ * each field after the first must be preceded by one or more of the
+ * characters in the corresponding delims entry.  Leading white space
+ * and a sign are accepted before each integer.  Parsing stops at the
+ * first field that cannot be parsed, leaving the remaining values
+ * unchanged.
+ *
+ * When all fields are parsed, a period followed by digits is parsed
+ * as fractional seconds and converted exactly to microseconds in
+ * usec, rounding any digits beyond microseconds.  Rounding can result
+ * in a value of 1000000.
+ *
+ * The number of characters parsed is set in length, if not NULL.
+ *
+ * Returns the number of integer fields parsed.
+ ***************************************************************************/
+static int
+parsetimestr_int (const char *timestr, int maxfields, const char *const *delims,
+                  int *values, int *usec, size_t *length)
+{
+  const char *cp  = timestr;
+  const char *end = timestr;
+  int64_t value;
+  int negative;
+  int fields;
+  int scale;
+
+  for (fields = 0; fields < maxfields; fields++)
+  {
+    /* Require one or more delimiters before all but the first field */
+    if (fields > 0)
+    {
+      if (*cp == '\0' || !strchr (delims[fields - 1], *cp))
+        break;
+
+      while (*cp != '\0' && strchr (delims[fields - 1], *cp))
+        cp++;
+    }
+
+    while (isspace ((unsigned char)*cp))
+      cp++;
+
+    negative = 0;
+    if (*cp == '-' || *cp == '+')
+      negative = (*cp++ == '-');
+
+    if (*cp < '0' || *cp > '9')
+      break;
+
+    /* Accumulate digits, saturating values too large for any field */
+    value = 0;
+    while (*cp >= '0' && *cp <= '9')
+    {
+      if (value < 100000000)
+        value = value * 10 + (*cp - '0');
+      cp++;
+    }
+
+    values[fields] = (int)((negative) ? -value : value);
+    end            = cp;
+  }
+
+  /* Fractional seconds following the last field */
+  if (fields == maxfields && cp[0] == '.' && cp[1] >= '0' && cp[1] <= '9')
+  {
+    cp++;
+    *usec = 0;
+
+    for (scale = 100000; scale > 0 && *cp >= '0' && *cp <= '9'; scale /= 10)
+      *usec += (*cp++ - '0') * scale;
+
+    /* Round at the first digit beyond microseconds and skip the rest */
+    if (*cp >= '5' && *cp <= '9')
+      *usec += 1;
+
+    while (*cp >= '0' && *cp <= '9')
+      cp++;
+
+    end = cp;
+  }
+
+  if (length)
+    *length = (size_t) (end - timestr);
+
+  return fields;
+} /* End of parsetimestr_int() */